@@ -1,5 +1,6 @@
 //https://stackoverflow.com/a/23303847
 #include "bitmap.h"
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -23,21 +24,19 @@ const uint32_t bits888[] = {0xFF0000,0x00FF00,0x0000FF};
 #define _ypixelpermeter 0x130B //2835 , 72 DPI
 #define pixel 0xFF
 
-char *bmp_create_header(int w, int h)
+static void bmp_fill_header(bitmap *pbitmap, int w, int h)
 {
 	const int _bitsperpixel = 24;
 	const int _compression = BI_RGB; //0
 
-	bitmap *pbitmap  = (bitmap*)calloc(1, sizeof(bitmap));
 	int _pixelbytesize = w * h * _bitsperpixel/8;
 	int _filesize = _pixelbytesize+sizeof(bitmap);
-	strcpy((char*)pbitmap->fileheader.signature, "BM");
+	memcpy(pbitmap->fileheader.signature, "BM", 2);
 	pbitmap->fileheader.filesize = _filesize;
 	pbitmap->fileheader.fileoffset_to_pixelarray = sizeof(bitmap);
 	pbitmap->bitmapinfoheader.dibheadersize = sizeof(bitmapinfoheader);
 	pbitmap->bitmapinfoheader.width = w;
-//	pbitmap->bitmapinfoheader.height = (-1)*h; // should be -ve height if written from top to bottom
-  pbitmap->bitmapinfoheader.height = h;
+	pbitmap->bitmapinfoheader.height = (-1)*h; // lines are written from top to bottom
 	pbitmap->bitmapinfoheader.planes = _planes;
 	pbitmap->bitmapinfoheader.bitsperpixel = _bitsperpixel;
 	pbitmap->bitmapinfoheader.compression = _compression;
@@ -45,33 +44,128 @@ char *bmp_create_header(int w, int h)
 	pbitmap->bitmapinfoheader.ypixelpermeter = _ypixelpermeter ;
 	pbitmap->bitmapinfoheader.xpixelpermeter = _xpixelpermeter ;
 	pbitmap->bitmapinfoheader.numcolorspallette = 0;
-	return (char *)pbitmap;
 }
 
-char *bmp_create_header565(int w, int h)
+static void bmp_fill_header565(bitmap565 *pbitmap, int w, int h)
 {
 	const int _bitsperpixel = 16;
 
-	bitmap565 *pbitmap  = (bitmap565*)calloc(1, sizeof(bitmap565));
 	int _pixelbytesize = w * h * _bitsperpixel/8;
 	int _filesize = _pixelbytesize+sizeof(bitmap565);
 	// bitmap565 is 12 bytes larger than std bitmap
-	strcpy((char*)pbitmap->fileheader.signature, "BM");
+	memcpy(pbitmap->fileheader.signature, "BM", 2);
 	pbitmap->fileheader.filesize = _filesize;
 	pbitmap->fileheader.fileoffset_to_pixelarray = sizeof(bitmap565);
 	pbitmap->bitmapinfoheader.dibheadersize = sizeof(bitmapinfoheader);
 	pbitmap->bitmapinfoheader.width = w;
-//	pbitmap->bitmapinfoheader.height = (-1)*h; // should be -ve height if written from top to bottom
-	pbitmap->bitmapinfoheader.height = h;
+	pbitmap->bitmapinfoheader.height = (-1)*h; // lines are written from top to bottom
 	pbitmap->bitmapinfoheader.planes = _planes;
 	pbitmap->bitmapinfoheader.bitsperpixel = _bitsperpixel;
 	pbitmap->bitmapinfoheader.compression = BI_BITFIELDS;
-	pbitmap->bitmapinfoheader.imagesize = 0; //_pixelbytesize;
+	pbitmap->bitmapinfoheader.imagesize = _pixelbytesize;
 	pbitmap->bitmapinfoheader.ypixelpermeter = _ypixelpermeter ;
 	pbitmap->bitmapinfoheader.xpixelpermeter = _xpixelpermeter ;
 	pbitmap->bitmapinfoheader.numcolorspallette = 0;
 	pbitmap->bitmapinfoheader.BF1 = bits565[0];
 	pbitmap->bitmapinfoheader.BF2 = bits565[1];
 	pbitmap->bitmapinfoheader.BF3 = bits565[2];
+}
+
+char *bmp_create_header(int w, int h)
+{
+	bitmap *pbitmap  = (bitmap*)calloc(1, sizeof(bitmap));
+	if (pbitmap) {
+		bmp_fill_header(pbitmap, w, h);
+	}
+	return (char *)pbitmap;
+}
+
+char *bmp_create_header565(int w, int h)
+{
+	bitmap565 *pbitmap  = (bitmap565*)calloc(1, sizeof(bitmap565));
+	if (pbitmap) {
+		bmp_fill_header565(pbitmap, w, h);
+	}
 	return (char *)pbitmap;
 }
+
+// header cache, filled by image_header_prepare at startup, see image_header_get
+
+#define IMAGE_HDR_CACHE_SIZE 8
+#define IMAGE_HDR_MAX_LEN    sizeof(bitmap565)
+
+typedef struct {
+	image_header_format_t fmt;
+	int w;
+	int h;
+	size_t len;
+	uint8_t data[IMAGE_HDR_MAX_LEN];
+} image_header_t;
+
+static image_header_t *s_hdr_cache[IMAGE_HDR_CACHE_SIZE];
+static volatile int s_hdr_count = 0;
+
+static image_header_t *image_header_find(image_header_format_t fmt, int w, int h)
+{
+	int count = s_hdr_count;
+	for (int i = 0; i < count; i++) {
+		image_header_t *e = s_hdr_cache[i];
+		if (e->fmt == fmt && e->w == w && e->h == h) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static image_header_t *image_header_add(image_header_format_t fmt, int w, int h)
+{
+	if (s_hdr_count >= IMAGE_HDR_CACHE_SIZE || fmt >= IMAGE_HDR_MAX) {
+		return NULL;
+	}
+	image_header_t *e = (image_header_t*)calloc(1, sizeof(image_header_t));
+	if (e == NULL) {
+		return NULL;
+	}
+	e->fmt = fmt;
+	e->w = w;
+	e->h = h;
+	switch (fmt) {
+	case IMAGE_HDR_BMP565:
+		bmp_fill_header565((bitmap565*)e->data, w, h);
+		e->len = sizeof(bitmap565);
+		break;
+	case IMAGE_HDR_BMP888:
+		bmp_fill_header((bitmap*)e->data, w, h);
+		e->len = sizeof(bitmap);
+		break;
+	case IMAGE_HDR_PGM:
+	case IMAGE_HDR_PPM:
+		e->len = snprintf((char*)e->data, sizeof(e->data), "%s %d %d %d\n",
+				(fmt == IMAGE_HDR_PGM) ? "P5" : "P6", w, h, 255);
+		break;
+	default:
+		break;
+	}
+	// publish the entry only once it is complete, readers don't lock
+	s_hdr_cache[s_hdr_count] = e;
+	s_hdr_count = s_hdr_count + 1;
+	return e;
+}
+
+const uint8_t *image_header_get(image_header_format_t fmt, int w, int h, size_t *len)
+{
+	image_header_t *e = image_header_find(fmt, w, h);
+	if (e == NULL) {
+		return NULL;
+	}
+	*len = e->len;
+	return e->data;
+}
+
+int image_header_prepare(image_header_format_t fmt, int w, int h)
+{
+	if (image_header_find(fmt, w, h) != NULL) {
+		return 0;
+	}
+	return (image_header_add(fmt, w, h) == NULL) ? -1 : 0;
+}
@@ -17,6 +17,7 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "rom/lldesc.h"
+#include "xtensa/core-macros.h"
 #include "soc/soc.h"
 #include "soc/gpio_sig_map.h"
 #include "soc/i2s_reg.h"
@@ -32,6 +33,7 @@
 #include "wiring.h"
 #include "camera.h"
 #include "camera_common.h"
+#include "camera_trace.h"
 #include "xclk.h"
 #if CONFIG_OV2640_SUPPORT
 #include "ov2640.h"
@@ -74,6 +76,9 @@ const int resolution[][2] = {
 #define min(a,b) ((a)<(b)?(a):(b))
 #define max(a,b) ((a)>(b)?(a):(b))
 
+// how long camera_run waits for a held frame to be released
+#define FB_WAIT_TICKS (1000 / portTICK_RATE_MS)
+
 static void i2s_init();
 static void i2s_run();
 static void IRAM_ATTR gpio_isr(void* arg);
@@ -85,6 +90,10 @@ static void dma_filter_task(void *pvParameters);
 static void dma_filter_raw(const dma_elem_t* src, lldesc_t* dma_desc, uint32_t* dst);
 
 static void i2s_stop();
+static esp_err_t fb_pool_init();
+static void fb_pool_deinit();
+static int fb_take_free();
+static void fb_publish(int slot, uint32_t timestamp_ms);
 
 
 static bool is_hs_mode()
@@ -328,7 +337,9 @@ esp_err_t camera_init(const camera_config_t* config)
 
 
     ESP_LOGD(TAG, "Frame buffer (%d bytes)", s_state->fb_size);
-    if (s_state->fb == NULL) {
+    if (config->strip_only) {
+      ESP_LOGD(TAG, "Strip only, no frame buffers");
+    } else if (s_state->fb == NULL) {
       ESP_LOGD(TAG, "Using 32-bit aligned ram shared with display - 320x240x2bpp");
       int max_fb_size = 320 * 240 * 2;
       //s_state->width * s_state->height * 2;
@@ -340,10 +351,16 @@ esp_err_t camera_init(const camera_config_t* config)
       s_state->fb = (uint32_t*)config->displayBuffer; //(uint8_t*) calloc(max_fb_size, 1);
       ESP_LOGD(TAG, "Allocated frame buffer (%d bytes)", max_fb_size);
     }
-    if (s_state->fb == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate frame buffer");
-        err = ESP_ERR_NO_MEM;
-        goto fail;
+    if (!config->strip_only) {
+        if (s_state->fb == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate frame buffer");
+            err = ESP_ERR_NO_MEM;
+            goto fail;
+        }
+        err = fb_pool_init();
+        if (err != ESP_OK) {
+            goto fail;
+        }
     }
     ESP_LOGD(TAG, "Initializing I2S and DMA");
     i2s_init();
@@ -354,7 +371,8 @@ esp_err_t camera_init(const camera_config_t* config)
     }
     s_state->data_ready = xQueueCreate(16, sizeof(size_t));
     s_state->frame_ready = xSemaphoreCreateBinary();
-    if (s_state->data_ready == NULL || s_state->frame_ready == NULL) {
+    s_state->capture_lock = xSemaphoreCreateRecursiveMutex();
+    if (s_state->data_ready == NULL || s_state->frame_ready == NULL || s_state->capture_lock == NULL) {
         ESP_LOGE(TAG, "Failed to create semaphores");
         err = ESP_ERR_NO_MEM;
         goto fail;
@@ -403,6 +421,10 @@ fail:
     if (s_state->frame_ready) {
         vSemaphoreDelete(s_state->frame_ready);
     }
+    if (s_state->capture_lock) {
+        vSemaphoreDelete(s_state->capture_lock);
+    }
+    fb_pool_deinit();
     if (s_state->dma_filter_task) {
         vTaskDelete(s_state->dma_filter_task);
     }
@@ -449,6 +471,20 @@ esp_err_t camera_run()
     if (s_state == NULL) {
         return ESP_ERR_INVALID_STATE;
     }
+    if (s_state->fb_slots == NULL) {
+        // strip only, there is nothing to capture into
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    camera_lock();
+    int slot = fb_take_free();
+    if (slot < 0) {
+        s_state->stats.frames_dropped++;
+        ESP_LOGW(TAG, "All %d frames are held, not capturing", s_state->fb_count);
+        camera_unlock();
+        return ESP_ERR_TIMEOUT;
+    }
+    TRACE_BEGIN(TRACE_CAPTURE);
+    s_state->fb = (uint32_t*) s_state->fb_slots[slot].fb.buf;
     struct timeval tv_start;
     gettimeofday(&tv_start, NULL);
 #ifndef _NDEBUG
@@ -467,12 +503,258 @@ esp_err_t camera_run()
 //    char frame_info_str[40]; //
 //    print_frame_data(frame_info_str);
 //    ESP_LOGI(TAG, "Frame format %s : %d done in %d ms", frame_info_str, s_state->frame_count, time_ms);
-    ESP_LOGI(TAG, "Frame %d done in %d ms", s_state->frame_count, time_ms);
+    ESP_LOGD(TAG, "Frame %d done in %d ms", s_state->frame_count, time_ms);
 
+    fb_publish(slot, tv_end.tv_sec * 1000 + tv_end.tv_usec / 1000);
     s_state->frame_count++;
+    TRACE_END(TRACE_CAPTURE);
+    camera_unlock();
+    return ESP_OK;
+}
+
+camera_fb_t* camera_fb_acquire()
+{
+    if (s_state == NULL || s_state->fb_lock == NULL) {
+        return NULL;
+    }
+    camera_fb_t* fb = NULL;
+    xSemaphoreTake(s_state->fb_lock, portMAX_DELAY);
+    if (s_state->fb_latest >= 0) {
+        camera_fb_slot_t* slot = &s_state->fb_slots[s_state->fb_latest];
+        slot->refcount++;
+        fb = &slot->fb;
+    }
+    xSemaphoreGive(s_state->fb_lock);
+    return fb;
+}
+
+camera_fb_t* camera_fb_capture()
+{
+    camera_fb_t* fb = NULL;
+    camera_lock();
+    if (camera_run() == ESP_OK) {
+        fb = camera_fb_acquire();
+    }
+    camera_unlock();
+    return fb;
+}
+
+bool camera_fb_can_capture()
+{
+    if (s_state == NULL || s_state->fb_lock == NULL) {
+        return false;
+    }
+    bool found = false;
+    xSemaphoreTake(s_state->fb_lock, portMAX_DELAY);
+    for (size_t i = 0; i < s_state->fb_count && !found; i++) {
+        found = s_state->fb_slots[i].refcount == 0;
+    }
+    xSemaphoreGive(s_state->fb_lock);
+    return found;
+}
+
+void camera_fb_release(camera_fb_t* fb)
+{
+    if (fb == NULL) {
+        return;
+    }
+    // camera_fb_t is the first member of its slot
+    camera_fb_slot_t* slot = (camera_fb_slot_t*) fb;
+    xSemaphoreTake(s_state->fb_lock, portMAX_DELAY);
+    if (--slot->refcount == 0) {
+        xSemaphoreGive(s_state->fb_released);
+    }
+    xSemaphoreGive(s_state->fb_lock);
+}
+
+void camera_get_stats(camera_stats_t* stats)
+{
+    if (s_state == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = s_state->stats;
+    stats->frames_captured = s_state->frame_count;
+    stats->filter_stack_free = uxTaskGetStackHighWaterMark(s_state->dma_filter_task);
+}
+
+void camera_lock()
+{
+    xSemaphoreTakeRecursive(s_state->capture_lock, portMAX_DELAY);
+}
+
+void camera_unlock()
+{
+    xSemaphoreGiveRecursive(s_state->capture_lock);
+}
+
+static esp_err_t fb_pool_init()
+{
+    size_t count = CONFIG_CAMERA_FB_COUNT;
+    s_state->fb_latest = -1;
+    s_state->fb_lock = xSemaphoreCreateMutex();
+    s_state->fb_released = xSemaphoreCreateBinary();
+    s_state->fb_slots = (camera_fb_slot_t*) calloc(count, sizeof(camera_fb_slot_t));
+    if (s_state->fb_lock == NULL || s_state->fb_released == NULL || s_state->fb_slots == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate frame pool");
+        return ESP_ERR_NO_MEM;
+    }
+    // the buffer passed in by the application is the first frame, the others are ours
+    s_state->fb_slots[0].fb.buf = (uint8_t*) s_state->fb;
+    s_state->fb_count = 1;
+    for (size_t i = 1; i < count; i++) {
+        uint8_t* buf = (uint8_t*) heap_caps_malloc(s_state->fb_size, MALLOC_CAP_32BIT);
+        if (buf == NULL) {
+            ESP_LOGW(TAG, "Only %d of %d frame buffers allocated", i, count);
+            break;
+        }
+        s_state->fb_slots[i].fb.buf = buf;
+        s_state->fb_count++;
+    }
+    for (size_t i = 0; i < s_state->fb_count; i++) {
+        camera_fb_t* fb = &s_state->fb_slots[i].fb;
+        fb->width = s_state->width;
+        fb->height = s_state->height;
+        fb->format = s_state->config.pixel_format;
+    }
+    ESP_LOGD(TAG, "Frame pool of %d buffers", s_state->fb_count);
     return ESP_OK;
 }
 
+static void fb_pool_deinit()
+{
+    if (s_state->fb_slots != NULL) {
+        for (size_t i = 1; i < s_state->fb_count; i++) {
+            free(s_state->fb_slots[i].fb.buf);
+        }
+        free(s_state->fb_slots);
+        s_state->fb_slots = NULL;
+    }
+    if (s_state->fb_lock) {
+        vSemaphoreDelete(s_state->fb_lock);
+        s_state->fb_lock = NULL;
+    }
+    if (s_state->fb_released) {
+        vSemaphoreDelete(s_state->fb_released);
+        s_state->fb_released = NULL;
+    }
+}
+
+// pick the frame nobody holds which was captured longest ago, the newest one last
+static int fb_take_free()
+{
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        int found = -1;
+        xSemaphoreTake(s_state->fb_lock, portMAX_DELAY);
+        for (size_t i = 0; i < s_state->fb_count; i++) {
+            const camera_fb_slot_t* slot = &s_state->fb_slots[i];
+            if (slot->refcount == 0 && (int) i != s_state->fb_latest &&
+                (found < 0 || (int32_t) (slot->fb.seq - s_state->fb_slots[found].fb.seq) < 0)) {
+                found = i;
+            }
+        }
+        if (found < 0 && s_state->fb_latest >= 0 && s_state->fb_slots[s_state->fb_latest].refcount == 0) {
+            found = s_state->fb_latest;
+            s_state->fb_latest = -1;
+        }
+        if (found >= 0) {
+            s_state->fb_slots[found].refcount = 1;
+        }
+        xSemaphoreGive(s_state->fb_lock);
+        if (found >= 0) {
+            return found;
+        }
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= FB_WAIT_TICKS ||
+            xSemaphoreTake(s_state->fb_released, FB_WAIT_TICKS - waited) != pdTRUE) {
+            return -1;
+        }
+    }
+}
+
+static void fb_publish(int slot, uint32_t timestamp_ms)
+{
+    camera_fb_t* fb = &s_state->fb_slots[slot].fb;
+    xSemaphoreTake(s_state->fb_lock, portMAX_DELAY);
+    fb->len = s_state->data_size;
+    fb->seq = s_state->frame_count;
+    fb->timestamp_ms = timestamp_ms;
+    s_state->fb_slots[slot].refcount--;
+    s_state->fb_latest = slot;
+    xSemaphoreGive(s_state->fb_lock);
+}
+
+esp_err_t camera_strips_start(size_t strip_lines, camera_strip_cb_t cb, void* arg)
+{
+    if (s_state == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (strip_lines == 0 || cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    camera_lock();
+    size_t size = 2 * strip_lines * s_state->width * s_state->fb_bytes_per_pixel;
+    if (s_state->strip_buf_size < size) {
+        free(s_state->strip_buf);
+        s_state->strip_buf_size = 0;
+        ESP_LOGD(TAG, "Allocating strip buffer (%d bytes)", size);
+        s_state->strip_buf = (uint32_t*) heap_caps_malloc(size, MALLOC_CAP_32BIT);
+        if (s_state->strip_buf == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate strip buffer");
+            camera_unlock();
+            return ESP_ERR_NO_MEM;
+        }
+        s_state->strip_buf_size = size;
+    }
+    if (s_state->strip_free == NULL) {
+        s_state->strip_free = xSemaphoreCreateCounting(2, 2);
+        if (s_state->strip_free == NULL) {
+            camera_unlock();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    s_state->strip_start = xTaskGetTickCount();
+    s_state->strip_lines = strip_lines;
+    s_state->strip_first_line = 0;
+    s_state->strip_cb = cb;
+    s_state->strip_cb_arg = arg;
+    TRACE_BEGIN(TRACE_CAPTURE);
+    i2s_run();
+    // the lock stays taken until camera_strips_wait
+    return ESP_OK;
+}
+
+esp_err_t camera_strips_wait()
+{
+    ESP_LOGD(TAG, "Waiting for frame");
+    xSemaphoreTake(s_state->frame_ready, portMAX_DELAY);
+    s_state->strip_lines = 0;
+    s_state->strip_cb = NULL;
+
+    int time_ms = (xTaskGetTickCount() - s_state->strip_start) * portTICK_PERIOD_MS;
+    ESP_LOGD(TAG, "Frame %d done in %d ms (strips)", s_state->frame_count, time_ms);
+
+    s_state->frame_count++;
+    TRACE_END(TRACE_CAPTURE);
+    camera_unlock();
+    return ESP_OK;
+}
+
+esp_err_t camera_run_strips(size_t strip_lines, camera_strip_cb_t cb, void* arg)
+{
+    esp_err_t err = camera_strips_start(strip_lines, cb, arg);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return camera_strips_wait();
+}
+
+void camera_strip_release()
+{
+    xSemaphoreGive(s_state->strip_free);
+}
+
 static esp_err_t dma_desc_init()
 {
     assert(s_state->width % 4 == 0);
@@ -660,12 +942,14 @@ static void i2s_run()
 
     // wait for vsync
     ESP_LOGD(TAG, "Waiting for positive edge on VSYNC");
+    TRACE_BEGIN(TRACE_VSYNC_WAIT);
     while (gpio_get_level(s_state->config.pin_vsync) == 0) {
         ;
     }
     while (gpio_get_level(s_state->config.pin_vsync) != 0) {
         ;
     }
+    TRACE_END(TRACE_VSYNC_WAIT);
     ESP_LOGD(TAG, "Got VSYNC");
 
     //init DMA and intr
@@ -697,9 +981,11 @@ static void IRAM_ATTR signal_dma_buf_received(bool* need_yield)
     size_t dma_desc_filled = s_state->dma_desc_cur;
     s_state->dma_desc_cur = (dma_desc_filled + 1) % s_state->dma_desc_count;
     s_state->dma_received_count++;
+    TRACE_INSTANT(TRACE_DMA_BUF);
     BaseType_t higher_priority_task_woken;
     BaseType_t ret = xQueueSendFromISR(s_state->data_ready, &dma_desc_filled, &higher_priority_task_woken);
     if (ret != pdTRUE) {
+        s_state->stats.dma_queue_overflows++;
         ESP_EARLY_LOGW(TAG, "queue send failed (%d), dma_received_count=%d", ret, s_state->dma_received_count);
     }
     *need_yield = (ret == pdTRUE && higher_priority_task_woken == pdTRUE);
@@ -744,25 +1030,87 @@ static size_t get_fb_pos()
 
 
 
+static size_t strip_line_bytes()
+{
+    return s_state->width * s_state->fb_bytes_per_pixel;
+}
+
+static uint8_t* strip_slot(size_t first_line)
+{
+    size_t slot = (first_line / s_state->strip_lines) & 1;
+    return (uint8_t*) s_state->strip_buf + slot * s_state->strip_lines * strip_line_bytes();
+}
+
+static uint32_t* strip_get_dst()
+{
+    size_t strip_pos = s_state->strip_first_line * strip_line_bytes();
+    size_t pos = get_fb_pos();
+    if (pos == strip_pos) {
+        // first DMA buffer of a new strip, wait until the consumer gave the slot back
+        xSemaphoreTake(s_state->strip_free, portMAX_DELAY);
+    }
+    return (uint32_t*) (strip_slot(s_state->strip_first_line) + pos - strip_pos);
+}
+
+static void strip_flush()
+{
+    size_t lines_done = get_fb_pos() / strip_line_bytes();
+    size_t first_line = s_state->strip_first_line;
+    if (lines_done == first_line) {
+        return;
+    }
+    (*s_state->strip_cb)(strip_slot(first_line), first_line, lines_done - first_line, s_state->strip_cb_arg);
+    s_state->strip_first_line = lines_done;
+}
+
 static void IRAM_ATTR dma_filter_task(void *pvParameters)
 {
     while (true) {
         size_t buf_idx;
         xQueueReceive(s_state->data_ready, &buf_idx, portMAX_DELAY);
+        uint32_t waiting = uxQueueMessagesWaiting(s_state->data_ready) + 1;
+        if (waiting > s_state->stats.dma_queue_high_water) {
+            s_state->stats.dma_queue_high_water = waiting;
+        }
         if (buf_idx == SIZE_MAX) {
             s_state->data_size = get_fb_pos();
+            // a buffer the queue had no room for left a gap in the frame
+            if (s_state->dma_filtered_count != s_state->dma_received_count) {
+                s_state->stats.frames_corrupt++;
+            }
+            s_state->stats.filter_us_last = s_state->filter_cycles / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+            s_state->stats.filter_us_total += s_state->stats.filter_us_last;
+            s_state->filter_cycles = 0;
+            if (s_state->strip_lines) {
+                strip_flush();
+                (*s_state->strip_cb)(NULL, s_state->strip_first_line, 0, s_state->strip_cb_arg);
+            }
+            TRACE_INSTANT(TRACE_FRAME_DONE);
             xSemaphoreGive(s_state->frame_ready);
             continue;
         }
 
         //uint8_t* pfb = s_state->fb + get_fb_pos();
-        uint32_t* pfb = s_state->fb + get_fb_pos()/4;
+        uint32_t* pfb;
+        if (s_state->strip_lines) {
+            pfb = strip_get_dst();
+        } else {
+            pfb = s_state->fb + get_fb_pos()/4;
+        }
         const dma_elem_t* buf = s_state->dma_buf[buf_idx];
         lldesc_t* desc = &s_state->dma_desc[buf_idx];
         ESP_LOGV(TAG, "dma_flt: pos=%d ", get_fb_pos()/4);
+        TRACE_BEGIN(TRACE_DMA_FILTER);
+        uint32_t start = XTHAL_GET_CCOUNT();
         (*s_state->dma_filter)(buf, desc, pfb);
+        s_state->filter_cycles += XTHAL_GET_CCOUNT() - start;
+        TRACE_END(TRACE_DMA_FILTER);
         s_state->dma_filtered_count++;
         ESP_LOGV(TAG, "dma_flt: flt_count=%d ", s_state->dma_filtered_count);
+        if (s_state->strip_lines &&
+            get_fb_pos() >= (s_state->strip_first_line + s_state->strip_lines) * strip_line_bytes()) {
+            strip_flush();
+        }
     }
 }
 
@@ -49,6 +49,11 @@ typedef enum {
 
 typedef void (*dma_filter_t)(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst);
 
+typedef struct {
+    camera_fb_t fb;
+    int refcount;                     //readers holding the frame, 1 more while it is captured into
+} camera_fb_slot_t;
+
 typedef struct {
     camera_config_t config;
     sensor_t sensor;
@@ -79,4 +84,23 @@ typedef struct {
     QueueHandle_t data_ready;
     SemaphoreHandle_t frame_ready;
     TaskHandle_t dma_filter_task;     //DMA filter task
+
+    uint32_t *strip_buf;              //ring of two strips, used instead of fb by camera_run_strips
+    size_t strip_buf_size;            //allocated size of strip_buf, in bytes
+    size_t strip_lines;               //lines per strip, 0 when capturing into fb
+    size_t strip_first_line;          //first line of the strip being filled
+    camera_strip_cb_t strip_cb;
+    void *strip_cb_arg;
+    SemaphoreHandle_t strip_free;     //counts strip slots not held by the consumer
+    TickType_t strip_start;           //when camera_strips_start started the frame
+    SemaphoreHandle_t capture_lock;   //recursive mutex, see camera_lock
+
+    camera_fb_slot_t *fb_slots;       //pool of frames, fb points into the one being captured
+    size_t fb_count;
+    int fb_latest;                    //newest complete frame, -1 if none
+    SemaphoreHandle_t fb_lock;        //guards the slots
+    SemaphoreHandle_t fb_released;    //given when a frame is no longer held
+
+    camera_stats_t stats;             //frames_captured is taken from frame_count
+    uint32_t filter_cycles;           //DMA filter time of the frame being captured
 } camera_state_t;
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "xtensa/core-macros.h"
+
+#include "camera_trace.h"
+
+#if CONFIG_CAMERA_TRACE
+
+#define TRACE_EVENTS CONFIG_CAMERA_TRACE_EVENTS
+#if (TRACE_EVENTS & (TRACE_EVENTS - 1)) != 0
+#error "CONFIG_CAMERA_TRACE_EVENTS must be a power of two"
+#endif
+// tasks told apart in one dump, later ones share the last thread
+#define TRACE_MAX_THREADS 16
+#define TRACE_LINE_MAX 128
+
+typedef struct {
+    uint32_t ccount;
+    TaskHandle_t task;          // NULL for instant events
+    uint8_t id;
+    uint8_t phase;
+} trace_event_t;
+
+typedef struct {
+    trace_event_t events[TRACE_EVENTS];
+    uint32_t head;              // events ever recorded, the next slot is head % TRACE_EVENTS
+} trace_ring_t;
+
+static trace_ring_t s_rings[portNUM_PROCESSORS];
+static volatile bool s_paused;
+
+static const char *s_names[TRACE_ID_COUNT] = {
+    [TRACE_CAPTURE] = "capture",
+    [TRACE_VSYNC_WAIT] = "vsync_wait",
+    [TRACE_DMA_BUF] = "dma_buf",
+    [TRACE_DMA_FILTER] = "dma_filter",
+    [TRACE_FRAME_DONE] = "frame_done",
+    [TRACE_JPEG_STRIP] = "jpeg_strip",
+    [TRACE_CONVERT] = "convert",
+    [TRACE_SEND] = "send",
+    [TRACE_PACE] = "pace",
+    [TRACE_REQUEST] = "request",
+};
+
+static const char s_phases[] = { 'B', 'E', 'i' };
+
+typedef struct {
+    trace_write_cb_t write;
+    void *arg;
+    int error;
+    bool first;
+    struct {
+        int core;
+        TaskHandle_t task;
+    } threads[TRACE_MAX_THREADS];
+    int thread_count;
+} dump_t;
+
+void IRAM_ATTR camera_trace_record(trace_id_t id, trace_phase_t phase)
+{
+    if (s_paused) {
+        return;
+    }
+    // nothing else on this core can run until the event is complete
+    uint32_t irq = portSET_INTERRUPT_MASK_FROM_ISR();
+    trace_ring_t *ring = &s_rings[xPortGetCoreID()];
+    trace_event_t *ev = &ring->events[ring->head++ & (TRACE_EVENTS - 1)];
+    ev->ccount = XTHAL_GET_CCOUNT();
+    ev->task = (phase == TRACE_PH_INSTANT) ? NULL : xTaskGetCurrentTaskHandle();
+    ev->id = id;
+    ev->phase = phase;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(irq);
+}
+
+static void emit(dump_t *d, const char *fmt, ...)
+{
+    char line[TRACE_LINE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (d->error == 0 && len > 0) {
+        if (len >= (int) sizeof(line)) {
+            len = sizeof(line) - 1;
+        }
+        d->error = d->write(d->arg, (const uint8_t*) line, len);
+    }
+}
+
+static int thread_id(dump_t *d, int core, TaskHandle_t task)
+{
+    int i;
+    for (i = 0; i < d->thread_count; i++) {
+        if (d->threads[i].core == core && d->threads[i].task == task) {
+            return i + 1;
+        }
+    }
+    if (i == TRACE_MAX_THREADS) {
+        return i;
+    }
+    d->threads[i].core = core;
+    d->threads[i].task = task;
+    d->thread_count++;
+    return i + 1;
+}
+
+/*
+ * Walks a ring from the newest event back, calling out with the cycles
+ * from each event to now. Only the distance to the next newer event is
+ * taken from the counter, so the counter wrapping every few seconds does
+ * not matter. The newest event is compared to the counter of the dumping
+ * core, which can be slightly behind that of the other one.
+ */
+static uint64_t walk_ring(dump_t *d, int core, uint32_t now, uint64_t base)
+{
+    const trace_ring_t *ring = &s_rings[core];
+    uint32_t count = ring->head < TRACE_EVENTS ? ring->head : TRACE_EVENTS;
+    uint64_t back = 0;
+    uint32_t next = now;
+    for (uint32_t n = 0; n < count; n++) {
+        const trace_event_t *ev = &ring->events[(ring->head - 1 - n) & (TRACE_EVENTS - 1)];
+        if (n == 0) {
+            int32_t delta = (int32_t) (now - ev->ccount);
+            back = delta > 0 ? delta : 0;
+        } else {
+            back += (uint32_t) (next - ev->ccount);
+        }
+        next = ev->ccount;
+        if (d == NULL || ev->id >= TRACE_ID_COUNT || ev->phase > TRACE_PH_INSTANT) {
+            continue;
+        }
+        uint64_t ns = (base - back) * 1000 / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+        emit(d, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d", d->first ? "" : ",\n",
+             s_names[ev->id], s_phases[ev->phase], ns / 1000, (unsigned) (ns % 1000), core);
+        if (ev->phase == TRACE_PH_INSTANT) {
+            emit(d, ",\"tid\":0,\"s\":\"p\"}");
+        } else {
+            emit(d, ",\"tid\":%d}", thread_id(d, core, ev->task));
+        }
+        d->first = false;
+    }
+    return back;
+}
+
+int camera_trace_dump_json(trace_write_cb_t write, void* arg)
+{
+    dump_t d = { .write = write, .arg = arg, .first = true };
+    s_paused = true;
+    // an event being recorded on the other core is done by now
+    vTaskDelay(1);
+    uint32_t now = XTHAL_GET_CCOUNT();
+    // the oldest event of both cores is at time 0
+    uint64_t base = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        uint64_t back = walk_ring(NULL, core, now, 0);
+        base = back > base ? back : base;
+    }
+    emit(&d, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int core = 0; core < portNUM_PROCESSORS && d.error == 0; core++) {
+        walk_ring(&d, core, now, base);
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        emit(&d, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"core %d\"}}",
+             d.first ? "" : ",\n", core, core);
+        d.first = false;
+    }
+    for (int i = 0; i < d.thread_count; i++) {
+        emit(&d, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+             d.threads[i].core, i + 1, pcTaskGetTaskName(d.threads[i].task));
+    }
+    emit(&d, "\n]}\n");
+    s_paused = false;
+    return d.error;
+}
+
+#else
+
+void camera_trace_record(trace_id_t id, trace_phase_t phase)
+{
+}
+
+int camera_trace_dump_json(trace_write_cb_t write, void* arg)
+{
+    return -1;
+}
+
+#endif // CONFIG_CAMERA_TRACE
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cr_codec.h"
+
+static void flush_out(cr_encoder_t* enc)
+{
+    if (enc->out_len && !enc->error) {
+        enc->error = enc->write(enc->write_arg, enc->out, enc->out_len);
+    }
+    enc->bytes_sent += enc->out_len;
+    enc->out_len = 0;
+}
+
+static inline void put_byte(cr_encoder_t* enc, uint8_t b)
+{
+    enc->out[enc->out_len++] = b;
+    if (enc->out_len == sizeof(enc->out)) {
+        flush_out(enc);
+    }
+}
+
+static void put_varint(cr_encoder_t* enc, uint32_t v)
+{
+    while (v >= 0x80) {
+        put_byte(enc, (v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    put_byte(enc, v);
+}
+
+static inline int absdiff(int a, int b)
+{
+    return a > b ? a - b : b - a;
+}
+
+static int block_changed(cr_encoder_t* enc, const uint16_t* rows, size_t stride, int x0, int lines)
+{
+    if (enc->keyframe) {
+        return 1;
+    }
+    const int x1 = (x0 + enc->block > enc->width) ? enc->width : x0 + enc->block;
+    const uint16_t* ref = enc->ref + enc->block_row * enc->block * enc->width;
+    uint32_t sad = 0;
+    for (int y = 0; y < lines; ++y) {
+        const uint16_t* cur = rows + y * stride;
+        const uint16_t* old = ref + y * enc->width;
+        for (int x = x0; x < x1; ++x) {
+            uint16_t a = cur[x];
+            uint16_t b = old[x];
+            if (a == b) {
+                continue;
+            }
+            sad += 2 * absdiff(a >> 11, b >> 11) +
+                   absdiff((a >> 5) & 0x3f, (b >> 5) & 0x3f) +
+                   2 * absdiff(a & 0x1f, b & 0x1f);
+        }
+        // bail out as soon as the answer is known
+        if (sad > enc->threshold) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void send_block(cr_encoder_t* enc, const uint16_t* rows, size_t stride, int x0, int lines)
+{
+    const int x1 = (x0 + enc->block > enc->width) ? enc->width : x0 + enc->block;
+    uint16_t* ref = enc->ref + enc->block_row * enc->block * enc->width;
+    for (int y = 0; y < lines; ++y) {
+        const uint16_t* cur = rows + y * stride;
+        uint16_t* dst = ref + y * enc->width;
+        for (int x = x0; x < x1; ++x) {
+            dst[x] = cur[x];
+            put_byte(enc, cur[x] & 0xff);
+            put_byte(enc, cur[x] >> 8);
+        }
+    }
+}
+
+int cr_enc_init(cr_encoder_t* enc, int width, int height, int block,
+                int threshold, int keyframe_interval)
+{
+    if (width <= 0 || height <= 0 || (block != 8 && block != 16)) {
+        return -1;
+    }
+    memset(enc, 0, sizeof(*enc));
+    enc->ref = (uint16_t*) malloc(width * height * sizeof(uint16_t));
+    if (enc->ref == NULL) {
+        return -1;
+    }
+    enc->width = width;
+    enc->height = height;
+    enc->block = block;
+    enc->threshold = threshold * block * block;
+    enc->keyframe_interval = keyframe_interval;
+    return 0;
+}
+
+void cr_enc_free(cr_encoder_t* enc)
+{
+    free(enc->ref);
+    enc->ref = NULL;
+}
+
+void cr_enc_force_keyframe(cr_encoder_t* enc)
+{
+    enc->frame_count = 0;
+}
+
+int cr_enc_begin(cr_encoder_t* enc, uint32_t seq, cr_write_cb_t write, void* arg)
+{
+    enc->keyframe = (enc->frame_count == 0) ||
+            (enc->keyframe_interval && enc->frame_count % enc->keyframe_interval == 0);
+    enc->block_row = 0;
+    enc->skip = 0;
+    enc->blocks_sent = 0;
+    enc->bytes_sent = 0;
+    enc->write = write;
+    enc->write_arg = arg;
+    enc->error = 0;
+    enc->out_len = 0;
+
+    put_byte(enc, 'C');
+    put_byte(enc, 'R');
+    put_byte(enc, CR_VERSION);
+    put_byte(enc, enc->keyframe ? CR_FLAG_KEYFRAME : 0);
+    put_byte(enc, enc->width & 0xff);
+    put_byte(enc, enc->width >> 8);
+    put_byte(enc, enc->height & 0xff);
+    put_byte(enc, enc->height >> 8);
+    put_byte(enc, enc->block);
+    put_byte(enc, 0);
+    for (int i = 0; i < 4; ++i) {
+        put_byte(enc, (seq >> (8 * i)) & 0xff);
+    }
+    return enc->error;
+}
+
+int cr_enc_rows(cr_encoder_t* enc, const uint16_t* rows, size_t stride)
+{
+    const int blocks = (enc->width + enc->block - 1) / enc->block;
+    int lines = enc->height - enc->block_row * enc->block;
+    if (lines > enc->block) {
+        lines = enc->block;
+    }
+    if (lines <= 0) {
+        return enc->error;
+    }
+
+    int bx = 0;
+    while (bx < blocks) {
+        if (!block_changed(enc, rows, stride, bx * enc->block, lines)) {
+            ++enc->skip;
+            ++bx;
+            continue;
+        }
+        int end = bx + 1;
+        while (end < blocks && block_changed(enc, rows, stride, end * enc->block, lines)) {
+            ++end;
+        }
+        put_varint(enc, enc->skip);
+        put_varint(enc, end - bx);
+        enc->skip = 0;
+        enc->blocks_sent += end - bx;
+        for (; bx < end; ++bx) {
+            send_block(enc, rows, stride, bx * enc->block, lines);
+        }
+        // the block which ended the run has already been found unchanged
+        if (end < blocks) {
+            ++enc->skip;
+            ++bx;
+        }
+    }
+    ++enc->block_row;
+    return enc->error;
+}
+
+int cr_enc_end(cr_encoder_t* enc)
+{
+    // rows never passed in (short frame) stay as they are on the client
+    const int blocks = (enc->width + enc->block - 1) / enc->block;
+    const int block_rows = (enc->height + enc->block - 1) / enc->block;
+    for (; enc->block_row < block_rows; ++enc->block_row) {
+        enc->skip += blocks;
+    }
+    if (enc->skip) {
+        put_varint(enc, enc->skip);
+        put_varint(enc, 0);
+    }
+    flush_out(enc);
+    ++enc->frame_count;
+    return enc->error;
+}
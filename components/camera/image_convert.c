@@ -0,0 +1,314 @@
+#include <string.h>
+#include "image_convert.h"
+
+static inline uint8_t clamp(int n)
+{
+    n = n > 255 ? 255 : n;
+    return n < 0 ? 0 : n;
+}
+
+// byte n of a framebuffer word, 0 is the least significant
+static inline uint8_t unpack(int n, uint32_t value)
+{
+    return value >> (n * 8);
+}
+
+// little endian, dst may be unaligned
+static inline void put_pixel(uint8_t* dst, uint16_t pixel)
+{
+    dst[0] = pixel;
+    dst[1] = pixel >> 8;
+}
+
+static inline uint8_t luma(uint16_t pixel)
+{
+    int r = (pixel >> 11) & 0x1f;
+    int g = (pixel >> 5) & 0x3f;
+    int b = pixel & 0x1f;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+    return (77 * r + 150 * g + 29 * b) >> 8;
+}
+
+uint16_t image_gray_to_rgb565(uint8_t y)
+{
+    return image_rgb565(y, y, y);
+}
+
+uint16_t image_yuv_to_rgb565(int y, int u, int v)
+{
+    int a0 = 1192 * (y - 16);
+    int a1 = 1634 * (v - 128);
+    int a2 = 832 * (v - 128);
+    int a3 = 400 * (u - 128);
+    int a4 = 2066 * (u - 128);
+    int r = (a0 + a1) >> 10;
+    int g = (a0 - a2 - a3) >> 10;
+    int b = (a0 + a4) >> 10;
+    return image_rgb565(clamp(r), clamp(g), clamp(b));
+}
+
+void image_yuv422_line_to_rgb565(const uint32_t* src, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; x += 2) {
+        uint32_t word = *src++;
+        uint8_t y1 = unpack(0, word);
+        uint8_t v = unpack(1, word);
+        uint8_t y2 = unpack(2, word);
+        uint8_t u = unpack(3, word);
+        put_pixel(dst, image_yuv_to_rgb565(y1, u, v));
+        put_pixel(dst + 2, image_yuv_to_rgb565(y2, u, v));
+        dst += 4;
+    }
+}
+
+void image_fb_rgb565_line_to_rgb565(const uint32_t* src, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; x += 2) {
+        uint32_t word = *src++;
+        put_pixel(dst, (unpack(2, word) << 8) | unpack(3, word));
+        put_pixel(dst + 2, (unpack(0, word) << 8) | unpack(1, word));
+        dst += 4;
+    }
+}
+
+void image_gray_line_to_rgb565(const uint8_t* src, uint16_t* dst, int width)
+{
+    for (int x = 0; x < width; x++) {
+        dst[x] = image_gray_to_rgb565(src[x]);
+    }
+}
+
+void image_rgb565_line_to_gray(const uint16_t* src, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; x++) {
+        dst[x] = luma(src[x]);
+    }
+}
+
+void image_rgb565_line_to_rgb444(const uint16_t* src, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; x += 2) {
+        uint16_t p0 = src[x];
+        uint16_t p1 = (x + 1 < width) ? src[x + 1] : 0;
+        // the top 4 bits of each channel
+        *dst++ = ((p0 >> 8) & 0xf0) | ((p0 >> 7) & 0x0f);
+        *dst++ = ((p0 << 3) & 0xf0) | (p1 >> 12);
+        if (x + 1 < width) {
+            *dst++ = ((p1 >> 3) & 0xf0) | ((p1 >> 1) & 0x0f);
+        }
+    }
+}
+
+// 4x4 Bayer matrix, the dither offset of a pixel is (n + 0.5) / 16 of a step
+static const uint8_t s_bayer[4][4] = {
+    { 0, 8, 2, 10 },
+    { 12, 4, 14, 6 },
+    { 3, 11, 1, 9 },
+    { 15, 7, 13, 5 },
+};
+
+void image_gray_line_to_packed(const uint8_t* src, uint8_t* dst, int width, int bits, int y)
+{
+    const int max = (1 << bits) - 1;
+    const int per_byte = 8 / bits;
+    const uint8_t* bayer = s_bayer[y & 3];
+    for (int x = 0; x < width; x += per_byte) {
+        uint8_t out = 0;
+        for (int i = 0; i < per_byte; i++) {
+            int v = 0;
+            if (x + i < width) {
+                v = (src[x + i] * max * 32 + (2 * bayer[(x + i) & 3] + 1) * 255) / (255 * 32);
+            }
+            out = (out << bits) | v;
+        }
+        *dst++ = out;
+    }
+}
+
+void image_gray_line_to_bilevel(const uint8_t* src, uint8_t* dst, int width, uint8_t threshold)
+{
+    for (int x = 0; x < width; x += 8) {
+        uint8_t out = 0;
+        for (int i = 0; i < 8; i++) {
+            out = (out << 1) | (x + i < width && src[x + i] >= threshold);
+        }
+        *dst++ = out;
+    }
+}
+
+uint8_t image_otsu_threshold(const uint32_t* histogram, int bins)
+{
+    uint32_t total = 0;
+    float sum = 0;
+    for (int i = 0; i < bins; i++) {
+        total += histogram[i];
+        sum += (float) i * histogram[i];
+    }
+    // the split which leaves the two classes furthest apart, weighted by their sizes
+    uint32_t below = 0;
+    float sum_below = 0;
+    float best = -1;
+    int split = bins / 2 - 1;
+    for (int t = 0; t + 1 < bins; t++) {
+        below += histogram[t];
+        sum_below += (float) t * histogram[t];
+        uint32_t above = total - below;
+        if (below == 0 || above == 0) {
+            continue;
+        }
+        float diff = sum_below / below - (sum - sum_below) / above;
+        float between = (float) below * above * diff * diff;
+        if (between > best) {
+            best = between;
+            split = t;
+        }
+    }
+    return (split + 1) * 256 / bins;
+}
+
+void image_scale_rgb565_line(const uint16_t* src, int src_width, uint16_t* dst, int dst_width)
+{
+    if (src_width == dst_width) {
+        memcpy(dst, src, dst_width * sizeof(uint16_t));
+        return;
+    }
+    // 16.16 fixed point step, sampling the middle of each destination pixel
+    uint32_t step = ((uint32_t) src_width << 16) / dst_width;
+    uint32_t pos = step / 2;
+    for (int x = 0; x < dst_width; x++) {
+        dst[x] = src[pos >> 16];
+        pos += step;
+    }
+}
+
+int image_scale_src_line(int dst_y, int src_height, int dst_height)
+{
+    int y = (int) (((int64_t) dst_y * 2 + 1) * src_height / (2 * dst_height));
+    return y < src_height ? y : src_height - 1;
+}
+
+void image_half_rgb565_line(const uint16_t* line0, const uint16_t* line1, uint16_t* dst, int src_width)
+{
+    for (int x = 0; x + 1 < src_width; x += 2) {
+        uint16_t p[4] = { line0[x], line0[x + 1], line1[x], line1[x + 1] };
+        int r = 2, g = 2, b = 2;
+        for (int i = 0; i < 4; i++) {
+            r += p[i] >> 11;
+            g += (p[i] >> 5) & 0x3f;
+            b += p[i] & 0x1f;
+        }
+        *dst++ = ((r >> 2) << 11) | ((g >> 2) << 5) | (b >> 2);
+    }
+}
+
+void image_stats_init(image_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->luma_min = 255;
+}
+
+static inline void stats_add(image_stats_t* stats, uint8_t y)
+{
+    stats->luma_sum += y;
+    stats->luma_min = y < stats->luma_min ? y : stats->luma_min;
+    stats->luma_max = y > stats->luma_max ? y : stats->luma_max;
+    stats->histogram[y * IMAGE_HISTOGRAM_BINS / 256]++;
+}
+
+void image_stats_rgb565_line(image_stats_t* stats, const uint16_t* line, int width)
+{
+    for (int x = 0; x < width; x++) {
+        stats_add(stats, luma(line[x]));
+    }
+    stats->pixels += width;
+}
+
+void image_stats_gray_line(image_stats_t* stats, const uint8_t* line, int width)
+{
+    for (int x = 0; x < width; x++) {
+        stats_add(stats, line[x]);
+    }
+    stats->pixels += width;
+}
+
+uint8_t image_stats_mean(const image_stats_t* stats)
+{
+    return stats->pixels ? stats->luma_sum / stats->pixels : 0;
+}
+
+void image_sig_init(image_sig_builder_t* b, image_sig_t* sig, int width, int height)
+{
+    memset(b, 0, sizeof(*b));
+    memset(sig, 0, sizeof(*sig));
+    b->sig = sig;
+    b->width = width;
+    b->height = height;
+    b->row = -1;
+}
+
+// stores the means of the row being summed and moves on to the row of line y
+static void sig_row(image_sig_builder_t* b, int y)
+{
+    int row = (int) ((int64_t) y * IMAGE_SIG_ROWS / b->height);
+    if (row == b->row) {
+        return;
+    }
+    if (b->row >= 0) {
+        for (int i = 0; i < IMAGE_SIG_COLS; i++) {
+            b->sig->cells[b->row][i] = b->count[i] ? b->sum[i] / b->count[i] : 0;
+        }
+    }
+    memset(b->sum, 0, sizeof(b->sum));
+    memset(b->count, 0, sizeof(b->count));
+    b->row = row;
+}
+
+void image_sig_rgb565_line(image_sig_builder_t* b, const uint16_t* line, int y)
+{
+    sig_row(b, y);
+    for (int x = 0; x < b->width; x += IMAGE_SIG_STEP) {
+        int col = x * IMAGE_SIG_COLS / b->width;
+        b->sum[col] += luma(line[x]);
+        b->count[col]++;
+    }
+}
+
+void image_sig_gray_line(image_sig_builder_t* b, const uint8_t* line, int y)
+{
+    sig_row(b, y);
+    for (int x = 0; x < b->width; x += IMAGE_SIG_STEP) {
+        int col = x * IMAGE_SIG_COLS / b->width;
+        b->sum[col] += line[x];
+        b->count[col]++;
+    }
+}
+
+void image_sig_finish(image_sig_builder_t* b)
+{
+    // past the last row, which stores it
+    sig_row(b, b->height);
+}
+
+uint32_t image_fnv1a(uint32_t hash, const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+int image_sig_diff(const image_sig_t* a, const image_sig_t* b)
+{
+    int max = 0;
+    for (int r = 0; r < IMAGE_SIG_ROWS; r++) {
+        for (int c = 0; c < IMAGE_SIG_COLS; c++) {
+            int d = a->cells[r][c] - b->cells[r][c];
+            d = d < 0 ? -d : d;
+            max = d > max ? d : max;
+        }
+    }
+    return max;
+}
@@ -1,6 +1,7 @@
 #ifndef _BITMAP_H_
 #define _BITMAP_H_
 #include <stdint.h>
+#include <stddef.h>
 
 // http://www.dragonwins.com/domains/getteched/bmp/bmpfileformat.htm
 
@@ -23,7 +24,7 @@ typedef struct __attribute__((packed, aligned(1))) {
 typedef struct __attribute__((packed, aligned(1))) {
     uint32_t dibheadersize;
     uint32_t width;
-    uint32_t height;
+    int32_t height;         // negative for top-down bitmaps
     uint16_t planes;
     uint16_t bitsperpixel;
     uint32_t compression;
@@ -44,7 +45,7 @@ typedef struct {
 typedef struct __attribute__((packed, aligned(1))) {
     uint32_t dibheadersize;
     uint32_t width;
-    uint32_t height;
+    int32_t height;         // negative for top-down bitmaps
     uint16_t planes;
     uint16_t bitsperpixel;
     uint32_t compression;
@@ -67,4 +68,26 @@ typedef struct {
 char *bmp_create_header(int w, int h);
 char *bmp_create_header565(int w, int h);
 
+typedef enum {
+    IMAGE_HDR_BMP565,       // BMP, 16 bpp with RGB565 bit fields
+    IMAGE_HDR_BMP888,       // BMP, 24 bpp
+    IMAGE_HDR_PGM,          // binary PGM (P5), 8 bit gray
+    IMAGE_HDR_PPM,          // binary PPM (P6), 8 bit RGB
+    IMAGE_HDR_MAX,
+} image_header_format_t;
+
+/*
+ * Headers are built once per (format, width, height) and kept for the life
+ * of the program, so the returned blob can be sent with NETCONN_NOCOPY.
+ * BMP headers have a negative height: lines are stored top-down, in the
+ * order they come out of the camera.
+ *
+ * image_header_prepare builds a header and must only be called while a
+ * single task runs, before serving requests; it returns -1 if the cache
+ * is full or out of memory. image_header_get only looks headers up, so
+ * it needs no lock, and returns NULL for one that was not prepared.
+ */
+const uint8_t *image_header_get(image_header_format_t fmt, int w, int h, size_t *len);
+int image_header_prepare(image_header_format_t fmt, int w, int h);
+
 #endif
@@ -48,6 +48,19 @@ typedef enum {
     CAMERA_OV7670 = 7670,
 } camera_model_t;
 
+/**
+ * @brief A captured frame, see camera_fb_acquire
+ */
+typedef struct {
+    uint8_t* buf;                   /*!< frame data, same layout as the framebuffer */
+    size_t len;                     /*!< bytes of valid data */
+    size_t width;                   /*!< in pixels */
+    size_t height;                  /*!< in pixels */
+    camera_pixelformat_t format;
+    uint32_t seq;                   /*!< frame counter at capture time */
+    uint32_t timestamp_ms;          /*!< when the capture finished, gettimeofday based */
+} camera_fb_t;
+
 typedef struct {
     int pin_reset;          /*!< GPIO pin for camera reset line */
     int pin_xclk;           /*!< GPIO pin for camera XCLK line */
@@ -78,6 +91,7 @@ typedef struct {
 
     uint32_t* displayBuffer;
 
+    bool strip_only;        /*!< frames only through camera_run_strips: no frame pool, displayBuffer unused */
 
 } camera_config_t;
 
@@ -131,6 +145,25 @@ uint32_t* camera_get_fb();
  */
 size_t camera_get_data_size();
 
+typedef struct {
+    uint32_t frames_captured;
+    uint32_t frames_dropped;          //!< not captured, every frame buffer was held
+    uint32_t frames_corrupt;          //!< DMA buffers were lost, lines are missing
+    uint32_t dma_queue_high_water;    //!< most DMA buffers waiting for the filter task
+    uint32_t dma_queue_overflows;     //!< DMA buffers lost because the queue was full
+    uint32_t filter_us_last;          //!< DMA filter time of the last frame
+    uint64_t filter_us_total;
+    uint32_t filter_stack_free;       //!< DMA filter task stack never used, in bytes
+} camera_stats_t;
+
+/**
+ * @brief Get the capture counters
+ *
+ * The counters are updated by the capture path without locking, a
+ * snapshot may mix values from two frames.
+ */
+void camera_get_stats(camera_stats_t* stats);
+
 /**
  * @brief Get the width of framebuffer, in pixels.
  * @return width of framebuffer, in pixels
@@ -150,10 +183,117 @@ int camera_get_fb_height();
  * and blocks until all lines of the image are stored into the framebuffer.
  * Once all lines are stored, the function returns.
  *
- * @return ESP_OK on success
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if initialized strip only
  */
 esp_err_t camera_run();
 
+/**
+ * @brief Get the newest complete frame and hold on to it
+ *
+ * Frames come from a pool of CONFIG_CAMERA_FB_COUNT buffers. A frame is
+ * never captured into while it is held, so it stays consistent until
+ * camera_fb_release, and it can be passed to lwIP without copying.
+ *
+ * @return the frame, NULL if nothing was captured yet
+ */
+camera_fb_t* camera_fb_acquire();
+
+/**
+ * @brief Capture a new frame and hold on to it
+ *
+ * Same as camera_run followed by camera_fb_acquire, except that no other
+ * capture can come in between.
+ *
+ * @return the frame, NULL if the capture failed
+ */
+camera_fb_t* camera_fb_capture();
+
+/**
+ * @brief Check whether a capture could start without waiting for a release
+ *
+ * @return true if a frame of the pool is not held
+ */
+bool camera_fb_can_capture();
+
+/**
+ * @brief Release a frame from camera_fb_acquire or camera_fb_capture
+ */
+void camera_fb_release(camera_fb_t* fb);
+
+/**
+ * @brief Take exclusive use of the camera
+ *
+ * camera_run and camera_run_strips take the lock themselves, so captures
+ * from different tasks never overlap. Hold it across a capture when the
+ * framebuffer must not be overwritten until it has been read.
+ * The lock is recursive.
+ */
+void camera_lock();
+
+/**
+ * @brief Release the lock taken with camera_lock
+ */
+void camera_unlock();
+
+/**
+ * @brief Strip callback
+ *
+ * Called from the DMA filter task each time a strip of lines is complete.
+ * The strip stays valid until camera_strip_release is called for it.
+ * Once the frame is complete it is called once more with line_count 0
+ * and no data, which is not released. It must not block.
+ *
+ * @param data first line of the strip, lines are width * bytes per pixel apart
+ * @param first_line index of the first line in the frame
+ * @param line_count number of lines in the strip, 0 at the end of the frame
+ * @param arg argument passed to camera_run_strips
+ */
+typedef void (*camera_strip_cb_t)(const uint8_t* data, size_t first_line, size_t line_count, void* arg);
+
+/**
+ * @brief Acquire one frame, handing it out in strips instead of the framebuffer
+ *
+ * Lines go into a ring of two strips of strip_lines lines each, so only
+ * those are resident in RAM. Every completed strip is passed to cb; the
+ * filter task blocks before reusing a strip slot until it is released,
+ * so the consumer has to keep up with the sensor.
+ * The last strip may be shorter if the frame ends early.
+ * Returns once the last strip has been passed to cb.
+ *
+ * @param strip_lines number of lines per strip, typically 8 or 16
+ * @param cb strip callback
+ * @param arg passed to cb
+ * @return ESP_OK on success
+ */
+esp_err_t camera_run_strips(size_t strip_lines, camera_strip_cb_t cb, void* arg);
+
+/**
+ * @brief Start acquiring one frame in strips like camera_run_strips, without waiting for it
+ *
+ * The camera stays locked until camera_strips_wait, which has to be
+ * called from the same task once cb has seen the end of the frame.
+ *
+ * @param strip_lines number of lines per strip, typically 8 or 16
+ * @param cb strip callback
+ * @param arg passed to cb
+ * @return ESP_OK on success, the camera is not locked otherwise
+ */
+esp_err_t camera_strips_start(size_t strip_lines, camera_strip_cb_t cb, void* arg);
+
+/**
+ * @brief Finish the frame started with camera_strips_start and unlock the camera
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t camera_strips_wait();
+
+/**
+ * @brief Return a strip passed to camera_strip_cb_t back to the camera
+ *
+ * Strips have to be released in the order they were received.
+ */
+void camera_strip_release();
+
 /**
  * @brief Print contents of framebuffer on terminal
  *
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+/*
+ * Trace points along the capture to socket pipeline.
+ *
+ * Each point stores the CPU cycle counter, the stage and the task into a
+ * ring of the core it runs on. Recording masks interrupts of that core for
+ * a few instructions and takes no lock, so it may be used in ISRs and on
+ * the DMA path. When the ring is full the oldest events are overwritten.
+ *
+ * The rings are exported in the Chrome trace event format: one process
+ * per core, one thread per task. The two cores' cycle counters are not
+ * synchronized, so their timelines can be shifted against each other by
+ * the difference of the counters, which stays constant while running.
+ *
+ * With CONFIG_CAMERA_TRACE off the trace points compile to nothing.
+ */
+
+typedef enum {
+    TRACE_CAPTURE,              // camera_run, from taking a buffer to the frame being done
+    TRACE_VSYNC_WAIT,           // busy wait for the start of a frame
+    TRACE_DMA_BUF,              // instant: I2S DMA buffer filled, from the ISR
+    TRACE_DMA_FILTER,           // one DMA buffer into the framebuffer or strip
+    TRACE_FRAME_DONE,           // instant: last DMA buffer filtered
+    TRACE_JPEG_STRIP,           // software JPEG of one strip
+    TRACE_CONVERT,              // framebuffer to RGB565
+    TRACE_SEND,                 // netconn_write
+    TRACE_PACE,                 // sleeping to hold the frame rate
+    TRACE_REQUEST,              // one HTTP request, routing to the last byte queued
+    TRACE_ID_COUNT
+} trace_id_t;
+
+typedef enum {
+    TRACE_PH_BEGIN,
+    TRACE_PH_END,
+    TRACE_PH_INSTANT,
+} trace_phase_t;
+
+/**
+ * @brief Output callback of camera_trace_dump_json
+ * @return 0 on success
+ */
+typedef int (*trace_write_cb_t)(void* arg, const uint8_t* data, size_t len);
+
+#if CONFIG_CAMERA_TRACE
+#define TRACE_BEGIN(id)     camera_trace_record(id, TRACE_PH_BEGIN)
+#define TRACE_END(id)       camera_trace_record(id, TRACE_PH_END)
+#define TRACE_INSTANT(id)   camera_trace_record(id, TRACE_PH_INSTANT)
+#else
+#define TRACE_BEGIN(id)     do { } while (0)
+#define TRACE_END(id)       do { } while (0)
+#define TRACE_INSTANT(id)   do { } while (0)
+#endif
+
+/**
+ * @brief Record an event, use the TRACE_ macros instead
+ *
+ * In IRAM, safe to call from ISRs. Instant events do not look up the task,
+ * they are shown on the timeline of the core.
+ */
+void camera_trace_record(trace_id_t id, trace_phase_t phase);
+
+/**
+ * @brief Write the events of both cores as Chrome trace event JSON
+ *
+ * Recording is paused meanwhile, events of that time are lost. Begin and
+ * end events are matched per task by the viewer; the ring may have
+ * overwritten the begin of the oldest spans.
+ *
+ * @return 0 on success, -1 if write failed, or tracing is not built in
+ */
+int camera_trace_dump_json(trace_write_cb_t write, void* arg);
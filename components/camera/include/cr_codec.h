@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Conditional replenishment codec for RGB565 frames.
+ *
+ * The frame is split into square blocks. A block is only sent when its
+ * sum of absolute differences against the reference (what the client
+ * currently shows) exceeds a threshold, so static scenes cost a few bytes
+ * per frame. Every keyframe_interval frames all blocks are sent.
+ *
+ * Stream format, all integers little endian:
+ *
+ *   frame  := header op*
+ *   header := 'C' 'R' version:u8 flags:u8 width:u16 height:u16
+ *             block:u8 reserved:u8 seq:u32
+ *   op     := skip:varint count:varint pixels:u16[count * block * block]
+ *
+ * Ops walk the blocks in raster order: skip unchanged blocks, then replace
+ * count blocks, each as block*block RGB565 pixels in raster order. Blocks
+ * on the right and bottom edges are clipped to the image. A frame ends
+ * once all blocks are covered, so frames can be concatenated on a stream.
+ */
+
+#define CR_VERSION          1
+#define CR_FLAG_KEYFRAME    0x01
+#define CR_HEADER_SIZE      14
+
+typedef int (*cr_write_cb_t)(void* arg, const uint8_t* data, size_t len);
+
+typedef struct {
+    int width;
+    int height;
+    int block;
+    uint32_t threshold;         // SAD above which a block is resent
+    int keyframe_interval;      // frames between keyframes, 0 for first frame only
+    uint16_t* ref;              // what the decoder has, width * height pixels
+
+    uint32_t frame_count;
+    int keyframe;
+    int block_row;
+    uint32_t skip;
+    uint32_t blocks_sent;
+    size_t bytes_sent;
+    cr_write_cb_t write;
+    void* write_arg;
+    int error;
+    size_t out_len;
+    uint8_t out[512];
+} cr_encoder_t;
+
+/**
+ * @brief Allocate the reference frame and set up the encoder
+ *
+ * @param block block size, 8 or 16
+ * @param threshold per pixel average difference to resend a block, SAD is
+ *        computed on the 5/6/5 bit channels with red and blue doubled
+ * @return 0 on success
+ */
+int cr_enc_init(cr_encoder_t* enc, int width, int height, int block,
+                int threshold, int keyframe_interval);
+
+void cr_enc_free(cr_encoder_t* enc);
+
+/**
+ * @brief Send a keyframe next, for instance when a new client subscribes
+ */
+void cr_enc_force_keyframe(cr_encoder_t* enc);
+
+/**
+ * @brief Start a frame and write its header
+ * @return 0 on success
+ */
+int cr_enc_begin(cr_encoder_t* enc, uint32_t seq, cr_write_cb_t write, void* arg);
+
+/**
+ * @brief Encode one row of blocks
+ *
+ * @param rows block lines of RGB565 pixels (fewer for the last row)
+ * @param stride distance between lines, in pixels
+ * @return 0 on success
+ */
+int cr_enc_rows(cr_encoder_t* enc, const uint16_t* rows, size_t stride);
+
+/**
+ * @brief Finish the frame
+ * @return 0 on success
+ */
+int cr_enc_end(cr_encoder_t* enc);
+
+#ifdef __cplusplus
+}
+#endif
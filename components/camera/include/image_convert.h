@@ -0,0 +1,214 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pixel conversion, scaling and statistics, one line at a time.
+ *
+ * Framebuffer lines are in the layout the DMA filter leaves them in: one
+ * 32 bit word per two pixels, see dma_filter_raw. Output RGB565 pixels
+ * are in the byte order BMP565 and the encoders expect.
+ *
+ * Like the encoders, this is plain C without ESP-IDF headers; host/Makefile
+ * builds it into libcamimg.a with the unit tests and benchmarks.
+ */
+
+#define IMAGE_HISTOGRAM_BINS 16
+// signature grid, and every how many pixels and lines are sampled
+#define IMAGE_SIG_COLS 16
+#define IMAGE_SIG_ROWS 12
+#define IMAGE_SIG_STEP 4
+
+typedef struct {
+    uint32_t pixels;
+    uint64_t luma_sum;
+    uint8_t luma_min;
+    uint8_t luma_max;
+    uint32_t histogram[IMAGE_HISTOGRAM_BINS];   //!< luma, 16 levels per bin
+} image_stats_t;
+
+/**
+ * @brief Coarse thumbnail of an image, the mean luma of each grid cell
+ *
+ * Cheap to compare: sensor noise barely moves a cell mean, while an
+ * object entering a cell does, see image_sig_diff.
+ */
+typedef struct {
+    uint8_t cells[IMAGE_SIG_ROWS][IMAGE_SIG_COLS];
+} image_sig_t;
+
+// collects one row of cells at a time
+typedef struct {
+    image_sig_t* sig;
+    int width;
+    int height;
+    int row;                            //!< cell row being summed, -1 before the first line
+    uint32_t sum[IMAGE_SIG_COLS];
+    uint16_t count[IMAGE_SIG_COLS];
+} image_sig_builder_t;
+
+/**
+ * @brief Pack 8 bit channels into RGB565
+ */
+static inline uint16_t image_rgb565(uint8_t r, uint8_t g, uint8_t b)
+{
+    return ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+}
+
+/**
+ * @brief Gray level as RGB565
+ */
+uint16_t image_gray_to_rgb565(uint8_t y);
+
+/**
+ * @brief BT.601 YCbCr to RGB565 in fixed point
+ */
+uint16_t image_yuv_to_rgb565(int y, int u, int v);
+
+/**
+ * @brief Framebuffer line captured as YUV422 to RGB565
+ *
+ * @param dst width * 2 bytes
+ */
+void image_yuv422_line_to_rgb565(const uint32_t* src, uint8_t* dst, int width);
+
+/**
+ * @brief Framebuffer line captured as RGB565 to RGB565 in BMP order
+ *
+ * @param dst width * 2 bytes
+ */
+void image_fb_rgb565_line_to_rgb565(const uint32_t* src, uint8_t* dst, int width);
+
+/**
+ * @brief 8 bit gray line to RGB565
+ */
+void image_gray_line_to_rgb565(const uint8_t* src, uint16_t* dst, int width);
+
+/**
+ * @brief RGB565 line to 8 bit gray, the luma the statistics use
+ */
+void image_rgb565_line_to_gray(const uint16_t* src, uint8_t* dst, int width);
+
+/**
+ * @brief RGB565 line to packed RGB444, two pixels in three bytes
+ *
+ * The first pixel's red and green, its blue and the second pixel's red,
+ * then the second pixel's green and blue, 4 bits each with the first in
+ * the high nibble. An odd last pixel takes two bytes.
+ *
+ * @param dst (width * 3 + 1) / 2 bytes
+ */
+void image_rgb565_line_to_rgb444(const uint16_t* src, uint8_t* dst, int width);
+
+/**
+ * @brief 8 bit gray line to 4 or 2 bits per pixel with 4x4 ordered dither
+ *
+ * Pixels are packed from the most significant bits of each byte.
+ *
+ * @param dst (width * bits + 7) / 8 bytes
+ * @param bits 4 or 2
+ * @param y line of the image, selects the row of the dither matrix
+ */
+void image_gray_line_to_packed(const uint8_t* src, uint8_t* dst, int width, int bits, int y);
+
+/**
+ * @brief 8 bit gray line to 1 bit per pixel, 1 for pixels at or above threshold
+ *
+ * @param dst (width + 7) / 8 bytes, the first pixel in the most significant bit
+ */
+void image_gray_line_to_bilevel(const uint8_t* src, uint8_t* dst, int width, uint8_t threshold);
+
+/**
+ * @brief Threshold splitting a gray histogram in two by Otsu's method
+ *
+ * @param histogram pixel counts of bins equal ranges of 0..255 wide
+ * @param bins number of bins, e.g. 256 or IMAGE_HISTOGRAM_BINS
+ * @return the lowest gray level of the upper class
+ */
+uint8_t image_otsu_threshold(const uint32_t* histogram, int bins);
+
+/**
+ * @brief Nearest neighbour scaling of one RGB565 line
+ *
+ * Lines are picked with image_scale_src_line, so any size can be made
+ * from a frame without holding more than the source line.
+ */
+void image_scale_rgb565_line(const uint16_t* src, int src_width, uint16_t* dst, int dst_width);
+
+/**
+ * @brief Source line of a destination line when scaling src_height to dst_height
+ */
+int image_scale_src_line(int dst_y, int src_height, int dst_height);
+
+/**
+ * @brief Half size RGB565 line, each pixel the average of a 2x2 block
+ *
+ * @param line0 upper source line
+ * @param line1 lower source line
+ * @param dst src_width / 2 pixels
+ */
+void image_half_rgb565_line(const uint16_t* line0, const uint16_t* line1, uint16_t* dst, int src_width);
+
+/**
+ * @brief Start collecting statistics of an image
+ */
+void image_stats_init(image_stats_t* stats);
+
+/**
+ * @brief Add a line of RGB565 pixels to the statistics
+ */
+void image_stats_rgb565_line(image_stats_t* stats, const uint16_t* line, int width);
+
+/**
+ * @brief Add a line of 8 bit gray pixels to the statistics
+ */
+void image_stats_gray_line(image_stats_t* stats, const uint8_t* line, int width);
+
+/**
+ * @brief Mean luma of the pixels added so far, 0 if none
+ */
+uint8_t image_stats_mean(const image_stats_t* stats);
+
+/**
+ * @brief Start a signature of a width x height image
+ *
+ * Lines are added top to bottom; only every IMAGE_SIG_STEP-th line needs
+ * to be, and of those every IMAGE_SIG_STEP-th pixel is sampled.
+ */
+void image_sig_init(image_sig_builder_t* b, image_sig_t* sig, int width, int height);
+
+/**
+ * @brief Add line y of RGB565 pixels to the signature
+ */
+void image_sig_rgb565_line(image_sig_builder_t* b, const uint16_t* line, int y);
+
+/**
+ * @brief Add line y of 8 bit gray pixels to the signature
+ */
+void image_sig_gray_line(image_sig_builder_t* b, const uint8_t* line, int y);
+
+/**
+ * @brief Complete the signature, cells no line was added to are 0
+ */
+void image_sig_finish(image_sig_builder_t* b);
+
+/**
+ * @brief Largest difference of a cell between two signatures, 0 to 255
+ */
+int image_sig_diff(const image_sig_t* a, const image_sig_t* b);
+
+#define IMAGE_FNV_SEED 2166136261u
+
+/**
+ * @brief FNV-1a hash of a buffer, seeded with a previous hash or IMAGE_FNV_SEED
+ */
+uint32_t image_fnv1a(uint32_t hash, const void* data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Baseline JPEG encoder which consumes the image in horizontal strips.
+ *
+ * The encoder never needs the whole frame: every call to jpeg_enc_strip()
+ * encodes complete MCU rows (8 lines) and pushes the entropy coded bytes to
+ * the write callback, so it can be fed straight from the DMA filter while
+ * the sensor is still scanning the bottom of the picture.
+ */
+
+typedef enum {
+    JPEG_INPUT_FB_RGB565,   //!< camera framebuffer words holding RGB565, see dma_filter_raw
+    JPEG_INPUT_FB_YUV422,   //!< camera framebuffer words holding YUYV, see dma_filter_raw
+    JPEG_INPUT_GRAYSCALE,   //!< 1 byte per pixel
+} jpeg_input_format_t;
+
+#define JPEG_MCU_LINES 8
+
+/**
+ * @brief Output callback
+ * @return 0 on success, anything else aborts the encoding
+ */
+typedef int (*jpeg_write_cb_t)(void* arg, const uint8_t* data, size_t len);
+
+typedef struct {
+    int width;
+    int height;
+    int lines_done;
+    int components;
+    jpeg_input_format_t input_format;
+    jpeg_write_cb_t write;
+    void* write_arg;
+    int error;
+
+    uint16_t qtab_y[64];              // quantizer * 8, natural order
+    uint16_t qtab_c[64];
+    uint8_t dqt_y[64];                // as sent in DQT, zigzag order
+    uint8_t dqt_c[64];
+    int last_dc[3];
+
+    uint32_t bit_buf;
+    int bit_cnt;
+    size_t out_len;
+    uint8_t out[256];
+} jpeg_encoder_t;
+
+/**
+ * @brief Start encoding a frame and emit the JPEG headers
+ *
+ * @param enc encoder state, owned by the caller
+ * @param width image width in pixels
+ * @param height image height in pixels
+ * @param format layout of the lines passed to jpeg_enc_strip
+ * @param quality 1 (worst) .. 100 (best)
+ * @param write output callback
+ * @param arg passed to write
+ * @return 0 on success
+ */
+int jpeg_enc_start(jpeg_encoder_t* enc, int width, int height, jpeg_input_format_t format,
+                   int quality, jpeg_write_cb_t write, void* arg);
+
+/**
+ * @brief Encode a strip of lines
+ *
+ * line_count must be a multiple of JPEG_MCU_LINES, except for the strip
+ * which ends the image.
+ *
+ * @param lines first line of the strip
+ * @param line_count number of lines in the strip
+ * @param stride distance between lines, in bytes
+ * @return 0 on success
+ */
+int jpeg_enc_strip(jpeg_encoder_t* enc, const uint8_t* lines, size_t line_count, size_t stride);
+
+/**
+ * @brief Flush pending bits and emit EOI
+ * @return 0 on success
+ */
+int jpeg_enc_finish(jpeg_encoder_t* enc);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Streaming encoder for the QOI lossless image format (https://qoiformat.org).
+ *
+ * Lines are fed one at a time, the state is the previous pixel, a 64 entry
+ * colour hash and a run counter, so memory use is fixed and independent of
+ * the image size. RGB565 input is widened by bit replication, which is
+ * reversible: the top bits of each decoded channel are the original pixel.
+ * Grayscale input is written as R = G = B.
+ */
+
+typedef enum {
+    QOI_INPUT_RGB565,       //!< uint16_t per pixel, as produced for the BMP endpoints
+    QOI_INPUT_RGB888,       //!< R, G, B bytes
+    QOI_INPUT_GRAYSCALE,    //!< 1 byte per pixel
+} qoi_input_format_t;
+
+#define QOI_HEADER_SIZE 14
+
+typedef int (*qoi_write_cb_t)(void* arg, const uint8_t* data, size_t len);
+
+typedef struct {
+    uint8_t r, g, b, a;
+} qoi_rgba_t;
+
+typedef struct {
+    int width;
+    int height;
+    int lines_done;
+    qoi_input_format_t input_format;
+    qoi_rgba_t prev;
+    qoi_rgba_t index[64];
+    int run;
+    qoi_write_cb_t write;
+    void* write_arg;
+    int error;
+    size_t bytes_out;
+    size_t out_len;
+    uint8_t out[256];
+} qoi_encoder_t;
+
+/**
+ * @brief Start an image and write the QOI header
+ * @return 0 on success
+ */
+int qoi_enc_start(qoi_encoder_t* enc, int width, int height, qoi_input_format_t format,
+                  qoi_write_cb_t write, void* arg);
+
+/**
+ * @brief Encode one line of width pixels
+ * @return 0 on success
+ */
+int qoi_enc_line(qoi_encoder_t* enc, const void* line);
+
+/**
+ * @brief Flush the pending run and write the end marker
+ * @return 0 on success
+ */
+int qoi_enc_finish(qoi_encoder_t* enc);
+
+#ifdef __cplusplus
+}
+#endif
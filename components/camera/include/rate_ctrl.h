@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Closed-loop JPEG rate controller.
+ *
+ * Call rate_ctrl_frame() with the size of every encoded frame and
+ * rate_ctrl_sent() with what the socket actually took. Between frames the
+ * controller moves the quality setting one or more steps so the average
+ * frame size stays inside a dead band around the budget:
+ *
+ *   budget = min(target_kbps, measured goodput) / measured fps
+ *
+ * capped by target_frame_bytes. Quality is kept in the units of the
+ * encoder: OV2640 QS counts down for better quality, the software encoder
+ * quality counts up; q_best and q_worst say which way is which.
+ */
+
+/**
+ * @brief Apply a new quality setting
+ * @return 0 on success
+ */
+typedef int (*rate_ctrl_apply_t)(void* arg, int quality);
+
+typedef struct {
+    int q_best;                     //!< setting giving the largest frames
+    int q_worst;                    //!< setting giving the smallest frames
+    int q_initial;
+    uint32_t target_kbps;           //!< 0 to only follow the measured goodput
+    uint32_t target_frame_bytes;    //!< 0 for no per frame limit
+    int hysteresis_pct;             //!< half width of the dead band, e.g. 15
+    int settle_frames;              //!< frames to wait after a change before judging it
+    rate_ctrl_apply_t apply;
+    void* apply_arg;
+} rate_ctrl_config_t;
+
+typedef struct {
+    rate_ctrl_config_t config;
+    int quality;
+    int settle;
+    uint32_t avg_frame_bytes;       // running averages, 0 until the first sample
+    uint32_t avg_interval_ms;
+    uint32_t goodput_bps;
+    uint32_t last_frame_ms;
+    uint32_t budget;                // bytes per frame used by the last decision
+    uint32_t changes;
+} rate_ctrl_t;
+
+/**
+ * @brief Initialize the controller and apply the initial quality
+ * @return 0 on success, -1 on invalid config
+ */
+int rate_ctrl_init(rate_ctrl_t* rc, const rate_ctrl_config_t* config);
+
+/**
+ * @brief Report the size of an encoded frame and adjust the quality
+ *
+ * @param frame_bytes size of the frame
+ * @param timestamp_ms capture time of the frame
+ * @return quality to use for the next frame
+ */
+int rate_ctrl_frame(rate_ctrl_t* rc, size_t frame_bytes, uint32_t timestamp_ms);
+
+/**
+ * @brief Report a measured transfer
+ *
+ * @param bytes bytes written to the socket
+ * @param elapsed_ms time the writes took
+ */
+void rate_ctrl_sent(rate_ctrl_t* rc, size_t bytes, uint32_t elapsed_ms);
+
+#ifdef __cplusplus
+}
+#endif
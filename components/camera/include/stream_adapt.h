@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per client choice of stream encoding.
+ *
+ * The caller has a ladder of encodings, level 0 giving the largest and
+ * best frames and every further level smaller ones: raw, downscaled,
+ * compressed, gray. After every frame it reports the size of the frame
+ * and how long encoding and writing it took. Writes go through a send
+ * buffer of a few KB shared by consecutive frames, so once the link is
+ * the limit they wait for the client to acknowledge what came before.
+ * Bytes over time of the last frames, several send buffers worth, is
+ * the client's goodput. That gives the frame budget
+ *
+ *   budget = goodput / target_fps
+ *
+ * The controller drops as many levels as it takes to get the average
+ * frame of the level under the budget, and goes back up one level at a
+ * time, once the level above has fit with room to spare for a while.
+ * Each time a level has to be left again right after going up to it,
+ * the wait before the next try at it doubles.
+ * Sizes of levels not used yet are the caller's guesses.
+ */
+
+#define STREAM_ADAPT_MAX_LEVELS 8
+// most frames the goodput is measured over
+#define STREAM_ADAPT_WINDOW     16
+
+typedef struct {
+    int levels;                     //!< encodings in the ladder, at most STREAM_ADAPT_MAX_LEVELS
+    int initial_level;
+    int target_fps;
+    int hysteresis_pct;             //!< half width of the dead band around the budget, e.g. 15
+    int hold_frames;                //!< frames to stay on a level before going up
+    uint32_t window_bytes;          //!< goodput is measured over the last frames adding up to this
+    uint32_t frame_bytes[STREAM_ADAPT_MAX_LEVELS];  //!< guessed frame size of each level
+} stream_adapt_config_t;
+
+typedef struct {
+    stream_adapt_config_t config;
+    int level;
+    int held;                       // frames sent on the level
+    bool probing;                   // went up and held fewer than hold_frames frames since
+    int hold[STREAM_ADAPT_MAX_LEVELS];  // frames to wait before going up to a level
+    uint32_t avg_bytes[STREAM_ADAPT_MAX_LEVELS];
+    uint32_t measured;              // bit per level which has a frame size sample
+    uint32_t win_bytes[STREAM_ADAPT_WINDOW];    // the last frames, newest before win_pos
+    uint32_t win_ms[STREAM_ADAPT_WINDOW];
+    int win_pos;
+    int win_count;
+    uint32_t goodput_bps;           // over the window, 0 until the first frame
+    uint32_t budget;                // bytes per frame used by the last decision
+    uint32_t changes;
+} stream_adapt_t;
+
+/**
+ * @brief Initialize the controller
+ * @return 0 on success, -1 on invalid config
+ */
+int stream_adapt_init(stream_adapt_t* sa, const stream_adapt_config_t* config);
+
+/**
+ * @brief Report a frame sent at the current level and pick the next level
+ *
+ * @param frame_bytes size of the frame
+ * @param elapsed_ms time from starting to encode the frame to its last byte written
+ * @return level to use for the next frame
+ */
+int stream_adapt_frame(stream_adapt_t* sa, size_t frame_bytes, uint32_t elapsed_ms);
+
+#ifdef __cplusplus
+}
+#endif
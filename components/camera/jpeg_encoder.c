@@ -0,0 +1,580 @@
+// Baseline JPEG encoder working on 8 line strips.
+// DCT is the integer LLM variant used by the IJG library (jfdctint.c),
+// tables are the default ones from the JPEG standard, annex K.
+#include <string.h>
+#include "jpeg_encoder.h"
+
+static const uint8_t s_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static const uint8_t s_std_lum_qt[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99,
+};
+
+static const uint8_t s_std_chr_qt[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+static const uint8_t s_dc_lum_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t s_dc_chr_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t s_dc_vals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t s_ac_lum_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t s_ac_lum_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+static const uint8_t s_ac_chr_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t s_ac_chr_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+typedef struct {
+    uint16_t code[256];
+    uint8_t size[256];
+} huff_table_t;
+
+// shared by all encoder instances, built on first use
+static huff_table_t s_huff_dc[2];
+static huff_table_t s_huff_ac[2];
+static int s_huff_ready;
+
+static void huff_build(huff_table_t* t, const uint8_t* bits, const uint8_t* vals)
+{
+    uint16_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; ++len) {
+        for (int i = 0; i < bits[len - 1]; ++i) {
+            t->code[vals[k]] = code++;
+            t->size[vals[k]] = len;
+            ++k;
+        }
+        code <<= 1;
+    }
+}
+
+static void huff_init()
+{
+    if (s_huff_ready) {
+        return;
+    }
+    huff_build(&s_huff_dc[0], s_dc_lum_bits, s_dc_vals);
+    huff_build(&s_huff_ac[0], s_ac_lum_bits, s_ac_lum_vals);
+    huff_build(&s_huff_dc[1], s_dc_chr_bits, s_dc_vals);
+    huff_build(&s_huff_ac[1], s_ac_chr_bits, s_ac_chr_vals);
+    s_huff_ready = 1;
+}
+
+/* output */
+
+static void flush_out(jpeg_encoder_t* enc)
+{
+    if (enc->out_len && !enc->error) {
+        enc->error = enc->write(enc->write_arg, enc->out, enc->out_len);
+    }
+    enc->out_len = 0;
+}
+
+static inline void put_byte(jpeg_encoder_t* enc, uint8_t b)
+{
+    enc->out[enc->out_len++] = b;
+    if (enc->out_len == sizeof(enc->out)) {
+        flush_out(enc);
+    }
+}
+
+static void put_word(jpeg_encoder_t* enc, uint16_t w)
+{
+    put_byte(enc, w >> 8);
+    put_byte(enc, w & 0xff);
+}
+
+static inline void put_bits(jpeg_encoder_t* enc, uint32_t code, int size)
+{
+    enc->bit_cnt += size;
+    enc->bit_buf |= code << (32 - enc->bit_cnt);
+    while (enc->bit_cnt >= 8) {
+        uint8_t c = enc->bit_buf >> 24;
+        put_byte(enc, c);
+        if (c == 0xff) {
+            put_byte(enc, 0);   // byte stuffing
+        }
+        enc->bit_buf <<= 8;
+        enc->bit_cnt -= 8;
+    }
+}
+
+static void flush_bits(jpeg_encoder_t* enc)
+{
+    put_bits(enc, 0x7f, 7);     // pad with ones
+    enc->bit_buf = 0;
+    enc->bit_cnt = 0;
+}
+
+/* headers */
+
+static void write_dht(jpeg_encoder_t* enc, uint8_t id, const uint8_t* bits, const uint8_t* vals)
+{
+    int count = 0;
+    for (int i = 0; i < 16; ++i) {
+        count += bits[i];
+    }
+    put_word(enc, 0xffc4);
+    put_word(enc, 2 + 1 + 16 + count);
+    put_byte(enc, id);
+    for (int i = 0; i < 16; ++i) {
+        put_byte(enc, bits[i]);
+    }
+    for (int i = 0; i < count; ++i) {
+        put_byte(enc, vals[i]);
+    }
+}
+
+static void write_headers(jpeg_encoder_t* enc)
+{
+    static const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    const int nc = enc->components;
+
+    put_word(enc, 0xffd8);          // SOI
+    put_word(enc, 0xffe0);          // APP0
+    put_word(enc, 2 + sizeof(jfif));
+    for (int i = 0; i < sizeof(jfif); ++i) {
+        put_byte(enc, jfif[i]);
+    }
+
+    put_word(enc, 0xffdb);          // DQT
+    put_word(enc, 2 + 65 * (nc == 1 ? 1 : 2));
+    put_byte(enc, 0);
+    for (int i = 0; i < 64; ++i) {
+        put_byte(enc, enc->dqt_y[i]);
+    }
+    if (nc > 1) {
+        put_byte(enc, 1);
+        for (int i = 0; i < 64; ++i) {
+            put_byte(enc, enc->dqt_c[i]);
+        }
+    }
+
+    put_word(enc, 0xffc0);          // SOF0
+    put_word(enc, 8 + 3 * nc);
+    put_byte(enc, 8);
+    put_word(enc, enc->height);
+    put_word(enc, enc->width);
+    put_byte(enc, nc);
+    put_byte(enc, 1);
+    put_byte(enc, nc == 1 ? 0x11 : 0x21);   // luma is 2x1 subsampled against chroma
+    put_byte(enc, 0);
+    if (nc > 1) {
+        put_byte(enc, 2);
+        put_byte(enc, 0x11);
+        put_byte(enc, 1);
+        put_byte(enc, 3);
+        put_byte(enc, 0x11);
+        put_byte(enc, 1);
+    }
+
+    write_dht(enc, 0x00, s_dc_lum_bits, s_dc_vals);
+    write_dht(enc, 0x10, s_ac_lum_bits, s_ac_lum_vals);
+    if (nc > 1) {
+        write_dht(enc, 0x01, s_dc_chr_bits, s_dc_vals);
+        write_dht(enc, 0x11, s_ac_chr_bits, s_ac_chr_vals);
+    }
+
+    put_word(enc, 0xffda);          // SOS
+    put_word(enc, 6 + 2 * nc);
+    put_byte(enc, nc);
+    put_byte(enc, 1);
+    put_byte(enc, 0x00);
+    if (nc > 1) {
+        put_byte(enc, 2);
+        put_byte(enc, 0x11);
+        put_byte(enc, 3);
+        put_byte(enc, 0x11);
+    }
+    put_byte(enc, 0);
+    put_byte(enc, 63);
+    put_byte(enc, 0);
+}
+
+/* transform */
+
+#define CONST_BITS  13
+#define PASS1_BITS  2
+#define DESCALE(x, n)  (((x) + (1 << ((n) - 1))) >> (n))
+
+#define FIX_0_298631336  2446
+#define FIX_0_390180644  3196
+#define FIX_0_541196100  4433
+#define FIX_0_765366865  6270
+#define FIX_0_899976223  7373
+#define FIX_1_175875602  9633
+#define FIX_1_501321110  12299
+#define FIX_1_847759065  15137
+#define FIX_1_961570560  16069
+#define FIX_2_053119869  16819
+#define FIX_2_562915447  20995
+#define FIX_3_072711026  25172
+
+// output is scaled up by 8, this is folded into the quantizer
+static void fdct(int32_t* data)
+{
+    int32_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    int32_t tmp10, tmp11, tmp12, tmp13;
+    int32_t z1, z2, z3, z4, z5;
+    int32_t* p;
+
+    for (p = data; p < data + 64; p += 8) {
+        tmp0 = p[0] + p[7];
+        tmp7 = p[0] - p[7];
+        tmp1 = p[1] + p[6];
+        tmp6 = p[1] - p[6];
+        tmp2 = p[2] + p[5];
+        tmp5 = p[2] - p[5];
+        tmp3 = p[3] + p[4];
+        tmp4 = p[3] - p[4];
+
+        tmp10 = tmp0 + tmp3;
+        tmp13 = tmp0 - tmp3;
+        tmp11 = tmp1 + tmp2;
+        tmp12 = tmp1 - tmp2;
+
+        p[0] = (tmp10 + tmp11) << PASS1_BITS;
+        p[4] = (tmp10 - tmp11) << PASS1_BITS;
+
+        z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        p[2] = DESCALE(z1 + tmp13 * FIX_0_765366865, CONST_BITS - PASS1_BITS);
+        p[6] = DESCALE(z1 - tmp12 * FIX_1_847759065, CONST_BITS - PASS1_BITS);
+
+        z1 = tmp4 + tmp7;
+        z2 = tmp5 + tmp6;
+        z3 = tmp4 + tmp6;
+        z4 = tmp5 + tmp7;
+        z5 = (z3 + z4) * FIX_1_175875602;
+
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 *= -FIX_1_961570560;
+        z4 *= -FIX_0_390180644;
+
+        z3 += z5;
+        z4 += z5;
+
+        p[7] = DESCALE(tmp4 + z1 + z3, CONST_BITS - PASS1_BITS);
+        p[5] = DESCALE(tmp5 + z2 + z4, CONST_BITS - PASS1_BITS);
+        p[3] = DESCALE(tmp6 + z2 + z3, CONST_BITS - PASS1_BITS);
+        p[1] = DESCALE(tmp7 + z1 + z4, CONST_BITS - PASS1_BITS);
+    }
+
+    for (p = data; p < data + 8; ++p) {
+        tmp0 = p[0] + p[56];
+        tmp7 = p[0] - p[56];
+        tmp1 = p[8] + p[48];
+        tmp6 = p[8] - p[48];
+        tmp2 = p[16] + p[40];
+        tmp5 = p[16] - p[40];
+        tmp3 = p[24] + p[32];
+        tmp4 = p[24] - p[32];
+
+        tmp10 = tmp0 + tmp3;
+        tmp13 = tmp0 - tmp3;
+        tmp11 = tmp1 + tmp2;
+        tmp12 = tmp1 - tmp2;
+
+        p[0] = DESCALE(tmp10 + tmp11, PASS1_BITS);
+        p[32] = DESCALE(tmp10 - tmp11, PASS1_BITS);
+
+        z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        p[16] = DESCALE(z1 + tmp13 * FIX_0_765366865, CONST_BITS + PASS1_BITS);
+        p[48] = DESCALE(z1 - tmp12 * FIX_1_847759065, CONST_BITS + PASS1_BITS);
+
+        z1 = tmp4 + tmp7;
+        z2 = tmp5 + tmp6;
+        z3 = tmp4 + tmp6;
+        z4 = tmp5 + tmp7;
+        z5 = (z3 + z4) * FIX_1_175875602;
+
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 *= -FIX_1_961570560;
+        z4 *= -FIX_0_390180644;
+
+        z3 += z5;
+        z4 += z5;
+
+        p[56] = DESCALE(tmp4 + z1 + z3, CONST_BITS + PASS1_BITS);
+        p[40] = DESCALE(tmp5 + z2 + z4, CONST_BITS + PASS1_BITS);
+        p[24] = DESCALE(tmp6 + z2 + z3, CONST_BITS + PASS1_BITS);
+        p[8] = DESCALE(tmp7 + z1 + z4, CONST_BITS + PASS1_BITS);
+    }
+}
+
+static inline int bit_count(int v)
+{
+    int n = 0;
+    while (v) {
+        ++n;
+        v >>= 1;
+    }
+    return n;
+}
+
+static void encode_block(jpeg_encoder_t* enc, int32_t* block, int comp)
+{
+    const uint16_t* qt = (comp == 0) ? enc->qtab_y : enc->qtab_c;
+    const huff_table_t* dc = &s_huff_dc[comp ? 1 : 0];
+    const huff_table_t* ac = &s_huff_ac[comp ? 1 : 0];
+    int16_t q[64];
+
+    fdct(block);
+    for (int i = 0; i < 64; ++i) {
+        int32_t c = block[s_zigzag[i]];
+        int32_t d = qt[s_zigzag[i]];
+        q[i] = (c >= 0) ? (c + (d >> 1)) / d : -((-c + (d >> 1)) / d);
+    }
+
+    int diff = q[0] - enc->last_dc[comp];
+    enc->last_dc[comp] = q[0];
+    int v = diff < 0 ? -diff : diff;
+    int nbits = bit_count(v);
+    put_bits(enc, dc->code[nbits], dc->size[nbits]);
+    if (nbits) {
+        put_bits(enc, (diff < 0 ? diff - 1 : diff) & ((1 << nbits) - 1), nbits);
+    }
+
+    int run = 0;
+    for (int i = 1; i < 64; ++i) {
+        int c = q[i];
+        if (c == 0) {
+            ++run;
+            continue;
+        }
+        while (run >= 16) {
+            put_bits(enc, ac->code[0xf0], ac->size[0xf0]);
+            run -= 16;
+        }
+        v = c < 0 ? -c : c;
+        nbits = bit_count(v);
+        int sym = (run << 4) | nbits;
+        put_bits(enc, ac->code[sym], ac->size[sym]);
+        put_bits(enc, (c < 0 ? c - 1 : c) & ((1 << nbits) - 1), nbits);
+        run = 0;
+    }
+    if (run) {
+        put_bits(enc, ac->code[0x00], ac->size[0x00]);     // EOB
+    }
+}
+
+/* pixel access */
+
+static inline uint8_t rgb_to_y(int r, int g, int b)
+{
+    return (77 * r + 150 * g + 29 * b) >> 8;
+}
+
+static inline uint16_t fb_rgb565(const uint8_t* line, int x)
+{
+    // two pixels per 32 bit word, stored as p0hi p0lo p1hi p1lo from the top byte down
+    const uint8_t* w = line + (x >> 1) * 4;
+    return (x & 1) ? (w[0] << 8) | w[1] : (w[2] << 8) | w[3];
+}
+
+static void load_mcu_color(jpeg_encoder_t* enc, const uint8_t** rows, int x0,
+                           int32_t* y0, int32_t* y1, int32_t* cb, int32_t* cr)
+{
+    const int last = enc->width - 1;
+    for (int r = 0; r < 8; ++r) {
+        const uint8_t* line = rows[r];
+        for (int c = 0; c < 16; c += 2) {
+            int xa = x0 + c;
+            int xb = xa + 1;
+            if (xa > last) xa = last;
+            if (xb > last) xb = last;
+            int32_t* py = (c < 8) ? &y0[r * 8 + c] : &y1[r * 8 + c - 8];
+            int ci = r * 8 + (c >> 1);
+            if (enc->input_format == JPEG_INPUT_FB_YUV422) {
+                // y1 v y2 u, pairs never straddle a word as xa is even unless clamped
+                const uint8_t* wa = line + (xa >> 1) * 4;
+                const uint8_t* wb = line + (xb >> 1) * 4;
+                py[0] = ((xa & 1) ? wa[2] : wa[0]) - 128;
+                py[1] = ((xb & 1) ? wb[2] : wb[0]) - 128;
+                cb[ci] = wa[3] - 128;
+                cr[ci] = wa[1] - 128;
+            } else {
+                uint16_t pa = fb_rgb565(line, xa);
+                uint16_t pb = fb_rgb565(line, xb);
+                int ra = (pa >> 8) & 0xf8, ga = (pa >> 3) & 0xfc, ba = (pa << 3) & 0xf8;
+                int rb = (pb >> 8) & 0xf8, gb = (pb >> 3) & 0xfc, bb = (pb << 3) & 0xf8;
+                py[0] = rgb_to_y(ra, ga, ba) - 128;
+                py[1] = rgb_to_y(rb, gb, bb) - 128;
+                int r2 = ra + rb, g2 = ga + gb, b2 = ba + bb;
+                cb[ci] = (-43 * r2 - 85 * g2 + 128 * b2) >> 9;
+                cr[ci] = (128 * r2 - 107 * g2 - 21 * b2) >> 9;
+            }
+        }
+    }
+}
+
+static void load_block_gray(jpeg_encoder_t* enc, const uint8_t** rows, int x0, int32_t* y)
+{
+    const int last = enc->width - 1;
+    for (int r = 0; r < 8; ++r) {
+        for (int c = 0; c < 8; ++c) {
+            int x = x0 + c;
+            y[r * 8 + c] = rows[r][x > last ? last : x] - 128;
+        }
+    }
+}
+
+static void encode_mcu_row(jpeg_encoder_t* enc, const uint8_t** rows)
+{
+    int32_t y0[64], y1[64], cb[64], cr[64];
+
+    if (enc->components == 1) {
+        for (int x = 0; x < enc->width; x += 8) {
+            load_block_gray(enc, rows, x, y0);
+            encode_block(enc, y0, 0);
+        }
+        return;
+    }
+    for (int x = 0; x < enc->width; x += 16) {
+        load_mcu_color(enc, rows, x, y0, y1, cb, cr);
+        encode_block(enc, y0, 0);
+        encode_block(enc, y1, 0);
+        encode_block(enc, cb, 1);
+        encode_block(enc, cr, 2);
+    }
+}
+
+/* API */
+
+static void scale_qtable(const uint8_t* std, int quality, uint16_t* qtab, uint8_t* dqt)
+{
+    int scale = (quality < 50) ? 5000 / quality : 200 - quality * 2;
+    for (int i = 0; i < 64; ++i) {
+        int q = (std[i] * scale + 50) / 100;
+        if (q < 1) q = 1;
+        if (q > 255) q = 255;
+        qtab[i] = q * 8;
+    }
+    for (int i = 0; i < 64; ++i) {
+        dqt[i] = qtab[s_zigzag[i]] / 8;
+    }
+}
+
+int jpeg_enc_start(jpeg_encoder_t* enc, int width, int height, jpeg_input_format_t format,
+                   int quality, jpeg_write_cb_t write, void* arg)
+{
+    if (width <= 0 || height <= 0 || width > 0xffff || height > 0xffff || write == NULL) {
+        return -1;
+    }
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+    huff_init();
+
+    memset(enc, 0, sizeof(*enc));
+    enc->width = width;
+    enc->height = height;
+    enc->input_format = format;
+    enc->components = (format == JPEG_INPUT_GRAYSCALE) ? 1 : 3;
+    enc->write = write;
+    enc->write_arg = arg;
+    scale_qtable(s_std_lum_qt, quality, enc->qtab_y, enc->dqt_y);
+    scale_qtable(s_std_chr_qt, quality, enc->qtab_c, enc->dqt_c);
+
+    write_headers(enc);
+    return enc->error;
+}
+
+int jpeg_enc_strip(jpeg_encoder_t* enc, const uint8_t* lines, size_t line_count, size_t stride)
+{
+    const uint8_t* rows[JPEG_MCU_LINES];
+    size_t done = 0;
+
+    if (line_count > (size_t) (enc->height - enc->lines_done)) {
+        line_count = enc->height - enc->lines_done;
+    }
+    while (done < line_count && !enc->error) {
+        // the last MCU row of the image repeats its bottom line
+        for (int r = 0; r < JPEG_MCU_LINES; ++r) {
+            size_t l = done + r;
+            if (l >= line_count) {
+                l = line_count - 1;
+            }
+            rows[r] = lines + l * stride;
+        }
+        encode_mcu_row(enc, rows);
+        done += JPEG_MCU_LINES;
+    }
+    enc->lines_done += line_count;
+    return enc->error;
+}
+
+int jpeg_enc_finish(jpeg_encoder_t* enc)
+{
+    // frame was cut short, fill the missing MCU rows with flat blocks
+    // so that decoders still accept the image
+    int32_t flat[64];
+    int blocks_per_row = (enc->components == 1) ? (enc->width + 7) / 8 : (enc->width + 15) / 16;
+    while (enc->lines_done < enc->height && !enc->error) {
+        for (int b = 0; b < blocks_per_row; ++b) {
+            for (int comp = 0; comp < enc->components; ++comp) {
+                int count = (comp == 0 && enc->components > 1) ? 2 : 1;
+                for (int n = 0; n < count; ++n) {
+                    memset(flat, 0, sizeof(flat));
+                    encode_block(enc, flat, comp);
+                }
+            }
+        }
+        enc->lines_done += JPEG_MCU_LINES;
+    }
+    flush_bits(enc);
+    put_word(enc, 0xffd9);          // EOI
+    flush_out(enc);
+    return enc->error;
+}
@@ -387,9 +387,6 @@ static const uint8_t saturation_regs[NUM_SATURATION_LEVELS + 1][5] = {
 
 static int reset(sensor_t *sensor)
 {
-    int i=0;
-    const uint8_t (*regs)[2];
-
     /* Reset all registers */
     SCCB_Write(sensor->slv_addr, BANK_SEL, BANK_SEL_SENSOR);
     SCCB_Write(sensor->slv_addr, COM7, COM7_SRST);
@@ -397,28 +394,17 @@ static int reset(sensor_t *sensor)
     /* delay n ms */
     delay(10);
 
-    i = 0;
-    regs = default_regs;
     /* Write initial regsiters */
-    while (regs[i][0]) {
-        SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-        i++;
-    }
+    SCCB_WriteRegs(sensor->slv_addr, default_regs);
 
-    i = 0;
-    regs = svga_regs;
     /* Write DSP input regsiters */
-    while (regs[i][0]) {
-        SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-        i++;
-    }
+    SCCB_WriteRegs(sensor->slv_addr, svga_regs);
 
     return 0;
 }
 
 static int set_pixformat(sensor_t *sensor, pixformat_t pixformat)
 {
-    int i=0;
     const uint8_t (*regs)[2]=NULL;
 
     /* read pixel format reg */
@@ -438,10 +424,7 @@ static int set_pixformat(sensor_t *sensor, pixformat_t pixformat)
     }
 
     /* Write initial regsiters */
-    while (regs[i][0]) {
-        SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-        i++;
-    }
+    SCCB_WriteRegs(sensor->slv_addr, regs);
 
     /* delay n ms */
     delay(30);
@@ -456,7 +439,6 @@ static int set_framesize(sensor_t *sensor, framesize_t framesize)
     uint16_t w = resolution[framesize][0];
     uint16_t h = resolution[framesize][1];
 
-    int i=0;
     const uint8_t (*regs)[2];
     
     if (framesize <= FRAMESIZE_SVGA) {
@@ -482,10 +464,7 @@ static int set_framesize(sensor_t *sensor, framesize_t framesize)
     ret |= SCCB_Write(sensor->slv_addr, CLKRC, clkrc);
 
     /* Write DSP input regsiters */
-    while (regs[i][0]) {
-        SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-        i++;
-    }
+    SCCB_WriteRegs(sensor->slv_addr, regs);
 
     /* Enable DSP */
     ret |= SCCB_Write(sensor->slv_addr, BANK_SEL, BANK_SEL_DSP);
@@ -718,9 +718,6 @@ static int ov7670_set_hue(sensor_t *sensor, ov7670_info_t* info, int value)
 
 static int reset(sensor_t *sensor)
 {
-    int i=0;
-    const uint8_t (*regs)[2];
-
     // Reset all registers
     SCCB_Write(sensor->slv_addr, COM7, COM7_RESET);
 
@@ -728,9 +725,7 @@ static int reset(sensor_t *sensor)
     systick_sleep(10);
 
     // Write default regsiters
-    for (i=0, regs = default_regs; regs[i][0]; i++) {
-        SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-    }
+    SCCB_WriteRegs(sensor->slv_addr, default_regs);
 
     // Delay
     systick_sleep(30);
@@ -816,9 +811,7 @@ static int set_pixformat(sensor_t *sensor, pixformat_t pixformat)
 
 static int set_framesize(sensor_t *sensor, framesize_t framesize)
 {
-	const uint8_t (*regs)[2];
 	int ret=0;
-	int i=0;
 
   // store clkrc before changing window settings...
   int reg =  SCCB_Read(sensor->slv_addr, OV7670_CLKRC_REG);
@@ -827,22 +820,13 @@ static int set_framesize(sensor_t *sensor, framesize_t framesize)
 	switch(framesize)
 	{
 		case FRAMESIZE_VGA:
-			for (i=0, regs = VGA_regs; regs[i][0]; i++)
-			{
-				ret |= SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-			}
+			ret |= SCCB_WriteRegs(sensor->slv_addr, VGA_regs);
 			break;
 		case FRAMESIZE_QVGA:
-			for (i=0, regs = QVGA_regs; regs[i][0]; i++)
-			{
-				ret |= SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-			}
+			ret |= SCCB_WriteRegs(sensor->slv_addr, QVGA_regs);
 			break;
 		case FRAMESIZE_QQVGA:
-			for (i=0, regs = QQVGA_regs; regs[i][0]; i++)
-			{
-				ret |= SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-			}
+			ret |= SCCB_WriteRegs(sensor->slv_addr, QQVGA_regs);
 			break;
 		default:
 			return -1;
@@ -114,9 +114,6 @@ static const uint8_t default_regs[][2] = {
 
 static int reset(sensor_t *sensor)
 {
-    int i=0;
-    const uint8_t (*regs)[2];
-
     // Reset all registers
     SCCB_Write(sensor->slv_addr, COM7, COM7_RESET);
 
@@ -124,9 +121,7 @@ static int reset(sensor_t *sensor)
     systick_sleep(10);
 
     // Write default regsiters
-    for (i=0, regs = default_regs; regs[i][0]; i++) {
-        SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-    }
+    SCCB_WriteRegs(sensor->slv_addr, default_regs);
 
     // Delay
     systick_sleep(30);
@@ -0,0 +1,158 @@
+#include <string.h>
+#include "qoi_encoder.h"
+
+#define QOI_OP_INDEX  0x00
+#define QOI_OP_DIFF   0x40
+#define QOI_OP_LUMA   0x80
+#define QOI_OP_RUN    0xc0
+#define QOI_OP_RGB    0xfe
+
+#define QOI_HASH(p) (((p).r * 3 + (p).g * 5 + (p).b * 7 + (p).a * 11) & 63)
+
+static void flush_out(qoi_encoder_t* enc)
+{
+    if (enc->out_len && !enc->error) {
+        enc->error = enc->write(enc->write_arg, enc->out, enc->out_len);
+    }
+    enc->bytes_out += enc->out_len;
+    enc->out_len = 0;
+}
+
+static inline void put_byte(qoi_encoder_t* enc, uint8_t b)
+{
+    enc->out[enc->out_len++] = b;
+    if (enc->out_len == sizeof(enc->out)) {
+        flush_out(enc);
+    }
+}
+
+static void put_u32(qoi_encoder_t* enc, uint32_t v)
+{
+    put_byte(enc, v >> 24);
+    put_byte(enc, v >> 16);
+    put_byte(enc, v >> 8);
+    put_byte(enc, v);
+}
+
+static inline void encode_pixel(qoi_encoder_t* enc, qoi_rgba_t px)
+{
+    if (px.r == enc->prev.r && px.g == enc->prev.g && px.b == enc->prev.b) {
+        if (++enc->run == 62) {
+            put_byte(enc, QOI_OP_RUN | (enc->run - 1));
+            enc->run = 0;
+        }
+        return;
+    }
+    if (enc->run) {
+        put_byte(enc, QOI_OP_RUN | (enc->run - 1));
+        enc->run = 0;
+    }
+
+    int h = QOI_HASH(px);
+    if (enc->index[h].r == px.r && enc->index[h].g == px.g &&
+        enc->index[h].b == px.b && enc->index[h].a == px.a) {
+        put_byte(enc, QOI_OP_INDEX | h);
+    } else {
+        enc->index[h] = px;
+        int8_t dr = px.r - enc->prev.r;
+        int8_t dg = px.g - enc->prev.g;
+        int8_t db = px.b - enc->prev.b;
+        int8_t dr_dg = dr - dg;
+        int8_t db_dg = db - dg;
+        if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+            put_byte(enc, QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+        } else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8) {
+            put_byte(enc, QOI_OP_LUMA | (dg + 32));
+            put_byte(enc, (dr_dg + 8) << 4 | (db_dg + 8));
+        } else {
+            put_byte(enc, QOI_OP_RGB);
+            put_byte(enc, px.r);
+            put_byte(enc, px.g);
+            put_byte(enc, px.b);
+        }
+    }
+    enc->prev = px;
+}
+
+int qoi_enc_start(qoi_encoder_t* enc, int width, int height, qoi_input_format_t format,
+                  qoi_write_cb_t write, void* arg)
+{
+    if (width <= 0 || height <= 0 || write == NULL) {
+        return -1;
+    }
+    memset(enc, 0, sizeof(*enc));
+    enc->width = width;
+    enc->height = height;
+    enc->input_format = format;
+    enc->write = write;
+    enc->write_arg = arg;
+    enc->prev.a = 255;
+
+    put_byte(enc, 'q');
+    put_byte(enc, 'o');
+    put_byte(enc, 'i');
+    put_byte(enc, 'f');
+    put_u32(enc, width);
+    put_u32(enc, height);
+    put_byte(enc, 3);       // channels
+    put_byte(enc, 0);       // sRGB with linear alpha
+    return enc->error;
+}
+
+int qoi_enc_line(qoi_encoder_t* enc, const void* line)
+{
+    qoi_rgba_t px = { .a = 255 };
+
+    if (enc->lines_done >= enc->height) {
+        return -1;
+    }
+    switch (enc->input_format) {
+        case QOI_INPUT_RGB565: {
+            const uint16_t* src = (const uint16_t*) line;
+            for (int x = 0; x < enc->width; ++x) {
+                uint16_t p = src[x];
+                px.r = ((p >> 8) & 0xf8) | (p >> 13);
+                px.g = ((p >> 3) & 0xfc) | ((p >> 9) & 0x03);
+                px.b = ((p << 3) & 0xf8) | ((p >> 2) & 0x07);
+                encode_pixel(enc, px);
+            }
+            break;
+        }
+        case QOI_INPUT_RGB888: {
+            const uint8_t* src = (const uint8_t*) line;
+            for (int x = 0; x < enc->width; ++x, src += 3) {
+                px.r = src[0];
+                px.g = src[1];
+                px.b = src[2];
+                encode_pixel(enc, px);
+            }
+            break;
+        }
+        case QOI_INPUT_GRAYSCALE: {
+            const uint8_t* src = (const uint8_t*) line;
+            for (int x = 0; x < enc->width; ++x) {
+                px.r = px.g = px.b = src[x];
+                encode_pixel(enc, px);
+            }
+            break;
+        }
+        default:
+            return -1;
+    }
+    ++enc->lines_done;
+    return enc->error;
+}
+
+int qoi_enc_finish(qoi_encoder_t* enc)
+{
+    if (enc->run) {
+        put_byte(enc, QOI_OP_RUN | (enc->run - 1));
+        enc->run = 0;
+    }
+    for (int i = 0; i < 7; ++i) {
+        put_byte(enc, 0);
+    }
+    put_byte(enc, 1);
+    flush_out(enc);
+    return enc->error;
+}
@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "rate_ctrl.h"
+
+// share of the link the controller plans with, the rest absorbs scene changes
+#define GOODPUT_HEADROOM_PCT 90
+#define GOODPUT_MAX_BPS      100000000
+
+// running average moving 1/4 of the way to every sample
+static uint32_t running_avg(uint32_t avg, uint32_t sample)
+{
+    if (avg == 0) {
+        return sample;
+    }
+    return (uint32_t) ((int64_t) avg + (((int64_t) sample - (int64_t) avg) >> 2));
+}
+
+static int clamp_quality(const rate_ctrl_config_t* c, int q)
+{
+    int lo = (c->q_best < c->q_worst) ? c->q_best : c->q_worst;
+    int hi = (c->q_best < c->q_worst) ? c->q_worst : c->q_best;
+    return (q < lo) ? lo : (q > hi) ? hi : q;
+}
+
+int rate_ctrl_init(rate_ctrl_t* rc, const rate_ctrl_config_t* config)
+{
+    memset(rc, 0, sizeof(*rc));
+    if (config->q_best == config->q_worst || config->hysteresis_pct < 0 ||
+        config->hysteresis_pct >= 100) {
+        return -1;
+    }
+    rc->config = *config;
+    rc->quality = clamp_quality(config, config->q_initial);
+    if (config->apply != NULL) {
+        return config->apply(config->apply_arg, rc->quality) == 0 ? 0 : -1;
+    }
+    return 0;
+}
+
+void rate_ctrl_sent(rate_ctrl_t* rc, size_t bytes, uint32_t elapsed_ms)
+{
+    if (bytes == 0) {
+        return;
+    }
+    // writes which only filled the send buffer look very fast, which is right:
+    // the link is not the limit then
+    uint64_t bps = (uint64_t) bytes * 8 * 1000 / (elapsed_ms ? elapsed_ms : 1);
+    if (bps > GOODPUT_MAX_BPS) {
+        bps = GOODPUT_MAX_BPS;
+    }
+    rc->goodput_bps = running_avg(rc->goodput_bps, (uint32_t) bps);
+}
+
+static uint32_t frame_budget(const rate_ctrl_t* rc)
+{
+    const rate_ctrl_config_t* c = &rc->config;
+    uint32_t bps = c->target_kbps * 1000;
+    if (rc->goodput_bps != 0) {
+        uint32_t link = (uint64_t) rc->goodput_bps * GOODPUT_HEADROOM_PCT / 100;
+        if (bps == 0 || link < bps) {
+            bps = link;
+        }
+    }
+    uint32_t budget = 0;
+    if (bps != 0 && rc->avg_interval_ms != 0) {
+        budget = (uint64_t) bps * rc->avg_interval_ms / 8000;
+    }
+    if (c->target_frame_bytes != 0 && (budget == 0 || c->target_frame_bytes < budget)) {
+        budget = c->target_frame_bytes;
+    }
+    return budget;
+}
+
+int rate_ctrl_frame(rate_ctrl_t* rc, size_t frame_bytes, uint32_t timestamp_ms)
+{
+    const rate_ctrl_config_t* c = &rc->config;
+    if (rc->last_frame_ms != 0 && timestamp_ms > rc->last_frame_ms) {
+        rc->avg_interval_ms = running_avg(rc->avg_interval_ms, timestamp_ms - rc->last_frame_ms);
+    }
+    rc->last_frame_ms = timestamp_ms;
+
+    if (rc->settle > 0) {
+        // frames still encoded with the old setting are not counted
+        if (--rc->settle == 0) {
+            rc->avg_frame_bytes = frame_bytes;
+        }
+        return rc->quality;
+    }
+    rc->avg_frame_bytes = running_avg(rc->avg_frame_bytes, frame_bytes);
+
+    rc->budget = frame_budget(rc);
+    if (rc->budget == 0) {
+        return rc->quality;
+    }
+    uint32_t ratio = (uint64_t) rc->avg_frame_bytes * 100 / rc->budget;
+    int steps = 0;
+    if (ratio > 100 + (uint32_t) c->hysteresis_pct) {
+        steps = (ratio > 200) ? 4 : (ratio > 140) ? 2 : 1;
+    } else if (ratio < 100 - (uint32_t) c->hysteresis_pct) {
+        // going up is cheaper to get wrong slowly than to overshoot
+        steps = (ratio < 50) ? -2 : -1;
+    }
+    if (steps == 0) {
+        return rc->quality;
+    }
+    int toward_worst = (c->q_worst > c->q_best) ? 1 : -1;
+    int quality = clamp_quality(c, rc->quality + steps * toward_worst);
+    if (quality != rc->quality) {
+        if (c->apply == NULL || c->apply(c->apply_arg, quality) == 0) {
+            rc->quality = quality;
+            rc->settle = c->settle_frames;
+            rc->changes++;
+        }
+    }
+    return rc->quality;
+}
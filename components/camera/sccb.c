@@ -3,9 +3,12 @@
  * Copyright (c) 2013/2014 Ibrahim Abdelkader <i.abdalkader@gmail.com>
  * This work is licensed under the MIT license, see the file LICENSE for details.
  *
- * SCCB (I2C like) driver.
+ * SCCB (I2C like) driver, bit-banged by twi.c. See sccb_i2c.c for the
+ * one on the I2C peripheral.
  *
  */
+#include "sdkconfig.h"
+#if CONFIG_SCCB_BITBANG
 #include <stdbool.h>
 #include "wiring.h"
 #include "sccb.h"
@@ -78,3 +81,13 @@ uint8_t SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data)
     }
     return ret;
 }
+
+int SCCB_WriteRegs(uint8_t slv_addr, const uint8_t (*regs)[2])
+{
+    int ret=0;
+    for (int i=0; regs[i][0]; i++) {
+        ret |= SCCB_Write(slv_addr, regs[i][0], regs[i][1]);
+    }
+    return ret;
+}
+#endif // CONFIG_SCCB_BITBANG
@@ -13,4 +13,6 @@ int SCCB_Init(int pin_sda, int pin_scl);
 uint8_t SCCB_Probe();
 uint8_t SCCB_Read(uint8_t slv_addr, uint8_t reg);
 uint8_t SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data);
+/* Write a table of {reg, value} pairs ending in {0, 0}, returns 0 on success */
+int SCCB_WriteRegs(uint8_t slv_addr, const uint8_t (*regs)[2]);
 #endif // __SCCB_H__
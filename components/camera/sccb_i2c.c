@@ -0,0 +1,140 @@
+/*
+ * SCCB on the ESP32 I2C peripheral.
+ *
+ * The driver queues each transaction as a command link and the peripheral
+ * clocks it out on its own; the calling task sleeps until the completion
+ * interrupt, so interrupts stay enabled and the other core keeps running.
+ * Register tables go out in batches of CONFIG_SCCB_WRITE_BATCH writes per
+ * command link, joined by repeated starts.
+ */
+#include "sdkconfig.h"
+#if CONFIG_SCCB_HARDWARE_I2C
+#include <stdbool.h>
+#include "driver/i2c.h"
+#include "esp_log.h"
+#include "wiring.h"
+#include "sccb.h"
+
+#define SCCB_PORT       CONFIG_SCCB_I2C_PORT
+#define SCCB_TIMEOUT_MS 1000
+
+static const char* TAG = "sccb";
+
+static bool s_installed = false;
+
+int SCCB_Init(int pin_sda, int pin_scl)
+{
+    if (s_installed) {
+        i2c_driver_delete(SCCB_PORT);
+        s_installed = false;
+    }
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = pin_sda,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_io_num = pin_scl,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = CONFIG_SCCB_CLK_FREQ,
+    };
+    esp_err_t err = i2c_param_config(SCCB_PORT, &conf);
+    if (err == ESP_OK) {
+        err = i2c_driver_install(SCCB_PORT, conf.mode, 0, 0, 0);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "I2C port %d setup failed: %d", SCCB_PORT, err);
+        return -1;
+    }
+    s_installed = true;
+    return 0;
+}
+
+// one command link from start to stop, the task waits for it without spinning
+static esp_err_t run(i2c_cmd_handle_t cmd)
+{
+    i2c_master_stop(cmd);
+    esp_err_t err = i2c_master_cmd_begin(SCCB_PORT, cmd, SCCB_TIMEOUT_MS / portTICK_RATE_MS);
+    i2c_cmd_link_delete(cmd);
+    return err;
+}
+
+static void write_reg(i2c_cmd_handle_t cmd, uint8_t slv_addr, uint8_t reg, uint8_t data)
+{
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (slv_addr << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, reg, true);
+    i2c_master_write_byte(cmd, data, true);
+}
+
+uint8_t SCCB_Probe()
+{
+    for (uint8_t i = 1; i < 127; i++) {
+        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (i << 1) | I2C_MASTER_WRITE, true);
+        i2c_master_write_byte(cmd, 0x00, true);
+        if (run(cmd) == ESP_OK) {
+            return i;
+        }
+        if (i != 126) {
+            systick_sleep(1); // Necessary for OV7725 camera (not for OV2640).
+        }
+    }
+    return 0;
+}
+
+uint8_t SCCB_Read(uint8_t slv_addr, uint8_t reg)
+{
+    // SCCB wants a stop between setting the address and reading
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (slv_addr << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, reg, true);
+    esp_err_t err = run(cmd);
+    uint8_t data = 0xff;
+    if (err == ESP_OK) {
+        cmd = i2c_cmd_link_create();
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (slv_addr << 1) | I2C_MASTER_READ, true);
+        i2c_master_read_byte(cmd, &data, I2C_MASTER_NACK);
+        err = run(cmd);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "SCCB_Read [%02x] failed: %d", reg, err);
+        return 0xff;
+    }
+    return data;
+}
+
+uint8_t SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data)
+{
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    write_reg(cmd, slv_addr, reg, data);
+    esp_err_t err = run(cmd);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "SCCB_Write [%02x]=%02x failed: %d", reg, data, err);
+        return 0xff;
+    }
+    return 0;
+}
+
+int SCCB_WriteRegs(uint8_t slv_addr, const uint8_t (*regs)[2])
+{
+    int ret = 0;
+    int i = 0;
+    while (regs[i][0]) {
+        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        int n = 0;
+        for (; n < CONFIG_SCCB_WRITE_BATCH && regs[i + n][0]; n++) {
+            write_reg(cmd, slv_addr, regs[i + n][0], regs[i + n][1]);
+        }
+        esp_err_t err = run(cmd);
+        if (err != ESP_OK) {
+            // like single writes, a failure does not stop the rest of the table
+            ESP_LOGE(TAG, "writing registers [%02x]..[%02x] failed: %d", regs[i][0], regs[i + n - 1][0], err);
+            ret = -1;
+        }
+        i += n;
+    }
+    return ret;
+}
+#endif // CONFIG_SCCB_HARDWARE_I2C
@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "stream_adapt.h"
+
+#define GOODPUT_MAX_BPS 100000000
+// failed attempts to go up make the wait before the next one at most this many times hold_frames
+#define HOLD_MAX_FACTOR 16
+
+// running average moving 1/4 of the way to every sample
+static uint32_t running_avg(uint32_t avg, uint32_t sample)
+{
+    if (avg == 0) {
+        return sample;
+    }
+    return (uint32_t) ((int64_t) avg + (((int64_t) sample - (int64_t) avg) >> 2));
+}
+
+/*
+ * Bytes over time of the newest frames adding up to window_bytes. A
+ * send buffer which had room takes a few frames in no time, so the
+ * window has to span several of them. Weighted by time, one frame which
+ * stalled on a slower link pulls the goodput down at once.
+ */
+static uint32_t window_goodput(stream_adapt_t* sa, uint32_t bytes, uint32_t elapsed_ms)
+{
+    sa->win_bytes[sa->win_pos] = bytes;
+    sa->win_ms[sa->win_pos] = elapsed_ms;
+    sa->win_pos = (sa->win_pos + 1) % STREAM_ADAPT_WINDOW;
+    if (sa->win_count < STREAM_ADAPT_WINDOW) {
+        sa->win_count++;
+    }
+    uint64_t total_bytes = 0;
+    uint32_t total_ms = 0;
+    for (int n = 0; n < sa->win_count && (n == 0 || total_bytes < sa->config.window_bytes); n++) {
+        int i = (sa->win_pos + STREAM_ADAPT_WINDOW - 1 - n) % STREAM_ADAPT_WINDOW;
+        total_bytes += sa->win_bytes[i];
+        total_ms += sa->win_ms[i];
+    }
+    uint64_t bps = total_bytes * 8 * 1000 / (total_ms ? total_ms : 1);
+    return (bps > GOODPUT_MAX_BPS) ? GOODPUT_MAX_BPS : (uint32_t) bps;
+}
+
+int stream_adapt_init(stream_adapt_t* sa, const stream_adapt_config_t* config)
+{
+    memset(sa, 0, sizeof(*sa));
+    if (config->levels < 1 || config->levels > STREAM_ADAPT_MAX_LEVELS || config->target_fps <= 0 ||
+        config->initial_level < 0 || config->initial_level >= config->levels ||
+        config->hysteresis_pct < 0 || config->hysteresis_pct >= 100) {
+        return -1;
+    }
+    sa->config = *config;
+    sa->level = config->initial_level;
+    for (int i = 0; i < config->levels; i++) {
+        sa->hold[i] = config->hold_frames;
+    }
+    memcpy(sa->avg_bytes, config->frame_bytes, sizeof(sa->avg_bytes));
+    return 0;
+}
+
+// the first frame of a level corrects the guesses of the levels not seen yet by as much
+static void add_frame_bytes(stream_adapt_t* sa, uint32_t bytes)
+{
+    const int level = sa->level;
+    if (sa->measured & (1u << level)) {
+        sa->avg_bytes[level] = running_avg(sa->avg_bytes[level], bytes);
+        return;
+    }
+    uint32_t guess = sa->avg_bytes[level];
+    for (int i = 0; i < sa->config.levels && guess != 0; i++) {
+        if (i != level && !(sa->measured & (1u << i))) {
+            sa->avg_bytes[i] = (uint64_t) sa->avg_bytes[i] * bytes / guess;
+        }
+    }
+    sa->avg_bytes[level] = bytes;
+    sa->measured |= 1u << level;
+}
+
+int stream_adapt_frame(stream_adapt_t* sa, size_t frame_bytes, uint32_t elapsed_ms)
+{
+    const stream_adapt_config_t* c = &sa->config;
+    if (frame_bytes == 0) {
+        return sa->level;
+    }
+    add_frame_bytes(sa, frame_bytes);
+    sa->goodput_bps = window_goodput(sa, frame_bytes, elapsed_ms);
+    sa->budget = sa->goodput_bps / 8 / c->target_fps;
+    sa->held++;
+
+    const uint64_t high = (uint64_t) sa->budget * (100 + c->hysteresis_pct) / 100;
+    const uint64_t low = (uint64_t) sa->budget * (100 - c->hysteresis_pct) / 100;
+    int level = sa->level;
+    if (sa->avg_bytes[level] > high) {
+        // straight down to the first level which fits, the last one if none does
+        while (level + 1 < c->levels && sa->avg_bytes[level] > sa->budget) {
+            level++;
+        }
+        if (sa->probing) {
+            // it did not fit after all, wait longer before trying it again
+            const int max_hold = c->hold_frames * HOLD_MAX_FACTOR;
+            int* hold = &sa->hold[sa->level];
+            *hold = (*hold * 2 < max_hold) ? *hold * 2 : max_hold;
+        }
+    } else if (sa->probing && sa->held >= c->hold_frames) {
+        sa->probing = false;
+        sa->hold[level] = c->hold_frames;
+    } else if (level > 0 && sa->held >= sa->hold[level - 1] && sa->avg_bytes[level - 1] < low) {
+        level--;
+    }
+    if (level != sa->level) {
+        sa->probing = level < sa->level;
+        sa->level = level;
+        sa->held = 0;
+        sa->changes++;
+    }
+    return sa->level;
+}
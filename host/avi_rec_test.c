@@ -0,0 +1,219 @@
+/*
+ * Runs the segment recorder against a directory standing in for the SPIFFS
+ * mount point and checks the files it leaves behind.
+ *
+ *   ./avi_rec_test [dir]
+ *
+ * Frames are real JPEGs from the software encoder, so the segments in dir
+ * can be played back afterwards. Without dir a temporary one is used.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "avi_rec.h"
+#include "jpeg_encoder.h"
+
+#define W 160
+#define H 120
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t size;
+} mem_t;
+
+static int mem_write(void* arg, const uint8_t* data, size_t len)
+{
+    mem_t* m = (mem_t*) arg;
+    if (m->len + len > m->size) {
+        return -1;
+    }
+    memcpy(m->data + m->len, data, len);
+    m->len += len;
+    return 0;
+}
+
+// a bar moving across a gradient, so every frame differs
+static size_t make_frame(int n, uint8_t* out, size_t size)
+{
+    static uint8_t gray[W * H];
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            int bar = ((x + n * 4) % W) < 16;
+            gray[y * W + x] = bar ? 255 : (uint8_t) (x + y);
+        }
+    }
+    mem_t m = { out, 0, size };
+    jpeg_encoder_t enc;
+    jpeg_enc_start(&enc, W, H, JPEG_INPUT_GRAYSCALE, 50, mem_write, &m);
+    jpeg_enc_strip(&enc, gray, H, W);
+    jpeg_enc_finish(&enc);
+    return enc.error ? 0 : m.len;
+}
+
+static uint32_t rd32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// returns the number of frames in the segment, -1 if it is broken
+static int check_segment(const char* name)
+{
+    FILE* f = fopen(name, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    uint8_t* d = malloc(size);
+    fseek(f, 0, SEEK_SET);
+    size_t got = fread(d, 1, size, f);
+    fclose(f);
+
+    int frames = -1;
+    if (got != (size_t) size || size < AVI_REC_HEADER_SIZE + 8) {
+        goto out;
+    }
+    if (memcmp(d, "RIFF", 4) || rd32(d + 4) != size - 8 || memcmp(d + 220, "movi", 4)) {
+        goto out;
+    }
+    uint32_t idx = 220 + rd32(d + 216);
+    if (idx + 8 > size || memcmp(d + idx, "idx1", 4)) {
+        goto out;
+    }
+    uint32_t n = rd32(d + idx + 4) / 16;
+    if (n != rd32(d + 48) || n != rd32(d + 140)) {
+        goto out;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const uint8_t* e = d + idx + 8 + i * 16;
+        uint32_t ofs = 220 + rd32(e + 8);
+        uint32_t len = rd32(e + 12);
+        if (ofs + 8 + len > idx || memcmp(d + ofs, "00dc", 4) || rd32(d + ofs + 4) != len ||
+            d[ofs + 8] != 0xff || d[ofs + 9] != 0xd8 || d[ofs + 8 + len - 1] != 0xd9) {
+            goto out;
+        }
+    }
+    frames = n;
+out:
+    free(d);
+    return frames;
+}
+
+static int check_dir(const char* dir, int expect_segments, int* total_frames)
+{
+    DIR* dp = opendir(dir);
+    struct dirent* de;
+    int segments = 0, errors = 0;
+    *total_frames = 0;
+    if (dp == NULL) {
+        perror(dir);
+        return 1;
+    }
+    while ((de = readdir(dp)) != NULL) {
+        if (strncmp(de->d_name, "seg", 3) != 0) {
+            continue;
+        }
+        char name[512];
+        snprintf(name, sizeof(name), "%s/%s", dir, de->d_name);
+        int frames = check_segment(name);
+        if (frames < 0) {
+            printf("  %s: broken\n", de->d_name);
+            errors++;
+        } else {
+            *total_frames += frames;
+        }
+        segments++;
+    }
+    closedir(dp);
+    if (segments != expect_segments) {
+        printf("  %d segments, expected %d\n", segments, expect_segments);
+        errors++;
+    }
+    return errors;
+}
+
+int main(int argc, char** argv)
+{
+    char tmp[] = "/tmp/avi_rec_XXXXXX";
+    const char* dir = (argc > 1) ? argv[1] : mkdtemp(tmp);
+    if (dir == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    avi_rec_config_t config = {
+        .dir = dir,
+        .max_segments = 4,
+        .segment_size = 32 * 1024,
+        .max_frame_size = 16 * 1024,
+        .write_chunk = 4096,
+        .width = W,
+        .height = H,
+        .fps = 10,
+    };
+    static uint8_t frame[16 * 1024];
+    avi_rec_t rec;
+    int errors = 0, frames;
+
+    // enough frames to wrap the ring a few times
+    if (avi_rec_init(&rec, &config) != 0) {
+        printf("init failed\n");
+        return 1;
+    }
+    for (int i = 0; i < 300; i++) {
+        size_t len = make_frame(i, frame, sizeof(frame));
+        if (avi_rec_write_frame(&rec, frame, len, i * 100) != 0) {
+            printf("frame %d dropped\n", i);
+            avi_rec_deinit(&rec);
+            return 1;
+        }
+    }
+    avi_rec_deinit(&rec);
+    printf("ring: %u segments written, %u deleted\n", (unsigned) rec.next_seq, (unsigned) rec.segments_deleted);
+    errors += check_dir(dir, config.max_segments, &frames);
+    printf("ring: %d frames kept\n", frames);
+
+    // a reset in the middle of a segment: stop without closing, then cut the last frame short
+    if (avi_rec_init(&rec, &config) != 0) {
+        printf("repair: init failed\n");
+        return 1;
+    }
+    uint32_t seq = rec.next_seq;
+    for (int i = 0; i < 5; i++) {
+        size_t len = make_frame(i, frame, sizeof(frame));
+        if (avi_rec_write_frame(&rec, frame, len, i * 100) != 0) {
+            printf("repair: frame %d dropped\n", i);
+            avi_rec_deinit(&rec);
+            return 1;
+        }
+    }
+    fwrite(rec.wbuf, 1, rec.wbuf_len, rec.file);
+    fwrite("00dc\x00\x10\x00\x00\xff\xd8", 1, 10, rec.file);
+    fclose(rec.file);
+    rec.file = NULL;
+    avi_rec_deinit(&rec);
+
+    if (avi_rec_init(&rec, &config) != 0) {
+        printf("repair: init after reset failed\n");
+        return 1;
+    }
+    char name[AVI_REC_NAME_MAX];
+    avi_rec_segment_name(&rec, seq, name, sizeof(name));
+    frames = check_segment(name);
+    printf("repair: %d frames recovered\n", frames);
+    if (frames != 5) {
+        errors++;
+    }
+    if (rec.next_seq != seq + 1 || !avi_rec_segment_ready(&rec, seq)) {
+        printf("repair: sequence not continued\n");
+        errors++;
+    }
+    avi_rec_deinit(&rec);
+
+    printf("%s (%s)\n", errors ? "FAILED" : "OK", dir);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+// Unit tests for the /stream broadcaster of main/, run on the host:
+//
+//   make -C host test
+//
+// broadcaster.c is included so the tests can see how many frames exist.
+// Rendering waits for the test to let each frame through, so which frames
+// reach which subscriber does not depend on timing. Prints every failed
+// check and exits non-zero if there was one.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../main/broadcaster.c"
+
+#define MAX_FRAMES 3
+#define QUEUE_DEPTH 2
+#define FRAMES 20
+#define WAIT_TICKS (1000 / portTICK_RATE_MS)
+
+static int s_checks;
+static int s_failed;
+static SemaphoreHandle_t s_permit;          // lets one frame be rendered
+static int s_most_alive;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) check_eq((long) (a), (long) (b), #a, #b, __FILE__, __LINE__)
+
+static void check(int ok, const char* what, const char* file, int line)
+{
+    s_checks++;
+    if (!ok) {
+        s_failed++;
+        printf("%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+static void check_eq(long a, long b, const char* sa, const char* sb, const char* file, int line)
+{
+    s_checks++;
+    if (a != b) {
+        s_failed++;
+        printf("%s:%d: %s == %s failed: %ld != %ld\n", file, line, sa, sb, a, b);
+    }
+}
+
+void metrics_register_task(TaskHandle_t task)
+{
+}
+
+static int frames_alive()
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int alive = s_frames_alive;
+    xSemaphoreGive(s_lock);
+    return alive;
+}
+
+// the frame being rendered already counts, so this sees the most there are
+static size_t render(uint8_t* dst, size_t size)
+{
+    xSemaphoreTake(s_permit, portMAX_DELAY);
+    int alive = frames_alive();
+    s_most_alive = alive > s_most_alive ? alive : s_most_alive;
+    memset(dst, 0x5a, size);
+    return size;
+}
+
+// waits up to a second for the broadcaster task to get to alive frames
+static bool wait_alive(int alive)
+{
+    for (int i = 0; i < 100 && frames_alive() != alive; i++) {
+        vTaskDelay(10 / portTICK_RATE_MS);
+    }
+    return frames_alive() == alive;
+}
+
+static int queue_len(const bcast_sub_t* sub)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int len = sub->queue_len;
+    xSemaphoreGive(s_lock);
+    return len;
+}
+
+// the same for a subscriber's queue
+static bool wait_queue_len(const bcast_sub_t* sub, int len)
+{
+    for (int i = 0; i < 100 && queue_len(sub) != len; i++) {
+        vTaskDelay(10 / portTICK_RATE_MS);
+    }
+    return queue_len(sub) == len;
+}
+
+// everybody left: a frame still being rendered goes nowhere and is freed
+static void drain()
+{
+    const int alive = frames_alive();
+    CHECK(alive <= 1);
+    if (alive == 1) {
+        xSemaphoreGive(s_permit);
+    }
+    CHECK(wait_alive(0));
+}
+
+static void test_lagging_subscriber()
+{
+    bcast_sub_t lagging, eager;
+    CHECK_EQ(broadcaster_subscribe(&lagging), ESP_OK);
+    CHECK_EQ(broadcaster_subscribe(&eager), ESP_OK);
+    CHECK_EQ(broadcaster_subscriber_count(), 2);
+
+    // eager takes every frame as it comes, lagging never asks for one
+    int received = 0;
+    for (uint32_t seq = 1; seq <= FRAMES; seq++) {
+        xSemaphoreGive(s_permit);
+        if (!broadcaster_next(&eager, WAIT_TICKS)) {
+            break;
+        }
+        CHECK_EQ(eager.frame->seq, seq);
+        CHECK_EQ(eager.frame->len, 64);
+        CHECK_EQ(eager.frame->data[63], 0x5a);
+        received++;
+        broadcaster_done(&eager);
+        CHECK(frames_alive() <= MAX_FRAMES);
+    }
+    CHECK_EQ(received, FRAMES);
+    CHECK_EQ(eager.frames_sent, FRAMES);
+    CHECK_EQ(eager.frames_skipped, 0);
+
+    // the lagging queue holds the newest frames, everything before was dropped
+    CHECK_EQ(lagging.queue_len, QUEUE_DEPTH);
+    for (int i = 0; i < QUEUE_DEPTH; i++) {
+        CHECK(broadcaster_next(&lagging, WAIT_TICKS));
+        CHECK_EQ(lagging.frame->seq, FRAMES - QUEUE_DEPTH + 1 + i);
+        broadcaster_done(&lagging);
+    }
+    CHECK_EQ(lagging.frames_skipped, FRAMES - QUEUE_DEPTH);
+    CHECK_EQ(lagging.frames_sent, QUEUE_DEPTH);
+    CHECK(!broadcaster_next(&lagging, 1));
+
+    broadcaster_unsubscribe(&lagging);
+    broadcaster_unsubscribe(&eager);
+    CHECK_EQ(broadcaster_subscriber_count(), 0);
+    CHECK(s_most_alive <= MAX_FRAMES);
+    CHECK(s_most_alive > 1);
+    drain();
+}
+
+static void test_unsubscribe_frees()
+{
+    bcast_sub_t sub;
+    CHECK_EQ(broadcaster_subscribe(&sub), ESP_OK);
+    for (int i = 0; i < QUEUE_DEPTH + 1; i++) {
+        xSemaphoreGive(s_permit);
+    }
+    // one frame held while sending, a full queue behind it
+    CHECK(broadcaster_next(&sub, WAIT_TICKS));
+    CHECK(wait_queue_len(&sub, QUEUE_DEPTH));
+    CHECK_EQ(frames_alive(), MAX_FRAMES);
+    CHECK(sub.frame != NULL);
+    broadcaster_unsubscribe(&sub);
+    CHECK_EQ(frames_alive(), 0);
+    CHECK(s_most_alive <= MAX_FRAMES);
+}
+
+/*
+ * A subscriber holding an old frame while another's queue is full uses
+ * up every frame there may be. One joining then must not push the count
+ * over the limit: waiting frames are dropped to make room, the one being
+ * sent is not.
+ */
+static void test_make_room()
+{
+    bcast_sub_t lagging, holding, joining;
+    CHECK_EQ(broadcaster_subscribe(&lagging), ESP_OK);
+    CHECK_EQ(broadcaster_subscribe(&holding), ESP_OK);
+    const uint32_t base = holding.last_seq;
+    xSemaphoreGive(s_permit);
+    CHECK(broadcaster_next(&holding, WAIT_TICKS));
+    CHECK_EQ(holding.frame->seq, base + 1);
+    xSemaphoreGive(s_permit);
+    xSemaphoreGive(s_permit);
+    CHECK(wait_queue_len(&holding, QUEUE_DEPTH));
+    CHECK_EQ(frames_alive(), MAX_FRAMES);
+
+    // base + 2 goes from both queues for base + 4
+    CHECK_EQ(broadcaster_subscribe(&joining), ESP_OK);
+    xSemaphoreGive(s_permit);
+    CHECK(broadcaster_next(&joining, WAIT_TICKS));
+    CHECK_EQ(joining.frame->seq, base + 4);
+    // joining has room again, base + 3 goes for the frame after
+    CHECK(wait_queue_len(&holding, 1));
+    CHECK_EQ(frames_alive(), MAX_FRAMES);
+    CHECK(s_most_alive <= MAX_FRAMES);
+    // the frames being sent stayed
+    CHECK_EQ(holding.frame->seq, base + 1);
+    CHECK_EQ(holding.frame->data[0], 0x5a);
+    CHECK_EQ(joining.frame->data[0], 0x5a);
+    broadcaster_done(&holding);
+    CHECK(broadcaster_next(&holding, WAIT_TICKS));
+    CHECK_EQ(holding.frame->seq, base + 4);
+    CHECK_EQ(holding.frames_skipped, 2);
+    broadcaster_done(&holding);
+    broadcaster_done(&joining);
+
+    broadcaster_unsubscribe(&lagging);
+    broadcaster_unsubscribe(&holding);
+    broadcaster_unsubscribe(&joining);
+    drain();
+}
+
+int main()
+{
+    s_permit = xSemaphoreCreateCounting(FRAMES, 0);
+    CHECK(s_permit != NULL);
+    CHECK_EQ(broadcaster_init(64, 1, QUEUE_DEPTH, &render), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(broadcaster_init(64, MAX_FRAMES, BCAST_QUEUE_MAX + 1, &render), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(broadcaster_init(64, MAX_FRAMES, QUEUE_DEPTH, &render), ESP_OK);
+    test_lagging_subscriber();
+    test_make_room();
+    test_unsubscribe_frees();
+    printf("%d checks, %d failed\n", s_checks, s_failed);
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * The HTTP server of the firmware on the host.
+ *
+ *   ./http_host [-p port] [-m model] [-r fps] [-s WxH] [-t seconds] [-v level]
+ *
+ * main/app_main.c and the modules it serves with are built unchanged
+ * against host/shim: FreeRTOS on threads, netconn on POSIX sockets and a
+ * synthetic camera of the given model (7670 or 7725 for RGB565 bitmaps,
+ * 2640 for JPEG) running at fps frames per second. The server listens on
+ * 127.0.0.1:port, default 8080, until interrupted or for the given time,
+ * then prints the CPU time it took. See loadgen.c to put it under load.
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "esp_log.h"
+#include "lwip/api.h"
+#include "host_shim.h"
+
+void app_main();
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double tv_sec(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+int main(int argc, char** argv)
+{
+    int port = 8080;
+    int seconds = 0;
+    int level = ESP_LOG_WARN;
+    synth_camera_config_t camera = { .model = CAMERA_OV7670, .fps = 25 };
+    int opt;
+    while ((opt = getopt(argc, argv, "p:m:r:s:t:v:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'm':
+            camera.model = (camera_model_t) atoi(optarg);
+            break;
+        case 'r':
+            camera.fps = atoi(optarg);
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &camera.width, &camera.height) != 2 ||
+                camera.width <= 0 || camera.height <= 0 || camera.width % 16 || camera.height % 8) {
+                fprintf(stderr, "bad size %s, width a multiple of 16 and height of 8\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'v':
+            level = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-m 7670|7725|2640] [-r fps] [-s WxH] [-t seconds] [-v level]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (camera.fps <= 0 || port <= 0 || port > 65535) {
+        fprintf(stderr, "bad frame rate or port\n");
+        return 1;
+    }
+
+    // the tasks inherit the mask, so only this thread takes the signals
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    sigaddset(&stop, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+    esp_log_level_set("*", (esp_log_level_t) level);
+    synth_camera_configure(&camera);
+    // the firmware binds port 80
+    netconn_port_offset = port - 80;
+    shim_task_adopt("main", true);
+    double start = now_sec();
+    app_main();
+    fprintf(stderr, "http_host: serving on http://127.0.0.1:%d/\n", port);
+
+    if (seconds > 0) {
+        alarm(seconds);
+    }
+    int sig;
+    sigwait(&stop, &sig);
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double wall = now_sec() - start;
+    double cpu = tv_sec(ru.ru_utime) + tv_sec(ru.ru_stime);
+    printf("http_host: %.1f s, cpu %.2f s user, %.2f s system, %.1f%% of one core\n",
+           wall, tv_sec(ru.ru_utime), tv_sec(ru.ru_stime), 100.0 * cpu / wall);
+    return 0;
+}
@@ -0,0 +1,235 @@
+// Unit tests for the incremental HTTP request parser of main/, run on the host:
+//
+//   make -C host test
+//
+// Requests are fed byte by byte, the way split netbufs hand them over, as
+// well as in one piece. Prints every failed check and exits non-zero if
+// there was one.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "http_parser.h"
+
+static int s_checks;
+static int s_failed;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) check_eq((long) (a), (long) (b), #a, #b, __FILE__, __LINE__)
+#define CHECK_STR(a, b) check_str((a), (b), #a, __FILE__, __LINE__)
+
+static void check(int ok, const char* what, const char* file, int line)
+{
+    s_checks++;
+    if (!ok) {
+        s_failed++;
+        printf("%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+static void check_eq(long a, long b, const char* sa, const char* sb, const char* file, int line)
+{
+    s_checks++;
+    if (a != b) {
+        s_failed++;
+        printf("%s:%d: %s == %s failed: %ld != %ld\n", file, line, sa, sb, a, b);
+    }
+}
+
+static void check_str(const char* a, const char* b, const char* sa, const char* file, int line)
+{
+    s_checks++;
+    if (strcmp(a, b) != 0) {
+        s_failed++;
+        printf("%s:%d: %s is \"%s\", expected \"%s\"\n", file, line, sa, a, b);
+    }
+}
+
+/*
+ * Parses one request from text, in pieces of step bytes. Returns the
+ * result of the last call and sets *used to the bytes consumed in all.
+ */
+static http_parse_result_t parse(http_request_t* req, const char* text, size_t len, size_t step, size_t* used)
+{
+    http_parse_result_t result = HTTP_PARSE_MORE;
+    size_t pos = 0;
+    http_request_init(req);
+    while (pos < len && result == HTTP_PARSE_MORE) {
+        size_t n = (len - pos < step) ? len - pos : step;
+        size_t consumed;
+        result = http_request_parse(req, text + pos, n, &consumed);
+        pos += consumed;
+        if (result == HTTP_PARSE_MORE && consumed != n) {
+            printf("parser left %d of %d bytes without being done\n", (int) (n - consumed), (int) n);
+            return HTTP_PARSE_ERROR;
+        }
+    }
+    *used = pos;
+    return result;
+}
+
+// parses a whole request both byte by byte and at once, returns the status on errors
+static int parse_status(const char* text)
+{
+    http_request_t req;
+    size_t used;
+    http_parse_result_t split = parse(&req, text, strlen(text), 1, &used);
+    int split_status = (split == HTTP_PARSE_ERROR) ? req.status : (split == HTTP_PARSE_DONE) ? 200 : 0;
+    http_parse_result_t whole = parse(&req, text, strlen(text), strlen(text), &used);
+    int whole_status = (whole == HTTP_PARSE_ERROR) ? req.status : (whole == HTTP_PARSE_DONE) ? 200 : 0;
+    CHECK_EQ(split_status, whole_status);
+    return split_status;
+}
+
+static void test_request()
+{
+    static const char text[] =
+        "GET /stream?fps=5&format=auto HTTP/1.1\r\n"
+        "Host: 192.168.4.1\r\n"
+        "IF-NONE-MATCH:   \"f12-ab\"  \r\n"
+        "X-Unknown: skipped\r\n"
+        "Connection: Upgrade, Keep-Alive\r\n"
+        "\r\n";
+    for (size_t step = 1; step <= sizeof(text); step += 7) {
+        http_request_t req;
+        size_t used;
+        CHECK_EQ(parse(&req, text, sizeof(text) - 1, step, &used), HTTP_PARSE_DONE);
+        CHECK_EQ(used, sizeof(text) - 1);
+        CHECK_STR(req.method, "GET");
+        CHECK_STR(req.path, "/stream");
+        CHECK_STR(req.query, "fps=5&format=auto");
+        CHECK_EQ(req.version_minor, 1);
+        CHECK(req.keep_alive);
+        CHECK_STR(http_request_header(&req, HTTP_HDR_IF_NONE_MATCH), "\"f12-ab\"");
+        CHECK_STR(http_request_header(&req, HTTP_HDR_CONTENT_LENGTH), "");
+        CHECK(http_header_has_token(&req, HTTP_HDR_CONNECTION, "upgrade"));
+        CHECK(!http_header_has_token(&req, HTTP_HDR_CONNECTION, "close"));
+    }
+
+    // bare LF line ends and leading blank lines are taken too
+    http_request_t req;
+    size_t used;
+    static const char lf[] = "\r\n\nHEAD /bmp HTTP/1.0\nConnection: keep-alive\n\n";
+    CHECK_EQ(parse(&req, lf, sizeof(lf) - 1, 1, &used), HTTP_PARSE_DONE);
+    CHECK_STR(req.method, "HEAD");
+    CHECK_STR(req.path, "/bmp");
+    CHECK_EQ(req.version_minor, 0);
+    CHECK(req.keep_alive);
+}
+
+static void test_keep_alive()
+{
+    http_request_t req;
+    size_t used;
+    static const char* const cases[][2] = {
+        { "GET / HTTP/1.1\r\n\r\n", "1" },
+        { "GET / HTTP/1.1\r\nConnection: close\r\n\r\n", "0" },
+        { "GET / HTTP/1.0\r\n\r\n", "0" },
+        { "GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", "1" },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        CHECK_EQ(parse(&req, cases[i][0], strlen(cases[i][0]), 1, &used), HTTP_PARSE_DONE);
+        CHECK_EQ(req.keep_alive, cases[i][1][0] == '1');
+    }
+}
+
+static void test_pipelining()
+{
+    // a POST with a body, then a GET, arriving in one piece
+    static const char text[] =
+        "POST /control HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world"
+        "GET /jpg?quality=30 HTTP/1.1\r\n\r\n";
+    const size_t first = strlen("POST /control HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world");
+    for (size_t step = 1; step <= sizeof(text); step += sizeof(text) / 3) {
+        http_request_t req;
+        size_t used;
+        CHECK_EQ(parse(&req, text, sizeof(text) - 1, step, &used), HTTP_PARSE_DONE);
+        CHECK_EQ(used, first);
+        CHECK_STR(req.method, "POST");
+        CHECK_STR(http_request_header(&req, HTTP_HDR_CONTENT_LENGTH), "11");
+        CHECK_EQ(parse(&req, text + used, sizeof(text) - 1 - used, step, &used), HTTP_PARSE_DONE);
+        CHECK_EQ(used, sizeof(text) - 1 - first);
+        CHECK_STR(req.path, "/jpg");
+        CHECK_EQ(http_query_int(&req, "quality", 0), 30);
+    }
+
+    // a request done in the middle of a piece leaves the rest unconsumed
+    http_request_t req;
+    size_t consumed;
+    http_request_init(&req);
+    CHECK_EQ(http_request_parse(&req, text, sizeof(text) - 1, &consumed), HTTP_PARSE_DONE);
+    CHECK_EQ(consumed, first);
+    // and a body split over pieces is waited for
+    http_request_init(&req);
+    CHECK_EQ(http_request_parse(&req, text, first - 4, &consumed), HTTP_PARSE_MORE);
+    CHECK_EQ(consumed, first - 4);
+    CHECK_EQ(http_request_parse(&req, text + first - 4, 4, &consumed), HTTP_PARSE_DONE);
+    CHECK_EQ(consumed, 4);
+}
+
+static void test_errors()
+{
+    char text[HTTP_HEAD_MAX + 256];
+
+    CHECK_EQ(parse_status("GET / HTTP/1.1\r\n\r\n"), 200);
+    CHECK_EQ(parse_status("GET / HTTP/1.1\r\nHost: x"), 0);
+    CHECK_EQ(parse_status("get / HTTP/1.1\r\n\r\n"), 501);
+    CHECK_EQ(parse_status(" / HTTP/1.1\r\n\r\n"), 400);
+    CHECK_EQ(parse_status("GET /\r\n\r\n"), 400);
+    CHECK_EQ(parse_status("GET bmp HTTP/1.1\r\n\r\n"), 400);
+    CHECK_EQ(parse_status("GET / HTTP/2.0\r\n\r\n"), 505);
+    CHECK_EQ(parse_status("GET / HTTP/1.1\rX\r\n\r\n"), 400);
+    CHECK_EQ(parse_status("GET / HTTP/1.1\r\nNoColon\r\n\r\n"), 400);
+    CHECK_EQ(parse_status("POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n"), 400);
+    CHECK_EQ(parse_status("POST / HTTP/1.1\r\nContent-Length: 12x\r\n\r\n"), 400);
+
+    // the longest path and query that fit, and one byte more
+    int n = snprintf(text, sizeof(text), "GET /%0*d HTTP/1.1\r\n\r\n", HTTP_PATH_MAX - 2, 0);
+    CHECK(n > 0);
+    CHECK_EQ(parse_status(text), 200);
+    snprintf(text, sizeof(text), "GET /%0*d HTTP/1.1\r\n\r\n", HTTP_PATH_MAX - 1, 0);
+    CHECK_EQ(parse_status(text), 414);
+    snprintf(text, sizeof(text), "GET /?q=%0*d HTTP/1.1\r\n\r\n", HTTP_QUERY_MAX - 3, 0);
+    CHECK_EQ(parse_status(text), 200);
+    snprintf(text, sizeof(text), "GET /?q=%0*d HTTP/1.1\r\n\r\n", HTTP_QUERY_MAX - 2, 0);
+    CHECK_EQ(parse_status(text), 414);
+
+    // headers beyond HTTP_HEAD_MAX are refused, long values of kept ones are cut
+    size_t len = (size_t) snprintf(text, sizeof(text), "GET / HTTP/1.1\r\n");
+    while (len < HTTP_HEAD_MAX) {
+        len += (size_t) snprintf(text + len, sizeof(text) - len, "X-Filler: %0*d\r\n", 40, 0);
+    }
+    snprintf(text + len, sizeof(text) - len, "\r\n");
+    CHECK_EQ(parse_status(text), 431);
+    snprintf(text, sizeof(text), "GET / HTTP/1.1\r\nIf-None-Match: %0*d\r\n\r\n", 200, 0);
+    http_request_t req;
+    size_t used;
+    CHECK_EQ(parse(&req, text, strlen(text), 1, &used), HTTP_PARSE_DONE);
+    CHECK_EQ(strlen(http_request_header(&req, HTTP_HDR_IF_NONE_MATCH)), HTTP_HEADER_VALUE_MAX - 1);
+}
+
+static void test_query()
+{
+    char value[16];
+    CHECK(http_params_get("a=1&name=x%41y+z&flag", "name", value, sizeof(value)));
+    CHECK_STR(value, "xAy z");
+    CHECK(http_params_get("a=1&name=x%41y+z&flag", "flag", value, sizeof(value)));
+    CHECK_STR(value, "");
+    CHECK(!http_params_get("a=1&name=2", "nam", value, sizeof(value)));
+    CHECK(http_params_get("long=0123456789abcdefghij", "long", value, 8));
+    CHECK_STR(value, "0123456");
+    CHECK_EQ(http_params_int("fps=12&q=abc", "fps", 5), 12);
+    CHECK_EQ(http_params_int("fps=12&q=abc", "q", 5), 5);
+    CHECK_EQ(http_params_int("fps=12&q=abc", "wait", -1), -1);
+    CHECK_EQ(http_params_int("fps=", "fps", 7), 7);
+}
+
+int main()
+{
+    test_request();
+    test_keep_alive();
+    test_pipelining();
+    test_errors();
+    test_query();
+    printf("%d checks, %d failed\n", s_checks, s_failed);
+    return s_failed ? 1 : 0;
+}
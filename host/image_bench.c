@@ -0,0 +1,249 @@
+// Micro-benchmarks of the image kernels in libcamimg.a on the host.
+//
+//   ./host/image_bench [-s WxH] [-t seconds] [name...]
+//
+// Each kernel runs over a synthetic frame for a while and reports frames
+// and megapixels per second. Names select kernels by prefix, all run by
+// default. Absolute numbers say little about the ESP32, but a change to a
+// kernel shows up here in seconds.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bitmap.h"
+#include "image_convert.h"
+#include "jpeg_encoder.h"
+#include "qoi_encoder.h"
+#include "cr_codec.h"
+
+typedef struct {
+    int width;
+    int height;
+    uint32_t* fb;           // framebuffer words, two pixels each
+    uint16_t* rgb;          // converted frame
+    uint8_t* gray;
+    uint16_t* out;
+    size_t bytes;           // output of the encoders
+} frame_t;
+
+typedef void (*kernel_t)(frame_t* f);
+
+static double s_seconds = 0.5;
+// results nobody reads, so the compiler keeps the work
+static volatile uint32_t s_sink;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int count_bytes(void* arg, const uint8_t* data, size_t len)
+{
+    ((frame_t*) arg)->bytes += len;
+    return 0;
+}
+
+static void k_yuv422(frame_t* f)
+{
+    for (int y = 0; y < f->height; y++) {
+        image_yuv422_line_to_rgb565(f->fb + y * f->width / 2, (uint8_t*) f->out, f->width);
+    }
+}
+
+static void k_fb_rgb565(frame_t* f)
+{
+    for (int y = 0; y < f->height; y++) {
+        image_fb_rgb565_line_to_rgb565(f->fb + y * f->width / 2, (uint8_t*) f->out, f->width);
+    }
+}
+
+static void k_gray(frame_t* f)
+{
+    for (int y = 0; y < f->height; y++) {
+        image_gray_line_to_rgb565(f->gray + y * f->width, f->out, f->width);
+    }
+}
+
+static void k_scale(frame_t* f)
+{
+    // to 3/4 size, as an odd ratio
+    const int w = f->width * 3 / 4, h = f->height * 3 / 4;
+    for (int y = 0; y < h; y++) {
+        int sy = image_scale_src_line(y, f->height, h);
+        image_scale_rgb565_line(f->rgb + sy * f->width, f->width, f->out, w);
+    }
+}
+
+static void k_half(frame_t* f)
+{
+    for (int y = 0; y + 1 < f->height; y += 2) {
+        image_half_rgb565_line(f->rgb + y * f->width, f->rgb + (y + 1) * f->width, f->out, f->width);
+    }
+}
+
+static void k_stats(frame_t* f)
+{
+    image_stats_t stats;
+    image_stats_init(&stats);
+    for (int y = 0; y < f->height; y++) {
+        image_stats_rgb565_line(&stats, f->rgb + y * f->width, f->width);
+    }
+    s_sink = image_stats_mean(&stats);
+}
+
+static void k_jpeg(frame_t* f)
+{
+    jpeg_encoder_t enc;
+    jpeg_enc_start(&enc, f->width, f->height, JPEG_INPUT_FB_RGB565, 50, &count_bytes, f);
+    for (int y = 0; y < f->height; y += JPEG_MCU_LINES) {
+        jpeg_enc_strip(&enc, (const uint8_t*) (f->fb + y * f->width / 2), JPEG_MCU_LINES, f->width * 2);
+    }
+    jpeg_enc_finish(&enc);
+}
+
+static void k_qoi(frame_t* f)
+{
+    qoi_encoder_t enc;
+    qoi_enc_start(&enc, f->width, f->height, QOI_INPUT_RGB565, &count_bytes, f);
+    for (int y = 0; y < f->height; y++) {
+        qoi_enc_line(&enc, f->rgb + y * f->width);
+    }
+    qoi_enc_finish(&enc);
+}
+
+static void k_cr(frame_t* f)
+{
+    // every frame a keyframe, the worst case
+    cr_encoder_t enc;
+    if (cr_enc_init(&enc, f->width, f->height, 8, 6, 0) != 0) {
+        return;
+    }
+    cr_enc_begin(&enc, 0, &count_bytes, f);
+    for (int y = 0; y + 8 <= f->height; y += 8) {
+        cr_enc_rows(&enc, f->rgb + y * f->width, f->width);
+    }
+    cr_enc_end(&enc);
+    cr_enc_free(&enc);
+}
+
+static const struct {
+    const char* name;
+    kernel_t kernel;
+} s_kernels[] = {
+    { "yuv422_to_rgb565", &k_yuv422 },
+    { "fb_rgb565_to_rgb565", &k_fb_rgb565 },
+    { "gray_to_rgb565", &k_gray },
+    { "scale_3_4", &k_scale },
+    { "half", &k_half },
+    { "stats", &k_stats },
+    { "jpeg_q50", &k_jpeg },
+    { "qoi", &k_qoi },
+    { "cr_keyframe", &k_cr },
+};
+
+static void run(const char* name, kernel_t kernel, frame_t* f)
+{
+    int frames = 0;
+    double start = now_sec(), elapsed;
+    f->bytes = 0;
+    do {
+        kernel(f);
+        frames++;
+        elapsed = now_sec() - start;
+    } while (elapsed < s_seconds);
+    printf("%-20s %4dx%-4d %9.1f fps %8.1f Mpx/s", name, f->width, f->height,
+           frames / elapsed, (double) f->width * f->height * frames / elapsed / 1e6);
+    if (f->bytes > (size_t) frames) {
+        printf("  %7zu bytes/frame", f->bytes / frames);
+    }
+    printf("\n");
+}
+
+// a gradient with some noise, compresses like a sensor image
+static void frame_init(frame_t* f, int w, int h)
+{
+    f->width = w;
+    f->height = h;
+    f->fb = malloc((size_t) w * h * 2);
+    f->rgb = malloc((size_t) w * h * 2);
+    f->gray = malloc((size_t) w * h);
+    f->out = malloc((size_t) w * 2);
+    srand(1);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int n = rand() % 9 - 4;
+            int r = x * 255 / w + n, g = y * 255 / h + n, b = 128 + n;
+            r = r < 0 ? 0 : r > 255 ? 255 : r;
+            g = g < 0 ? 0 : g > 255 ? 255 : g;
+            f->rgb[y * w + x] = image_rgb565(r, g, b);
+            f->gray[y * w + x] = g;
+        }
+    }
+    // the framebuffer holds the pixel pairs as the DMA filter leaves them
+    for (int i = 0; i < w * h / 2; i++) {
+        uint16_t p0 = f->rgb[2 * i], p1 = f->rgb[2 * i + 1];
+        f->fb[i] = ((uint32_t) (p1 >> 8) << 0) | ((uint32_t) (p1 & 0xff) << 8) |
+                   ((uint32_t) (p0 >> 8) << 16) | ((uint32_t) (p0 & 0xff) << 24);
+    }
+}
+
+static void frame_free(frame_t* f)
+{
+    free(f->fb);
+    free(f->rgb);
+    free(f->gray);
+    free(f->out);
+}
+
+static int selected(int argc, char** argv, int first, const char* name)
+{
+    if (first >= argc) {
+        return 1;
+    }
+    for (int i = first; i < argc; i++) {
+        if (strncmp(name, argv[i], strlen(argv[i])) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int w = 0, h = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0 || w % 16 || h % 8) {
+                fprintf(stderr, "bad size %s, width a multiple of 16 and height of 8\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            s_seconds = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-s WxH] [-t seconds] [name...]\n", argv[0]);
+            return 1;
+        }
+    }
+    static const int sizes[][2] = { { 160, 120 }, { 640, 480 } };
+    for (int s = 0; s < 2; s++) {
+        frame_t f;
+        if (w) {
+            if (s > 0) {
+                break;
+            }
+            frame_init(&f, w, h);
+        } else {
+            frame_init(&f, sizes[s][0], sizes[s][1]);
+        }
+        for (size_t k = 0; k < sizeof(s_kernels) / sizeof(s_kernels[0]); k++) {
+            if (selected(argc, argv, i, s_kernels[k].name)) {
+                run(s_kernels[k].name, s_kernels[k].kernel, &f);
+            }
+        }
+        frame_free(&f);
+    }
+    return 0;
+}
@@ -0,0 +1,885 @@
+// Unit tests for the image code in libcamimg.a, run on the host:
+//
+//   make -C host test
+//
+// Prints every failed check and exits non-zero if there was one.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bitmap.h"
+#include "image_convert.h"
+#include "jpeg_encoder.h"
+#include "qoi_encoder.h"
+#include "cr_codec.h"
+#include "stream_adapt.h"
+#include "rate_ctrl.h"
+
+static int s_checks;
+static int s_failed;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) check_eq((long) (a), (long) (b), #a, #b, __FILE__, __LINE__)
+
+static void check(int ok, const char* what, const char* file, int line)
+{
+    s_checks++;
+    if (!ok) {
+        s_failed++;
+        printf("%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+static void check_eq(long a, long b, const char* sa, const char* sb, const char* file, int line)
+{
+    s_checks++;
+    if (a != b) {
+        s_failed++;
+        printf("%s:%d: %s == %s failed: %ld != %ld (0x%lx != 0x%lx)\n", file, line, sa, sb, a, b, a, b);
+    }
+}
+
+typedef struct {
+    uint8_t data[8192];
+    size_t len;
+} buffer_t;
+
+static int buffer_write(void* arg, const uint8_t* data, size_t len)
+{
+    buffer_t* buf = (buffer_t*) arg;
+    if (buf->len + len > sizeof(buf->data)) {
+        return -1;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+static uint32_t le32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void test_pixels()
+{
+    CHECK_EQ(image_rgb565(255, 255, 255), 0xffff);
+    CHECK_EQ(image_rgb565(255, 0, 0), 0xf800);
+    CHECK_EQ(image_rgb565(0, 255, 0), 0x07e0);
+    CHECK_EQ(image_rgb565(0, 0, 255), 0x001f);
+    CHECK_EQ(image_gray_to_rgb565(0), 0);
+    CHECK_EQ(image_gray_to_rgb565(255), 0xffff);
+    // BT.601 studio swing: 16 is black, 235 is white
+    CHECK_EQ(image_yuv_to_rgb565(16, 128, 128), 0);
+    CHECK_EQ(image_yuv_to_rgb565(235, 128, 128), 0xffff);
+    CHECK_EQ(image_yuv_to_rgb565(0, 128, 128), 0);
+    CHECK_EQ(image_yuv_to_rgb565(82, 90, 240) >> 11, 31);      // red
+}
+
+static void test_lines()
+{
+    // Y0 V Y1 U from the least significant byte
+    const uint32_t yuv[2] = { (128u << 24) | (16 << 16) | (128 << 8) | 235, 0x80108010 };
+    uint8_t out[8];
+    image_yuv422_line_to_rgb565(yuv, out, 4);
+    CHECK_EQ(out[0], 0xff);
+    CHECK_EQ(out[1], 0xff);
+    CHECK_EQ(out[2], 0x00);
+    CHECK_EQ(out[3], 0x00);
+    CHECK_EQ(out[4] | out[6], 0);
+
+    // the sensor's byte pairs come swapped within the word
+    const uint32_t rgb[1] = { 0x44332211 };
+    image_fb_rgb565_line_to_rgb565(rgb, out, 2);
+    CHECK_EQ(out[0], 0x44);
+    CHECK_EQ(out[1], 0x33);
+    CHECK_EQ(out[2], 0x22);
+    CHECK_EQ(out[3], 0x11);
+    // unaligned destination
+    image_fb_rgb565_line_to_rgb565(rgb, out + 1, 2);
+    CHECK_EQ(out[1], 0x44);
+    CHECK_EQ(out[4], 0x11);
+
+    const uint8_t gray[3] = { 0, 128, 255 };
+    uint16_t px[3];
+    image_gray_line_to_rgb565(gray, px, 3);
+    CHECK_EQ(px[0], 0);
+    CHECK_EQ(px[1], image_rgb565(128, 128, 128));
+    CHECK_EQ(px[2], 0xffff);
+
+    uint8_t back[3];
+    image_rgb565_line_to_gray(px, back, 3);
+    CHECK_EQ(back[0], 0);
+    CHECK(back[1] >= 126 && back[1] <= 130);
+    CHECK_EQ(back[2], 255);
+}
+
+static void test_scale()
+{
+    const uint16_t src[4] = { 1, 2, 3, 4 };
+    uint16_t dst[8];
+    image_scale_rgb565_line(src, 4, dst, 4);
+    CHECK(memcmp(src, dst, sizeof(src)) == 0);
+    image_scale_rgb565_line(src, 4, dst, 2);
+    CHECK_EQ(dst[0], 2);
+    CHECK_EQ(dst[1], 4);
+    image_scale_rgb565_line(src, 4, dst, 8);
+    CHECK_EQ(dst[0], 1);
+    CHECK_EQ(dst[1], 1);
+    CHECK_EQ(dst[7], 4);
+    image_scale_rgb565_line(src, 4, dst, 3);
+    CHECK_EQ(dst[0], 1);
+    CHECK_EQ(dst[2], 4);
+
+    CHECK_EQ(image_scale_src_line(0, 120, 120), 0);
+    CHECK_EQ(image_scale_src_line(119, 120, 120), 119);
+    CHECK_EQ(image_scale_src_line(0, 120, 60), 1);
+    CHECK_EQ(image_scale_src_line(59, 120, 60), 119);
+    CHECK_EQ(image_scale_src_line(239, 120, 240), 119);
+
+    const uint16_t white[2] = { 0xffff, 0xffff };
+    const uint16_t black[2] = { 0, 0 };
+    const uint16_t mixed[2] = { 0xffff, 0 };
+    image_half_rgb565_line(white, white, dst, 2);
+    CHECK_EQ(dst[0], 0xffff);
+    image_half_rgb565_line(black, black, dst, 2);
+    CHECK_EQ(dst[0], 0);
+    image_half_rgb565_line(mixed, mixed, dst, 2);
+    CHECK_EQ(dst[0] >> 11, 16);
+    CHECK_EQ((dst[0] >> 5) & 0x3f, 32);
+}
+
+static void test_pack()
+{
+    const uint16_t rgb[3] = { image_rgb565(0xf0, 0x80, 0x10), image_rgb565(0x20, 0x40, 0xff), 0xffff };
+    uint8_t out[8];
+    memset(out, 0xaa, sizeof(out));
+    image_rgb565_line_to_rgb444(rgb, out, 3);
+    CHECK_EQ(out[0], 0xf8);
+    CHECK_EQ(out[1], 0x12);
+    CHECK_EQ(out[2], 0x4f);
+    CHECK_EQ(out[3], 0xff);
+    CHECK_EQ(out[4], 0xf0);
+    CHECK_EQ(out[5], 0xaa);
+
+    // black and white stay solid, mid gray dithers to a mix of the two levels around it
+    uint8_t gray[8];
+    memset(gray, 255, sizeof(gray));
+    image_gray_line_to_packed(gray, out, 8, 4, 0);
+    CHECK_EQ(out[0], 0xff);
+    CHECK_EQ(out[3], 0xff);
+    image_gray_line_to_packed(gray, out, 8, 2, 1);
+    CHECK_EQ(out[0], 0xff);
+    CHECK_EQ(out[1], 0xff);
+    memset(gray, 0, sizeof(gray));
+    image_gray_line_to_packed(gray, out, 8, 2, 0);
+    CHECK_EQ(out[0] | out[1], 0);
+    int ones = 0;
+    for (int y = 0; y < 4; y++) {
+        memset(gray, 128, sizeof(gray));
+        image_gray_line_to_packed(gray, out, 4, 2, y);
+        for (int x = 0; x < 4; x++) {
+            int v = (out[0] >> (6 - 2 * x)) & 3;
+            CHECK(v == 1 || v == 2);
+            ones += v == 2;
+        }
+    }
+    CHECK_EQ(ones, 8);
+
+    const uint8_t line[10] = { 0, 200, 99, 100, 255, 0, 0, 0, 100, 0 };
+    image_gray_line_to_bilevel(line, out, 10, 100);
+    CHECK_EQ(out[0], 0x58);
+    CHECK_EQ(out[1], 0x80);
+
+    // two peaks, the threshold falls between them
+    uint32_t hist[256] = { 0 };
+    hist[30] = 500;
+    hist[40] = 300;
+    hist[200] = 400;
+    hist[220] = 100;
+    int t = image_otsu_threshold(hist, 256);
+    CHECK(t > 40 && t <= 200);
+    uint32_t coarse[IMAGE_HISTOGRAM_BINS] = { 0 };
+    coarse[2] = 10;
+    coarse[12] = 10;
+    t = image_otsu_threshold(coarse, IMAGE_HISTOGRAM_BINS);
+    CHECK(t > 2 * 16 && t <= 12 * 16);
+}
+
+static void test_stats()
+{
+    image_stats_t stats;
+    image_stats_init(&stats);
+    CHECK_EQ(image_stats_mean(&stats), 0);
+    const uint8_t gray[4] = { 0, 255, 100, 101 };
+    image_stats_gray_line(&stats, gray, 4);
+    CHECK_EQ(stats.pixels, 4);
+    CHECK_EQ(stats.luma_min, 0);
+    CHECK_EQ(stats.luma_max, 255);
+    CHECK_EQ(image_stats_mean(&stats), 114);
+    CHECK_EQ(stats.histogram[0], 1);
+    CHECK_EQ(stats.histogram[6], 2);
+    CHECK_EQ(stats.histogram[15], 1);
+
+    const uint16_t rgb[3] = { 0xffff, 0, image_rgb565(128, 128, 128) };
+    image_stats_init(&stats);
+    image_stats_rgb565_line(&stats, rgb, 3);
+    CHECK_EQ(stats.luma_max, 255);
+    CHECK_EQ(stats.luma_min, 0);
+    CHECK(stats.histogram[8] == 1 || stats.histogram[7] == 1);
+}
+
+static void test_sig()
+{
+    enum { W = 64, H = 48 };
+    uint8_t line[W];
+    image_sig_builder_t b;
+    image_sig_t flat, noisy, object;
+    // flat gray, the same with +-1 noise, and with a bright 8x8 object
+    for (int pass = 0; pass < 3; pass++) {
+        image_sig_t* sig = pass == 0 ? &flat : pass == 1 ? &noisy : &object;
+        image_sig_init(&b, sig, W, H);
+        for (int y = 0; y < H; y += IMAGE_SIG_STEP) {
+            for (int x = 0; x < W; x++) {
+                line[x] = 100 + (pass == 1 ? (x + y) % 3 - 1 : 0);
+                if (pass == 2 && x >= 16 && x < 24 && y >= 8 && y < 16) {
+                    line[x] = 250;
+                }
+            }
+            image_sig_gray_line(&b, line, y);
+        }
+        image_sig_finish(&b);
+    }
+    CHECK_EQ(flat.cells[0][0], 100);
+    CHECK_EQ(flat.cells[IMAGE_SIG_ROWS - 1][IMAGE_SIG_COLS - 1], 100);
+    CHECK(image_sig_diff(&flat, &noisy) <= 1);
+    CHECK_EQ(image_sig_diff(&flat, &object), 150);
+    CHECK_EQ(image_sig_diff(&object, &object), 0);
+    // the FNV-1a test vector
+    CHECK_EQ(image_fnv1a(IMAGE_FNV_SEED, "a", 1), 0xe40c292c);
+
+    const uint16_t white[W] = { [0 ... W - 1] = 0xffff };
+    image_sig_init(&b, &flat, W, H);
+    image_sig_rgb565_line(&b, white, 0);
+    image_sig_finish(&b);
+    CHECK_EQ(flat.cells[0][0], 255);
+    CHECK_EQ(flat.cells[1][0], 0);
+}
+
+static void test_headers()
+{
+    size_t len;
+    // only prepared headers are there, lookups never add any
+    CHECK(image_header_get(IMAGE_HDR_BMP565, 160, 120, &len) == NULL);
+    CHECK_EQ(image_header_prepare(IMAGE_HDR_BMP565, 160, 120), 0);
+    CHECK_EQ(image_header_prepare(IMAGE_HDR_BMP565, 160, 120), 0);
+    CHECK_EQ(image_header_prepare(IMAGE_HDR_PGM, 160, 120), 0);
+    CHECK(image_header_get(IMAGE_HDR_BMP565, 80, 60, &len) == NULL);
+    const uint8_t* bmp = image_header_get(IMAGE_HDR_BMP565, 160, 120, &len);
+    CHECK(bmp != NULL);
+    CHECK_EQ(len, sizeof(bitmap565));
+    CHECK(memcmp(bmp, "BM", 2) == 0);
+    CHECK_EQ(le32(bmp + 2), len + 160 * 120 * 2);
+    CHECK_EQ(le32(bmp + 10), len);
+    CHECK_EQ(le32(bmp + 18), 160);
+    CHECK_EQ((int32_t) le32(bmp + 22), -120);
+    CHECK_EQ(bmp[28], 16);
+    CHECK_EQ(le32(bmp + 30), BI_BITFIELDS);
+    // the same blob comes back, it may be sent without copying
+    size_t len2;
+    CHECK(image_header_get(IMAGE_HDR_BMP565, 160, 120, &len2) == bmp);
+
+    const uint8_t* pgm = image_header_get(IMAGE_HDR_PGM, 160, 120, &len);
+    CHECK(pgm != NULL);
+    CHECK(len == 15 && memcmp(pgm, "P5 160 120 255\n", len) == 0);
+}
+
+/*
+ * Just enough of a baseline JPEG decoder to check what the encoder wrote:
+ * it reads the tables, walks the entropy coded data of every block and
+ * keeps the DC coefficients, which give the mean of each block.
+ */
+typedef struct {
+    uint8_t bits[17];           // number of codes of each length 1..16
+    uint8_t vals[256];
+} huff_table_t;
+
+typedef struct {
+    const uint8_t* data;
+    size_t len;
+    size_t pos;
+    int bit;                    // next bit of data[pos], 7 first
+    bool marker;                // ran into a marker, the entropy coded data ended
+} bit_reader_t;
+
+#define DEC_MAX_BLOCKS 64
+
+typedef struct {
+    int width;
+    int height;
+    int components;
+    int h[3];
+    int v[3];
+    int tq[3];
+    int td[3];
+    int ta[3];
+    uint8_t dqt[4][64];
+    huff_table_t dc[4];
+    huff_table_t ac[4];
+    int blocks[3];
+    int mean[3][DEC_MAX_BLOCKS];    // per component, in the order of the scan
+    bool eoi;
+} jpeg_dec_t;
+
+static int read_bit(bit_reader_t* br)
+{
+    if (br->marker || br->pos >= br->len) {
+        return 0;
+    }
+    if (br->bit == 7 && br->data[br->pos] == 0xff) {
+        if (br->pos + 1 < br->len && br->data[br->pos + 1] != 0) {
+            br->marker = true;
+            return 0;
+        }
+    }
+    int b = (br->data[br->pos] >> br->bit) & 1;
+    if (br->bit-- == 0) {
+        br->bit = 7;
+        // a stuffed zero follows every 0xff
+        br->pos += (br->data[br->pos] == 0xff) ? 2 : 1;
+    }
+    return b;
+}
+
+static int read_bits(bit_reader_t* br, int n)
+{
+    int v = 0;
+    while (n-- > 0) {
+        v = (v << 1) | read_bit(br);
+    }
+    return v;
+}
+
+static int huff_decode(bit_reader_t* br, const huff_table_t* t)
+{
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= 16; len++) {
+        code |= read_bit(br);
+        int count = t->bits[len];
+        if (code - first < count) {
+            return t->vals[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// a coefficient of size bits, negative ones have the top bit clear
+static int extend(int v, int size)
+{
+    return (size > 0 && v < (1 << (size - 1))) ? v - (1 << size) + 1 : v;
+}
+
+static bool decode_block(bit_reader_t* br, jpeg_dec_t* dec, int c, int* pred)
+{
+    int size = huff_decode(br, &dec->dc[dec->td[c]]);
+    if (size < 0 || size > 11 || dec->blocks[c] >= DEC_MAX_BLOCKS) {
+        return false;
+    }
+    *pred += extend(read_bits(br, size), size);
+    // the DC coefficient is 8 times the mean of the block, less 128
+    dec->mean[c][dec->blocks[c]++] = *pred * dec->dqt[dec->tq[c]][0] / 8 + 128;
+    for (int k = 1; k < 64; k++) {
+        int rs = huff_decode(br, &dec->ac[dec->ta[c]]);
+        if (rs < 0) {
+            return false;
+        }
+        if ((rs & 15) == 0) {
+            if (rs != 0xf0) {
+                break;
+            }
+            k += 15;
+            continue;
+        }
+        k += rs >> 4;
+        read_bits(br, rs & 15);
+    }
+    return !br->marker;
+}
+static int be16(const uint8_t* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+// decodes the block means of a baseline JPEG with 8 bit tables, false if it is not one
+static bool jpeg_decode_means(const uint8_t* data, size_t len, jpeg_dec_t* dec)
+{
+    memset(dec, 0, sizeof(*dec));
+    if (len < 4 || be16(data) != 0xffd8) {
+        return false;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= len) {
+        const int marker = be16(data + pos);
+        const int seg_len = be16(data + pos + 2);
+        const uint8_t* seg = data + pos + 4;
+        if ((marker & 0xff00) != 0xff00 || pos + 2 + seg_len > len) {
+            return false;
+        }
+        if (marker == 0xffdb) {
+            for (int i = 0; i + 65 <= seg_len - 2; i += 65) {
+                memcpy(dec->dqt[seg[i] & 3], seg + i + 1, 64);
+            }
+        } else if (marker == 0xffc4) {
+            for (int i = 0; i < seg_len - 2;) {
+                huff_table_t* t = (seg[i] >> 4) ? &dec->ac[seg[i] & 3] : &dec->dc[seg[i] & 3];
+                int count = 0;
+                for (int n = 1; n <= 16; n++) {
+                    t->bits[n] = seg[i + n];
+                    count += t->bits[n];
+                }
+                memcpy(t->vals, seg + i + 17, count);
+                i += 17 + count;
+            }
+        } else if (marker == 0xffc0) {
+            dec->height = be16(seg + 1);
+            dec->width = be16(seg + 3);
+            dec->components = seg[5];
+            for (int c = 0; c < dec->components && c < 3; c++) {
+                dec->h[c] = seg[7 + 3 * c] >> 4;
+                dec->v[c] = seg[7 + 3 * c] & 15;
+                dec->tq[c] = seg[8 + 3 * c] & 3;
+            }
+        } else if (marker == 0xffda) {
+            if (dec->components < 1 || dec->components > 3 || seg[0] != dec->components) {
+                return false;
+            }
+            int hmax = 1, vmax = 1;
+            for (int c = 0; c < dec->components; c++) {
+                dec->td[c] = seg[2 + 2 * c] >> 4;
+                dec->ta[c] = seg[2 + 2 * c] & 15;
+                hmax = dec->h[c] > hmax ? dec->h[c] : hmax;
+                vmax = dec->v[c] > vmax ? dec->v[c] : vmax;
+            }
+            // one component is not interleaved, its MCU is a single block
+            if (dec->components == 1) {
+                dec->h[0] = dec->v[0] = hmax = vmax = 1;
+            }
+            bit_reader_t br = { .data = seg + seg_len - 2, .len = len - (pos + 2 + seg_len), .bit = 7 };
+            int pred[3] = { 0 };
+            const int mcus = ((dec->width + 8 * hmax - 1) / (8 * hmax)) * ((dec->height + 8 * vmax - 1) / (8 * vmax));
+            for (int m = 0; m < mcus; m++) {
+                for (int c = 0; c < dec->components; c++) {
+                    for (int b = 0; b < dec->h[c] * dec->v[c]; b++) {
+                        if (!decode_block(&br, dec, c, &pred[c])) {
+                            return false;
+                        }
+                    }
+                }
+            }
+            // the last byte is padded with ones, then EOI
+            size_t end = br.pos + (br.bit != 7 ? 1 : 0);
+            dec->eoi = end + 2 <= br.len && be16(br.data + end) == 0xffd9 && end + 2 == br.len;
+            return true;
+        }
+        pos += 2 + seg_len;
+    }
+    return false;
+}
+
+static void test_jpeg()
+{
+    static buffer_t buf;
+    jpeg_encoder_t enc;
+    jpeg_dec_t dec;
+    uint8_t lines[16 * 16];
+
+    // a flat gray frame comes back as its level in every block
+    memset(lines, 200, sizeof(lines));
+    buf.len = 0;
+    CHECK_EQ(jpeg_enc_start(&enc, 16, 16, JPEG_INPUT_GRAYSCALE, 50, &buffer_write, &buf), 0);
+    CHECK_EQ(jpeg_enc_strip(&enc, lines, 16, 16), 0);
+    CHECK_EQ(jpeg_enc_finish(&enc), 0);
+    CHECK(jpeg_decode_means(buf.data, buf.len, &dec));
+    CHECK(dec.eoi);
+    CHECK_EQ(dec.width, 16);
+    CHECK_EQ(dec.height, 16);
+    CHECK_EQ(dec.components, 1);
+    CHECK_EQ(dec.blocks[0], 4);
+    for (int i = 0; i < dec.blocks[0]; i++) {
+        CHECK(abs(dec.mean[0][i] - 200) <= 2);
+    }
+
+    // a gradient, each block in raster order has the mean of its pixels
+    for (int i = 0; i < 16 * 16; i++) {
+        lines[i] = i;
+    }
+    buf.len = 0;
+    CHECK_EQ(jpeg_enc_start(&enc, 16, 16, JPEG_INPUT_GRAYSCALE, 50, &buffer_write, &buf), 0);
+    CHECK_EQ(jpeg_enc_strip(&enc, lines, 16, 16), 0);
+    CHECK_EQ(jpeg_enc_finish(&enc), 0);
+    CHECK(jpeg_decode_means(buf.data, buf.len, &dec));
+    CHECK(dec.eoi);
+    CHECK_EQ(dec.blocks[0], 4);
+    for (int i = 0; i < dec.blocks[0]; i++) {
+        int mean = ((i / 2) * 8 * 16 + 56) + (i % 2) * 8 + 3;
+        CHECK(abs(dec.mean[0][i] - mean) <= 2);
+    }
+
+    // a flat RGB565 framebuffer, luma 2x1 subsampled: two Y blocks, one Cb, one Cr
+    const int r = 200, g = 80, b = 40;
+    const uint16_t p = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+    uint8_t fb[16 * 8 * 2];
+    for (size_t i = 0; i < sizeof(fb); i += 4) {
+        fb[i] = fb[i + 2] = p >> 8;
+        fb[i + 1] = fb[i + 3] = p & 0xff;
+    }
+    buf.len = 0;
+    CHECK_EQ(jpeg_enc_start(&enc, 16, 8, JPEG_INPUT_FB_RGB565, 90, &buffer_write, &buf), 0);
+    CHECK_EQ(jpeg_enc_strip(&enc, fb, 8, 16 * 2), 0);
+    CHECK_EQ(jpeg_enc_finish(&enc), 0);
+    CHECK(jpeg_decode_means(buf.data, buf.len, &dec));
+    CHECK(dec.eoi);
+    CHECK_EQ(dec.components, 3);
+    CHECK_EQ(dec.blocks[0], 2);
+    CHECK_EQ(dec.blocks[1], 1);
+    CHECK_EQ(dec.blocks[2], 1);
+    const int y = (299 * r + 587 * g + 114 * b) / 1000;
+    const int cb = 128 + (-169 * r - 331 * g + 500 * b) / 1000;
+    const int cr = 128 + (500 * r - 419 * g - 81 * b) / 1000;
+    CHECK(abs(dec.mean[0][0] - y) <= 2);
+    CHECK(abs(dec.mean[0][1] - y) <= 2);
+    CHECK(abs(dec.mean[1][0] - cb) <= 2);
+    CHECK(abs(dec.mean[2][0] - cr) <= 2);
+
+    // and nothing is left between the last block and EOI
+    CHECK(buf.data[0] == 0xff && buf.data[1] == 0xd8);
+    CHECK(buf.data[buf.len - 2] == 0xff && buf.data[buf.len - 1] == 0xd9);
+}
+
+/*
+ * A QOI decoder written from the specification rather than from the
+ * encoder, so both would have to get an op wrong the same way for a bad
+ * image to pass. It counts the ops it met, for the tests to know which
+ * ones their input took.
+ */
+enum {
+    QOI_DEC_INDEX,
+    QOI_DEC_DIFF,
+    QOI_DEC_LUMA,
+    QOI_DEC_RUN,
+    QOI_DEC_RGB,
+    QOI_DEC_OPS,
+};
+
+static uint32_t be32(const uint8_t* p)
+{
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// decodes into R, G, B bytes, false unless it is a complete image of width x height
+static bool qoi_decode(const uint8_t* data, size_t len, int width, int height, uint8_t* rgb, int ops[QOI_DEC_OPS])
+{
+    static const uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    if (len < QOI_HEADER_SIZE + sizeof(end) || memcmp(data, "qoif", 4) != 0 ||
+        be32(data + 4) != (uint32_t) width || be32(data + 8) != (uint32_t) height || data[12] != 3) {
+        return false;
+    }
+    uint8_t index[64][4];
+    uint8_t px[4] = { 0, 0, 0, 255 };
+    memset(index, 0, sizeof(index));
+    memset(ops, 0, QOI_DEC_OPS * sizeof(int));
+    const size_t body_end = len - sizeof(end);
+    size_t pos = QOI_HEADER_SIZE;
+    int run = 0;
+    for (int n = 0; n < width * height; n++) {
+        if (run > 0) {
+            run--;
+        } else {
+            if (pos >= body_end) {
+                return false;
+            }
+            const uint8_t b = data[pos++];
+            if (b == 0xfe || b == 0xff) {
+                const size_t channels = (b == 0xfe) ? 3 : 4;
+                if (pos + channels > body_end) {
+                    return false;
+                }
+                memcpy(px, data + pos, channels);
+                pos += channels;
+                ops[QOI_DEC_RGB]++;
+            } else if ((b & 0xc0) == 0x00) {
+                memcpy(px, index[b], 4);
+                ops[QOI_DEC_INDEX]++;
+            } else if ((b & 0xc0) == 0x40) {
+                px[0] += ((b >> 4) & 3) - 2;
+                px[1] += ((b >> 2) & 3) - 2;
+                px[2] += (b & 3) - 2;
+                ops[QOI_DEC_DIFF]++;
+            } else if ((b & 0xc0) == 0x80) {
+                if (pos >= body_end) {
+                    return false;
+                }
+                const int dg = (b & 0x3f) - 32;
+                const uint8_t b2 = data[pos++];
+                px[0] += dg - 8 + (b2 >> 4);
+                px[1] += dg;
+                px[2] += dg - 8 + (b2 & 15);
+                ops[QOI_DEC_LUMA]++;
+            } else {
+                run = b & 0x3f;
+                ops[QOI_DEC_RUN]++;
+            }
+            memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) & 63], px, 4);
+        }
+        memcpy(rgb + 3 * n, px, 3);
+    }
+    return pos == body_end && memcmp(data + body_end, end, sizeof(end)) == 0;
+}
+
+#define QOI_TEST_W 80
+#define QOI_TEST_H 6
+
+static uint8_t widen(int value, int bits)
+{
+    value <<= 8 - bits;
+    return value | (value >> bits);
+}
+
+static void test_qoi()
+{
+    static buffer_t buf;
+    static uint8_t decoded[QOI_TEST_W * QOI_TEST_H * 3];
+    qoi_encoder_t enc;
+    int ops[QOI_DEC_OPS];
+    uint32_t seed = 12345;
+
+    // a run longer than one op holds, a red and green ramp, two colours
+    // taking turns and noise. Widened RGB565 channels never move by less
+    // than 4, so the small DIFF steps only come up in gray
+    uint16_t rgb565[QOI_TEST_H][QOI_TEST_W];
+    for (int x = 0; x < QOI_TEST_W; x++) {
+        rgb565[0][x] = 0;
+        rgb565[1][x] = (((x / 2) & 31) << 11) | ((x & 63) << 5) | 16;
+        rgb565[2][x] = (x & 1) ? 0xf800 : 0x07ff;
+        seed = seed * 1103515245 + 12345;
+        rgb565[3][x] = seed >> 16;
+        rgb565[4][x] = (x < 70) ? 0x1234 : 0xffff;
+        rgb565[5][x] = rgb565[3][x / 2];
+    }
+    buf.len = 0;
+    CHECK_EQ(qoi_enc_start(&enc, QOI_TEST_W, QOI_TEST_H, QOI_INPUT_RGB565, &buffer_write, &buf), 0);
+    for (int y = 0; y < QOI_TEST_H; y++) {
+        CHECK_EQ(qoi_enc_line(&enc, rgb565[y]), 0);
+    }
+    CHECK_EQ(qoi_enc_finish(&enc), 0);
+    CHECK_EQ(enc.bytes_out, buf.len);
+    CHECK(qoi_decode(buf.data, buf.len, QOI_TEST_W, QOI_TEST_H, decoded, ops));
+    int wrong = 0;
+    for (int i = 0; i < QOI_TEST_W * QOI_TEST_H; i++) {
+        const uint16_t p = rgb565[i / QOI_TEST_W][i % QOI_TEST_W];
+        if (decoded[3 * i] != widen(p >> 11, 5) || decoded[3 * i + 1] != widen((p >> 5) & 63, 6) ||
+            decoded[3 * i + 2] != widen(p & 31, 5)) {
+            wrong++;
+        }
+    }
+    CHECK_EQ(wrong, 0);
+    CHECK(ops[QOI_DEC_RUN] >= 2);
+    CHECK(ops[QOI_DEC_INDEX] > 0);
+    CHECK(ops[QOI_DEC_LUMA] > 0);
+    CHECK(ops[QOI_DEC_RGB] > 0);
+
+    // gray: a run, steps of 1, steps of 10 which wrap around, two levels
+    // taking turns and noise
+    uint8_t gray[QOI_TEST_H][QOI_TEST_W];
+    for (int x = 0; x < QOI_TEST_W; x++) {
+        gray[0][x] = 100;
+        gray[1][x] = 100 + x;
+        gray[2][x] = x * 10;
+        gray[3][x] = (x & 1) ? 30 : 200;
+        seed = seed * 1103515245 + 12345;
+        gray[4][x] = seed >> 24;
+        gray[5][x] = 255 - x;
+    }
+    buf.len = 0;
+    CHECK_EQ(qoi_enc_start(&enc, QOI_TEST_W, QOI_TEST_H, QOI_INPUT_GRAYSCALE, &buffer_write, &buf), 0);
+    for (int y = 0; y < QOI_TEST_H; y++) {
+        CHECK_EQ(qoi_enc_line(&enc, gray[y]), 0);
+    }
+    CHECK_EQ(qoi_enc_finish(&enc), 0);
+    CHECK(qoi_decode(buf.data, buf.len, QOI_TEST_W, QOI_TEST_H, decoded, ops));
+    wrong = 0;
+    for (int i = 0; i < QOI_TEST_W * QOI_TEST_H; i++) {
+        const uint8_t level = gray[i / QOI_TEST_W][i % QOI_TEST_W];
+        if (decoded[3 * i] != level || decoded[3 * i + 1] != level || decoded[3 * i + 2] != level) {
+            wrong++;
+        }
+    }
+    CHECK_EQ(wrong, 0);
+    CHECK(ops[QOI_DEC_RUN] >= 2);
+    CHECK(ops[QOI_DEC_INDEX] > 0);
+    CHECK(ops[QOI_DEC_DIFF] > 0);
+    CHECK(ops[QOI_DEC_LUMA] > 0);
+    CHECK(ops[QOI_DEC_RGB] > 0);
+
+    // a truncated image does not decode
+    CHECK(!qoi_decode(buf.data, buf.len - 9, QOI_TEST_W, QOI_TEST_H, decoded, ops));
+}
+
+static void test_cr()
+{
+    static buffer_t buf;
+    cr_encoder_t enc;
+    uint16_t rows[16 * 8];
+    for (int i = 0; i < 16 * 8; i++) {
+        rows[i] = i * 517;
+    }
+    CHECK_EQ(cr_enc_init(&enc, 16, 8, 8, 6, 0), 0);
+    // a keyframe carries every block, an unchanged frame none
+    for (int frame = 0; frame < 2; frame++) {
+        buf.len = 0;
+        CHECK_EQ(cr_enc_begin(&enc, frame, &buffer_write, &buf), 0);
+        CHECK_EQ(cr_enc_rows(&enc, rows, 16), 0);
+        CHECK_EQ(cr_enc_end(&enc), 0);
+        CHECK_EQ(enc.blocks_sent, frame == 0 ? 2 : 0);
+    }
+    cr_enc_free(&enc);
+}
+
+static void test_adapt()
+{
+    stream_adapt_t sa;
+    stream_adapt_config_t config = {
+        .levels = 3,
+        .target_fps = 10,
+        .hysteresis_pct = 15,
+        .hold_frames = 3,
+        .frame_bytes = { 40000, 10000, 2000 },
+    };
+    CHECK_EQ(stream_adapt_init(&sa, &config), 0);
+    // 320 kbit/s leaves 4000 bytes a frame, only the last level fits
+    CHECK_EQ(stream_adapt_frame(&sa, 40000, 1000), 2);
+    CHECK_EQ(sa.budget, 4000);
+    // at 8 Mbit/s it climbs back one level at a time, holding each
+    int frames = 0;
+    while (sa.level == 2 && frames < 20) {
+        stream_adapt_frame(&sa, 2000, 2);
+        frames++;
+    }
+    CHECK_EQ(sa.level, 1);
+    CHECK(frames >= config.hold_frames);
+    frames = 0;
+    while (sa.level == 1 && frames < 20) {
+        stream_adapt_frame(&sa, 10000, 10);
+        frames++;
+    }
+    CHECK_EQ(sa.level, 0);
+    CHECK_EQ(sa.changes, 3);
+    // the link slows down: the first slow frame drops the level, and the
+    // next attempt to go up waits twice as long
+    CHECK_EQ(stream_adapt_frame(&sa, 40000, 400), 1);
+    CHECK_EQ(sa.hold[0], 2 * config.hold_frames);
+    CHECK_EQ(sa.hold[1], config.hold_frames);
+    // a frame twice the guess scales the guesses of the levels not seen yet
+    CHECK_EQ(stream_adapt_init(&sa, &config), 0);
+    stream_adapt_frame(&sa, 80000, 10);
+    CHECK_EQ(sa.avg_bytes[1], 20000);
+    // a frame which found the send buffer empty says little about the link
+    config.initial_level = 0;
+    config.window_bytes = 40000;
+    CHECK_EQ(stream_adapt_init(&sa, &config), 0);
+    for (int i = 0; i < 3; i++) {
+        stream_adapt_frame(&sa, 10000, 500);
+    }
+    CHECK_EQ(sa.goodput_bps, 160000);
+    stream_adapt_frame(&sa, 10000, 0);
+    CHECK_EQ(sa.goodput_bps, 213333);
+    // the window holds window_bytes, older frames drop out
+    stream_adapt_frame(&sa, 10000, 10);
+    stream_adapt_frame(&sa, 10000, 10);
+    CHECK_EQ(sa.goodput_bps, 40000 * 8 * 1000 / 520);
+    stream_adapt_frame(&sa, 10000, 10);
+    stream_adapt_frame(&sa, 10000, 10);
+    CHECK_EQ(sa.goodput_bps, 8000000);
+    config.initial_level = 3;
+    CHECK_EQ(stream_adapt_init(&sa, &config), -1);
+}
+
+static int s_applied;
+
+static int record_quality(void* arg, int quality)
+{
+    if (arg != NULL) {
+        return -1;
+    }
+    s_applied = quality;
+    return 0;
+}
+
+static void test_rate()
+{
+    rate_ctrl_t rc;
+    rate_ctrl_config_t config = {
+        .q_best = 90,
+        .q_worst = 5,
+        .q_initial = 50,
+        .hysteresis_pct = 15,
+        .settle_frames = 1,
+        .apply = &record_quality,
+    };
+    CHECK_EQ(rate_ctrl_init(&rc, &config), 0);
+    CHECK_EQ(s_applied, 50);
+    // 800 kbit/s at 10 fps, 90% of it planned with: 9000 bytes a frame
+    rate_ctrl_sent(&rc, 10000, 100);
+    CHECK_EQ(rate_ctrl_frame(&rc, 20000, 1000), 50);
+    CHECK_EQ(rate_ctrl_frame(&rc, 20000, 1100), 46);
+    CHECK_EQ(rc.budget, 9000);
+    CHECK_EQ(s_applied, 46);
+    // the frame after a change is not judged, the next one starts the average
+    CHECK_EQ(rate_ctrl_frame(&rc, 12000, 1200), 46);
+    CHECK_EQ(rate_ctrl_frame(&rc, 12000, 1300), 45);
+    // inside the dead band nothing moves
+    CHECK_EQ(rate_ctrl_frame(&rc, 9500, 1400), 45);
+    CHECK_EQ(rate_ctrl_frame(&rc, 9500, 1500), 45);
+    // under the budget it goes up, by two steps once under half of it
+    CHECK_EQ(rate_ctrl_frame(&rc, 2000, 1600), 46);
+    CHECK_EQ(rate_ctrl_frame(&rc, 2000, 1700), 46);
+    CHECK_EQ(rate_ctrl_frame(&rc, 2000, 1800), 48);
+    CHECK_EQ(rc.changes, 4);
+
+    // OV2640 QS counts the other way and stops at q_worst; without a
+    // measured link the per frame limit is the budget
+    config.q_best = 10;
+    config.q_worst = 63;
+    config.q_initial = 61;
+    config.target_frame_bytes = 1000;
+    CHECK_EQ(rate_ctrl_init(&rc, &config), 0);
+    CHECK_EQ(rate_ctrl_frame(&rc, 5000, 0), 63);
+    CHECK_EQ(rc.budget, 1000);
+    // a setting the encoder refuses is not taken
+    config.q_initial = 30;
+    CHECK_EQ(rate_ctrl_init(&rc, &config), 0);
+    rc.config.apply_arg = &rc;
+    CHECK_EQ(rate_ctrl_frame(&rc, 5000, 0), 30);
+    CHECK_EQ(rc.changes, 0);
+    config.q_worst = config.q_best;
+    CHECK_EQ(rate_ctrl_init(&rc, &config), -1);
+}
+
+int main()
+{
+    test_pixels();
+    test_lines();
+    test_scale();
+    test_pack();
+    test_stats();
+    test_sig();
+    test_headers();
+    test_jpeg();
+    test_qoi();
+    test_cr();
+    test_adapt();
+    test_rate();
+    printf("%d checks, %d failed\n", s_checks, s_failed);
+    return s_failed ? 1 : 0;
+}
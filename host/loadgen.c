@@ -0,0 +1,454 @@
+/*
+ * Load generator for the HTTP server, run against http_host or a device.
+ *
+ *   ./loadgen [-a address] [-p port] [-t seconds] [-n streams] [-s snapshots]
+ *             [-S slow_streams] [-k slow_kbps] [-u stream_path] [-U snapshot_path]
+ *             [-i snapshot_interval_ms] [-P server_pid]
+ *
+ * Stream clients read a multipart stream (/stream by default) as fast as
+ * they can, slow ones read it at slow_kbps through a small receive
+ * buffer. Snapshot clients fetch /bmp over a kept-alive connection, with
+ * interval_ms between requests, 0 for back to back. A client turned away
+ * with 503 tries again a second later.
+ *
+ * At the end every client reports frames or responses per second and
+ * the percentiles of the time between stream frames or of the snapshot
+ * latency, request sent to last byte. With -P, the CPU time the server
+ * process took meanwhile is read from /proc.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define BOUNDARY "--123456789000000000000987654321"
+#define HEADER_MAX 4096
+#define SLOW_RCVBUF 4096
+#define RETRY_MS 1000
+
+typedef enum {
+    CLIENT_STREAM,
+    CLIENT_SLOW,
+    CLIENT_SNAPSHOT,
+} client_type_t;
+
+typedef struct {
+    uint32_t* us;
+    size_t count;
+    size_t size;
+} samples_t;
+
+typedef struct {
+    client_type_t type;
+    int index;
+    pthread_t thread;
+    // results
+    uint64_t bytes;
+    uint32_t items;             // stream frames or snapshot responses
+    uint32_t rejected;          // 503 answers
+    uint32_t errors;            // failed connections, other statuses, early ends
+    double first_ms;            // connect to first frame, streams only
+    samples_t samples;          // frame intervals or snapshot latencies, in us
+} client_t;
+
+static struct sockaddr_in s_addr;
+static const char* s_stream_path = "/stream";
+static const char* s_snapshot_path = "/bmp";
+static int s_slow_kbps = 64;
+static int s_interval_ms = 0;
+static double s_end;
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void samples_add(samples_t* s, double sec)
+{
+    if (s->count == s->size) {
+        s->size = s->size ? s->size * 2 : 256;
+        s->us = realloc(s->us, s->size * sizeof(uint32_t));
+    }
+    s->us[s->count++] = (uint32_t) (sec * 1e6);
+}
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+// nearest rank, in ms, of samples sorted already
+static double percentile(const samples_t* s, double p)
+{
+    if (s->count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t) ceil(p / 100 * s->count);
+    return s->us[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+static int connect_server(int rcvbuf)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (rcvbuf > 0) {
+        // before connect, so the window is small from the start
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    // a read never blocks past the end of the run for long
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 200000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (struct sockaddr*) &s_addr, sizeof(s_addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int send_request(int fd, const char* path, bool keep_alive)
+{
+    char req[256];
+    int len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: loadgen\r\nConnection: %s\r\n\r\n",
+                       path, keep_alive ? "keep-alive" : "close");
+    return send(fd, req, len, MSG_NOSIGNAL) == len ? 0 : -1;
+}
+
+// read, retrying on the receive timeout until the run is over; 0 at the end of the stream
+static ssize_t read_some(int fd, void* buf, size_t len)
+{
+    while (true) {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return n;
+        }
+        if (now_sec() >= s_end) {
+            return -1;
+        }
+    }
+}
+
+typedef struct {
+    int status;
+    long content_length;        // -1 if not given
+    bool close;
+    size_t body_start;          // bytes after the header in buf
+    size_t buffered;
+    char buf[HEADER_MAX];
+} response_t;
+
+// reads up to the end of the header, the start of the body stays in resp->buf
+static int read_header(int fd, response_t* resp)
+{
+    resp->buffered = 0;
+    char* end = NULL;
+    while (end == NULL) {
+        if (resp->buffered == sizeof(resp->buf) - 1) {
+            return -1;
+        }
+        ssize_t n = read_some(fd, resp->buf + resp->buffered, sizeof(resp->buf) - 1 - resp->buffered);
+        if (n <= 0) {
+            return -1;
+        }
+        resp->buffered += n;
+        resp->buf[resp->buffered] = '\0';
+        end = strstr(resp->buf, "\r\n\r\n");
+    }
+    resp->body_start = end + 4 - resp->buf;
+    resp->status = 0;
+    resp->content_length = -1;
+    resp->close = false;
+    sscanf(resp->buf, "HTTP/1.%*d %d", &resp->status);
+    for (char* line = strstr(resp->buf, "\r\n"); line != NULL && line < end; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            resp->content_length = atol(line + 17);
+        } else if (strncasecmp(line + 2, "Connection: close", 17) == 0) {
+            resp->close = true;
+        }
+    }
+    return 0;
+}
+
+// counts the boundaries of a multipart stream, each one ends a frame
+static void run_stream(client_t* c, int fd, double connected)
+{
+    const size_t blen = strlen(BOUNDARY);
+    const size_t chunk = (c->type == CLIENT_SLOW) ? 512 : 16384;
+    char buf[16384 + sizeof(BOUNDARY)];
+    size_t carry = 0;
+    double last = connected;
+    double start = now_sec();
+    uint64_t read_total = 0;
+    response_t resp;
+    if (read_header(fd, &resp) != 0 || resp.status != 200) {
+        if (resp.status == 503) {
+            c->rejected++;
+        } else {
+            c->errors++;
+        }
+        return;
+    }
+    // the first part follows the header directly
+    carry = resp.buffered - resp.body_start;
+    memcpy(buf, resp.buf + resp.body_start, carry);
+    while (now_sec() < s_end) {
+        ssize_t n = read_some(fd, buf + carry, chunk);
+        if (n <= 0) {
+            if (now_sec() < s_end) {
+                c->errors++;
+            }
+            break;
+        }
+        c->bytes += n;
+        read_total += n;
+        size_t len = carry + n;
+        char* p = buf;
+        char* hit;
+        while ((hit = memmem(p, buf + len - p, BOUNDARY, blen)) != NULL) {
+            double t = now_sec();
+            if (c->items == 0) {
+                c->first_ms = (t - connected) * 1000;
+            } else {
+                samples_add(&c->samples, t - last);
+            }
+            last = t;
+            c->items++;
+            p = hit + blen;
+        }
+        // keep what could be the start of a boundary split across reads
+        carry = (buf + len - p < (long) blen) ? buf + len - p : blen - 1;
+        memmove(buf, buf + len - carry, carry);
+        if (c->type == CLIENT_SLOW) {
+            double due = start + read_total * 8.0 / (s_slow_kbps * 1000.0);
+            double wait = due - now_sec();
+            if (wait > 0) {
+                sleep_ms((int) (wait * 1000));
+            }
+        }
+    }
+}
+
+// requests on one connection until the server closes it or the run ends
+static void run_snapshots(client_t* c, int fd)
+{
+    char body[16384];
+    bool open = true;
+    while (open && now_sec() < s_end) {
+        double start = now_sec();
+        response_t resp;
+        if (send_request(fd, s_snapshot_path, true) != 0 || read_header(fd, &resp) != 0) {
+            if (now_sec() < s_end) {
+                c->errors++;
+            }
+            return;
+        }
+        long left = resp.content_length;
+        size_t got = resp.buffered - resp.body_start;
+        if (left >= 0) {
+            left -= got;
+        }
+        c->bytes += got;
+        // without a length the body ends with the connection
+        while (left != 0) {
+            ssize_t n = read_some(fd, body, (left > 0 && left < (long) sizeof(body)) ? left : sizeof(body));
+            if (n <= 0) {
+                break;
+            }
+            c->bytes += n;
+            if (left > 0) {
+                left -= n;
+            }
+        }
+        if (resp.status == 503) {
+            c->rejected++;
+            sleep_ms(RETRY_MS);
+            return;
+        } else if (resp.status != 200 || left > 0) {
+            c->errors++;
+            return;
+        }
+        c->items++;
+        samples_add(&c->samples, now_sec() - start);
+        open = !resp.close && resp.content_length >= 0;
+        if (s_interval_ms > 0) {
+            sleep_ms(s_interval_ms);
+        }
+    }
+}
+
+static void* client_main(void* arg)
+{
+    client_t* c = (client_t*) arg;
+    while (now_sec() < s_end) {
+        double connected = now_sec();
+        int fd = connect_server(c->type == CLIENT_SLOW ? SLOW_RCVBUF : 0);
+        if (fd < 0) {
+            c->errors++;
+            sleep_ms(RETRY_MS);
+            continue;
+        }
+        if (c->type == CLIENT_SNAPSHOT) {
+            run_snapshots(c, fd);
+        } else if (send_request(fd, s_stream_path, false) == 0) {
+            uint32_t rejected = c->rejected;
+            run_stream(c, fd, connected);
+            if (c->rejected != rejected) {
+                sleep_ms(RETRY_MS);
+            }
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+// utime + stime of a process, in seconds
+static double process_cpu(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    char line[1024];
+    double cpu = -1;
+    if (fgets(line, sizeof(line), f) != NULL) {
+        // after the command, which may contain spaces, utime and stime are fields 14 and 15
+        char* p = strrchr(line, ')');
+        unsigned long utime, stime;
+        if (p != NULL && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                                &utime, &stime) == 2) {
+            cpu = (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+        }
+    }
+    fclose(f);
+    return cpu;
+}
+
+static void report(client_t* c, double seconds)
+{
+    static const char* names[] = { "stream", "slow", "snapshot" };
+    qsort(c->samples.us, c->samples.count, sizeof(uint32_t), &cmp_u32);
+    printf("%-8s %2d %8.1f %9.1f %7u %7u %8.1f %8.1f %8.1f %8.1f", names[c->type], c->index,
+           c->items / seconds, c->bytes / seconds / 1024, c->rejected, c->errors,
+           percentile(&c->samples, 50), percentile(&c->samples, 90), percentile(&c->samples, 99),
+           percentile(&c->samples, 100));
+    if (c->type != CLIENT_SNAPSHOT && c->items > 0) {
+        printf("  first %.0f ms", c->first_ms);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* address = "127.0.0.1";
+    int port = 8080;
+    int seconds = 10;
+    int streams = 2, snapshots = 2, slow = 0;
+    int server_pid = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:t:n:s:S:k:u:U:i:P:")) != -1) {
+        switch (opt) {
+        case 'a': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        case 'n': streams = atoi(optarg); break;
+        case 's': snapshots = atoi(optarg); break;
+        case 'S': slow = atoi(optarg); break;
+        case 'k': s_slow_kbps = atoi(optarg); break;
+        case 'u': s_stream_path = optarg; break;
+        case 'U': s_snapshot_path = optarg; break;
+        case 'i': s_interval_ms = atoi(optarg); break;
+        case 'P': server_pid = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-a address] [-p port] [-t seconds] [-n streams] [-s snapshots]\n"
+                    "       [-S slow_streams] [-k slow_kbps] [-u stream_path] [-U snapshot_path]\n"
+                    "       [-i snapshot_interval_ms] [-P server_pid]\n", argv[0]);
+            return 1;
+        }
+    }
+    s_addr.sin_family = AF_INET;
+    s_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &s_addr.sin_addr) != 1 || seconds <= 0 || s_slow_kbps <= 0) {
+        fprintf(stderr, "bad address, duration or rate\n");
+        return 1;
+    }
+
+    // wait for a server started together with us
+    for (int i = 0; i < 50; i++) {
+        int fd = connect_server(0);
+        if (fd >= 0) {
+            close(fd);
+            break;
+        }
+        sleep_ms(100);
+    }
+
+    const int count = streams + slow + snapshots;
+    client_t* clients = calloc(count, sizeof(client_t));
+    for (int i = 0; i < count; i++) {
+        clients[i].type = i < streams ? CLIENT_STREAM : i < streams + slow ? CLIENT_SLOW : CLIENT_SNAPSHOT;
+        clients[i].index = i;
+    }
+    double cpu_start = server_pid ? process_cpu(server_pid) : -1;
+    double start = now_sec();
+    s_end = start + seconds;
+    for (int i = 0; i < count; i++) {
+        pthread_create(&clients[i].thread, NULL, &client_main, &clients[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        pthread_join(clients[i].thread, NULL);
+    }
+    double elapsed = now_sec() - start;
+    double cpu_end = server_pid ? process_cpu(server_pid) : -1;
+
+    printf("%-8s %2s %8s %9s %7s %7s %8s %8s %8s %8s\n", "client", "#", "per_s", "KiB/s", "503", "errors",
+           "p50_ms", "p90_ms", "p99_ms", "max_ms");
+    samples_t all = { 0 };
+    uint32_t snapshot_count = 0;
+    for (int i = 0; i < count; i++) {
+        report(&clients[i], elapsed);
+        if (clients[i].type == CLIENT_SNAPSHOT) {
+            for (size_t j = 0; j < clients[i].samples.count; j++) {
+                samples_add(&all, clients[i].samples.us[j] / 1e6);
+            }
+            snapshot_count += clients[i].items;
+        }
+    }
+    if (snapshots > 0) {
+        qsort(all.us, all.count, sizeof(uint32_t), &cmp_u32);
+        printf("snapshots: %.1f/s, latency p50 %.1f ms p90 %.1f ms p99 %.1f ms\n", snapshot_count / elapsed,
+               percentile(&all, 50), percentile(&all, 90), percentile(&all, 99));
+    }
+    if (cpu_start >= 0 && cpu_end >= 0) {
+        printf("server cpu: %.2f s in %.1f s, %.1f%% of one core\n", cpu_end - cpu_start, elapsed,
+               100 * (cpu_end - cpu_start) / elapsed);
+    }
+    for (int i = 0; i < count; i++) {
+        free(clients[i].samples.us);
+    }
+    free(all.us);
+    free(clients);
+    return 0;
+}
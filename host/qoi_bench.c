@@ -0,0 +1,123 @@
+// Compare the QOI encoder against raw RGB565 BMP output on the host.
+//
+// Without arguments a few synthetic scenes are used. Raw frames saved from
+// the /get endpoint (RGB565, 2 bytes per pixel) can be passed as files.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bitmap.h"
+#include "qoi_encoder.h"
+
+static size_t s_bytes;
+
+static int count_bytes(void* arg, const uint8_t* data, size_t len)
+{
+    s_bytes += len;
+    return 0;
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(const char* name, const uint16_t* img, int w, int h)
+{
+    qoi_encoder_t enc;
+    const size_t raw = (size_t) w * h * 2;
+    const size_t bmp = sizeof(bitmap565) + raw;
+    int iterations = 0;
+    double start = now_sec(), elapsed;
+    do {
+        s_bytes = 0;
+        qoi_enc_start(&enc, w, h, QOI_INPUT_RGB565, &count_bytes, NULL);
+        for (int y = 0; y < h; ++y) {
+            qoi_enc_line(&enc, img + (size_t) y * w);
+        }
+        qoi_enc_finish(&enc);
+        ++iterations;
+        elapsed = now_sec() - start;
+    } while (elapsed < 0.5);
+
+    printf("%-12s %4dx%-4d bmp %7zu  qoi %7zu  ratio %5.2f  %7.1f MB/s\n",
+           name, w, h, bmp, s_bytes, (double) bmp / s_bytes,
+           raw * iterations / elapsed / 1e6);
+}
+
+static uint16_t rgb565(int r, int g, int b)
+{
+    r = r < 0 ? 0 : r > 255 ? 255 : r;
+    g = g < 0 ? 0 : g > 255 ? 255 : g;
+    b = b < 0 ? 0 : b > 255 ? 255 : b;
+    return ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+}
+
+static void synthetic(int w, int h)
+{
+    uint16_t* img = malloc((size_t) w * h * 2);
+    srand(1);
+
+    for (int i = 0; i < w * h; ++i) {
+        img[i] = rgb565(80, 120, 160);
+    }
+    bench("flat", img, w, h);
+
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            img[y * w + x] = rgb565(x * 255 / w, y * 255 / h, 128);
+        }
+    }
+    bench("gradient", img, w, h);
+
+    // sensor like: gradient plus a little noise
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            int n = rand() % 9 - 4;
+            img[y * w + x] = rgb565(x * 255 / w + n, y * 255 / h + n, 128 + n);
+        }
+    }
+    bench("noisy", img, w, h);
+
+    for (int i = 0; i < w * h; ++i) {
+        img[i] = rand();
+    }
+    bench("random", img, w, h);
+    free(img);
+}
+
+int main(int argc, char** argv)
+{
+    int w = 160, h = 120;
+    int files = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+                fprintf(stderr, "bad size %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        FILE* f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        uint16_t* img = calloc((size_t) w * h, 2);
+        if (fread(img, 2, (size_t) w * h, f) != (size_t) w * h) {
+            fprintf(stderr, "%s: short file for %dx%d\n", argv[i], w, h);
+        }
+        fclose(f);
+        bench(argv[i], img, w, h);
+        free(img);
+        ++files;
+    }
+    if (files == 0) {
+        synthetic(w, h);
+        synthetic(640, 480);
+    }
+    return 0;
+}
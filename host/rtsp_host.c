@@ -0,0 +1,442 @@
+/*
+ * RTSP and RTP/JPEG on the host.
+ *
+ *   ./rtsp_host            check the packetizer and the RTSP state machine
+ *   ./rtsp_host -s [port]  serve a moving test picture, default port 8554,
+ *                          then e.g. ffplay rtsp://127.0.0.1:8554/
+ *
+ * The server uses the same session and packetizer code as the firmware,
+ * only the sockets are POSIX. Frames come from the software encoder.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "rtp_jpeg.h"
+#include "rtsp_session.h"
+#include "jpeg_encoder.h"
+
+#define W 320
+#define H 240
+#define FPS 15
+#define FRAME_MAX (64 * 1024)
+#define RTP_PORT 5004
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t size;
+} mem_t;
+
+static int mem_write(void* arg, const uint8_t* data, size_t len)
+{
+    mem_t* m = (mem_t*) arg;
+    if (m->len + len > m->size) {
+        return -1;
+    }
+    memcpy(m->data + m->len, data, len);
+    m->len += len;
+    return 0;
+}
+
+// a bar moving across a color gradient, framebuffer YUYV words as the camera has them
+static size_t make_frame(int n, int quality, jpeg_input_format_t format, uint8_t* out, size_t size)
+{
+    static uint8_t fb[W * H * 2];
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x += 2) {
+            uint8_t* p = &fb[(y * W + x) * 2];
+            int bar = ((x + n * 4) % W) < 16;
+            p[0] = p[2] = bar ? 235 : (uint8_t) (16 + (x + y) / 3);
+            p[1] = (uint8_t) (64 + y / 2);
+            p[3] = (uint8_t) (64 + x / 3);
+            if (format == JPEG_INPUT_GRAYSCALE) {
+                fb[y * W + x] = fb[y * W + x + 1] = p[0];
+            }
+        }
+    }
+    mem_t m = { out, 0, size };
+    jpeg_encoder_t enc;
+    jpeg_enc_start(&enc, W, H, format, quality, mem_write, &m);
+    jpeg_enc_strip(&enc, fb, H, format == JPEG_INPUT_GRAYSCALE ? W : W * 2);
+    jpeg_enc_finish(&enc);
+    return enc.error ? 0 : m.len;
+}
+
+/* packetizer check */
+
+#define MAX_PACKETS 256
+
+typedef struct {
+    uint8_t data[MAX_PACKETS][RTP_JPEG_PACKET_MAX];
+    size_t len[MAX_PACKETS];
+    int count;
+    int fail_at;                // send fails at this packet, -1 never
+} capture_t;
+
+static int capture_send(void* arg, const uint8_t* packet, size_t len)
+{
+    capture_t* c = (capture_t*) arg;
+    if (c->count == c->fail_at || c->count == MAX_PACKETS) {
+        return -1;
+    }
+    memcpy(c->data[c->count], packet, len);
+    c->len[c->count++] = len;
+    return 0;
+}
+
+static uint32_t rd16(const uint8_t* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t rd32(const uint8_t* p)
+{
+    return (rd16(p) << 16) | rd16(p + 2);
+}
+
+// finds a marker segment, returns its payload
+static const uint8_t* find_marker(const uint8_t* jpeg, size_t len, uint8_t marker, size_t* seg_len)
+{
+    size_t pos = 2;
+    while (pos + 4 <= len && jpeg[pos] == 0xff) {
+        size_t n = rd16(jpeg + pos + 2);
+        if (jpeg[pos + 1] == marker) {
+            *seg_len = n - 2;
+            return jpeg + pos + 4;
+        }
+        pos += 2 + n;
+    }
+    return NULL;
+}
+
+// reassembles the packets of one frame and compares with the JPEG they came from
+static int check_frame(const capture_t* c, const uint8_t* jpeg, size_t len, uint32_t ts,
+                       uint16_t first_seq, size_t packet_size, int expect_type)
+{
+    static uint8_t scan[FRAME_MAX];
+    size_t scan_len = 0;
+    size_t sos_len, dqt_len;
+    const uint8_t* sos = find_marker(jpeg, len, 0xda, &sos_len);
+    const uint8_t* dqt = find_marker(jpeg, len, 0xdb, &dqt_len);
+    if (sos == NULL || dqt == NULL) {
+        printf("  test frame has no SOS or DQT\n");
+        return 1;
+    }
+    const uint8_t* scan_start = sos + sos_len;
+    size_t expect_len = jpeg + len - 2 - scan_start;
+    while (jpeg[len - 2] != 0xff || jpeg[len - 1] != 0xd9) {
+        // padding after EOI
+        len--;
+        expect_len--;
+    }
+
+    for (int i = 0; i < c->count; i++) {
+        const uint8_t* p = c->data[i];
+        size_t plen = c->len[i];
+        int last = i == c->count - 1;
+        if (plen > packet_size || p[0] != 0x80 || (p[1] & 0x7f) != RTP_JPEG_PAYLOAD_TYPE ||
+            !!(p[1] & 0x80) != last || rd16(p + 2) != (uint16_t) (first_seq + i) || rd32(p + 4) != ts) {
+            printf("  packet %d: bad RTP header\n", i);
+            return 1;
+        }
+        const uint8_t* j = p + 12;
+        uint32_t offset = rd32(j) & 0xffffff;
+        if (offset != scan_len || j[4] != expect_type || j[5] != 255 || j[6] != W / 8 || j[7] != H / 8) {
+            printf("  packet %d: bad JPEG header, offset %u type %d\n", i, offset, j[4]);
+            return 1;
+        }
+        j += 8;
+        if (expect_type >= 64) {
+            if (rd16(j) != 16 || rd16(j + 2) != 0xffff) {
+                printf("  packet %d: bad restart header\n", i);
+                return 1;
+            }
+            j += 4;
+        }
+        if (offset == 0) {
+            // both tables, in the order of the DQT segments
+            if (rd16(j + 2) != 128 || memcmp(j + 4, dqt + 1, 64) != 0) {
+                printf("  packet %d: bad quantization tables\n", i);
+                return 1;
+            }
+            j += 4 + 128;
+        }
+        memcpy(scan + scan_len, j, p + plen - j);
+        scan_len += p + plen - j;
+    }
+    if (scan_len != expect_len || memcmp(scan, scan_start, scan_len) != 0) {
+        printf("  scan data differs, %zu bytes, expected %zu\n", scan_len, expect_len);
+        return 1;
+    }
+    return 0;
+}
+
+// the same JPEG with a DRI segment after SOI
+static size_t add_restart_interval(uint8_t* jpeg, size_t len)
+{
+    memmove(jpeg + 8, jpeg + 2, len - 2);
+    memcpy(jpeg + 2, "\xff\xdd\x00\x04\x00\x10", 6);
+    return len + 6;
+}
+
+static int test_packetizer()
+{
+    static uint8_t jpeg[FRAME_MAX];
+    static capture_t c;
+    rtp_jpeg_t rtp;
+    int errors = 0;
+    const size_t packet_sizes[] = { 576, 1400, RTP_JPEG_PACKET_MAX };
+
+    for (int s = 0; s < 3; s++) {
+        rtp_jpeg_init(&rtp, 0x12345678, packet_sizes[s]);
+        int packets = 0;
+        for (int i = 0; i < 20; i++) {
+            // quality changes the tables between frames
+            size_t len = make_frame(i, 20 + i * 4, JPEG_INPUT_FB_YUV422, jpeg, sizeof(jpeg));
+            c.count = 0;
+            c.fail_at = -1;
+            uint16_t seq = rtp.seq;
+            if (rtp_jpeg_send_frame(&rtp, jpeg, len, i * 6000, capture_send, &c) != RTP_JPEG_OK ||
+                check_frame(&c, jpeg, len, i * 6000, seq, packet_sizes[s], 0) != 0) {
+                printf("packet size %zu, frame %d failed\n", packet_sizes[s], i);
+                errors++;
+            }
+            packets += c.count;
+        }
+        printf("packet size %zu: %d frames in %d packets\n", packet_sizes[s], rtp.frames, packets);
+    }
+
+    rtp_jpeg_init(&rtp, 1, 1400);
+    size_t len = make_frame(0, 50, JPEG_INPUT_FB_YUV422, jpeg, sizeof(jpeg));
+    memset(jpeg + len, 0, 100);
+    c.count = 0;
+    if (rtp_jpeg_send_frame(&rtp, jpeg, len + 100, 0, capture_send, &c) != RTP_JPEG_OK ||
+        check_frame(&c, jpeg, len + 100, 0, rtp.seq - c.count, 1400, 0) != 0) {
+        printf("padding after EOI failed\n");
+        errors++;
+    }
+
+    len = add_restart_interval(jpeg, len);
+    c.count = 0;
+    if (rtp_jpeg_send_frame(&rtp, jpeg, len, 0, capture_send, &c) != RTP_JPEG_OK ||
+        check_frame(&c, jpeg, len, 0, rtp.seq - c.count, 1400, 64) != 0) {
+        printf("restart markers failed\n");
+        errors++;
+    }
+
+    c.count = 0;
+    c.fail_at = 1;
+    if (rtp_jpeg_send_frame(&rtp, jpeg, len, 0, capture_send, &c) != RTP_JPEG_ERR_SEND || c.count != 1) {
+        printf("send failure not reported\n");
+        errors++;
+    }
+    c.fail_at = -1;
+
+    len = make_frame(0, 50, JPEG_INPUT_GRAYSCALE, jpeg, sizeof(jpeg));
+    c.count = 0;
+    if (rtp_jpeg_send_frame(&rtp, jpeg, len, 0, capture_send, &c) != RTP_JPEG_ERR_FORMAT || c.count != 0) {
+        printf("grayscale JPEG not refused\n");
+        errors++;
+    }
+    return errors;
+}
+
+/* RTSP state machine check */
+
+static int expect(rtsp_session_t* s, const char* request, const char* status, const char* contains)
+{
+    char response[RTSP_RESPONSE_MAX];
+    size_t n = rtsp_session_handle(s, request, response, sizeof(response));
+    response[n] = '\0';
+    if (n == 0 || strncmp(response, status, strlen(status)) != 0 ||
+        (contains != NULL && strstr(response, contains) == NULL)) {
+        printf("request:\n%sresponse:\n%s\n", request, response);
+        return 1;
+    }
+    return 0;
+}
+
+static int test_session()
+{
+    rtsp_session_t s;
+    int errors = 0;
+    rtsp_session_init(&s, 0xabcd1234, 5004);
+    const char* url = "rtsp://192.168.4.1/";
+
+    char req[512];
+    const char* partial = "OPTIONS rtsp://x/ RTSP/1.0\r\nCSeq: 1\r\n";
+    const char* with_body = "SET_PARAMETER rtsp://x/ RTSP/1.0\r\nCSeq: 2\r\nContent-Length: 4\r\n\r\nab";
+    if (rtsp_request_len(partial, strlen(partial)) != 0 || rtsp_request_len(with_body, strlen(with_body)) != 0) {
+        printf("incomplete request taken as complete\n");
+        errors++;
+    }
+    snprintf(req, sizeof(req), "%scdOPTIONS", with_body);
+    if (rtsp_request_len(req, strlen(req)) != strlen(with_body) + 2) {
+        printf("request body not counted\n");
+        errors++;
+    }
+
+    snprintf(req, sizeof(req), "OPTIONS %s RTSP/1.0\r\nCSeq: 1\r\n\r\n", url);
+    errors += expect(&s, req, "RTSP/1.0 200", "Public: OPTIONS, DESCRIBE, SETUP, PLAY");
+    snprintf(req, sizeof(req), "PLAY %s RTSP/1.0\r\nCSeq: 2\r\n\r\n", url);
+    errors += expect(&s, req, "RTSP/1.0 455", "CSeq: 2");
+    snprintf(req, sizeof(req), "DESCRIBE %s RTSP/1.0\r\nCSeq: 3\r\nAccept: application/sdp\r\n\r\n", url);
+    errors += expect(&s, req, "RTSP/1.0 200", "m=video 0 RTP/AVP 26");
+    snprintf(req, sizeof(req), "SETUP %strack1 RTSP/1.0\r\nCSeq: 4\r\n"
+             "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n\r\n", url);
+    errors += expect(&s, req, "RTSP/1.0 461", NULL);
+    snprintf(req, sizeof(req), "SETUP %strack1 RTSP/1.0\r\nCSeq: 5\r\n"
+             "transport: RTP/AVP;unicast;client_port=6000-6001\r\n\r\n", url);
+    errors += expect(&s, req, "RTSP/1.0 200", "server_port=5004-5005");
+    if (s.state != RTSP_STATE_READY || s.client_rtp_port != 6000) {
+        printf("SETUP did not set up\n");
+        errors++;
+    }
+    snprintf(req, sizeof(req), "PLAY %s RTSP/1.0\r\nCSeq: 6\r\nSession: 1\r\n\r\n", url);
+    errors += expect(&s, req, "RTSP/1.0 454", NULL);
+    snprintf(req, sizeof(req), "PLAY %s RTSP/1.0\r\nCSeq: 7\r\nSession: ABCD1234\r\nRange: npt=0.000-\r\n\r\n", url);
+    errors += expect(&s, req, "RTSP/1.0 200", "Session: ABCD1234");
+    if (s.state != RTSP_STATE_PLAYING) {
+        printf("PLAY did not play\n");
+        errors++;
+    }
+    snprintf(req, sizeof(req), "RECORD %s RTSP/1.0\r\nCSeq: 8\r\n\r\n", url);
+    errors += expect(&s, req, "RTSP/1.0 501", NULL);
+    snprintf(req, sizeof(req), "TEARDOWN %s RTSP/1.0\r\nCSeq: 9\r\nSession: ABCD1234\r\n\r\n", url);
+    errors += expect(&s, req, "RTSP/1.0 200", NULL);
+    if (!s.teardown) {
+        printf("TEARDOWN did not end the session\n");
+        errors++;
+    }
+    errors += expect(&s, "garbage\r\n\r\n", "RTSP/1.0 400", NULL);
+    return errors;
+}
+
+/* server */
+
+typedef struct {
+    int fd;
+    struct sockaddr_in addr;
+} udp_dest_t;
+
+static int udp_send(void* arg, const uint8_t* packet, size_t len)
+{
+    udp_dest_t* d = (udp_dest_t*) arg;
+    return sendto(d->fd, packet, len, 0, (struct sockaddr*) &d->addr, sizeof(d->addr)) == (ssize_t) len ? 0 : -1;
+}
+
+static uint32_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void serve_client(int fd, int udp, struct sockaddr_in* peer)
+{
+    static char request[RTSP_REQUEST_MAX + 1];
+    static uint8_t jpeg[FRAME_MAX];
+    char response[RTSP_RESPONSE_MAX];
+    static rtp_jpeg_t rtp;
+    rtsp_session_t session;
+    udp_dest_t dest = { .fd = udp, .addr = *peer };
+    size_t len = 0;
+    int frame = 0;
+
+    rtsp_session_init(&session, (uint32_t) rand(), RTP_PORT);
+    rtp_jpeg_init(&rtp, (uint32_t) rand(), 1400);
+    uint32_t next_ms = now_ms();
+    while (!session.teardown) {
+        int timeout = -1;
+        if (session.state == RTSP_STATE_PLAYING) {
+            timeout = (int) (next_ms - now_ms());
+            timeout = timeout < 0 ? 0 : timeout;
+        }
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout) > 0) {
+            ssize_t n = recv(fd, request + len, RTSP_REQUEST_MAX - len, 0);
+            if (n <= 0) {
+                break;
+            }
+            len += n;
+            size_t req_len;
+            while ((req_len = rtsp_request_len(request, len)) > 0) {
+                char next = request[req_len];
+                request[req_len] = '\0';
+                printf("%.*s\n", (int) strcspn(request, "\r\n"), request);
+                size_t resp_len = rtsp_session_handle(&session, request, response, sizeof(response));
+                request[req_len] = next;
+                memmove(request, request + req_len, len - req_len);
+                len -= req_len;
+                if (resp_len == 0 || send(fd, response, resp_len, 0) != (ssize_t) resp_len) {
+                    session.teardown = true;
+                }
+            }
+            if (len == RTSP_REQUEST_MAX) {
+                break;
+            }
+        }
+        if (session.state == RTSP_STATE_PLAYING && (int) (now_ms() - next_ms) >= 0) {
+            dest.addr.sin_port = htons(session.client_rtp_port);
+            uint32_t ts = now_ms();
+            size_t n = make_frame(frame++, 50, JPEG_INPUT_FB_YUV422, jpeg, sizeof(jpeg));
+            rtp_jpeg_send_frame(&rtp, jpeg, n, ts * (RTP_JPEG_CLOCK_HZ / 1000), udp_send, &dest);
+            next_ms += 1000 / FPS;
+            if ((int) (now_ms() - next_ms) > 0) {
+                // late, do not try to catch up
+                next_ms = now_ms();
+            }
+        }
+    }
+    printf("client left: %u frames in %u packets, %u dropped\n", rtp.frames, rtp.packets, rtp.frames_dropped);
+}
+
+static int serve(int port)
+{
+    int one = 1;
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int udp = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY) };
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    addr.sin_port = htons(port);
+    if (bind(listener, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listener, 1) != 0) {
+        perror("listen");
+        return 1;
+    }
+    addr.sin_port = htons(RTP_PORT);
+    if (bind(udp, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        perror("bind RTP port");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("serving rtsp://127.0.0.1:%d/\n", port);
+    while (1) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        int fd = accept(listener, (struct sockaddr*) &peer, &peer_len);
+        if (fd < 0) {
+            continue;
+        }
+        printf("client %s\n", inet_ntoa(peer.sin_addr));
+        serve_client(fd, udp, &peer);
+        close(fd);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-s") == 0) {
+        return serve(argc > 2 ? atoi(argv[2]) : 8554);
+    }
+    int errors = test_packetizer();
+    errors += test_session();
+    printf("%s\n", errors ? "FAILED" : "OK");
+    return errors ? 1 : 0;
+}
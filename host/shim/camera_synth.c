@@ -0,0 +1,542 @@
+/*
+ * The camera API of camera.h with a synthetic sensor, for the host build.
+ *
+ * Frames are a moving test pattern in the framebuffer layout of the real
+ * driver. The sensor runs at a fixed frame rate: a capture waits for the
+ * next VSYNC and takes one frame time to read out, strips come in over
+ * that time. JPEG frames (an OV2640) come from the software encoder.
+ * The frame pool, its locking and the statistics follow camera.c.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "camera.h"
+#include "jpeg_encoder.h"
+#include "host_shim.h"
+
+// how long camera_run waits for a held frame to be released
+#define FB_WAIT_TICKS (1000 / portTICK_RATE_MS)
+// lines the DMA queue of the real driver holds while the filter task waits for a strip slot
+#define DMA_QUEUE_LINES 4
+
+static const char* TAG = "camera";
+
+const int resolution[][2] = {
+        { 40, 30 }, /* 40x30 */
+        { 64, 32 }, /* 64x32 */
+        { 64, 64 }, /* 64x64 */
+        { 88, 72 }, /* QQCIF */
+        { 160, 120 }, /* QQVGA */
+        { 128, 160 }, /* QQVGA2*/
+        { 176, 144 }, /* QCIF  */
+        { 240, 160 }, /* HQVGA */
+        { 320, 240 }, /* QVGA  */
+        { 352, 288 }, /* CIF   */
+        { 640, 480 }, /* VGA   */
+        { 800, 600 }, /* SVGA  */
+        { 1280, 1024 }, /* SXGA  */
+        { 1600, 1200 }, /* UXGA  */
+};
+
+typedef struct {
+    camera_fb_t fb;
+    int refcount;
+} camera_fb_slot_t;
+
+typedef struct {
+    synth_camera_config_t synth;
+    camera_config_t config;
+    int width;
+    int height;
+    size_t fb_bytes_per_pixel;
+    size_t fb_size;
+    uint64_t start_us;              // VSYNC every frame time from here
+    uint32_t frame_count;
+    camera_fb_slot_t* fb_slots;
+    size_t fb_count;
+    int fb_latest;
+    SemaphoreHandle_t fb_lock;
+    SemaphoreHandle_t fb_released;
+    SemaphoreHandle_t capture_lock;
+    uint8_t* strip_buf;
+    size_t strip_buf_size;
+    SemaphoreHandle_t strip_free;
+    SemaphoreHandle_t strip_go;     // camera_strips_start wakes the readout task
+    SemaphoreHandle_t frame_ready;
+    size_t strip_lines;
+    camera_strip_cb_t strip_cb;
+    void* strip_cb_arg;
+    uint32_t* jpeg_src;             // RGB565 frame encoded for JPEG frames
+    int jpeg_quality;
+    camera_stats_t stats;
+    sensor_t sensor;
+} synth_state_t;
+
+static synth_state_t s_state = {
+    .synth = { .model = CAMERA_OV7670, .fps = 25 },
+};
+static bool s_initialized;
+
+void synth_camera_configure(const synth_camera_config_t* config)
+{
+    s_state.synth = *config;
+}
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(uint64_t t)
+{
+    uint64_t now = now_us();
+    if (t > now) {
+        struct timespec ts = { .tv_sec = (t - now) / 1000000, .tv_nsec = ((t - now) % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static uint64_t frame_us()
+{
+    return 1000000 / s_state.synth.fps;
+}
+
+// the readout of a frame starts at a VSYNC
+static uint64_t wait_vsync()
+{
+    uint64_t elapsed = now_us() - s_state.start_us;
+    uint64_t vsync = s_state.start_us + (elapsed / frame_us() + 1) * frame_us();
+    sleep_until_us(vsync);
+    return vsync;
+}
+
+static uint32_t now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static uint8_t clamp(int n)
+{
+    return n < 0 ? 0 : n > 255 ? 255 : n;
+}
+
+// a gradient scrolling right, a box bouncing down and some sensor noise
+static void pattern_pixel(int x, int y, uint32_t seq, int* r, int* g, int* b)
+{
+    const int w = s_state.width, h = s_state.height;
+    uint32_t noise = (x * 7919u + y * 104729u + seq * 15485863u) * 2654435761u;
+    int n = (int) (noise >> 29) - 4;
+    int box_y = (seq * 4) % (2 * h);
+    box_y = box_y < h ? box_y : 2 * h - box_y;
+    bool box = x >= w / 3 && x < w / 3 + w / 8 && y >= box_y - h / 8 && y < box_y;
+    *r = clamp(box ? 250 : ((x + seq * 2) % w) * 255 / w + n);
+    *g = clamp(box ? 40 : y * 255 / h + n);
+    *b = clamp(box ? 40 : 128 + n);
+}
+
+static uint16_t rgb565(int r, int g, int b)
+{
+    return ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+}
+
+// lines in the layout dma_filter_raw leaves them in, see image_convert.h
+static void render_lines(uint8_t* dst, camera_pixelformat_t format, int first_line, int count, uint32_t seq)
+{
+    for (int y = first_line; y < first_line + count; y++) {
+        for (int x = 0; x < s_state.width; x += 2) {
+            int r0, g0, b0, r1, g1, b1;
+            pattern_pixel(x, y, seq, &r0, &g0, &b0);
+            pattern_pixel(x + 1, y, seq, &r1, &g1, &b1);
+            if (format == CAMERA_PF_GRAYSCALE) {
+                *dst++ = (77 * r0 + 150 * g0 + 29 * b0) >> 8;
+                *dst++ = (77 * r1 + 150 * g1 + 29 * b1) >> 8;
+            } else if (format == CAMERA_PF_YUV422) {
+                // Y0 V Y1 U from the least significant byte
+                int y0 = 16 + ((66 * r0 + 129 * g0 + 25 * b0) >> 8);
+                int y1 = 16 + ((66 * r1 + 129 * g1 + 25 * b1) >> 8);
+                int u = 128 + ((-38 * r0 - 74 * g0 + 112 * b0) >> 8);
+                int v = 128 + ((112 * r0 - 94 * g0 - 18 * b0) >> 8);
+                *dst++ = y0;
+                *dst++ = v;
+                *dst++ = y1;
+                *dst++ = u;
+            } else {
+                // the second pixel in the low half, bytes swapped
+                uint16_t p0 = rgb565(r0, g0, b0), p1 = rgb565(r1, g1, b1);
+                *dst++ = p1 >> 8;
+                *dst++ = p1 & 0xff;
+                *dst++ = p0 >> 8;
+                *dst++ = p0 & 0xff;
+            }
+        }
+    }
+}
+
+typedef struct {
+    uint8_t* dst;
+    size_t len;
+    size_t size;
+} jpeg_out_t;
+
+static int jpeg_out_write(void* arg, const uint8_t* data, size_t len)
+{
+    jpeg_out_t* out = (jpeg_out_t*) arg;
+    if (out->len + len > out->size) {
+        return -1;
+    }
+    memcpy(out->dst + out->len, data, len);
+    out->len += len;
+    return 0;
+}
+
+static size_t render_frame(uint8_t* dst, uint32_t seq)
+{
+    if (s_state.config.pixel_format != CAMERA_PF_JPEG) {
+        render_lines(dst, s_state.config.pixel_format, 0, s_state.height, seq);
+        return s_state.fb_size;
+    }
+    render_lines((uint8_t*) s_state.jpeg_src, CAMERA_PF_RGB565, 0, s_state.height, seq);
+    jpeg_encoder_t enc;
+    jpeg_out_t out = { .dst = dst, .size = s_state.fb_size };
+    jpeg_enc_start(&enc, s_state.width, s_state.height, JPEG_INPUT_FB_RGB565, s_state.jpeg_quality,
+                   &jpeg_out_write, &out);
+    for (int y = 0; y < s_state.height; y += JPEG_MCU_LINES) {
+        jpeg_enc_strip(&enc, (const uint8_t*) s_state.jpeg_src + y * s_state.width * 2, JPEG_MCU_LINES,
+                       s_state.width * 2);
+    }
+    if (jpeg_enc_finish(&enc) != 0) {
+        s_state.stats.frames_corrupt++;
+        return 0;
+    }
+    return out.len;
+}
+
+// the OV2640 QS register, lower is better, as a software encoder quality
+static int set_quality(sensor_t* sensor, int qs)
+{
+    s_state.jpeg_quality = clamp(100 - qs) < 5 ? 5 : clamp(100 - qs);
+    return 0;
+}
+
+/*
+ * The DMA filter task of camera_run_strips: lines come in at the pace of
+ * the sensor. The real one can only wait for a strip slot as long as the
+ * DMA queue holds lines, after that the frame loses some.
+ */
+static void strip_task(void* arg)
+{
+    while (true) {
+        xSemaphoreTake(s_state.strip_go, portMAX_DELAY);
+        const size_t strip_lines = s_state.strip_lines;
+        const size_t line_bytes = s_state.width * s_state.fb_bytes_per_pixel;
+        const TickType_t queue_ticks = frame_us() * DMA_QUEUE_LINES / s_state.height / 1000 / portTICK_RATE_MS + 1;
+        bool corrupt = false;
+        uint64_t vsync = wait_vsync();
+        for (size_t first = 0, n = 0; first < (size_t) s_state.height; first += strip_lines, n++) {
+            size_t count = (s_state.height - first < strip_lines) ? s_state.height - first : strip_lines;
+            uint8_t* slot = s_state.strip_buf + (n % 2) * strip_lines * line_bytes;
+            if (xSemaphoreTake(s_state.strip_free, queue_ticks) != pdTRUE) {
+                corrupt = true;
+                xSemaphoreTake(s_state.strip_free, portMAX_DELAY);
+            }
+            render_lines(slot, s_state.config.pixel_format, first, count, s_state.frame_count);
+            sleep_until_us(vsync + frame_us() * (first + count) / s_state.height);
+            s_state.strip_cb(slot, first, count, s_state.strip_cb_arg);
+        }
+        if (corrupt) {
+            s_state.stats.frames_corrupt++;
+        }
+        s_state.strip_cb(NULL, s_state.height, 0, s_state.strip_cb_arg);
+        xSemaphoreGive(s_state.frame_ready);
+    }
+}
+
+esp_err_t camera_probe(const camera_config_t* config, camera_model_t* out_camera_model)
+{
+    s_state.sensor.set_quality = &set_quality;
+    *out_camera_model = s_state.synth.model;
+    ESP_LOGI(TAG, "Synthetic camera as %d at %d fps", s_state.synth.model, s_state.synth.fps);
+    return ESP_OK;
+}
+
+esp_err_t camera_init(const camera_config_t* config)
+{
+    if (s_initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memcpy(&s_state.config, config, sizeof(*config));
+    s_state.width = s_state.synth.width ? s_state.synth.width : resolution[config->frame_size][0];
+    s_state.height = s_state.synth.height ? s_state.synth.height : resolution[config->frame_size][1];
+    s_state.fb_bytes_per_pixel = (config->pixel_format == CAMERA_PF_GRAYSCALE) ? 1 : 2;
+    s_state.fb_size = s_state.width * s_state.height * s_state.fb_bytes_per_pixel;
+    set_quality(&s_state.sensor, config->jpeg_quality);
+    s_state.fb_latest = -1;
+    s_state.fb_lock = xSemaphoreCreateMutex();
+    s_state.fb_released = xSemaphoreCreateBinary();
+    s_state.capture_lock = xSemaphoreCreateRecursiveMutex();
+    s_state.strip_free = xSemaphoreCreateCounting(2, 2);
+    s_state.strip_go = xSemaphoreCreateBinary();
+    s_state.frame_ready = xSemaphoreCreateBinary();
+    // strip only: no slots, camera_run fails and camera_fb_acquire never has a frame
+    s_state.fb_count = config->strip_only ? 0 : CONFIG_CAMERA_FB_COUNT;
+    s_state.fb_slots = (camera_fb_slot_t*) calloc(s_state.fb_count + 1, sizeof(camera_fb_slot_t));
+    if (config->pixel_format == CAMERA_PF_JPEG) {
+        s_state.jpeg_src = (uint32_t*) malloc(s_state.width * s_state.height * 2);
+        if (s_state.jpeg_src == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (s_state.fb_lock == NULL || s_state.fb_released == NULL || s_state.capture_lock == NULL ||
+        s_state.strip_free == NULL || s_state.strip_go == NULL || s_state.frame_ready == NULL ||
+        s_state.fb_slots == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!xTaskCreatePinnedToCore(&strip_task, "dma_filter", 2048, NULL, 10, NULL, 1)) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < s_state.fb_count; i++) {
+        camera_fb_t* fb = &s_state.fb_slots[i].fb;
+        fb->buf = (uint8_t*) malloc(s_state.fb_size);
+        if (fb->buf == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        fb->width = s_state.width;
+        fb->height = s_state.height;
+        fb->format = config->pixel_format;
+    }
+    s_state.start_us = now_us();
+    s_initialized = true;
+    ESP_LOGI(TAG, "%dx%d, %d frame buffers", s_state.width, s_state.height, s_state.fb_count);
+    return ESP_OK;
+}
+
+uint32_t* camera_get_fb()
+{
+    return s_state.fb_latest >= 0 ? (uint32_t*) s_state.fb_slots[s_state.fb_latest].fb.buf : NULL;
+}
+
+size_t camera_get_data_size()
+{
+    return s_state.fb_latest >= 0 ? s_state.fb_slots[s_state.fb_latest].fb.len : 0;
+}
+
+int camera_get_fb_width()
+{
+    return s_state.width;
+}
+
+int camera_get_fb_height()
+{
+    return s_state.height;
+}
+
+sensor_t* get_cam_sensor()
+{
+    return &s_state.sensor;
+}
+
+int get_image_mime_info_str(char* outstr)
+{
+    return sprintf(outstr, "Content-Disposition: attachment;filename=\"img_%dx%d_%dbpp_synth_%u.img\";"
+                   "Content-type: application/octet-stream\r\n\r\n",
+                   s_state.width, s_state.height, (int) s_state.fb_bytes_per_pixel, (unsigned) s_state.frame_count);
+}
+
+// pick a frame nobody holds, older frames first so the newest stays available
+static int fb_take_free()
+{
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        int found = -1;
+        xSemaphoreTake(s_state.fb_lock, portMAX_DELAY);
+        for (size_t i = 0; i < s_state.fb_count; i++) {
+            if (s_state.fb_slots[i].refcount == 0 && (int) i != s_state.fb_latest) {
+                found = i;
+                break;
+            }
+        }
+        if (found < 0 && s_state.fb_latest >= 0 && s_state.fb_slots[s_state.fb_latest].refcount == 0) {
+            found = s_state.fb_latest;
+            s_state.fb_latest = -1;
+        }
+        if (found >= 0) {
+            s_state.fb_slots[found].refcount = 1;
+        }
+        xSemaphoreGive(s_state.fb_lock);
+        if (found >= 0) {
+            return found;
+        }
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= FB_WAIT_TICKS ||
+            xSemaphoreTake(s_state.fb_released, FB_WAIT_TICKS - waited) != pdTRUE) {
+            return -1;
+        }
+    }
+}
+
+static void fb_publish(int slot, size_t len)
+{
+    camera_fb_t* fb = &s_state.fb_slots[slot].fb;
+    xSemaphoreTake(s_state.fb_lock, portMAX_DELAY);
+    fb->len = len;
+    fb->seq = s_state.frame_count;
+    fb->timestamp_ms = now_ms();
+    s_state.fb_slots[slot].refcount--;
+    s_state.fb_latest = slot;
+    xSemaphoreGive(s_state.fb_lock);
+}
+
+esp_err_t camera_run()
+{
+    if (!s_initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_state.fb_count == 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    camera_lock();
+    int slot = fb_take_free();
+    if (slot < 0) {
+        s_state.stats.frames_dropped++;
+        ESP_LOGW(TAG, "All %d frames are held, not capturing", s_state.fb_count);
+        camera_unlock();
+        return ESP_ERR_TIMEOUT;
+    }
+    uint64_t vsync = wait_vsync();
+    size_t len = render_frame(s_state.fb_slots[slot].fb.buf, s_state.frame_count);
+    // the last line arrives one frame time after VSYNC
+    sleep_until_us(vsync + frame_us());
+    ESP_LOGD(TAG, "Frame %u done", (unsigned) s_state.frame_count);
+    fb_publish(slot, len);
+    s_state.frame_count++;
+    camera_unlock();
+    return ESP_OK;
+}
+
+camera_fb_t* camera_fb_acquire()
+{
+    if (!s_initialized) {
+        return NULL;
+    }
+    camera_fb_t* fb = NULL;
+    xSemaphoreTake(s_state.fb_lock, portMAX_DELAY);
+    if (s_state.fb_latest >= 0) {
+        camera_fb_slot_t* slot = &s_state.fb_slots[s_state.fb_latest];
+        slot->refcount++;
+        fb = &slot->fb;
+    }
+    xSemaphoreGive(s_state.fb_lock);
+    return fb;
+}
+
+camera_fb_t* camera_fb_capture()
+{
+    camera_fb_t* fb = NULL;
+    camera_lock();
+    if (camera_run() == ESP_OK) {
+        fb = camera_fb_acquire();
+    }
+    camera_unlock();
+    return fb;
+}
+
+bool camera_fb_can_capture()
+{
+    bool found = false;
+    xSemaphoreTake(s_state.fb_lock, portMAX_DELAY);
+    for (size_t i = 0; i < s_state.fb_count && !found; i++) {
+        found = s_state.fb_slots[i].refcount == 0;
+    }
+    xSemaphoreGive(s_state.fb_lock);
+    return found;
+}
+
+void camera_fb_release(camera_fb_t* fb)
+{
+    if (fb == NULL) {
+        return;
+    }
+    // camera_fb_t is the first member of its slot
+    camera_fb_slot_t* slot = (camera_fb_slot_t*) fb;
+    xSemaphoreTake(s_state.fb_lock, portMAX_DELAY);
+    if (--slot->refcount == 0) {
+        xSemaphoreGive(s_state.fb_released);
+    }
+    xSemaphoreGive(s_state.fb_lock);
+}
+
+void camera_get_stats(camera_stats_t* stats)
+{
+    *stats = s_state.stats;
+    stats->frames_captured = s_state.frame_count;
+}
+
+void camera_lock()
+{
+    xSemaphoreTakeRecursive(s_state.capture_lock, portMAX_DELAY);
+}
+
+void camera_unlock()
+{
+    xSemaphoreGiveRecursive(s_state.capture_lock);
+}
+
+esp_err_t camera_strips_start(size_t strip_lines, camera_strip_cb_t cb, void* arg)
+{
+    if (!s_initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (strip_lines == 0 || cb == NULL || s_state.config.pixel_format == CAMERA_PF_JPEG) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    camera_lock();
+    const size_t line_bytes = s_state.width * s_state.fb_bytes_per_pixel;
+    size_t size = 2 * strip_lines * line_bytes;
+    if (s_state.strip_buf_size < size) {
+        free(s_state.strip_buf);
+        s_state.strip_buf = (uint8_t*) malloc(size);
+        s_state.strip_buf_size = s_state.strip_buf != NULL ? size : 0;
+        if (s_state.strip_buf == NULL) {
+            camera_unlock();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    s_state.strip_lines = strip_lines;
+    s_state.strip_cb = cb;
+    s_state.strip_cb_arg = arg;
+    xSemaphoreGive(s_state.strip_go);
+    // the lock stays taken until camera_strips_wait
+    return ESP_OK;
+}
+
+esp_err_t camera_strips_wait()
+{
+    xSemaphoreTake(s_state.frame_ready, portMAX_DELAY);
+    s_state.frame_count++;
+    camera_unlock();
+    return ESP_OK;
+}
+
+esp_err_t camera_run_strips(size_t strip_lines, camera_strip_cb_t cb, void* arg)
+{
+    esp_err_t err = camera_strips_start(strip_lines, cb, arg);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return camera_strips_wait();
+}
+
+void camera_strip_release()
+{
+    xSemaphoreGive(s_state.strip_free);
+}
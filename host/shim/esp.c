@@ -0,0 +1,152 @@
+/*
+ * Logging, heap, WiFi and flash of ESP-IDF for the host build.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_spiffs.h"
+#include "nvs_flash.h"
+
+static esp_log_level_t s_log_level = ESP_LOG_WARN;
+static system_event_cb_t s_event_cb;
+static void* s_event_ctx;
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    s_log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    if (level > s_log_level) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+// milliseconds since the program started, as since boot on the device
+static struct timespec s_start;
+
+__attribute__((constructor)) static void log_clock_start()
+{
+    clock_gettime(CLOCK_MONOTONIC, &s_start);
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - s_start.tv_sec) * 1000 + (ts.tv_nsec - s_start.tv_nsec) / 1000000;
+}
+
+uint32_t esp_random(void)
+{
+    return ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+}
+
+void* heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+// what malloc has left in the pages it holds, the process can always grow
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return mallinfo2().fordblks;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return mallinfo2().fordblks;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return mallinfo2().fordblks;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_spiffs_register(const esp_vfs_spiffs_conf_t* conf)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_spiffs_info(const char* partition_label, size_t* total_bytes, size_t* used_bytes)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void* ctx)
+{
+    s_event_cb = cb;
+    s_event_ctx = ctx;
+    return ESP_OK;
+}
+
+static void post_event(system_event_t* event)
+{
+    if (s_event_cb != NULL) {
+        s_event_cb(s_event_ctx, event);
+    }
+}
+
+void tcpip_adapter_init(void)
+{
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t* config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t* conf)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    system_event_t event = { .event_id = SYSTEM_EVENT_STA_START };
+    post_event(&event);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    // 127.0.0.1 in network byte order
+    const uint8_t loopback[4] = { 127, 0, 0, 1 };
+    system_event_t event = { .event_id = SYSTEM_EVENT_STA_GOT_IP };
+    memcpy(&event.event_info.got_ip.ip_info.ip.addr, loopback, sizeof(loopback));
+    post_event(&event);
+    return ESP_OK;
+}
@@ -0,0 +1,460 @@
+/*
+ * FreeRTOS tasks, queues, semaphores and event groups on POSIX threads.
+ *
+ * Good enough to run the application's tasks on the host: blocking calls
+ * block, timeouts time out, and a tick lasts as long as on the device.
+ * There is no scheduler, tasks of any priority and core run in parallel.
+ */
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_heap_caps.h"
+#include "host_shim.h"
+
+struct shim_task {
+    pthread_t thread;
+    char name[16];
+    int core;
+    uint32_t stack_depth;
+    bool skip_delays;
+    TaskFunction_t fn;
+    void* arg;
+};
+
+struct shim_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;         // broadcast on every send and receive
+    uint8_t* items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    TaskHandle_t owner;             // recursive mutexes only
+    UBaseType_t depth;
+};
+
+struct shim_event_group {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+static __thread struct shim_task* s_current;
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// tick 0 is when the program started
+static uint64_t s_start_us;
+
+__attribute__((constructor)) static void start_clock()
+{
+    s_start_us = now_us();
+}
+
+static void sleep_us(uint64_t us)
+{
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static void cond_init(pthread_cond_t* cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec deadline(TickType_t timeout)
+{
+    uint64_t us = now_us() + (uint64_t) timeout * portTICK_PERIOD_MS * 1000;
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    return ts;
+}
+
+// false once the deadline has passed, the mutex is held either way
+static bool cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex, TickType_t timeout, const struct timespec* until)
+{
+    if (timeout == portMAX_DELAY) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return timeout > 0 && pthread_cond_timedwait(cond, mutex, until) != ETIMEDOUT;
+}
+
+/* tasks */
+
+static void* task_main(void* arg)
+{
+    s_current = (struct shim_task*) arg;
+    s_current->fn(s_current->arg);
+    return NULL;
+}
+
+static struct shim_task* task_new(const char* name, int core, uint32_t stack_depth)
+{
+    struct shim_task* task = (struct shim_task*) calloc(1, sizeof(struct shim_task));
+    if (task != NULL) {
+        snprintf(task->name, sizeof(task->name), "%s", name);
+        task->core = (core >= 0 && core < portNUM_PROCESSORS) ? core : 0;
+        task->stack_depth = stack_depth;
+    }
+    return task;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core)
+{
+    struct shim_task* task = task_new(name, core, stack_depth);
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    if (pthread_create(&task->thread, NULL, &task_main, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* arg,
+                       UBaseType_t priority, TaskHandle_t* handle)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+TaskHandle_t shim_task_adopt(const char* name, bool skip_delays)
+{
+    if (s_current == NULL) {
+        s_current = task_new(name, 0, 0);
+        s_current->thread = pthread_self();
+    }
+    s_current->skip_delays = skip_delays;
+    return s_current;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == s_current) {
+        pthread_exit(NULL);
+    }
+    fprintf(stderr, "vTaskDelete of another task is not supported\n");
+    abort();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (now_us() - s_start_us) / (portTICK_PERIOD_MS * 1000);
+}
+
+// like the scheduler, wakes at a tick boundary
+static void delay_until(TickType_t tick)
+{
+    uint64_t wake_us = s_start_us + (uint64_t) tick * portTICK_PERIOD_MS * 1000;
+    uint64_t now = now_us();
+    if (wake_us > now) {
+        sleep_us(wake_us - now);
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (s_current != NULL && s_current->skip_delays) {
+        return;
+    }
+    if (ticks == 0) {
+        sched_yield();
+        return;
+    }
+    delay_until(xTaskGetTickCount() + ticks);
+}
+
+void vTaskDelayUntil(TickType_t* previous_wake, TickType_t increment)
+{
+    *previous_wake += increment;
+    delay_until(*previous_wake);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return shim_task_adopt("thread", false);
+}
+
+const char* pcTaskGetTaskName(TaskHandle_t task)
+{
+    if (task == NULL) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+    return task->name;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    if (task == NULL) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+    return task->stack_depth;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return s_current != NULL ? s_current->core : 0;
+}
+
+uint32_t xPortGetFreeHeapSize(void)
+{
+    return heap_caps_get_free_size(0);
+}
+
+/* queues and semaphores */
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct shim_queue* q = (struct shim_queue*) calloc(1, sizeof(struct shim_queue));
+    if (q == NULL) {
+        return NULL;
+    }
+    if (item_size > 0) {
+        q->items = (uint8_t*) malloc(length * item_size);
+        if (q->items == NULL) {
+            free(q);
+            return NULL;
+        }
+    }
+    q->length = length;
+    q->item_size = item_size;
+    pthread_mutex_init(&q->mutex, NULL);
+    cond_init(&q->changed);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    if (q != NULL) {
+        pthread_mutex_destroy(&q->mutex);
+        pthread_cond_destroy(&q->changed);
+        free(q->items);
+        free(q);
+    }
+}
+
+static BaseType_t queue_send(QueueHandle_t q, const void* item, TickType_t timeout, bool front)
+{
+    struct timespec until = deadline(timeout);
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == q->length) {
+        if (!cond_wait(&q->changed, &q->mutex, timeout, &until)) {
+            pthread_mutex_unlock(&q->mutex);
+            return pdFALSE;
+        }
+    }
+    if (front) {
+        q->head = (q->head + q->length - 1) % q->length;
+    }
+    if (q->item_size > 0) {
+        UBaseType_t slot = front ? q->head : (q->head + q->count) % q->length;
+        memcpy(q->items + slot * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void* item, TickType_t timeout)
+{
+    return queue_send(q, item, timeout, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void* item, TickType_t timeout)
+{
+    return queue_send(q, item, timeout, true);
+}
+
+static BaseType_t queue_receive(QueueHandle_t q, void* item, TickType_t timeout, bool remove)
+{
+    struct timespec until = deadline(timeout);
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == 0) {
+        if (!cond_wait(&q->changed, &q->mutex, timeout, &until)) {
+            pthread_mutex_unlock(&q->mutex);
+            return pdFALSE;
+        }
+    }
+    if (q->item_size > 0 && item != NULL) {
+        memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    }
+    if (remove) {
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t timeout)
+{
+    return queue_receive(q, item, timeout, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void* item, TickType_t timeout)
+{
+    return queue_receive(q, item, timeout, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->mutex);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q)
+{
+    return q->length - uxQueueMessagesWaiting(q);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    SemaphoreHandle_t sem = xQueueCreate(max_count, 0);
+    if (sem != NULL) {
+        sem->count = initial_count;
+    }
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+// no priority inheritance, nobody would notice without a scheduler
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t timeout)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    struct timespec until = deadline(timeout);
+    pthread_mutex_lock(&mutex->mutex);
+    while (mutex->owner != NULL && mutex->owner != self) {
+        if (!cond_wait(&mutex->changed, &mutex->mutex, timeout, &until)) {
+            pthread_mutex_unlock(&mutex->mutex);
+            return pdFALSE;
+        }
+    }
+    mutex->owner = self;
+    mutex->depth++;
+    pthread_mutex_unlock(&mutex->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+    BaseType_t ret = pdFALSE;
+    pthread_mutex_lock(&mutex->mutex);
+    if (mutex->owner == xTaskGetCurrentTaskHandle()) {
+        if (--mutex->depth == 0) {
+            mutex->owner = NULL;
+            pthread_cond_broadcast(&mutex->changed);
+        }
+        ret = pdTRUE;
+    }
+    pthread_mutex_unlock(&mutex->mutex);
+    return ret;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem)
+{
+    return uxQueueMessagesWaiting(sem);
+}
+
+/* event groups */
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct shim_event_group* group = (struct shim_event_group*) calloc(1, sizeof(struct shim_event_group));
+    if (group != NULL) {
+        pthread_mutex_init(&group->mutex, NULL);
+        cond_init(&group->changed);
+    }
+    return group;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    pthread_mutex_lock(&group->mutex);
+    EventBits_t bits = group->bits;
+    pthread_mutex_unlock(&group->mutex);
+    return bits;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->mutex);
+    group->bits |= bits;
+    EventBits_t now = group->bits;
+    pthread_cond_broadcast(&group->changed);
+    pthread_mutex_unlock(&group->mutex);
+    return now;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->mutex);
+    EventBits_t before = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return before;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t timeout)
+{
+    struct timespec until = deadline(timeout);
+    pthread_mutex_lock(&group->mutex);
+    while (true) {
+        EventBits_t set = group->bits & bits;
+        bool done = wait_for_all ? set == bits : set != 0;
+        if (done || !cond_wait(&group->changed, &group->mutex, timeout, &until)) {
+            break;
+        }
+    }
+    EventBits_t result = group->bits;
+    bool done = wait_for_all ? (result & bits) == bits : (result & bits) != 0;
+    if (done && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "esp_err.h"
+#include "lwip/api.h"
+
+typedef enum {
+    SYSTEM_EVENT_STA_START,
+    SYSTEM_EVENT_STA_GOT_IP,
+    SYSTEM_EVENT_STA_DISCONNECTED,
+} system_event_id_t;
+
+typedef struct {
+    ip4_addr_t ip;
+    ip4_addr_t netmask;
+    ip4_addr_t gw;
+} tcpip_adapter_ip_info_t;
+
+typedef struct {
+    system_event_id_t event_id;
+    union {
+        struct {
+            tcpip_adapter_ip_info_t ip_info;
+        } got_ip;
+    } event_info;
+} system_event_t;
+
+typedef esp_err_t (*system_event_cb_t)(void* ctx, system_event_t* event);
+
+/**
+ * @brief Events are delivered from the calling task, see esp_wifi_start
+ */
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void* ctx);
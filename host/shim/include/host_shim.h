@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+ * Settings of the host build that the ESP-IDF API has no place for,
+ * made by host/http_host.c before app_main runs.
+ */
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "camera.h"
+
+/**
+ * @brief Make the calling thread a task
+ *
+ * @param skip_delays vTaskDelay returns at once in this task, for the
+ *                    waits of app_main on the radio and the sensor
+ */
+TaskHandle_t shim_task_adopt(const char* name, bool skip_delays);
+
+typedef struct {
+    camera_model_t model;       //!< what camera_probe finds, app_main picks the pixel format by it
+    int fps;                    //!< frame rate of the sensor
+    int width;                  //!< 0 for the frame size app_main asks for
+    int height;
+} synth_camera_config_t;
+
+/**
+ * @brief Configure the synthetic camera, before camera_probe
+ */
+void synth_camera_configure(const synth_camera_config_t* config);
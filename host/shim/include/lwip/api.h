@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+ * The netconn API on POSIX sockets. Only TCP, blocking, one socket per
+ * netconn. The kernel copies what is written, so data passed with
+ * NETCONN_NOCOPY is free to go as soon as netconn_write returns, and the
+ * pcb reports it acknowledged right away; SO_SNDBUF is set to the lwIP
+ * send buffer, so a slow client holds up a writer about as early as on
+ * the device.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lwip/err.h"
+
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef int8_t s8_t;
+typedef int16_t s16_t;
+
+typedef struct {
+    u32_t addr;                 // network byte order
+} ip4_addr_t;
+typedef ip4_addr_t ip_addr_t;
+
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) ((const u8_t*) &(ipaddr)->addr)[0], ((const u8_t*) &(ipaddr)->addr)[1], \
+                       ((const u8_t*) &(ipaddr)->addr)[2], ((const u8_t*) &(ipaddr)->addr)[3]
+
+#define NETCONN_NOFLAG    0x00
+#define NETCONN_NOCOPY    0x00
+#define NETCONN_COPY      0x01
+#define NETCONN_MORE      0x02
+#define NETCONN_DONTBLOCK 0x04
+
+enum netconn_type {
+    NETCONN_TCP = 0x10,
+};
+
+struct tcp_pcb;
+
+struct netconn {
+    enum netconn_type type;
+    union {
+        struct tcp_pcb *tcp;    // NULL once the connection was aborted
+    } pcb;
+    int fd;
+    int recv_timeout;           // ms, 0 waits forever
+    int send_timeout;
+};
+
+// one received segment
+struct netbuf {
+    u8_t *data;
+    u16_t len;
+};
+
+struct netconn *netconn_new(enum netconn_type type);
+err_t netconn_delete(struct netconn *conn);
+err_t netconn_bind(struct netconn *conn, const ip_addr_t *addr, u16_t port);
+err_t netconn_listen(struct netconn *conn);
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn);
+err_t netconn_recv(struct netconn *conn, struct netbuf **new_buf);
+err_t netconn_write(struct netconn *conn, const void *data, size_t size, u8_t flags);
+err_t netconn_close(struct netconn *conn);
+void netconn_set_recvtimeout(struct netconn *conn, int timeout_ms);
+void netconn_set_sendtimeout(struct netconn *conn, int timeout_ms);
+
+err_t netbuf_data(struct netbuf *buf, void **data, u16_t *len);
+s8_t netbuf_next(struct netbuf *buf);
+void netbuf_delete(struct netbuf *buf);
+
+char *ipaddr_ntoa(const ip_addr_t *addr);
+
+/**
+ * @brief Added to every port bound, so the server runs unprivileged
+ */
+extern int netconn_port_offset;
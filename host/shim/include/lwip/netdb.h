@@ -0,0 +1,3 @@
+#pragma once
+
+// nothing of it is used by the code built on the host
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "lwip/api.h"
+
+// what tx_ring.c looks at, see api.h for why both are always equal
+struct tcp_pcb {
+    u32_t lastack;
+    u32_t snd_lbb;
+    struct netconn *conn;
+};
+
+/**
+ * @brief Reset the connection, the netconn is left without its pcb
+ */
+void tcp_abort(struct tcp_pcb *pcb);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "lwip/err.h"
+
+typedef void (*tcpip_callback_fn)(void *ctx);
+
+/**
+ * @brief Runs fn in the calling task, there is no tcpip thread
+ */
+err_t tcpip_callback(tcpip_callback_fn fn, void *ctx);
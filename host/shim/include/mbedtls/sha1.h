@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stddef.h>
+
+void mbedtls_sha1(const unsigned char* input, size_t ilen, unsigned char output[20]);
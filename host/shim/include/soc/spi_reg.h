@@ -0,0 +1,4 @@
+#pragma once
+
+// only the bit macros, as everything including it expects
+#include "soc/soc.h"
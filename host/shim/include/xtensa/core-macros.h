@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include "sdkconfig.h"
+
+// a cycle counter running at the configured CPU clock, wrapping like the real one
+static inline uint32_t XTHAL_GET_CCOUNT(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (((uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec) * CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ / 1000);
+}
@@ -0,0 +1,105 @@
+/*
+ * The two mbedTLS calls of the WebSocket handshake, so the host build
+ * needs no crypto library.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+
+static uint32_t rol(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t h[5], const unsigned char* p)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t) p[4 * i] << 24) | (p[4 * i + 1] << 16) | (p[4 * i + 2] << 8) | p[4 * i + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void mbedtls_sha1(const unsigned char* input, size_t ilen, unsigned char output[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    size_t done = 0;
+    for (; ilen - done >= 64; done += 64) {
+        sha1_block(h, input + done);
+    }
+    // padding and the length in bits, one or two more blocks
+    unsigned char tail[128] = { 0 };
+    size_t rest = ilen - done;
+    memcpy(tail, input + done, rest);
+    tail[rest] = 0x80;
+    size_t tail_len = (rest < 56) ? 64 : 128;
+    uint64_t bits = (uint64_t) ilen * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[tail_len - 1 - i] = bits >> (8 * i);
+    }
+    for (size_t i = 0; i < tail_len; i += 64) {
+        sha1_block(h, tail + i);
+    }
+    for (int i = 0; i < 20; i++) {
+        output[i] = h[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
+
+int mbedtls_base64_encode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t need = (slen + 2) / 3 * 4 + 1;
+    if (dlen < need) {
+        *olen = need;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+    unsigned char* p = dst;
+    for (size_t i = 0; i < slen; i += 3) {
+        uint32_t v = src[i] << 16;
+        if (i + 1 < slen) {
+            v |= src[i + 1] << 8;
+        }
+        if (i + 2 < slen) {
+            v |= src[i + 2];
+        }
+        *p++ = alphabet[(v >> 18) & 63];
+        *p++ = alphabet[(v >> 12) & 63];
+        *p++ = (i + 1 < slen) ? alphabet[(v >> 6) & 63] : '=';
+        *p++ = (i + 2 < slen) ? alphabet[v & 63] : '=';
+    }
+    *p = '\0';
+    *olen = p - dst;
+    return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * The lwIP netconn calls of the HTTP server on POSIX sockets, see
+ * lwip/api.h for what differs.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "sdkconfig.h"
+#include "lwip/api.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+
+int netconn_port_offset = 8000;
+
+static err_t errno_to_err(int error)
+{
+    switch (error) {
+    case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+        return ERR_WOULDBLOCK;
+    case ECONNRESET:
+    case EPIPE:
+        return ERR_RST;
+    case ENOMEM:
+    case ENOBUFS:
+        return ERR_MEM;
+    case EADDRINUSE:
+        return ERR_USE;
+    default:
+        return ERR_CLSD;
+    }
+}
+
+static struct netconn *conn_new(int fd)
+{
+    struct netconn *conn = (struct netconn*) calloc(1, sizeof(struct netconn));
+    struct tcp_pcb *pcb = (struct tcp_pcb*) calloc(1, sizeof(struct tcp_pcb));
+    if (conn == NULL || pcb == NULL) {
+        free(conn);
+        free(pcb);
+        return NULL;
+    }
+    conn->type = NETCONN_TCP;
+    conn->fd = fd;
+    conn->pcb.tcp = pcb;
+    pcb->conn = conn;
+    return conn;
+}
+
+struct netconn *netconn_new(enum netconn_type type)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct netconn *conn = conn_new(fd);
+    if (conn == NULL) {
+        close(fd);
+    }
+    return conn;
+}
+
+err_t netconn_delete(struct netconn *conn)
+{
+    if (conn == NULL) {
+        return ERR_ARG;
+    }
+    if (conn->fd >= 0) {
+        close(conn->fd);
+    }
+    free(conn->pcb.tcp);
+    free(conn);
+    return ERR_OK;
+}
+
+err_t netconn_bind(struct netconn *conn, const ip_addr_t *addr, u16_t port)
+{
+    int one = 1;
+    setsockopt(conn->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port + netconn_port_offset),
+        // IP_ADDR_ANY would expose the test server, the loopback is enough
+        .sin_addr.s_addr = addr != NULL ? addr->addr : htonl(INADDR_LOOPBACK),
+    };
+    if (bind(conn->fd, (struct sockaddr*) &sa, sizeof(sa)) != 0) {
+        fprintf(stderr, "bind to port %d: %s\n", port + netconn_port_offset, strerror(errno));
+        return errno_to_err(errno);
+    }
+    return ERR_OK;
+}
+
+err_t netconn_listen(struct netconn *conn)
+{
+    return listen(conn->fd, SOMAXCONN) == 0 ? ERR_OK : errno_to_err(errno);
+}
+
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn)
+{
+    int fd;
+    do {
+        fd = accept(conn->fd, NULL, NULL);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        return ERR_ABRT;
+    }
+    // as small as the lwIP send buffer, so slow readers push back as early
+    int sndbuf = CONFIG_TCP_SND_BUF_DEFAULT;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    *new_conn = conn_new(fd);
+    if (*new_conn == NULL) {
+        close(fd);
+        return ERR_MEM;
+    }
+    return ERR_OK;
+}
+
+err_t netconn_recv(struct netconn *conn, struct netbuf **new_buf)
+{
+    *new_buf = NULL;
+    if (conn->fd < 0) {
+        return ERR_ABRT;
+    }
+    struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, conn->recv_timeout > 0 ? conn->recv_timeout : -1);
+    } while (ready < 0 && errno == EINTR);
+    if (ready == 0) {
+        return ERR_TIMEOUT;
+    }
+    struct netbuf *buf = (struct netbuf*) malloc(sizeof(struct netbuf) + CONFIG_TCP_MSS);
+    if (buf == NULL) {
+        return ERR_MEM;
+    }
+    // at most a segment, as lwIP hands them over
+    buf->data = (u8_t*) (buf + 1);
+    ssize_t n = recv(conn->fd, buf->data, CONFIG_TCP_MSS, 0);
+    if (n <= 0) {
+        free(buf);
+        return n == 0 ? ERR_CLSD : errno_to_err(errno);
+    }
+    buf->len = n;
+    *new_buf = buf;
+    return ERR_OK;
+}
+
+err_t netconn_write(struct netconn *conn, const void *data, size_t size, u8_t flags)
+{
+    struct tcp_pcb *pcb = conn->pcb.tcp;
+    if (pcb == NULL || conn->fd < 0) {
+        return ERR_CONN;
+    }
+    const u8_t *p = (const u8_t*) data;
+    while (size > 0) {
+        ssize_t n = send(conn->fd, p, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno_to_err(errno);
+        }
+        // copied by the kernel, so as good as acknowledged for the caller's buffers
+        pcb->snd_lbb += n;
+        pcb->lastack = pcb->snd_lbb;
+        p += n;
+        size -= n;
+    }
+    return ERR_OK;
+}
+
+err_t netconn_close(struct netconn *conn)
+{
+    if (conn->fd >= 0) {
+        shutdown(conn->fd, SHUT_WR);
+    }
+    return ERR_OK;
+}
+
+void netconn_set_recvtimeout(struct netconn *conn, int timeout_ms)
+{
+    conn->recv_timeout = timeout_ms;
+}
+
+void netconn_set_sendtimeout(struct netconn *conn, int timeout_ms)
+{
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    conn->send_timeout = timeout_ms;
+    if (conn->fd >= 0) {
+        setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+}
+
+err_t netbuf_data(struct netbuf *buf, void **data, u16_t *len)
+{
+    *data = buf->data;
+    *len = buf->len;
+    return ERR_OK;
+}
+
+s8_t netbuf_next(struct netbuf *buf)
+{
+    // one segment per netbuf, there is no next fragment
+    return -1;
+}
+
+void netbuf_delete(struct netbuf *buf)
+{
+    free(buf);
+}
+
+char *ipaddr_ntoa(const ip_addr_t *addr)
+{
+    static char s_str[16];
+    struct in_addr in = { .s_addr = addr->addr };
+    return inet_ntop(AF_INET, &in, s_str, sizeof(s_str)) != NULL ? s_str : NULL;
+}
+
+void tcp_abort(struct tcp_pcb *pcb)
+{
+    struct netconn *conn = pcb->conn;
+    // a zero linger time makes close send a reset
+    struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+    setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close(conn->fd);
+    conn->fd = -1;
+    conn->pcb.tcp = NULL;
+    free(pcb);
+}
+
+err_t tcpip_callback(tcpip_callback_fn fn, void *ctx)
+{
+    fn(ctx);
+    return ERR_OK;
+}
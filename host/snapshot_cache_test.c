@@ -0,0 +1,223 @@
+// Unit tests for the snapshot cache of main/, run on the host:
+//
+//   make -C host test
+//
+// The cache is built against the FreeRTOS shim and set up once with a
+// cap of CAP bytes, so every test starts from frames newer than the last.
+// Prints every failed check and exits non-zero if there was one.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot_cache.h"
+
+#define CAP 1000
+
+static int s_checks;
+static int s_failed;
+static uint32_t s_seq;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) check_eq((long) (a), (long) (b), #a, #b, __FILE__, __LINE__)
+
+static void check(int ok, const char* what, const char* file, int line)
+{
+    s_checks++;
+    if (!ok) {
+        s_failed++;
+        printf("%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+static void check_eq(long a, long b, const char* sa, const char* sb, const char* file, int line)
+{
+    s_checks++;
+    if (a != b) {
+        s_failed++;
+        printf("%s:%d: %s == %s failed: %ld != %ld\n", file, line, sa, sb, a, b);
+    }
+}
+
+static snap_key_t key(uint32_t seq, uint8_t format)
+{
+    snap_key_t k = { .seq = seq, .width = 160, .height = 120, .format = format };
+    return k;
+}
+
+// an entry filled with format, put into the cache; the caller keeps a reference
+static snap_entry_t* put(uint32_t seq, uint8_t format, size_t size)
+{
+    snap_key_t k = key(seq, format);
+    snap_entry_t* entry = snap_cache_new(&k, size);
+    if (entry == NULL) {
+        return NULL;
+    }
+    memset(entry->data, format, size);
+    entry->len = size;
+    snap_cache_put(entry);
+    return entry;
+}
+
+// whether format of frame seq is cached, without keeping the reference
+static bool cached(uint32_t seq, uint8_t format)
+{
+    snap_key_t k = key(seq, format);
+    snap_entry_t* entry = snap_cache_get(&k);
+    if (entry == NULL) {
+        return false;
+    }
+    snap_cache_release(entry);
+    return true;
+}
+
+static void test_get_put()
+{
+    const uint32_t seq = ++s_seq;
+    snap_key_t k = key(seq, 1);
+    CHECK(snap_cache_get(&k) == NULL);
+    CHECK(snap_cache_new(&k, CAP + 1) == NULL);
+
+    snap_entry_t* entry = put(seq, 1, 300);
+    CHECK(entry != NULL && entry->cached);
+    CHECK_EQ(snap_cache_bytes(), 300);
+    snap_entry_t* hit = snap_cache_get(&k);
+    CHECK(hit == entry);
+    CHECK_EQ(entry->refcount, 3);
+    CHECK_EQ(hit->data[299], 1);
+    snap_cache_release(hit);
+    snap_cache_release(entry);
+    CHECK_EQ(entry->refcount, 1);
+
+    // another quality is another output
+    k.quality = 50;
+    CHECK(snap_cache_get(&k) == NULL);
+
+    // encoded twice at the same time, the first one stays
+    snap_entry_t* twice = put(seq, 1, 300);
+    CHECK(twice != NULL && !twice->cached);
+    CHECK_EQ(snap_cache_bytes(), 300);
+    snap_cache_release(twice);
+}
+
+static void test_lru()
+{
+    const uint32_t seq = ++s_seq;
+    snap_entry_t* a = put(seq, 1, 300);
+    snap_entry_t* b = put(seq, 2, 300);
+    snap_entry_t* c = put(seq, 3, 300);
+    CHECK_EQ(snap_cache_bytes(), 900);
+    // a was used last, b is the least recently used now
+    CHECK(cached(seq, 1));
+    snap_entry_t* d = put(seq, 4, 300);
+    CHECK(!b->cached);
+    CHECK(!cached(seq, 2));
+    CHECK(cached(seq, 1));
+    CHECK(cached(seq, 3));
+    CHECK(cached(seq, 4));
+    CHECK_EQ(snap_cache_bytes(), 900);
+
+    // an evicted entry stays valid for whoever still holds it
+    CHECK_EQ(b->refcount, 1);
+    CHECK_EQ(b->data[0], 2);
+    CHECK_EQ(b->data[299], 2);
+    snap_cache_release(b);
+
+    // one large entry pushes out as many as it takes, oldest first
+    snap_entry_t* e = put(seq, 5, 600);
+    CHECK(e->cached);
+    CHECK(!c->cached);
+    CHECK(!a->cached);
+    CHECK(d->cached);
+    CHECK_EQ(snap_cache_bytes(), 900);
+    snap_cache_release(a);
+    snap_cache_release(c);
+    snap_cache_release(d);
+    snap_cache_release(e);
+}
+
+static void test_max_entries()
+{
+    const uint32_t seq = ++s_seq;
+    // more entries than slots, all small enough to fit the cap
+    for (int i = 1; i <= 9; i++) {
+        snap_cache_release(put(seq, i, 10));
+    }
+    CHECK(!cached(seq, 1));
+    for (int i = 2; i <= 9; i++) {
+        CHECK(cached(seq, i));
+    }
+    CHECK_EQ(snap_cache_bytes(), 80);
+}
+
+static void test_age_out()
+{
+    const uint32_t seq = ++s_seq;
+    snap_entry_t* held = put(seq, 1, 200);
+    snap_cache_release(put(seq, 2, 200));
+    CHECK_EQ(snap_cache_bytes(), 400);
+
+    // a lookup for the next frame drops everything of this one
+    CHECK(!cached(seq + 1, 1));
+    CHECK_EQ(snap_cache_bytes(), 0);
+    CHECK(!held->cached);
+    CHECK_EQ(held->data[199], 1);
+    // and nobody asks for it again
+    CHECK(!cached(seq, 2));
+
+    // a request which took a while finishes after the newer frame came in
+    snap_entry_t* late = put(seq, 3, 100);
+    CHECK(late != NULL && !late->cached);
+    CHECK_EQ(snap_cache_bytes(), 0);
+    snap_cache_release(late);
+    snap_cache_release(held);
+    s_seq++;
+
+    // a newer frame's entry ages out the older ones
+    snap_cache_release(put(s_seq, 1, 100));
+    snap_cache_release(put(s_seq + 1, 1, 100));
+    s_seq++;
+    CHECK(!cached(s_seq - 1, 1));
+    CHECK(cached(s_seq, 1));
+    CHECK_EQ(snap_cache_bytes(), 100);
+}
+
+static void test_append()
+{
+    const uint32_t seq = ++s_seq;
+    snap_key_t k = key(seq, 7);
+    uint8_t data[400];
+    memset(data, 7, sizeof(data));
+
+    // grows past the size it started with
+    snap_entry_t* entry = snap_cache_new(&k, 16);
+    CHECK(snap_cache_append(&entry, data, 300));
+    CHECK(snap_cache_append(&entry, data, 400));
+    CHECK(entry != NULL && entry->len == 700 && entry->size >= 700 && entry->size <= CAP);
+    snap_cache_put(entry);
+    CHECK(entry->cached);
+    CHECK(cached(seq, 7));
+    snap_cache_release(entry);
+
+    // past the cap it is given up
+    k.format = 8;
+    entry = snap_cache_new(&k, 16);
+    CHECK(snap_cache_append(&entry, data, 400));
+    CHECK(snap_cache_append(&entry, data, 400));
+    CHECK(!snap_cache_append(&entry, data, 400));
+    CHECK(entry == NULL);
+    CHECK(!cached(seq, 8));
+}
+
+int main()
+{
+    if (snap_cache_init(CAP) != ESP_OK) {
+        printf("snap_cache_init failed\n");
+        return 1;
+    }
+    test_get_put();
+    test_lru();
+    test_max_entries();
+    test_age_out();
+    test_append();
+    printf("%d checks, %d failed\n", s_checks, s_failed);
+    return s_failed ? 1 : 0;
+}
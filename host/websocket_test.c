@@ -0,0 +1,268 @@
+// Unit tests for the WebSocket framing of main/, run on the host:
+//
+//   make -C host test
+//
+// Client frames are fed to the parser byte by byte and in larger pieces.
+// Prints every failed check and exits non-zero if there was one.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "websocket.h"
+
+static int s_checks;
+static int s_failed;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) check_eq((long) (a), (long) (b), #a, #b, __FILE__, __LINE__)
+
+static void check(int ok, const char* what, const char* file, int line)
+{
+    s_checks++;
+    if (!ok) {
+        s_failed++;
+        printf("%s:%d: check failed: %s\n", file, line, what);
+    }
+}
+
+static void check_eq(long a, long b, const char* sa, const char* sb, const char* file, int line)
+{
+    s_checks++;
+    if (a != b) {
+        s_failed++;
+        printf("%s:%d: %s == %s failed: %ld != %ld\n", file, line, sa, sb, a, b);
+    }
+}
+
+// length encodings of a client frame
+enum {
+    LEN_SHORTEST,
+    LEN_16,
+    LEN_64,
+};
+
+static const uint8_t s_mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+// appends a masked client frame to out, returns its size
+static size_t client_frame(uint8_t* out, int opcode, bool fin, const void* payload, size_t len, int len_form)
+{
+    size_t n;
+    if (len_form == LEN_SHORTEST) {
+        n = ws_frame_header(out, opcode, fin, len);
+    } else {
+        out[0] = (fin ? 0x80 : 0) | opcode;
+        out[1] = (len_form == LEN_16) ? 126 : 127;
+        n = (len_form == LEN_16) ? 4 : 10;
+        for (size_t i = 2; i < n; i++) {
+            out[i] = (uint8_t) ((uint64_t) len >> (8 * (n - 1 - i)));
+        }
+    }
+    out[1] |= 0x80;
+    memcpy(out + n, s_mask, 4);
+    n += 4;
+    for (size_t i = 0; i < len; i++) {
+        out[n + i] = ((const uint8_t*) payload)[i] ^ s_mask[i & 3];
+    }
+    return n + len;
+}
+
+typedef struct {
+    int opcode;
+    uint8_t payload[WS_MESSAGE_MAX];
+    size_t len;
+} message_t;
+
+/*
+ * Feeds data in pieces of step bytes and collects up to max messages.
+ * Returns the number of messages, or -close_code on a parse error.
+ */
+static int parse(const uint8_t* data, size_t len, size_t step, message_t* msgs, int max)
+{
+    ws_parser_t* ws = (ws_parser_t*) malloc(sizeof(ws_parser_t));
+    ws_parser_init(ws);
+    int count = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        size_t end = (len - pos < step) ? len : pos + step;
+        while (pos < end) {
+            size_t avail = end - pos;
+            size_t consumed;
+            ws_parse_result_t r = ws_parse(ws, data + pos, avail, &consumed);
+            pos += consumed;
+            if (r == WS_PARSE_ERROR) {
+                int code = ws->close_code;
+                free(ws);
+                return -code;
+            }
+            if (r == WS_PARSE_MESSAGE && count < max) {
+                msgs[count].opcode = ws->opcode;
+                memcpy(msgs[count].payload, ws->payload, ws->payload_len);
+                msgs[count].len = ws->payload_len;
+                count++;
+            } else if (r == WS_PARSE_MORE && consumed != avail) {
+                printf("parser left input without a message\n");
+                free(ws);
+                return -1;
+            }
+        }
+    }
+    free(ws);
+    return count;
+}
+
+// parses at a few piece sizes, they must all agree; msgs holds those of the last
+static int parse_all(const uint8_t* data, size_t len, message_t* msgs, int max)
+{
+    int first = parse(data, len, 1, msgs, max);
+    static const size_t steps[] = { 3, 7, 64 };
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        CHECK_EQ(parse(data, len, steps[i], msgs, max), first);
+    }
+    return parse(data, len, len, msgs, max);
+}
+
+static void test_handshake()
+{
+    char key[WS_ACCEPT_KEY_LEN + 1];
+    // the example of RFC 6455 section 1.3
+    CHECK(ws_accept_key("dGhlIHNhbXBsZSBub25jZQ==", key, sizeof(key)));
+    CHECK(strcmp(key, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+    CHECK(!ws_accept_key("", key, sizeof(key)));
+    CHECK(!ws_accept_key("dGhlIHNhbXBsZSBub25jZQ==", key, WS_ACCEPT_KEY_LEN));
+}
+
+static void test_server_header()
+{
+    uint8_t h[WS_HEADER_MAX];
+    CHECK_EQ(ws_frame_header(h, WS_OP_BINARY, true, 125), 2);
+    CHECK_EQ(h[0], 0x82);
+    CHECK_EQ(h[1], 125);
+    CHECK_EQ(ws_frame_header(h, WS_OP_CONTINUATION, false, 126), 4);
+    CHECK_EQ(h[0], 0x00);
+    CHECK_EQ(h[1], 126);
+    CHECK_EQ(h[2] << 8 | h[3], 126);
+    CHECK_EQ(ws_frame_header(h, WS_OP_BINARY, false, 0x10000), 10);
+    CHECK_EQ(h[1], 127);
+    CHECK_EQ(h[7], 1);
+    CHECK_EQ(h[8] | h[9], 0);
+}
+
+static void test_masking()
+{
+    // the masked "Hello" of RFC 6455 section 5.7
+    static const uint8_t hello[] = { 0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58 };
+    message_t msgs[4];
+    CHECK_EQ(parse_all(hello, sizeof(hello), msgs, 4), 1);
+    CHECK_EQ(msgs[0].opcode, WS_OP_TEXT);
+    CHECK_EQ(msgs[0].len, 5);
+    CHECK(memcmp(msgs[0].payload, "Hello", 5) == 0);
+
+    // clients must mask
+    uint8_t frame[32];
+    size_t n = client_frame(frame, WS_OP_TEXT, true, "Hello", 5, LEN_SHORTEST);
+    frame[1] &= 0x7f;
+    memmove(frame + 2, frame + 6, n - 6);
+    CHECK_EQ(parse_all(frame, n - 4, msgs, 4), -WS_CLOSE_PROTOCOL);
+}
+
+static void test_lengths()
+{
+    uint8_t payload[WS_MESSAGE_MAX + 1];
+    uint8_t data[4 * (WS_MESSAGE_MAX + 16)];
+    message_t msgs[4];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t) (i * 7);
+    }
+    // the longest message in 16 and 64 bit lengths, and a short one in 64 bits
+    size_t n = client_frame(data, WS_OP_BINARY, true, payload, WS_MESSAGE_MAX, LEN_16);
+    n += client_frame(data + n, WS_OP_BINARY, true, payload, WS_MESSAGE_MAX, LEN_64);
+    n += client_frame(data + n, WS_OP_TEXT, true, payload, 3, LEN_64);
+    n += client_frame(data + n, WS_OP_BINARY, true, NULL, 0, LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), 4);
+    CHECK_EQ(msgs[0].len, WS_MESSAGE_MAX);
+    CHECK(memcmp(msgs[0].payload, payload, WS_MESSAGE_MAX) == 0);
+    CHECK_EQ(msgs[1].len, WS_MESSAGE_MAX);
+    CHECK(memcmp(msgs[1].payload, payload, WS_MESSAGE_MAX) == 0);
+    CHECK_EQ(msgs[2].opcode, WS_OP_TEXT);
+    CHECK_EQ(msgs[2].len, 3);
+    CHECK_EQ(msgs[3].len, 0);
+
+    // one byte too many is refused as soon as the header says so
+    n = client_frame(data, WS_OP_BINARY, true, payload, WS_MESSAGE_MAX + 1, LEN_16);
+    CHECK_EQ(parse_all(data, 8, msgs, 4), -WS_CLOSE_TOO_BIG);
+    // as is a 64 bit length no buffer could hold
+    static const uint8_t huge[] = { 0x82, 0xff, 0, 0, 1, 0, 0, 0, 0, 0, 1, 2, 3, 4 };
+    CHECK_EQ(parse_all(huge, sizeof(huge), msgs, 4), -WS_CLOSE_TOO_BIG);
+}
+
+static void test_fragments()
+{
+    uint8_t data[256];
+    message_t msgs[4];
+    // a message in three fragments with a ping and a pong between them
+    size_t n = client_frame(data, WS_OP_TEXT, false, "fps=", 4, LEN_SHORTEST);
+    n += client_frame(data + n, WS_OP_PING, true, "ping", 4, LEN_SHORTEST);
+    n += client_frame(data + n, WS_OP_CONTINUATION, false, "12&format=", 10, LEN_16);
+    n += client_frame(data + n, WS_OP_PONG, true, NULL, 0, LEN_SHORTEST);
+    n += client_frame(data + n, WS_OP_CONTINUATION, true, "jpg", 3, LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), 3);
+    CHECK_EQ(msgs[0].opcode, WS_OP_PING);
+    CHECK_EQ(msgs[0].len, 4);
+    CHECK(memcmp(msgs[0].payload, "ping", 4) == 0);
+    CHECK_EQ(msgs[1].opcode, WS_OP_PONG);
+    CHECK_EQ(msgs[1].len, 0);
+    CHECK_EQ(msgs[2].opcode, WS_OP_TEXT);
+    CHECK_EQ(msgs[2].len, 17);
+    CHECK(memcmp(msgs[2].payload, "fps=12&format=jpg", 17) == 0);
+
+    // a close frame with its status code
+    static const uint8_t code[] = { WS_CLOSE_NORMAL >> 8, WS_CLOSE_NORMAL & 0xff };
+    n = client_frame(data, WS_OP_CLOSE, true, code, 2, LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), 1);
+    CHECK_EQ(msgs[0].opcode, WS_OP_CLOSE);
+    CHECK_EQ(msgs[0].payload[0] << 8 | msgs[0].payload[1], WS_CLOSE_NORMAL);
+
+    // fragments adding up to more than a message may hold
+    uint8_t payload[WS_MESSAGE_MAX] = { 0 };
+    n = client_frame(data, WS_OP_BINARY, false, payload, WS_MESSAGE_MAX - 1, LEN_SHORTEST);
+    n += client_frame(data + n, WS_OP_CONTINUATION, true, payload, 2, LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), -WS_CLOSE_TOO_BIG);
+}
+
+static void test_protocol_errors()
+{
+    uint8_t data[256];
+    message_t msgs[4];
+    // a continuation with nothing to continue
+    size_t n = client_frame(data, WS_OP_CONTINUATION, true, "x", 1, LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), -WS_CLOSE_PROTOCOL);
+    // a new message before the last one was finished
+    n = client_frame(data, WS_OP_TEXT, false, "a", 1, LEN_SHORTEST);
+    n += client_frame(data + n, WS_OP_TEXT, true, "b", 1, LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), -WS_CLOSE_PROTOCOL);
+    // fragmented and oversized control frames
+    n = client_frame(data, WS_OP_PING, false, "a", 1, LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), -WS_CLOSE_PROTOCOL);
+    uint8_t payload[126] = { 0 };
+    n = client_frame(data, WS_OP_PING, true, payload, sizeof(payload), LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), -WS_CLOSE_PROTOCOL);
+    // reserved bits without an extension, reserved opcodes
+    n = client_frame(data, WS_OP_TEXT, true, "a", 1, LEN_SHORTEST);
+    data[0] |= 0x40;
+    CHECK_EQ(parse_all(data, n, msgs, 4), -WS_CLOSE_PROTOCOL);
+    n = client_frame(data, 0x3, true, "a", 1, LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), -WS_CLOSE_PROTOCOL);
+    n = client_frame(data, 0xb, true, "a", 1, LEN_SHORTEST);
+    CHECK_EQ(parse_all(data, n, msgs, 4), -WS_CLOSE_PROTOCOL);
+}
+
+int main()
+{
+    test_handshake();
+    test_server_header();
+    test_masking();
+    test_lengths();
+    test_fragments();
+    test_protocol_errors();
+    printf("%d checks, %d failed\n", s_checks, s_failed);
+    return s_failed ? 1 : 0;
+}
@@ -17,10 +17,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <byteswap.h>
+#include <sys/time.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
 
 #include "esp_heap_caps.h"
 #include "esp_system.h"
@@ -34,6 +36,7 @@
 #include "driver/hspi.h"
 #include "soc/gpio_reg.h"
 #include "esp_attr.h"
+#include "xtensa/core-macros.h"
 
 #include "soc/gpio_struct.h"
 #include "freertos/semphr.h"
@@ -44,12 +47,69 @@
 #include "lwip/netdb.h"
 #include "lwip/api.h"
 #include "bitmap.h"
+#include "image_convert.h"
+#include "jpeg_stream.h"
+#include "recorder.h"
+#include "broadcaster.h"
+#include "cr_codec.h"
+#include "qoi_encoder.h"
+#include "rate_ctrl.h"
+#include "stream_adapt.h"
+#include "tx_ring.h"
+#include "http_parser.h"
+#include "rtsp_server.h"
+#include "websocket.h"
+#include "metrics.h"
+#include "camera_trace.h"
+#include "frame_etag.h"
+#include "snapshot_cache.h"
 
 #define WIFI_PASSWORD CONFIG_WIFI_PASSWORD
 #define WIFI_SSID     CONFIG_WIFI_SSID
 #define CAMERA_PIXEL_FORMAT CAMERA_PF_RGB565
 //#define CAMERA_PIXEL_FORMAT CAMERA_PF_YUV422
+#if CONFIG_CAMERA_STRIP_ONLY
+// no framebuffer, frames only exist as software JPEG, so the size is only limited by the strips
+#define CAMERA_STRIP_ONLY true
+#define CAMERA_FRAME_SIZE CAMERA_FS_VGA
+#else
+#define CAMERA_STRIP_ONLY false
 #define CAMERA_FRAME_SIZE CAMERA_FS_QQVGA
+#endif
+// quality of the software JPEG encoder, where rate control starts each connection
+#define CAMERA_JPEG_QUALITY 15
+
+#define RATE_CTRL_HYSTERESIS_PCT 15
+#define RATE_CTRL_SETTLE_FRAMES  1
+// OV2640 QS register: lower is better, below 10 VGA frames outgrow the framebuffer
+#define OV2640_QS_BEST           10
+#define OV2640_QS_WORST          63
+#define SW_JPEG_QUALITY_BEST     90
+#define SW_JPEG_QUALITY_WORST    5
+#define HTTP_WORKERS CONFIG_HTTP_WORKERS
+#define HTTP_BACKLOG CONFIG_HTTP_BACKLOG
+#define HTTP_RECV_TIMEOUT_MS 5000
+// idle time allowed between requests on a kept-alive connection
+#define HTTP_KEEPALIVE_TIMEOUT_MS 2000
+#define HTTP_KEEPALIVE_MAX_REQUESTS 100
+// responses go out in chunks of whole segments, see tx_ring.h
+#define HTTP_TX_CHUNK_SIZE (CONFIG_HTTP_TX_CHUNK_MSS * CONFIG_TCP_MSS)
+#define HTTP_TX_END_TIMEOUT_MS 5000
+#define STREAM_SEND_CHUNK (2 * CONFIG_TCP_MSS)
+#define STREAM_FRAME_TIMEOUT_MS 5000
+// a viewer whose socket takes nothing for this long is dropped, it would pin its frame
+#define STREAM_SEND_TIMEOUT_MS 3000
+// frames an adaptive stream stays on an encoding before trying a larger one
+#define STREAM_ADAPT_HOLD_FRAMES 10
+// an adaptive stream measures goodput over this much, the send buffer takes a few frames at once
+#define STREAM_ADAPT_WINDOW_BYTES (4 * CONFIG_TCP_SND_BUF_DEFAULT)
+// how often a long-polled snapshot looks for a changed frame
+#define SNAPSHOT_POLL_MS 50
+
+// conditional replenishment stream (/cr, /crstream)
+#define CR_BLOCK_SIZE 8
+#define CR_THRESHOLD 6
+#define CR_KEYFRAME_INTERVAL 100
 
 static const char* TAG = "ESP-CAM";
 static EventGroupHandle_t espilicam_event_group;
@@ -100,57 +160,9 @@ static camera_config_t config = {
 static camera_model_t camera_model;
 
 
-// DISPLAY LOGIC
-static inline uint8_t clamp(int n)
-{
-    n = n>255 ? 255 : n;
-    return n<0 ? 0 : n;
-}
-
-// Pass 8-bit (each) R,G,B, get back 16-bit packed color
-static inline uint16_t ILI9341_color565(uint8_t r, uint8_t g, uint8_t b) {
-  return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
-}
-
-uint16_t get_grayscale_pixel_as_565(uint8_t pix) {
-    // R = (img[n]&248)<<8; // 5 bit cao cua Y
-    // G = (img[n]&252)<<3; // 6 bit cao cua Y
-    // B = (img[n]&248)>>3; // 5 bit cao cua Y
-    uint16_t graypixel=((pix&248)<<8)|((pix&252)<<3)|((pix&248)>>3);
-    return graypixel;
-
-}
-
-// integers instead of floating point...
-static inline uint16_t fast_yuv_to_rgb565(int y, int u, int v) {
-int a0 = 1192 * (y - 16);
-int a1 = 1634 * (v - 128);
-int a2 = 832 * (v - 128);
-int a3 = 400 * (u - 128);
-int a4 = 2066 * (u - 128);
-int r = (a0 + a1) >> 10;
-int g = (a0 - a2 - a3) >> 10;
-int b = (a0 + a4) >> 10;
-return ILI9341_color565(clamp(r),clamp(g),clamp(b));
-
-}
-
-// fast but uses floating points...
-static inline uint16_t fast_pascal_to_565(int Y, int U, int V) {
-  uint8_t r, g, b;
-  r = clamp(1.164*(Y-16) + 1.596*(V-128));
-  g = clamp(1.164*(Y-16) - 0.392*(U-128) - 0.813*(V-128));
-  b = clamp(1.164*(Y-16) + 2.017*(U-128));
-  return ILI9341_color565(r,g,b);
-}
-
 //Warning: This gets squeezed into IRAM.
 volatile static uint32_t *currFbPtr __attribute__ ((aligned(4))) = NULL;
 
-inline uint8_t unpack(int byteNumber, uint32_t value) {
-    return (value >> (byteNumber * 8));
-}
-
 // camera code
 
 const static char http_hdr[] = "HTTP/1.1 200 OK\r\n";
@@ -165,6 +177,45 @@ const static char http_bitmap_hdr[] =
         "Content-type: image/bitmap\r\n\r\n";
 const static char http_yuv422_hdr[] =
         "Content-Disposition: attachment; Content-type: application/octet-stream\r\n\r\n";
+const static char http_octet_stream_hdr[] =
+        "Content-type: application/octet-stream\r\n\r\n";
+const static char http_qoi_hdr[] =
+        "Content-type: image/qoi\r\n\r\n";
+const static char http_html_hdr[] =
+        "Content-type: text/html\r\n\r\n";
+const static char http_text_hdr[] =
+        "Content-type: text/plain\r\n\r\n";
+const static char http_json_hdr[] =
+        "Content-type: application/json\r\n\r\n";
+const static char http_metrics_hdr[] =
+        "Content-type: text/plain; version=0.0.4\r\n\r\n";
+const static char http_avi_hdr[] =
+        "Content-type: video/x-msvideo\r\n\r\n";
+const static char http_not_modified_hdr[] = "HTTP/1.1 304 Not Modified\r\n";
+const static char http_busy_hdr[] =
+        "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\n\r\n";
+
+extern const char cr_viewer_html_start[] asm("_binary_cr_viewer_html_start");
+extern const char cr_viewer_html_end[]   asm("_binary_cr_viewer_html_end");
+extern const char fb_viewer_html_start[] asm("_binary_fb_viewer_html_start");
+extern const char fb_viewer_html_end[]   asm("_binary_fb_viewer_html_end");
+
+// per connection state, handed from the accept loop to a worker
+typedef struct {
+    struct netconn *conn;
+    int worker;                 // index of the worker serving it, -1 while queued
+    uint32_t accepted_ms;
+    tx_ring_t *tx;              // transmit chunks of the worker
+    struct netbuf *inbuf;       // received data not parsed yet, may hold the next request
+    u16_t in_offset;            // into the current fragment of inbuf
+    bool keep_alive;            // the response being sent leaves the connection open
+    int requests;
+    char etag[FRAME_ETAG_LEN];  // sent with the response headers if not empty
+    int jpeg_quality;           // of the software encoder, moved by rate
+    rate_ctrl_t *rate;          // controller of the worker, NULL without rate control
+} http_conn_t;
+
+static QueueHandle_t s_http_queue = NULL;
 
 static EventGroupHandle_t wifi_event_group;
 const int CONNECTED_BIT = BIT0;
@@ -236,252 +287,1783 @@ uint8_t getHexVal(char c)
      return (uint8_t)(c-'A'+10);
 }
 
-static void convert_fb32bit_line_to_bmp565(uint32_t *srcline, uint8_t *destline, const camera_pixelformat_t format) {
+// content_length of a response which never has a body, 304
+#define HTTP_NO_BODY -2
+
+/*
+ * Status line, the content type block without its blank line, then the
+ * ETag, length and connection headers. content_length -1 means the length
+ * is not known up front, the connection is closed after the response then.
+ * Everything goes through the tx ring, so it leaves together with the
+ * start of the body; handlers writing to the netconn directly have to
+ * tx_ring_flush first.
+ */
+static err_t send_response_hdr(http_conn_t *hc, const char *status, const char *type_hdr, size_t type_len,
+                               long content_length)
+{
+    char extra[112];
+    int n = 0;
+    // don't keep a worker busy with one client while others queue up
+    if (content_length == -1 || hc->requests >= HTTP_KEEPALIVE_MAX_REQUESTS ||
+        uxQueueMessagesWaiting(s_http_queue) > 0) {
+        hc->keep_alive = false;
+    }
+    if (hc->etag[0] != '\0') {
+        n += snprintf(extra + n, sizeof(extra) - n, "ETag: %s\r\n", hc->etag);
+    }
+    if (content_length >= 0) {
+        n += snprintf(extra + n, sizeof(extra) - n, "Content-Length: %ld\r\n", content_length);
+    }
+    n += snprintf(extra + n, sizeof(extra) - n, "Connection: %s\r\n\r\n", hc->keep_alive ? "keep-alive" : "close");
+    err_t err = tx_ring_write(hc->tx, status, strlen(status));
+    if (err == ERR_OK) {
+        err = tx_ring_write(hc->tx, type_hdr, type_len - 2);
+    }
+    if (err == ERR_OK) {
+        err = tx_ring_write(hc->tx, extra, n);
+    }
+    return err;
+}
 
-  uint16_t pixel565 = 0;
-  uint16_t pixel565_2 = 0;
-  uint32_t long2px = 0;
-  uint16_t *sptr;
-  int current_src_pos = 0, current_dest_pos = 0;
-  for ( int current_pixel_pos = 0; current_pixel_pos < 160; current_pixel_pos += 2 )
-  {
-    current_src_pos = current_pixel_pos / 2;
-    long2px = srcline[current_src_pos];
-    if (format == CAMERA_PF_YUV422) {
-        uint8_t y1, y2, u, v;
-        y1 = unpack(0,long2px);
-        v  = unpack(1,long2px);
-        y2 = unpack(2,long2px);
-        u  = unpack(3,long2px);
+#define send_ok_hdr(hc, type_hdr, content_length) \
+    send_response_hdr(hc, http_hdr, type_hdr, sizeof(type_hdr) - 1, content_length)
+
+static const char *http_reason(int status)
+{
+    switch (status) {
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 414: return "URI Too Long";
+    case 426: return "Upgrade Required";
+    case 431: return "Request Header Fields Too Large";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    default:  return "Error";
+    }
+}
+
+static err_t send_error(http_conn_t *hc, int status)
+{
+    char line[48];
+    char body[48];
+    int body_len = snprintf(body, sizeof(body), "%d %s\n", status, http_reason(status));
+    snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", status, http_reason(status));
+    err_t err = send_response_hdr(hc, line, http_text_hdr, sizeof(http_text_hdr) - 1, body_len);
+    if (err == ERR_OK) {
+        err = tx_ring_write(hc->tx, body, body_len);
+    }
+    return err;
+}
 
-        pixel565 = fast_yuv_to_rgb565(y1,u,v);
-        pixel565_2 = fast_yuv_to_rgb565(y2,u,v);
+// list of the recordings on flash, newest first
+static err_t serve_recording_list(http_conn_t *hc)
+{
+    uint32_t first, next;
+    char line[80];
+    err_t err = send_ok_hdr(hc, http_html_hdr, -1);
+    if (!recorder_get_segments(&first, &next)) {
+        return tx_ring_write(hc->tx, "Recorder is not running\n", 24);
+    }
+    for (uint32_t seq = next; seq > first && err == ERR_OK; seq--) {
+        int len = snprintf(line, sizeof(line), "<a href=\"/rec/%05u.avi\">seg%05u.avi</a><br>\n",
+                           (unsigned) seq - 1, (unsigned) seq - 1);
+        err = tx_ring_write(hc->tx, line, len);
+    }
+    return err;
+}
+
+static err_t serve_recording(http_conn_t *hc, uint32_t seq)
+{
+    size_t size;
+    FILE *file = recorder_open_segment(seq, &size);
+    if (file == NULL) {
+        return send_error(hc, 404);
+    }
+    err_t err = send_ok_hdr(hc, http_avi_hdr, size);
+    // read straight into the transmit chunks
+    size_t left = size;
+    while (err == ERR_OK && left > 0) {
+        size_t avail;
+        uint8_t *dst = tx_ring_reserve(hc->tx, &avail);
+        if (dst == NULL) {
+            err = ERR_TIMEOUT;
+            break;
+        }
+        size_t n = fread(dst, 1, (avail < left) ? avail : left, file);
+        if (n == 0) {
+            // the length is already out, the client has to notice
+            ESP_LOGW(TAG, "Recording %u ended %d bytes early", (unsigned) seq, left);
+            hc->keep_alive = false;
+            err = ERR_CLSD;
+            break;
+        }
+        left -= n;
+        err = tx_ring_commit(hc->tx, n);
+    }
+    recorder_close_segment(file);
+    return err;
+}
 
-        sptr = &destline[current_dest_pos];
-        *sptr = pixel565;
-        sptr = &destline[current_dest_pos+2];
-        *sptr = pixel565_2;
-        current_dest_pos += 4;
+// headers come from the bitmap.c cache
+static err_t write_image_header(http_conn_t *hc, image_header_format_t fmt)
+{
+    size_t len;
+    const uint8_t *hdr = image_header_get(fmt, camera_get_fb_width(), camera_get_fb_height(), &len);
+    if (hdr == NULL) {
+        return ERR_MEM;
+    }
+    return tx_ring_write(hc->tx, hdr, len);
+}
 
+// one framebuffer line to RGB565, see image_convert.h
+static void convert_fb32bit_line_to_bmp565(uint32_t *srcline, uint8_t *destline, int width, const camera_pixelformat_t format)
+{
+    if (format == CAMERA_PF_YUV422) {
+        image_yuv422_line_to_rgb565(srcline, destline, width);
     } else if (format == CAMERA_PF_RGB565) {
-      pixel565 =  (unpack(2,long2px) << 8) | unpack(3,long2px);
-      pixel565_2 = (unpack(0,long2px) << 8) | unpack(1,long2px);
+        image_fb_rgb565_line_to_rgb565(srcline, destline, width);
+    }
+}
+
+
+#if CONFIG_RATE_CTRL_ENABLE
+// the OV2640 quality is one setting for all viewers, fed once per /stream frame
+static rate_ctrl_t s_rate_ctrl;
+static SemaphoreHandle_t s_rate_lock = NULL;    // guards s_rate_ctrl and the slowest send below
+static uint32_t s_rate_sent_seq;                // /stream frame the slowest send is of
+static size_t s_rate_sent_bytes;
+static uint32_t s_rate_sent_ms;
+#endif
+
+// counts what one JPEG frame costs on the socket
+typedef struct {
+    struct netconn *conn;
+    metric_counter_t *sent;     // bytes sent by the endpoint, may be NULL
+    size_t bytes;
+    uint32_t write_ms;
+} jpeg_writer_t;
+
+static uint32_t now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static err_t jpeg_writer_write(jpeg_writer_t *w, const void *data, size_t len, u8_t flags)
+{
+    uint32_t start = now_ms();
+    TRACE_BEGIN(TRACE_SEND);
+    err_t err = netconn_write(w->conn, data, len, flags);
+    TRACE_END(TRACE_SEND);
+    w->write_ms += now_ms() - start;
+    w->bytes += len;
+    if (err == ERR_OK && w->sent != NULL) {
+        metric_add(w->sent, len);
+    }
+    return err;
+}
+
+// for the few responses written to the netconn directly, past the tx ring
+static err_t conn_write(http_conn_t *hc, const void *data, size_t len, u8_t flags)
+{
+    TRACE_BEGIN(TRACE_SEND);
+    err_t err = netconn_write(hc->conn, data, len, flags);
+    TRACE_END(TRACE_SEND);
+    if (err == ERR_OK && hc->tx->sent != NULL) {
+        metric_add(hc->tx->sent, len);
+    }
+    return err;
+}
+
+static int jpeg_writer_cb(void* arg, const uint8_t* data, size_t len)
+{
+    return jpeg_writer_write((jpeg_writer_t*) arg, data, len, NETCONN_COPY) == ERR_OK ? 0 : -1;
+}
+
+/*
+ * A viewer sent /stream frame seq. Every viewer gets the same frames, so
+ * the sensor quality follows the slowest of them: its send of a frame is
+ * reported once the next frame comes along.
+ */
+static void rate_ctrl_feed_sent(uint32_t seq, const jpeg_writer_t *w)
+{
+#if CONFIG_RATE_CTRL_ENABLE
+    xSemaphoreTake(s_rate_lock, portMAX_DELAY);
+    if (seq != s_rate_sent_seq) {
+        rate_ctrl_sent(&s_rate_ctrl, s_rate_sent_bytes, s_rate_sent_ms);
+        s_rate_sent_seq = seq;
+        s_rate_sent_bytes = 0;
+    }
+    if (s_rate_sent_bytes == 0 || w->write_ms > s_rate_sent_ms) {
+        s_rate_sent_bytes = w->bytes;
+        s_rate_sent_ms = w->write_ms;
+    }
+    xSemaphoreGive(s_rate_lock);
+#endif
+}
+
+// a sensor JPEG frame was rendered for /stream
+static void rate_ctrl_feed_frame(size_t frame_bytes, uint32_t timestamp_ms)
+{
+#if CONFIG_RATE_CTRL_ENABLE
+    xSemaphoreTake(s_rate_lock, portMAX_DELAY);
+    rate_ctrl_frame(&s_rate_ctrl, frame_bytes, timestamp_ms);
+    xSemaphoreGive(s_rate_lock);
+#endif
+}
+
+// a software JPEG frame went out, let the connection's controller pick the quality of the next one
+static void rate_ctrl_feed(http_conn_t *hc, const jpeg_writer_t *w)
+{
+#if CONFIG_RATE_CTRL_ENABLE
+    if (hc->rate != NULL) {
+        rate_ctrl_sent(hc->rate, w->bytes, w->write_ms);
+        rate_ctrl_frame(hc->rate, w->bytes, now_ms());
+    }
+#endif
+}
+
+#if CONFIG_RATE_CTRL_ENABLE
+static int apply_sensor_quality(void* arg, int quality)
+{
+    // not in the middle of a frame, nor while another task talks to the sensor
+    sensor_t *sensor = get_cam_sensor();
+    camera_lock();
+    int ret = sensor->set_quality(sensor, quality);
+    camera_unlock();
+    return ret;
+}
+
+static int apply_sw_quality(void* arg, int quality)
+{
+    ((http_conn_t*) arg)->jpeg_quality = quality;
+    return 0;
+}
+
+static void rate_ctrl_config_defaults(rate_ctrl_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->target_kbps = CONFIG_RATE_CTRL_KBPS;
+    config->target_frame_bytes = CONFIG_RATE_CTRL_FRAME_BYTES;
+    config->hysteresis_pct = RATE_CTRL_HYSTERESIS_PCT;
+    config->settle_frames = RATE_CTRL_SETTLE_FRAMES;
+}
+#endif
 
-      sptr = &destline[current_dest_pos];
-      *sptr = pixel565;
-      sptr = &destline[current_dest_pos+2];
-      *sptr = pixel565_2;
-      current_dest_pos += 4;
+// each connection starts from the configured quality of the software encoder
+static void conn_rate_ctrl_init(http_conn_t *hc, rate_ctrl_t *rc)
+{
+    hc->jpeg_quality = CAMERA_JPEG_QUALITY;
+    hc->rate = NULL;
+#if CONFIG_RATE_CTRL_ENABLE
+    if (s_pixel_format == CAMERA_PF_JPEG) {
+        return;
     }
-  }
+    rate_ctrl_config_t config;
+    rate_ctrl_config_defaults(&config);
+    config.q_best = SW_JPEG_QUALITY_BEST;
+    config.q_worst = SW_JPEG_QUALITY_WORST;
+    config.q_initial = CAMERA_JPEG_QUALITY;
+    config.apply = &apply_sw_quality;
+    config.apply_arg = hc;
+    if (rate_ctrl_init(rc, &config) == 0) {
+        hc->rate = rc;
+    }
+#endif
 }
 
+// copy n bytes to dst at len, returns the new length or size + 1 once it does not fit
+static size_t append(uint8_t *dst, size_t len, size_t size, const void *data, size_t n)
+{
+    if (len + n > size) {
+        return size + 1;
+    }
+    memcpy(dst + len, data, n);
+    return len + n;
+}
 
-// TODO: handle http request while videomode on
+// one part of the /stream response, rendered once for all viewers by the broadcaster
+static size_t render_stream_part(uint8_t *dst, size_t size)
+{
+    size_t len = 0;
+    camera_fb_t *fb = camera_fb_capture();
+    if (fb == NULL) {
+        return 0;
+    }
+    if ((s_pixel_format == CAMERA_PF_RGB565) || (s_pixel_format == CAMERA_PF_YUV422)) {
+        const int width = fb->width;
+        const int height = fb->height;
+        const uint32_t *pixels = (const uint32_t*) fb->buf;
+        size_t hdr_len;
+        const uint8_t *hdr = image_header_get(IMAGE_HDR_BMP565, width, height, &hdr_len);
+        len = append(dst, len, size, http_bitmap_hdr, sizeof(http_bitmap_hdr) - 1);
+        len = append(dst, len, size, hdr, hdr_len);
+        if (hdr != NULL && len + width * height * 2 <= size) {
+            // convert framebuffer on the fly, straight into the frame
+            TRACE_BEGIN(TRACE_CONVERT);
+            uint32_t start = XTHAL_GET_CCOUNT();
+            for (int i = 0; i < height; i++) {
+                convert_fb32bit_line_to_bmp565((uint32_t*) &pixels[(i * width) / 2], dst + len, width, s_pixel_format);
+                len += width * 2;
+            }
+            TRACE_END(TRACE_CONVERT);
+            // the broadcaster task is pinned, so the cycle counter is that of one core
+            metric_add(&g_metrics.convert_us, (XTHAL_GET_CCOUNT() - start) / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+            metric_add(&g_metrics.convert_frames, 1);
+        } else {
+            len = size + 1;
+        }
+    } else {
+        len = append(dst, len, size, http_jpg_hdr, sizeof(http_jpg_hdr) - 1);
+        len = append(dst, len, size, fb->buf, fb->len);
+        rate_ctrl_feed_frame(fb->len, fb->timestamp_ms);
+    }
+    camera_fb_release(fb);
+    len = append(dst, len, size, http_stream_boundary, sizeof(http_stream_boundary) - 1);
+    if (len > size) {
+        ESP_LOGW(TAG, "Stream frame does not fit in %d bytes", size);
+        return 0;
+    }
+    return len;
+}
 
-static void http_server_netconn_serve(struct netconn *conn)
+// waits out the rest of a frame interval, fps <= 0 for no limit
+static void pace_frame(uint32_t *last_ms, int fps)
 {
-    /*  user data buff, it is designed on pbuf
-        struct netbuff{
-            struct pbuf *p, *ptr;
-            struct ip_addr *addr;
-            u16_t port;
+    if (fps > 0) {
+        int wait = (int) (*last_ms + 1000 / fps - now_ms());
+        if (wait > 0) {
+            TRACE_BEGIN(TRACE_PACE);
+            vTaskDelay(wait / portTICK_RATE_MS);
+            TRACE_END(TRACE_PACE);
         }
-        netbuf: it is just a header, data storage in the pbuf.
-                p is pointer of the first pbuf struct always,but 
-                ptr maybe point other position. 
-     */
-    struct netbuf *inbuf;
-    char *buf;
-    u16_t buflen;
-    err_t err;
-    /*
-    netconn_recv: Read the data from the port, and data recvive from recvmbox, To TCP
-                  ,data in recvmbox is pbuf struct.
-                  blocking if nothing yet there.
-                  We assume the request (the part we care about) is in one netbuf
-    */
-    err = netconn_recv(conn, &inbuf);
+    }
+    *last_ms = now_ms();
+}
+
+/*
+ * Keeps the newest frame of the camera pool at most one interval old
+ * while moviemode is on. Streams capture for themselves, so a round is
+ * skipped when someone else captured recently, and it never waits for a
+ * held frame to be released.
+ */
+static void capture_task(void *pvParameters)
+{
+    const uint32_t interval_ms = 1000 / CONFIG_CAPTURE_FPS;
+    uint32_t last_ms = now_ms();
+    metrics_register_task(NULL);
+    while (true) {
+        xEventGroupWaitBits(espilicam_event_group, MOVIEMODE_ON_BIT, false, true, portMAX_DELAY);
+        pace_frame(&last_ms, CONFIG_CAPTURE_FPS);
+        camera_fb_t *fb = camera_fb_acquire();
+        bool fresh = fb != NULL && now_ms() - fb->timestamp_ms < interval_ms;
+        camera_fb_release(fb);
+        if (fresh) {
+            continue;
+        }
+        camera_lock();
+        if (camera_fb_can_capture()) {
+            camera_run();
+        }
+        camera_unlock();
+    }
+}
+
+// the newest frame if it is at most max_age_ms old, a new capture otherwise
+static camera_fb_t *snapshot_frame(int max_age_ms)
+{
+    camera_fb_t *fb = camera_fb_acquire();
+    if (fb != NULL && (int) (now_ms() - fb->timestamp_ms) <= max_age_ms) {
+        return fb;
+    }
+    camera_fb_release(fb);
+    return camera_fb_capture();
+}
+
+/*
+ * snapshot_frame for a request which may carry If-None-Match. While the
+ * client has the frame already, waits up to ?wait=ms for the scene to
+ * change. Returns NULL with *not_modified set if it did not, hc->etag is
+ * the client's tag then; otherwise hc->etag is the tag of the frame.
+ */
+static camera_fb_t *snapshot_frame_if_changed(http_conn_t *hc, const http_request_t *req, int max_age_ms,
+                                              bool *not_modified)
+{
+    const char *if_none_match = http_request_header(req, HTTP_HDR_IF_NONE_MATCH);
+    int wait_ms = http_query_int(req, "wait", 0);
+    wait_ms = (wait_ms < 0) ? 0 : (wait_ms > CONFIG_SNAPSHOT_WAIT_MAX_MS) ? CONFIG_SNAPSHOT_WAIT_MAX_MS : wait_ms;
+    const uint32_t start = now_ms();
+    *not_modified = false;
+    camera_fb_t *fb = snapshot_frame(max_age_ms);
+    frame_etag_t tag, match;
+    while (fb != NULL) {
+        frame_etag_get(fb, &tag);
+        if (*if_none_match == '\0' ||
+            !frame_etag_match(if_none_match, &tag, CONFIG_SNAPSHOT_CHANGE_THRESHOLD, &match)) {
+            frame_etag_format(&tag, hc->etag, sizeof(hc->etag));
+            return fb;
+        }
+        camera_fb_release(fb);
+        if ((int) (now_ms() - start) >= wait_ms) {
+            // the client keeps comparing against its own frame, so slow drift adds up
+            frame_etag_format(&match, hc->etag, sizeof(hc->etag));
+            *not_modified = true;
+            return NULL;
+        }
+        vTaskDelay(SNAPSHOT_POLL_MS / portTICK_RATE_MS);
+        fb = snapshot_frame(max_age_ms);
+    }
+    return NULL;
+}
+
+static err_t send_not_modified(http_conn_t *hc)
+{
+    metric_add(&g_metrics.snapshots_not_modified, 1);
+    return send_response_hdr(hc, http_not_modified_hdr, "\r\n", 2, HTTP_NO_BODY);
+}
+
+static err_t serve_stream(http_conn_t *hc, int fps)
+{
+    struct netconn *conn = hc->conn;
+    bcast_sub_t sub;
+    err_t err = send_ok_hdr(hc, http_stream_hdr, -1);
     if (err == ERR_OK) {
-        /*
-            API function: let ptr of netbuf record pbuf data address put in dataptr
-            buf:    start address of pbuf
-            buflen: data length in the pbuf
-        */
-        netbuf_data(inbuf, (void**) &buf, &buflen);
-        /* 
-            Is this an HTTP GET command? (only check the first 5 chars, since
-            there are other formats for GET, and we're keeping it very simple )
-        */
-        if (buflen >= 5 && buf[0] == 'G' && buf[1] == 'E' && buf[2] == 'T' && buf[3] == ' ' && buf[4] == '/') {
-            printf("000\n");
-            // disable videomode (autocapture) to allow streaming...
-            bool s_moviemode = is_moviemode_on();
-            set_moviemode(false);
-            /* Send the HTTP header
-             * subtract 1 from the size, since we dont send the \0 in the string
-             * NETCONN_NOCOPY: our data is const static, so no need to copy it
-             * http_hdr : first address of data
-             * sizeof(http_hdr)-1: length of data
-             * err_t netconn_write(struct netconn *conn, const void *dataptr, size_t size, u8_t apiflags);
-             * #define NETCONN_NOFLAG 0X00
-             * #define NETCONN_NOCOPY 0X00 not copy dataptr data to buff, so don't modify data
-             * #define NETCONN_COPY   0X01 copy data to core thread space
-             * #define NETCONN_MORE   0X02 last TCP package's PSH will be set, and receiver will trans data to upper
-             */
-            netconn_write(conn, http_hdr, sizeof(http_hdr) - 1,NETCONN_NOCOPY);
-            //check if a stream is requested.
-            if (buf[5] == 's') {
-                printf("00\n");
-                //Send mjpeg stream header
-                err = netconn_write(conn, http_stream_hdr, sizeof(http_stream_hdr) - 1,NETCONN_NOCOPY);
-                ESP_LOGD(TAG, "Stream started.");
-                ESP_LOGD(TAG, "write http_stream hdr  = %d", err);
-                //Run while everyhting is ok and connection open.
-                while(err == ERR_OK) {
-                    printf("01\n");
-                    ESP_LOGD(TAG, "Capture frame");
-                    //PAUSE_DISPLAY = true;
-                    //err = camera_run();
-                    //PAUSE_DISPLAY = false;
-                    if (err != ESP_OK) {
-                        ESP_LOGD(TAG, "Camera capture failed with error = %d", err);
-                    } else {
-                        ESP_LOGD(TAG, "Done");
-                        //stream an image..
-                        if((s_pixel_format == CAMERA_PF_RGB565) || (s_pixel_format == CAMERA_PF_YUV422)) {
-                            printf("02\n");
-                            // write mime boundary start
-                            err = netconn_write(conn, http_bitmap_hdr, sizeof(http_bitmap_hdr) - 1,NETCONN_NOCOPY);
-                            // write bitmap header
-                            char *bmp = bmp_create_header565(camera_get_fb_width(), camera_get_fb_height());
-                            err = netconn_write(conn, bmp, sizeof(bitmap565), NETCONN_NOCOPY);
-                            free(bmp);
-                            // convert framebuffer on the fly...
-                            // only rgb and yuv...
-                            uint8_t s_line[160*2];
-                            uint32_t *fbl;
-                            for (int i = 0; i < 120; i++) {
-                                fbl = &currFbPtr[(i*160)/2];  //(i*(320*2)/4); // 4 bytes for each 2 pixel / 2 byte read..
-                                convert_fb32bit_line_to_bmp565(fbl, s_line,s_pixel_format);
-                                err = netconn_write(conn, s_line, 160*2,NETCONN_COPY);
-                            }
-                        }else {
-                            printf("03\n");
-                            // stream jpeg
-                            err = netconn_write(conn, http_jpg_hdr, sizeof(http_jpg_hdr) - 1,NETCONN_NOCOPY);
-                            if(err == ERR_OK)
-                                err = netconn_write(conn, camera_get_fb(), camera_get_data_size(),NETCONN_COPY);
-                        }
-                        if(err == ERR_OK){
-                            //Send boundary to next jpeg
-                            printf("04\n");
-                            err = netconn_write(conn, http_stream_boundary,sizeof(http_stream_boundary) -1, NETCONN_NOCOPY);
-                        }
-                        vTaskDelay(30 / portTICK_RATE_MS);
-                    }
-                }
-                ESP_LOGD(TAG, "Stream ended.");
-                ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
+        // frames are written to the netconn directly
+        err = tx_ring_flush(hc->tx);
+    }
+    if (broadcaster_subscribe(&sub) != ESP_OK) {
+        ESP_LOGW(TAG, "Too many stream viewers");
+        return ERR_MEM;
+    }
+    netconn_set_sendtimeout(conn, STREAM_SEND_TIMEOUT_MS);
+    ESP_LOGD(TAG, "Stream started.");
+    uint32_t last_ms = now_ms();
+    while (err == ERR_OK) {
+        pace_frame(&last_ms, fps);
+        if (!broadcaster_next(&sub, STREAM_FRAME_TIMEOUT_MS / portTICK_RATE_MS)) {
+            err = ERR_TIMEOUT;
+            break;
+        }
+        // every viewer sends the shared frame from its own cursor
+        jpeg_writer_t writer = { .conn = conn, .sent = hc->tx->sent };
+        while (err == ERR_OK && sub.offset < sub.frame->len) {
+            size_t n = sub.frame->len - sub.offset;
+            if (n > STREAM_SEND_CHUNK) {
+                n = STREAM_SEND_CHUNK;
+            }
+            err = jpeg_writer_write(&writer, sub.frame->data + sub.offset, n, NETCONN_COPY);
+            sub.offset += n;
+        }
+        if (s_pixel_format == CAMERA_PF_JPEG) {
+            rate_ctrl_feed_sent(sub.frame->seq, &writer);
+        }
+        broadcaster_done(&sub);
+    }
+    broadcaster_unsubscribe(&sub);
+    return err;
+}
+
+// stream of conditional replenishment frames, decoded by the page served on /cr
+static err_t serve_cr_stream(http_conn_t *hc, int fps)
+{
+    tx_ring_t *tx = hc->tx;
+    const int width = camera_get_fb_width();
+    const int height = camera_get_fb_height();
+    err_t err = send_ok_hdr(hc, http_octet_stream_hdr, -1);
+    cr_encoder_t *enc = (cr_encoder_t*) malloc(sizeof(cr_encoder_t));
+    uint16_t *rows = (uint16_t*) malloc(width * CR_BLOCK_SIZE * sizeof(uint16_t));
+    if (enc == NULL || rows == NULL ||
+        cr_enc_init(enc, width, height, CR_BLOCK_SIZE, CR_THRESHOLD, CR_KEYFRAME_INTERVAL) != 0) {
+        ESP_LOGE(TAG, "Not enough memory for CR stream");
+        free(rows);
+        free(enc);
+        return ERR_MEM;
+    }
+    uint32_t seq = 0;
+    uint32_t last_ms = now_ms();
+    while (err == ERR_OK) {
+        pace_frame(&last_ms, fps);
+        camera_fb_t *fb = camera_fb_capture();
+        if (fb == NULL) {
+            break;
+        }
+        const uint32_t *pixels = (const uint32_t*) fb->buf;
+        cr_enc_begin(enc, seq++, &tx_ring_write_cb, tx);
+        for (int y0 = 0; y0 < height; y0 += CR_BLOCK_SIZE) {
+            int lines = (height - y0 < CR_BLOCK_SIZE) ? height - y0 : CR_BLOCK_SIZE;
+            for (int i = 0; i < lines; i++) {
+                convert_fb32bit_line_to_bmp565((uint32_t*) &pixels[((y0 + i) * width) / 2],
+                        (uint8_t*) &rows[i * width], width, s_pixel_format);
+            }
+            cr_enc_rows(enc, rows, width);
+        }
+        if (cr_enc_end(enc) != 0) {
+            err = ERR_CLSD;
+        } else {
+            err = tx_ring_flush(tx);
+        }
+        camera_fb_release(fb);
+        ESP_LOGD(TAG, "CR frame %d: %d blocks, %d bytes", seq, enc->blocks_sent, enc->bytes_sent);
+    }
+    cr_enc_free(enc);
+    free(enc);
+    free(rows);
+    return err;
+}
+
+// converts straight into the transmit chunks, a line split across two goes through s_line
+// (the trace shows the chunks sent meanwhile nested in the conversion)
+static err_t send_frame_rgb565(tx_ring_t *tx, const camera_fb_t *fb)
+{
+    const int width = fb->width;
+    const size_t line_len = width * 2;
+    const uint32_t *pixels = (const uint32_t*) fb->buf;
+    uint8_t s_line[line_len];
+    err_t err = ERR_OK;
+    TRACE_BEGIN(TRACE_CONVERT);
+    for (int i = 0; i < fb->height && err == ERR_OK; i++) {
+        size_t avail;
+        uint8_t *dst = tx_ring_reserve(tx, &avail);
+        if (dst == NULL) {
+            err = ERR_TIMEOUT;
+            break;
+        }
+        if (avail >= line_len) {
+            convert_fb32bit_line_to_bmp565((uint32_t*) &pixels[(i * width) / 2], dst, width, s_pixel_format);
+            err = tx_ring_commit(tx, line_len);
+        } else {
+            convert_fb32bit_line_to_bmp565((uint32_t*) &pixels[(i * width) / 2], s_line, width, s_pixel_format);
+            err = tx_ring_write(tx, s_line, line_len);
+        }
+    }
+    TRACE_END(TRACE_CONVERT);
+    return err;
+}
+
+#if CONFIG_RTSP_ENABLE
+static uint8_t *s_rtsp_jpeg;
+
+static int rtsp_jpeg_write(void *arg, const uint8_t *data, size_t len)
+{
+    rtsp_frame_t *frame = (rtsp_frame_t*) arg;
+    if (frame->len + len > CONFIG_RTSP_MAX_FRAME_KB * 1024) {
+        return -1;
+    }
+    memcpy(s_rtsp_jpeg + frame->len, data, len);
+    frame->len += len;
+    return 0;
+}
+
+// the sensor's JPEG straight from the pool, or a software encoded one
+static bool rtsp_frame_get(rtsp_frame_t *frame)
+{
+    if (s_pixel_format == CAMERA_PF_JPEG) {
+        camera_fb_t *fb = camera_fb_capture();
+        if (fb == NULL) {
+            return false;
+        }
+        frame->data = fb->buf;
+        frame->len = fb->len;
+        frame->timestamp_ms = fb->timestamp_ms;
+        frame->handle = fb;
+        return true;
+    }
+    frame->data = s_rtsp_jpeg;
+    frame->len = 0;
+    frame->timestamp_ms = now_ms();
+    frame->handle = NULL;
+    if (jpeg_stream_frame(s_pixel_format, CAMERA_JPEG_QUALITY, &rtsp_jpeg_write, frame) != ESP_OK) {
+        ESP_LOGD(TAG, "RTSP frame larger than %d KB, dropped", CONFIG_RTSP_MAX_FRAME_KB);
+        return false;
+    }
+    return true;
+}
+
+static void rtsp_frame_put(rtsp_frame_t *frame)
+{
+    camera_fb_release((camera_fb_t*) frame->handle);
+}
+
+static esp_err_t rtsp_init()
+{
+    if (s_pixel_format == CAMERA_PF_GRAYSCALE) {
+        // RTP/JPEG has no single component type
+        ESP_LOGW(TAG, "RTSP needs a color format, not started");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (s_pixel_format != CAMERA_PF_JPEG) {
+        s_rtsp_jpeg = (uint8_t*) malloc(CONFIG_RTSP_MAX_FRAME_KB * 1024);
+        if (s_rtsp_jpeg == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return rtsp_server_init(CONFIG_RTSP_PORT, CONFIG_RTSP_FPS, CONFIG_RTSP_PACKET_SIZE,
+                            &rtsp_frame_get, &rtsp_frame_put);
+}
+#endif
+
+// outputs kept by the snapshot cache
+typedef enum {
+    SNAP_FORMAT_RGB565 = 1,     // the pixels of /bmp and /raw, headers come from bitmap.c
+    SNAP_FORMAT_QOI = 2,
+} snap_format_t;
+
+static snap_key_t snap_key(const camera_fb_t *fb, snap_format_t format)
+{
+    snap_key_t key = {
+        .seq = fb->seq,
+        .width = fb->width,
+        .height = fb->height,
+        .format = format,
+    };
+    return key;
+}
+
+// the frame converted to RGB565, cached or converted into the cache; NULL if it cannot be kept
+static snap_entry_t *snapshot_rgb565(const camera_fb_t *fb)
+{
+    const snap_key_t key = snap_key(fb, SNAP_FORMAT_RGB565);
+    snap_entry_t *entry = snap_cache_get(&key);
+    if (entry != NULL) {
+        metric_add(&g_metrics.snapshot_cache_hits, 1);
+        return entry;
+    }
+    metric_add(&g_metrics.snapshot_cache_misses, 1);
+    const int width = fb->width;
+    const size_t line_len = width * 2;
+    entry = snap_cache_new(&key, line_len * fb->height);
+    if (entry == NULL) {
+        return NULL;
+    }
+    const uint32_t *pixels = (const uint32_t*) fb->buf;
+    TRACE_BEGIN(TRACE_CONVERT);
+    for (int i = 0; i < fb->height; i++) {
+        convert_fb32bit_line_to_bmp565((uint32_t*) &pixels[(i * width) / 2], entry->data + i * line_len,
+                                       width, s_pixel_format);
+    }
+    TRACE_END(TRACE_CONVERT);
+    entry->len = entry->size;
+    snap_cache_put(entry);
+    return entry;
+}
+
+// the encoder writes to the connection and, while it fits, a new cache entry
+typedef struct {
+    tx_ring_t *tx;
+    snap_entry_t *entry;
+} qoi_tee_t;
+
+static int qoi_tee_cb(void *arg, const uint8_t *data, size_t len)
+{
+    qoi_tee_t *tee = (qoi_tee_t*) arg;
+    if (tee->entry != NULL) {
+        snap_cache_append(&tee->entry, data, len);
+    }
+    return tx_ring_write_cb(tee->tx, data, len);
+}
+
+// lossless snapshot, QOI encoded line by line from the framebuffer
+static err_t serve_qoi(http_conn_t *hc, const http_request_t *req, int max_age_ms)
+{
+    tx_ring_t *tx = hc->tx;
+    const int width = camera_get_fb_width();
+    const int height = camera_get_fb_height();
+    // keep the frame until it is encoded
+    bool not_modified;
+    camera_fb_t *fb = snapshot_frame_if_changed(hc, req, max_age_ms, &not_modified);
+    if (not_modified) {
+        return send_not_modified(hc);
+    }
+    if (fb == NULL) {
+        return send_error(hc, 503);
+    }
+    const snap_key_t key = snap_key(fb, SNAP_FORMAT_QOI);
+    snap_entry_t *cached = snap_cache_get(&key);
+    if (cached != NULL) {
+        // the length is known this time, so the connection can stay open
+        metric_add(&g_metrics.snapshot_cache_hits, 1);
+        camera_fb_release(fb);
+        err_t err = send_ok_hdr(hc, http_qoi_hdr, cached->len);
+        if (err != ERR_OK) {
+            snap_cache_release(cached);
+            return err;
+        }
+        return tx_ring_send_buf(tx, cached->data, cached->len, &snap_cache_release, cached);
+    }
+    metric_add(&g_metrics.snapshot_cache_misses, 1);
+
+    // gray lines are encoded straight from the frame, RGB565 and YUV422 go through a line of RGB565
+    const bool gray = s_pixel_format == CAMERA_PF_GRAYSCALE;
+    err_t err = send_ok_hdr(hc, http_qoi_hdr, -1);
+    qoi_encoder_t *enc = (qoi_encoder_t*) malloc(sizeof(qoi_encoder_t));
+    uint8_t *s_line = gray ? NULL : (uint8_t*) malloc(width * 2);
+    if (enc == NULL || (s_line == NULL && !gray)) {
+        free(enc);
+        free(s_line);
+        camera_fb_release(fb);
+        return ERR_MEM;
+    }
+    // most frames compress to well under 2 bytes a pixel, the entry grows if not
+    size_t guess = width * height;
+    guess = (guess < CONFIG_SNAPSHOT_CACHE_KB * 1024) ? guess : CONFIG_SNAPSHOT_CACHE_KB * 1024;
+    qoi_tee_t tee = { .tx = tx, .entry = snap_cache_new(&key, guess) };
+    const uint32_t *pixels = (const uint32_t*) fb->buf;
+    qoi_enc_start(enc, width, height, gray ? QOI_INPUT_GRAYSCALE : QOI_INPUT_RGB565, &qoi_tee_cb, &tee);
+    for (int i = 0; i < height && enc->error == 0; i++) {
+        if (gray) {
+            qoi_enc_line(enc, fb->buf + i * width);
+        } else {
+            convert_fb32bit_line_to_bmp565((uint32_t*) &pixels[(i * width) / 2], s_line, width, s_pixel_format);
+            qoi_enc_line(enc, s_line);
+        }
+    }
+    if (qoi_enc_finish(enc) != 0) {
+        err = ERR_CLSD;
+    }
+    ESP_LOGD(TAG, "QOI image: %d bytes, raw %d bytes", enc->bytes_out, width * height * (gray ? 1 : 2));
+    camera_fb_release(fb);
+    if (tee.entry != NULL) {
+        if (err == ERR_OK) {
+            snap_cache_put(tee.entry);
+        }
+        snap_cache_release(tee.entry);
+    }
+    free(s_line);
+    free(enc);
+    return err;
+}
+
+// software JPEG, encoded strip by strip while the frame is captured
+static err_t serve_sw_jpeg(http_conn_t *hc, int quality)
+{
+    err_t err = send_ok_hdr(hc, http_jpg_hdr, -1);
+    if (err == ERR_OK) {
+        err = tx_ring_flush(hc->tx);
+    }
+    if (err == ERR_OK) {
+        jpeg_writer_t writer = { .conn = hc->conn, .sent = hc->tx->sent };
+        esp_err_t ret = jpeg_stream_frame(s_pixel_format, quality ? quality : hc->jpeg_quality, &jpeg_writer_cb, &writer);
+        ESP_LOGD(TAG, "JPEG frame sent, result = %d", ret);
+        if (quality == 0) {
+            rate_ctrl_feed(hc, &writer);
+        }
+        // the body is delimited by closing, a cut off image must not look complete
+        if (ret != ESP_OK) {
+            err = ERR_CLSD;
+        }
+    }
+    return err;
+}
+
+static err_t serve_mjpeg(http_conn_t *hc, int quality, int fps)
+{
+    struct netconn *conn = hc->conn;
+    err_t err = send_ok_hdr(hc, http_stream_hdr, -1);
+    if (err == ERR_OK) {
+        err = tx_ring_flush(hc->tx);
+    }
+    ESP_LOGD(TAG, "JPEG stream started.");
+    uint32_t last_ms = now_ms();
+    while (err == ERR_OK) {
+        pace_frame(&last_ms, fps);
+        err = conn_write(hc, http_jpg_hdr, sizeof(http_jpg_hdr) - 1, NETCONN_NOCOPY);
+        jpeg_writer_t writer = { .conn = conn, .sent = hc->tx->sent };
+        if (err == ERR_OK && jpeg_stream_frame(s_pixel_format, quality ? quality : hc->jpeg_quality,
+                                               &jpeg_writer_cb, &writer) != ESP_OK) {
+            err = ERR_CLSD;
+        }
+        if (quality == 0) {
+            rate_ctrl_feed(hc, &writer);
+        }
+        if (err == ERR_OK) {
+            err = conn_write(hc, http_stream_boundary, sizeof(http_stream_boundary) - 1, NETCONN_NOCOPY);
+        }
+    }
+    ESP_LOGD(TAG, "JPEG stream ended.");
+    return err;
+}
+
+/*
+ * /stream?format=auto gives every viewer its own encoding of the frames,
+ * from a ladder of smaller and smaller ones. Frames are not drained one
+ * by one, that would cost a round trip and the client's delayed ACK per
+ * frame. They follow each other through the few chunks of the tx ring,
+ * so on a link which is the limit writing a frame waits for the ACKs of
+ * what went before, and the time to encode and write it is what it costs
+ * on that viewer's link. The stream_adapt_t picks the encoding which
+ * keeps that under the frame interval. Each part says what it is and the
+ * goodput behind the choice in X-Stream-Format and X-Goodput-Kbps.
+ */
+typedef enum {
+    ADAPT_BMP,                  // RGB565, what the broadcaster sends
+    ADAPT_BMP_HALF,             // RGB565 at half the width and height
+    ADAPT_JPG,
+    ADAPT_GRAY_JPG,
+    ADAPT_GRAY_JPG_HALF,
+    ADAPT_LEVELS,
+} adapt_level_t;
+
+static const char *const s_adapt_names[ADAPT_LEVELS] = {
+    "bmp", "bmp_half", "jpg", "gray_jpg", "gray_jpg_half",
+};
+
+typedef struct {
+    tx_ring_t *tx;
+    jpeg_encoder_t enc;
+    uint16_t *rgb;              // two source lines and a half size line
+    uint8_t *gray;              // a strip of JPEG_MCU_LINES gray lines
+} adapt_stream_t;
+
+static void fb_line_rgb565(const camera_fb_t *fb, int y, uint16_t *dst)
+{
+    if (fb->format == CAMERA_PF_GRAYSCALE) {
+        image_gray_line_to_rgb565(fb->buf + y * fb->width, dst, fb->width);
+        return;
+    }
+    convert_fb32bit_line_to_bmp565((uint32_t*) fb->buf + (y * fb->width) / 2, (uint8_t*) dst,
+                                   fb->width, s_pixel_format);
+}
+
+// line y as 8 bit gray, in the framebuffer or converted through rgb into gray
+static const uint8_t *fb_line_gray(const camera_fb_t *fb, int y, uint16_t *rgb, uint8_t *gray)
+{
+    if (fb->format == CAMERA_PF_GRAYSCALE) {
+        return fb->buf + y * fb->width;
+    }
+    fb_line_rgb565(fb, y, rgb);
+    image_rgb565_line_to_gray(rgb, gray, fb->width);
+    return gray;
+}
+
+// line y of the frame at half size, from source lines 2y and 2y+1
+static const uint16_t *fb_half_line(adapt_stream_t *as, const camera_fb_t *fb, int y)
+{
+    const int width = fb->width;
+    fb_line_rgb565(fb, 2 * y, as->rgb);
+    fb_line_rgb565(fb, 2 * y + 1, as->rgb + width);
+    image_half_rgb565_line(as->rgb, as->rgb + width, as->rgb + 2 * width, width);
+    return as->rgb + 2 * width;
+}
+
+static err_t send_bmp_half(adapt_stream_t *as, const camera_fb_t *fb)
+{
+    const int width = fb->width / 2;
+    const int height = fb->height / 2;
+    size_t hdr_len;
+    const uint8_t *hdr = image_header_get(IMAGE_HDR_BMP565, width, height, &hdr_len);
+    err_t err = (hdr != NULL) ? tx_ring_write(as->tx, hdr, hdr_len) : ERR_MEM;
+    for (int y = 0; y < height && err == ERR_OK; y++) {
+        err = tx_ring_write(as->tx, fb_half_line(as, fb, y), width * 2);
+    }
+    return err;
+}
+
+static err_t send_jpg(adapt_stream_t *as, const camera_fb_t *fb)
+{
+    const jpeg_input_format_t input =
+            (s_pixel_format == CAMERA_PF_YUV422) ? JPEG_INPUT_FB_YUV422 : JPEG_INPUT_FB_RGB565;
+    if (jpeg_enc_start(&as->enc, fb->width, fb->height, input, CAMERA_JPEG_QUALITY, &tx_ring_write_cb, as->tx) != 0) {
+        return ERR_CLSD;
+    }
+    // the framebuffer is complete, so it is all one strip
+    jpeg_enc_strip(&as->enc, fb->buf, fb->height, fb->width * 2);
+    return jpeg_enc_finish(&as->enc) == 0 ? ERR_OK : ERR_CLSD;
+}
+
+static err_t send_gray_jpg(adapt_stream_t *as, const camera_fb_t *fb, bool half)
+{
+    const int width = half ? fb->width / 2 : fb->width;
+    const int height = half ? fb->height / 2 : fb->height;
+    if (jpeg_enc_start(&as->enc, width, height, JPEG_INPUT_GRAYSCALE, CAMERA_JPEG_QUALITY,
+                       &tx_ring_write_cb, as->tx) != 0) {
+        return ERR_CLSD;
+    }
+    for (int y0 = 0; y0 < height && as->enc.error == 0; y0 += JPEG_MCU_LINES) {
+        int lines = (height - y0 < JPEG_MCU_LINES) ? height - y0 : JPEG_MCU_LINES;
+        for (int i = 0; i < lines; i++) {
+            const uint16_t *line = as->rgb;
+            if (half) {
+                line = fb_half_line(as, fb, y0 + i);
             } else {
+                fb_line_rgb565(fb, y0 + i, as->rgb);
+            }
+            image_rgb565_line_to_gray(line, as->gray + i * width, width);
+        }
+        jpeg_enc_strip(&as->enc, as->gray, lines, width);
+    }
+    return jpeg_enc_finish(&as->enc) == 0 ? ERR_OK : ERR_CLSD;
+}
+
+static err_t send_adapt_part(adapt_stream_t *as, const camera_fb_t *fb, adapt_level_t level, uint32_t goodput_bps)
+{
+    char hdr[128];
+    int len = snprintf(hdr, sizeof(hdr), "Content-type: %s\r\nX-Stream-Format: %s\r\nX-Goodput-Kbps: %u\r\n\r\n",
+                       (level <= ADAPT_BMP_HALF) ? "image/bitmap" : "image/jpg", s_adapt_names[level],
+                       goodput_bps / 1000);
+    err_t err = tx_ring_write(as->tx, hdr, len);
+    if (err != ERR_OK) {
+        return err;
+    }
+    switch (level) {
+    case ADAPT_BMP: {
+        size_t hdr_len;
+        const uint8_t *bmp = image_header_get(IMAGE_HDR_BMP565, fb->width, fb->height, &hdr_len);
+        err = (bmp != NULL) ? tx_ring_write(as->tx, bmp, hdr_len) : ERR_MEM;
+        return (err == ERR_OK) ? send_frame_rgb565(as->tx, fb) : err;
+    }
+    case ADAPT_BMP_HALF:
+        return send_bmp_half(as, fb);
+    case ADAPT_JPG:
+        return send_jpg(as, fb);
+    case ADAPT_GRAY_JPG:
+        return send_gray_jpg(as, fb, false);
+    default:
+        return send_gray_jpg(as, fb, true);
+    }
+}
+
+static err_t serve_adaptive_stream(http_conn_t *hc, int fps)
+{
+    tx_ring_t *tx = hc->tx;
+    const int width = camera_get_fb_width();
+    const int height = camera_get_fb_height();
+    const uint32_t pixels = width * height;
+    const stream_adapt_config_t config = {
+        .levels = ADAPT_LEVELS,
+        .initial_level = ADAPT_JPG,
+        .target_fps = fps > 0 ? fps : CONFIG_STREAM_ADAPT_FPS,
+        .hysteresis_pct = RATE_CTRL_HYSTERESIS_PCT,
+        .hold_frames = STREAM_ADAPT_HOLD_FRAMES,
+        .window_bytes = STREAM_ADAPT_WINDOW_BYTES,
+        // rough sizes of a typical scene, the first frame sent corrects them
+        .frame_bytes = { pixels * 2, pixels / 2, pixels / 6, pixels / 8, pixels / 32 },
+    };
+    stream_adapt_t sa;
+    adapt_stream_t *as = (adapt_stream_t*) malloc(sizeof(adapt_stream_t));
+    if (as != NULL) {
+        as->tx = tx;
+        as->rgb = (uint16_t*) malloc(width * 3 * sizeof(uint16_t));
+        as->gray = (uint8_t*) malloc(width * JPEG_MCU_LINES);
+    }
+    if (as == NULL || as->rgb == NULL || as->gray == NULL || stream_adapt_init(&sa, &config) != 0) {
+        ESP_LOGE(TAG, "Not enough memory for adaptive stream");
+        if (as != NULL) {
+            free(as->rgb);
+            free(as->gray);
+        }
+        free(as);
+        return ERR_MEM;
+    }
+    err_t err = send_ok_hdr(hc, http_stream_hdr, -1);
+    if (err == ERR_OK) {
+        err = tx_ring_flush(tx);
+    }
+    ESP_LOGD(TAG, "Adaptive stream started at %d fps.", config.target_fps);
+    uint32_t last_ms = now_ms();
+    while (err == ERR_OK) {
+        pace_frame(&last_ms, config.target_fps);
+        camera_fb_t *fb = camera_fb_capture();
+        if (fb == NULL) {
+            break;
+        }
+        const adapt_level_t level = (adapt_level_t) sa.level;
+        const size_t bytes = tx->bytes;
+        const uint32_t start = now_ms();
+        err = send_adapt_part(as, fb, level, sa.goodput_bps);
+        camera_fb_release(fb);
+        if (err == ERR_OK) {
+            err = tx_ring_write(tx, http_stream_boundary, sizeof(http_stream_boundary) - 1);
+        }
+        if (err == ERR_OK) {
+            // the part goes out now, the next write waits for it only if the window is full
+            err = tx_ring_flush(tx);
+        }
+        if (err == ERR_OK && stream_adapt_frame(&sa, tx->bytes - bytes, now_ms() - start) != level) {
+            ESP_LOGD(TAG, "Stream %s -> %s, goodput %u kbit/s, budget %u bytes", s_adapt_names[level],
+                     s_adapt_names[sa.level], sa.goodput_bps / 1000, sa.budget);
+        }
+    }
+    ESP_LOGD(TAG, "Adaptive stream ended after %u changes.", sa.changes);
+    free(as->gray);
+    free(as->rgb);
+    free(as);
+    return err;
+}
+
+/*
+ * /ws streams frames as binary WebSocket messages, each one a ws_frame_info_t
+ * followed by the image. Text messages from the client change the stream,
+ * "fps=5&format=jpg&quality=30", and are answered with the settings in use.
+ */
+typedef enum {
+    WS_FORMAT_RGB565 = 1,       // converted lines
+    WS_FORMAT_JPEG = 2,         // sensor JPEG as captured or the software encoder
+    WS_FORMAT_GRAY = 3,         // framebuffer as captured
+} ws_format_t;
+
+// in front of every frame, little endian like the ESP32
+typedef struct __attribute__((packed)) {
+    uint8_t version;            // 1
+    uint8_t format;             // ws_format_t
+    uint16_t header_len;        // sizeof(ws_frame_info_t), the image follows
+    uint16_t width;
+    uint16_t height;
+    uint32_t seq;
+    uint32_t timestamp_ms;      // capture time
+} ws_frame_info_t;
+
+typedef struct {
+    http_conn_t *hc;
+    int fps;
+    ws_format_t format;
+    int quality;
+    uint32_t seq;
+    ws_parser_t parser;
+} ws_stream_t;
+
+static const char *ws_format_name(ws_format_t format)
+{
+    return format == WS_FORMAT_RGB565 ? "rgb565" : format == WS_FORMAT_GRAY ? "gray" : "jpg";
+}
+
+// the format by name if this camera can deliver it, 0 otherwise
+static ws_format_t ws_format_parse(const char *name)
+{
+    // raw frames need the framebuffer
+    const bool rgb = !CAMERA_STRIP_ONLY &&
+                     ((s_pixel_format == CAMERA_PF_RGB565) || (s_pixel_format == CAMERA_PF_YUV422));
+    if (strcmp(name, "jpg") == 0) {
+        return WS_FORMAT_JPEG;
+    } else if (strcmp(name, "rgb565") == 0 && rgb) {
+        return WS_FORMAT_RGB565;
+    } else if (strcmp(name, "gray") == 0 && s_pixel_format == CAMERA_PF_GRAYSCALE && !CAMERA_STRIP_ONLY) {
+        return WS_FORMAT_GRAY;
+    }
+    return 0;
+}
+
+static err_t ws_send_message(tx_ring_t *tx, int opcode, const void *data, size_t len)
+{
+    uint8_t hdr[WS_HEADER_MAX];
+    err_t err = tx_ring_write(tx, hdr, ws_frame_header(hdr, opcode, true, len));
+    if (err == ERR_OK && len > 0) {
+        err = tx_ring_write(tx, data, len);
+    }
+    if (err == ERR_OK) {
+        err = tx_ring_flush(tx);
+    }
+    return err;
+}
+
+static err_t ws_send_info(ws_stream_t *ws, bool fin, size_t image_len, int width, int height, uint32_t timestamp_ms)
+{
+    ws_frame_info_t info = {
+        .version = 1,
+        .format = ws->format,
+        .header_len = sizeof(ws_frame_info_t),
+        .width = width,
+        .height = height,
+        .seq = ws->seq++,
+        .timestamp_ms = timestamp_ms,
+    };
+    uint8_t hdr[WS_HEADER_MAX];
+    err_t err = tx_ring_write(ws->hc->tx, hdr, ws_frame_header(hdr, WS_OP_BINARY, fin, sizeof(info) + image_len));
+    if (err == ERR_OK) {
+        err = tx_ring_write(ws->hc->tx, &info, sizeof(info));
+    }
+    return err;
+}
+
+// software JPEG has no length until it is done, it goes in continuation frames
+static int ws_jpeg_fragment_cb(void *arg, const uint8_t *data, size_t len)
+{
+    tx_ring_t *tx = (tx_ring_t*) arg;
+    uint8_t hdr[WS_HEADER_MAX];
+    if (tx_ring_write(tx, hdr, ws_frame_header(hdr, WS_OP_CONTINUATION, false, len)) != ERR_OK) {
+        return -1;
+    }
+    return tx_ring_write_cb(tx, data, len);
+}
+
+static err_t ws_send_frame(ws_stream_t *ws)
+{
+    tx_ring_t *tx = ws->hc->tx;
+    err_t err;
+    if (ws->format == WS_FORMAT_JPEG && s_pixel_format != CAMERA_PF_JPEG) {
+        err = ws_send_info(ws, false, 0, camera_get_fb_width(), camera_get_fb_height(), now_ms());
+        if (err == ERR_OK && jpeg_stream_frame(s_pixel_format, ws->quality ? ws->quality : ws->hc->jpeg_quality,
+                                               &ws_jpeg_fragment_cb, tx) != ESP_OK) {
+            err = ERR_CLSD;
+        }
+        uint8_t hdr[WS_HEADER_MAX];
+        if (err == ERR_OK) {
+            err = tx_ring_write(tx, hdr, ws_frame_header(hdr, WS_OP_CONTINUATION, true, 0));
+        }
+        return err == ERR_OK ? tx_ring_flush(tx) : err;
+    }
+
+    camera_fb_t *fb = camera_fb_capture();
+    if (fb == NULL) {
+        return ERR_ABRT;
+    }
+    if (ws->format == WS_FORMAT_RGB565) {
+        err = ws_send_info(ws, true, fb->width * fb->height * 2, fb->width, fb->height, fb->timestamp_ms);
+        if (err == ERR_OK) {
+            err = send_frame_rgb565(tx, fb);
+        }
+        camera_fb_release(fb);
+        return err == ERR_OK ? tx_ring_flush(tx) : err;
+    }
+    // the frame goes out from the pool, released once acknowledged
+    err = ws_send_info(ws, true, fb->len, fb->width, fb->height, fb->timestamp_ms);
+    if (err != ERR_OK) {
+        camera_fb_release(fb);
+        return err;
+    }
+    return tx_ring_send_frame(tx, fb);
+}
+
+static err_t ws_send_settings(ws_stream_t *ws)
+{
+    char text[64];
+    int n = snprintf(text, sizeof(text), "fps=%d&format=%s&quality=%d", ws->fps, ws_format_name(ws->format), ws->quality);
+    return ws_send_message(ws->hc->tx, WS_OP_TEXT, text, n);
+}
+
+// a control message, values which do not apply are left as they are
+static err_t ws_control(ws_stream_t *ws, const uint8_t *payload, size_t len)
+{
+    char text[WS_MESSAGE_MAX + 1];
+    memcpy(text, payload, len);
+    text[len] = '\0';
+    char format[8];
+    int fps = http_params_int(text, "fps", ws->fps);
+    int quality = http_params_int(text, "quality", ws->quality);
+    if (fps >= 0) {
+        ws->fps = fps;
+    }
+    if (quality >= 0 && quality <= 100) {
+        ws->quality = quality;
+    }
+    if (http_params_get(text, "format", format, sizeof(format)) && ws_format_parse(format) != 0) {
+        ws->format = ws_format_parse(format);
+    }
+    return ws_send_settings(ws);
+}
+
+/*
+ * Waits up to timeout_ms for data and returns the first complete message.
+ * Data after it stays in hc->inbuf for the next call.
+ */
+static ws_parse_result_t ws_receive(http_conn_t *hc, ws_parser_t *parser, int timeout_ms)
+{
+    if (hc->inbuf == NULL) {
+        netconn_set_recvtimeout(hc->conn, timeout_ms);
+        err_t err = netconn_recv(hc->conn, &hc->inbuf);
+        if (err != ERR_OK) {
+            hc->inbuf = NULL;
+            parser->close_code = 0;
+            return err == ERR_TIMEOUT ? WS_PARSE_MORE : WS_PARSE_ERROR;
+        }
+        hc->in_offset = 0;
+    }
+    ws_parse_result_t res = WS_PARSE_MORE;
+    while (hc->inbuf != NULL && res == WS_PARSE_MORE) {
+        uint8_t *data;
+        u16_t len;
+        netbuf_data(hc->inbuf, (void**) &data, &len);
+        size_t used;
+        res = ws_parse(parser, data + hc->in_offset, len - hc->in_offset, &used);
+        hc->in_offset += used;
+        if (hc->in_offset >= len) {
+            hc->in_offset = 0;
+            if (netbuf_next(hc->inbuf) < 0) {
+                netbuf_delete(hc->inbuf);
+                hc->inbuf = NULL;
+            }
+        }
+    }
+    return res;
+}
+
+static err_t ws_close(tx_ring_t *tx, int code)
+{
+    uint8_t payload[2] = { code >> 8, code & 0xff };
+    return ws_send_message(tx, WS_OP_CLOSE, payload, sizeof(payload));
+}
+
+static err_t serve_ws(http_conn_t *hc, const http_request_t *req, const char *format, int quality, int fps)
+{
+    char accept[WS_ACCEPT_KEY_LEN + 1];
+    if (!http_header_has_token(req, HTTP_HDR_UPGRADE, "websocket") ||
+        !ws_accept_key(http_request_header(req, HTTP_HDR_SEC_WEBSOCKET_KEY), accept, sizeof(accept))) {
+        return send_error(hc, 400);
+    }
+    if (strcmp(http_request_header(req, HTTP_HDR_SEC_WEBSOCKET_VERSION), "13") != 0) {
+        return send_error(hc, 426);
+    }
+    ws_stream_t ws = {
+        .hc = hc,
+        .fps = fps,
+        .quality = quality,
+        .format = ws_format_parse(format),
+    };
+    if (ws.format == 0) {
+        ws.format = (s_pixel_format == CAMERA_PF_JPEG || CAMERA_STRIP_ONLY) ? WS_FORMAT_JPEG :
+                    (s_pixel_format == CAMERA_PF_GRAYSCALE) ? WS_FORMAT_GRAY : WS_FORMAT_RGB565;
+    }
+    ws_parser_init(&ws.parser);
+    hc->keep_alive = false;
 
-                //CAMER_PF_JPEG
-                if (s_pixel_format == CAMERA_PF_JPEG) {
-                printf("0\n");
-                    netconn_write(conn, http_jpg_hdr, sizeof(http_jpg_hdr) - 1, NETCONN_NOCOPY);
-
-                //CAMERA_PF_GRAYSCALE
-                } else if (s_pixel_format == CAMERA_PF_GRAYSCALE) {
-                printf("1\n");
-                    netconn_write(conn, http_pgm_hdr, sizeof(http_pgm_hdr) - 1, NETCONN_NOCOPY);
-                    if (memcmp(&buf[5], "pgm", 3) == 0) {
-                        char pgm_header[32];
-                        snprintf(pgm_header, sizeof(pgm_header), "P5 %d %d %d\n", camera_get_fb_width(), camera_get_fb_height(), 255);
-                        netconn_write(conn, pgm_header, strlen(pgm_header), NETCONN_COPY);
-                    }else {
-                        char outstr[120];
-                        get_image_mime_info_str(outstr);
-                        netconn_write(conn, outstr, sizeof(outstr) - 1, NETCONN_NOCOPY);
-                        //netconn_write(conn, http_yuv422_hdr, sizeof(http_yuv422_hdr) - 1, NETCONN_NOCOPY);
-                    }
-
-                //CAMERA_PF_RGB565
-                } else if (s_pixel_format == CAMERA_PF_RGB565) {
-                printf("2\n");
-                    netconn_write(conn, http_bitmap_hdr, sizeof(http_bitmap_hdr) - 1, NETCONN_NOCOPY);
-                    if (memcmp(&buf[5], "bmp", 3) == 0) {
-                        printf("2-a\n");
-                        char *bmp = bmp_create_header565(camera_get_fb_width(), camera_get_fb_height());
-                        err = netconn_write(conn, bmp, sizeof(bitmap565), NETCONN_COPY);
-                        free(bmp);
-                    } else {
-                        printf("2-b\n");
-                        char outstr[120];
-                        get_image_mime_info_str(outstr);
-                        netconn_write(conn, outstr, sizeof(outstr) - 1, NETCONN_NOCOPY);
-                        //netconn_write(conn, http_yuv422_hdr, sizeof(http_yuv422_hdr) - 1, NETCONN_NOCOPY);
-                    }
-
-                //CAMERA_PF_YUV422
-                } else if (s_pixel_format == CAMERA_PF_YUV422) {
-                printf("3\n");
-                    if (memcmp(&buf[5], "bmp", 3) == 0) {
-                        printf("a\n");
-                        //PAUSE_DISPLAY = true;
-                        // send YUV converted to 565 2bpp for now...
-                        netconn_write(conn, http_bitmap_hdr, sizeof(http_bitmap_hdr) - 1, NETCONN_NOCOPY);
-                        char *bmp = bmp_create_header565(camera_get_fb_width(), camera_get_fb_height());
-                        err = netconn_write(conn, bmp, sizeof(bitmap565), NETCONN_COPY);
-                        free(bmp);
-                    } else {
-                        printf("b\n");
-                        char outstr[120];
-                        get_image_mime_info_str(outstr);
-                        netconn_write(conn, outstr, sizeof(outstr) - 1, NETCONN_NOCOPY);
-                        printf("c\n");
-                        //netconn_write(conn, http_yuv422_hdr, sizeof(http_yuv422_hdr) - 1, NETCONN_NOCOPY);
-                    }
-
-                //other
-                } else {
-                printf("4\n");
-                    char outstr[120];
-                    get_image_mime_info_str(outstr);
-                    netconn_write(conn, outstr, sizeof(outstr) - 1, NETCONN_NOCOPY);
-                }
-
-                // handle non streaming images (http../get and http:../bmp )
-                ESP_LOGD(TAG, "Image requested.");
-                //ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
-                bool s_moviemode = is_moviemode_on();
-                set_moviemode(false);
-                set_moviemode(s_moviemode);
-                //ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
-                if (err != ESP_OK) {
-                    ESP_LOGD(TAG, "Camera capture failed with error = %d", err);
-                } else {
-                    ESP_LOGD(TAG, "Done");
-                    //Send jpeg
-                    if ((s_pixel_format == CAMERA_PF_RGB565) || (s_pixel_format == CAMERA_PF_YUV422)) {
-                        ESP_LOGD(TAG, "Converting framebuffer to RGB565 requested, sending...");
-                        uint8_t s_line[160*2];
-                        uint32_t *fbl;
-                        for (int i = 0; i < 120; i++) {
-                            printf("sending %d\n", i);
-                            fbl = &currFbPtr[(i*160)/2];  //(i*(320*2)/4); // 4 bytes for each 2 pixel / 2 byte read..
-                            convert_fb32bit_line_to_bmp565(fbl, s_line, s_pixel_format);
-                            err = netconn_write(conn, s_line, 160*2, NETCONN_COPY);
-                        }
-                        //    ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
-                    } else
-                        err = netconn_write(conn, camera_get_fb(), camera_get_data_size(),NETCONN_NOCOPY);
-                } // handle .bmp and std gets...
-            }// end GET request:
-        set_moviemode(s_moviemode);
+    char resp[160];
+    int n = snprintf(resp, sizeof(resp), "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                     "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    err_t err = tx_ring_write(hc->tx, resp, n);
+    if (err == ERR_OK) {
+        err = ws_send_settings(&ws);
+    }
+    netconn_set_sendtimeout(hc->conn, STREAM_SEND_TIMEOUT_MS);
+    ESP_LOGD(TAG, "WebSocket stream started.");
+    uint32_t next_ms = now_ms();
+    while (err == ERR_OK) {
+        // control messages are taken while waiting for the next frame
+        int wait = (int) (next_ms - now_ms());
+        ws_parse_result_t res = ws_receive(hc, &ws.parser, wait < 1 ? 1 : wait);
+        if (res == WS_PARSE_ERROR) {
+            if (ws.parser.close_code != 0) {
+                ws_close(hc->tx, ws.parser.close_code);
+            }
+            break;
+        } else if (res == WS_PARSE_MESSAGE) {
+            if (ws.parser.opcode == WS_OP_TEXT) {
+                err = ws_control(&ws, ws.parser.payload, ws.parser.payload_len);
+            } else if (ws.parser.opcode == WS_OP_PING) {
+                err = ws_send_message(hc->tx, WS_OP_PONG, ws.parser.payload, ws.parser.payload_len);
+            } else if (ws.parser.opcode == WS_OP_CLOSE) {
+                ws_close(hc->tx, WS_CLOSE_NORMAL);
+                break;
+            }
+            continue;
+        }
+        if ((int) (now_ms() - next_ms) >= 0) {
+            err = ws_send_frame(&ws);
+            next_ms = (ws.fps > 0) ? next_ms + 1000 / ws.fps : now_ms();
+            if ((int) (now_ms() - next_ms) > 0) {
+                next_ms = now_ms();
+            }
+        }
+    }
+    ESP_LOGD(TAG, "WebSocket stream ended after %d frames.", ws.seq);
+    return err;
+}
+
+/*
+ * One image from one captured frame. format is "bmp", "pgm", "jpg", "qoi"
+ * or "raw", "" picks what suits the pixel format. Apart from software
+ * JPEG and QOI, which are encoded while sending, the length is known
+ * before the first byte goes out, so the connection can stay open.
+ * The frame kept by the background capture is used if it is at most
+ * max_age_ms old; software JPEG always captures, strip by strip, and
+ * so has no ETag. The others answer If-None-Match, see frame_etag.h.
+ */
+static err_t serve_snapshot(http_conn_t *hc, const http_request_t *req, const char *format, int quality,
+                            int max_age_ms)
+{
+    const bool rgb = (s_pixel_format == CAMERA_PF_RGB565) || (s_pixel_format == CAMERA_PF_YUV422);
+    if (CAMERA_STRIP_ONLY && *format != '\0' && strcmp(format, "jpg") != 0) {
+        return send_error(hc, 404);
+    }
+    if (*format == '\0') {
+        format = CAMERA_STRIP_ONLY ? "jpg" : rgb ? "bmp" :
+                 (s_pixel_format == CAMERA_PF_GRAYSCALE) ? "pgm" :
+                 (s_pixel_format == CAMERA_PF_JPEG) ? "jpg" : "raw";
+    }
+    if (strcmp(format, "qoi") == 0 && (rgb || s_pixel_format == CAMERA_PF_GRAYSCALE)) {
+        return serve_qoi(hc, req, max_age_ms);
+    }
+    if (strcmp(format, "jpg") == 0 && s_pixel_format != CAMERA_PF_JPEG) {
+        return serve_sw_jpeg(hc, quality);
+    }
+    const bool bmp = strcmp(format, "bmp") == 0 && rgb;
+    const bool pgm = strcmp(format, "pgm") == 0 && s_pixel_format == CAMERA_PF_GRAYSCALE;
+    const bool jpg = strcmp(format, "jpg") == 0;
+    if (!bmp && !pgm && !jpg && strcmp(format, "raw") != 0) {
+        return send_error(hc, 400);
+    }
+
+    ESP_LOGD(TAG, "Image requested.");
+    bool not_modified;
+    camera_fb_t *fb = snapshot_frame_if_changed(hc, req, max_age_ms, &not_modified);
+    if (not_modified) {
+        return send_not_modified(hc);
+    }
+    if (fb == NULL) {
+        ESP_LOGD(TAG, "Camera capture failed");
+        return send_error(hc, 503);
+    }
+    // RGB565 and YUV422 go out converted to RGB565, once per frame if the cache can keep it
+    snap_entry_t *converted = rgb ? snapshot_rgb565(fb) : NULL;
+    const size_t body_len = rgb ? fb->width * fb->height * 2 : fb->len;
+    err_t err;
+    if (bmp || pgm) {
+        image_header_format_t fmt = bmp ? IMAGE_HDR_BMP565 : IMAGE_HDR_PGM;
+        size_t hdr_len;
+        if (image_header_get(fmt, fb->width, fb->height, &hdr_len) == NULL) {
+            err = ERR_MEM;
+        } else if (bmp) {
+            err = send_ok_hdr(hc, http_bitmap_hdr, hdr_len + body_len);
+        } else {
+            err = send_ok_hdr(hc, http_pgm_hdr, hdr_len + body_len);
+        }
+        if (err == ERR_OK) {
+            err = write_image_header(hc, fmt);
+        }
+    } else if (jpg) {
+        err = send_ok_hdr(hc, http_jpg_hdr, body_len);
+    } else {
+        char outstr[120];
+        int len = get_image_mime_info_str(outstr);
+        err = send_response_hdr(hc, http_hdr, outstr, len, body_len);
+    }
+    if (err != ERR_OK) {
+        if (converted != NULL) {
+            snap_cache_release(converted);
+        }
+        camera_fb_release(fb);
+        return err;
+    }
+
+    if (converted != NULL) {
+        camera_fb_release(fb);
+        err = tx_ring_send_buf(hc->tx, converted->data, converted->len, &snap_cache_release, converted);
+    } else if (rgb) {
+        ESP_LOGD(TAG, "Converting framebuffer to RGB565 requested, sending...");
+        err = send_frame_rgb565(hc->tx, fb);
+        camera_fb_release(fb);
+    } else if (jpg) {
+        // sent from the frame itself, the tx ring releases it once acknowledged
+        err = tx_ring_send_frame(hc->tx, fb);
+    } else {
+        err = tx_ring_send_frame(hc->tx, fb);
+    }
+    return err;
+}
+
+/*
+ * /fb sends the framebuffer as captured, behind a fb_frame_header_t, so a
+ * client can convert the pixels itself: the camera neither converts nor
+ * copies, the frame goes out from the pool like a sensor JPEG. The
+ * length is known, so a viewer polls over one kept-alive connection.
+ * www/fb_viewer.html, served as /fbview, decodes it on a canvas.
+ */
+#define FB_FRAME_MAGIC "CAMF"
+
+// in front of the framebuffer, little endian like the ESP32
+typedef struct __attribute__((packed)) {
+    char magic[4];              // FB_FRAME_MAGIC
+    uint8_t version;            // 1
+    uint8_t format;             // camera_pixelformat_t, or fb_packed_format_t for ?format=
+    uint16_t header_len;        // sizeof(fb_frame_header_t), the framebuffer follows
+    uint16_t width;
+    uint16_t height;
+    uint32_t stride;            // bytes per line, 0 for JPEG
+    uint32_t seq;
+    uint32_t timestamp_ms;      // capture time
+    uint32_t data_len;          // bytes of framebuffer
+} fb_frame_header_t;
+
+/*
+ * Fewer bits per pixel for slow links, /fb?format=rgb444 and so on.
+ * Numbered after camera_pixelformat_t; the sensor's own RGB444 keeps 16
+ * bits a pixel, these are packed.
+ */
+typedef enum {
+    FB_FORMAT_RGB444 = 16,      // see image_rgb565_line_to_rgb444
+    FB_FORMAT_GRAY4 = 17,       // dithered, see image_gray_line_to_packed
+    FB_FORMAT_GRAY2 = 18,
+    FB_FORMAT_GRAY1 = 19,       // split at the Otsu threshold of the frame
+} fb_packed_format_t;
+
+typedef struct {
+    const char *name;
+    fb_packed_format_t format;
+    int bits;                   // per pixel
+} fb_packing_t;
+
+static const fb_packing_t s_fb_packings[] = {
+    { "rgb444", FB_FORMAT_RGB444, 12 },
+    { "gray4", FB_FORMAT_GRAY4, 4 },
+    { "gray2", FB_FORMAT_GRAY2, 2 },
+    { "gray1", FB_FORMAT_GRAY1, 1 },
+};
+
+static const fb_packing_t *fb_packing(const char *name)
+{
+    for (int i = 0; i < sizeof(s_fb_packings) / sizeof(s_fb_packings[0]); i++) {
+        if (strcmp(name, s_fb_packings[i].name) == 0) {
+            return &s_fb_packings[i];
         }
     }
+    return NULL;
+}
+
+static size_t fb_packed_stride(const fb_packing_t *packing, int width)
+{
+    return (width * packing->bits + 7) / 8;
+}
+
+static uint8_t fb_otsu_threshold(const camera_fb_t *fb, uint16_t *rgb, uint8_t *gray)
+{
+    uint32_t *histogram = (uint32_t*) calloc(256, sizeof(uint32_t));
+    if (histogram == NULL) {
+        return 128;
+    }
+    for (int y = 0; y < fb->height; y++) {
+        const uint8_t *line = fb_line_gray(fb, y, rgb, gray);
+        for (int x = 0; x < fb->width; x++) {
+            histogram[line[x]]++;
+        }
+    }
+    uint8_t threshold = image_otsu_threshold(histogram, 256);
+    free(histogram);
+    return threshold;
+}
+
+static err_t send_fb_packed(tx_ring_t *tx, const camera_fb_t *fb, const fb_packing_t *packing)
+{
+    const int width = fb->width;
+    const size_t stride = fb_packed_stride(packing, width);
+    uint16_t *rgb = (uint16_t*) malloc(width * sizeof(uint16_t));
+    uint8_t *gray = (uint8_t*) malloc(width + stride);
+    if (rgb == NULL || gray == NULL) {
+        free(rgb);
+        free(gray);
+        return ERR_MEM;
+    }
+    uint8_t *out = gray + width;
+    const uint8_t threshold = (packing->format == FB_FORMAT_GRAY1) ? fb_otsu_threshold(fb, rgb, gray) : 0;
+    err_t err = ERR_OK;
+    TRACE_BEGIN(TRACE_CONVERT);
+    for (int y = 0; y < fb->height && err == ERR_OK; y++) {
+        if (packing->format == FB_FORMAT_RGB444) {
+            fb_line_rgb565(fb, y, rgb);
+            image_rgb565_line_to_rgb444(rgb, out, width);
+        } else if (packing->format == FB_FORMAT_GRAY1) {
+            image_gray_line_to_bilevel(fb_line_gray(fb, y, rgb, gray), out, width, threshold);
+        } else {
+            image_gray_line_to_packed(fb_line_gray(fb, y, rgb, gray), out, width, packing->bits, y);
+        }
+        err = tx_ring_write(tx, out, stride);
+    }
+    TRACE_END(TRACE_CONVERT);
+    free(gray);
+    free(rgb);
+    return err;
+}
+
+static err_t serve_fb(http_conn_t *hc, const http_request_t *req, const char *format, int max_age_ms)
+{
+    const fb_packing_t *packing = NULL;
+    if (*format != '\0') {
+        packing = fb_packing(format);
+        if (packing == NULL || s_pixel_format == CAMERA_PF_JPEG) {
+            return send_error(hc, 400);
+        }
+    }
+    bool not_modified;
+    camera_fb_t *fb = snapshot_frame_if_changed(hc, req, max_age_ms, &not_modified);
+    if (not_modified) {
+        return send_not_modified(hc);
+    }
+    if (fb == NULL) {
+        return send_error(hc, 503);
+    }
+    const int bytes_per_pixel = (fb->format == CAMERA_PF_GRAYSCALE) ? 1 : (fb->format == CAMERA_PF_JPEG) ? 0 : 2;
+    fb_frame_header_t hdr = {
+        .version = 1,
+        .format = fb->format,
+        .header_len = sizeof(fb_frame_header_t),
+        .width = fb->width,
+        .height = fb->height,
+        .stride = fb->width * bytes_per_pixel,
+        .seq = fb->seq,
+        .timestamp_ms = fb->timestamp_ms,
+        .data_len = fb->len,
+    };
+    if (packing != NULL) {
+        hdr.format = packing->format;
+        hdr.stride = fb_packed_stride(packing, fb->width);
+        hdr.data_len = hdr.stride * fb->height;
+    }
+    memcpy(hdr.magic, FB_FRAME_MAGIC, sizeof(hdr.magic));
+    err_t err = send_ok_hdr(hc, http_octet_stream_hdr, sizeof(hdr) + hdr.data_len);
+    if (err == ERR_OK) {
+        err = tx_ring_write(hc->tx, &hdr, sizeof(hdr));
+    }
+    if (err != ERR_OK || packing != NULL) {
+        if (err == ERR_OK) {
+            err = send_fb_packed(hc->tx, fb, packing);
+        }
+        camera_fb_release(fb);
+        return err;
+    }
+    return tx_ring_send_frame(hc->tx, fb);
+}
+
+// a page embedded in flash, it never changes
+static err_t serve_embedded_html(http_conn_t *hc, const char *start, const char *end)
+{
+    // COMPONENT_EMBED_TXTFILES adds a NUL
+    size_t len = end - start - 1;
+    err_t err = send_ok_hdr(hc, http_html_hdr, len);
+    if (err == ERR_OK) {
+        err = tx_ring_flush(hc->tx);
+    }
+    if (err == ERR_OK) {
+        err = conn_write(hc, start, len, NETCONN_NOCOPY);
+    }
+    return err;
+}
+
+#if CONFIG_CAMERA_TRACE
+static err_t serve_trace(http_conn_t *hc)
+{
+    err_t err = send_ok_hdr(hc, http_json_hdr, -1);
+    if (err == ERR_OK && camera_trace_dump_json(&tx_ring_write_cb, hc->tx) != 0) {
+        err = ERR_CLSD;
+    }
+    return err;
+}
+#endif
+
+static err_t serve_metrics(http_conn_t *hc)
+{
+    err_t err = send_ok_hdr(hc, http_metrics_hdr, -1);
+    if (err == ERR_OK && metrics_render(&tx_ring_write_cb, hc->tx) != 0) {
+        err = ERR_CLSD;
+    }
+    return err;
+}
+
+// what /metrics counts a request as
+static metrics_endpoint_t request_endpoint(const char *path)
+{
+    if (strcmp(path, "/stream") == 0) {
+        return METRICS_EP_STREAM;
+    } else if (strcmp(path, "/mjpeg") == 0) {
+        return METRICS_EP_MJPEG;
+    } else if (strcmp(path, "/cr") == 0 || strcmp(path, "/crstream") == 0) {
+        return METRICS_EP_CR;
+    } else if (strcmp(path, "/ws") == 0) {
+        return METRICS_EP_WS;
+    } else if (strncmp(path, "/rec", 4) == 0) {
+        return METRICS_EP_REC;
+    } else if (strcmp(path, "/metrics") == 0) {
+        return METRICS_EP_METRICS;
+    } else if (strcmp(path, "/") == 0 || strcmp(path, "/get") == 0 || strcmp(path, "/snapshot") == 0 ||
+               strcmp(path, "/bmp") == 0 || strcmp(path, "/pgm") == 0 || strcmp(path, "/jpg") == 0 ||
+               strcmp(path, "/qoi") == 0 || strcmp(path, "/raw") == 0 || strcmp(path, "/fb") == 0) {
+        return METRICS_EP_SNAPSHOT;
+    }
+    return METRICS_EP_OTHER;
+}
+
+// size=WxH is accepted as long as it is what the sensor delivers
+static bool size_supported(const char *size)
+{
+    int w, h;
+    return sscanf(size, "%dx%d", &w, &h) == 2 &&
+           w == camera_get_fb_width() && h == camera_get_fb_height();
+}
+
+// what is left without a framebuffer: software JPEG, encoded while the strips come in
+static bool strip_only_path(const char *path)
+{
+    return strcmp(path, "/") == 0 || strcmp(path, "/get") == 0 || strcmp(path, "/snapshot") == 0 ||
+           strcmp(path, "/jpg") == 0 || strcmp(path, "/mjpeg") == 0 || strcmp(path, "/ws") == 0 ||
+           strcmp(path, "/metrics") == 0 || strcmp(path, "/trace") == 0 ||
+           strcmp(path, "/rec") == 0 || strncmp(path, "/rec/", 5) == 0;
+}
+
+static err_t route_request(http_conn_t *hc, const http_request_t *req)
+{
+    const char *path = req->path;
+    const bool rgb = (s_pixel_format == CAMERA_PF_RGB565) || (s_pixel_format == CAMERA_PF_YUV422);
+    char format[8] = "";
+    char size[16];
+    http_query_get(req, "format", format, sizeof(format));
+    const int quality = http_query_int(req, "quality", 0);
+    const int fps = http_query_int(req, "fps", 0);
+    const int max_age = http_query_int(req, "max_age", CONFIG_CAPTURE_MAX_AGE_MS);
+
+    ESP_LOGD(TAG, "%s %s?%s", req->method, path, req->query);
+    const metrics_endpoint_t endpoint = request_endpoint(path);
+    metric_add(&g_metrics.requests[endpoint], 1);
+    hc->tx->sent = &g_metrics.bytes_sent[endpoint];
+    if (strcmp(req->method, "GET") != 0) {
+        return send_error(hc, 405);
+    }
+    if (quality < 0 || quality > 100 || fps < 0 || max_age < 0 ||
+        (http_query_get(req, "size", size, sizeof(size)) && !size_supported(size))) {
+        return send_error(hc, 400);
+    }
+
+    if (CAMERA_STRIP_ONLY && !strip_only_path(path)) {
+        return send_error(hc, 404);
+    } else if (strcmp(path, "/stream") == 0 && strcmp(format, "auto") == 0 && rgb) {
+        return serve_adaptive_stream(hc, fps);
+    } else if (strcmp(path, "/stream") == 0 ||
+               (strcmp(path, "/mjpeg") == 0 && s_pixel_format == CAMERA_PF_JPEG)) {
+        err_t err = serve_stream(hc, fps);
+        ESP_LOGD(TAG, "Stream ended.");
+        ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
+        return err;
+    } else if (strcmp(path, "/ws") == 0) {
+        return serve_ws(hc, req, format, quality, fps);
+    } else if (strcmp(path, "/mjpeg") == 0) {
+        return serve_mjpeg(hc, quality, fps);
+    } else if (strcmp(path, "/crstream") == 0 && rgb) {
+        err_t err = serve_cr_stream(hc, fps);
+        ESP_LOGD(TAG, "CR stream ended.");
+        return err;
+    } else if (strcmp(path, "/cr") == 0) {
+        return serve_embedded_html(hc, cr_viewer_html_start, cr_viewer_html_end);
+    } else if (strcmp(path, "/fbview") == 0) {
+        return serve_embedded_html(hc, fb_viewer_html_start, fb_viewer_html_end);
+    } else if (strcmp(path, "/fb") == 0) {
+        return serve_fb(hc, req, format, max_age);
+    } else if (strcmp(path, "/metrics") == 0) {
+        return serve_metrics(hc);
+#if CONFIG_CAMERA_TRACE
+    } else if (strcmp(path, "/trace") == 0) {
+        return serve_trace(hc);
+#endif
+    } else if (strcmp(path, "/rec") == 0) {
+        return serve_recording_list(hc);
+    } else if (strncmp(path, "/rec/", 5) == 0) {
+        return serve_recording(hc, strtoul(path + 5, NULL, 10));
+    } else if (strcmp(path, "/") == 0 || strcmp(path, "/get") == 0 || strcmp(path, "/snapshot") == 0) {
+        return serve_snapshot(hc, req, format, quality, max_age);
+    } else if (strcmp(path, "/bmp") == 0 || strcmp(path, "/pgm") == 0 || strcmp(path, "/jpg") == 0 ||
+               strcmp(path, "/qoi") == 0 || strcmp(path, "/raw") == 0) {
+        return serve_snapshot(hc, req, path + 1, quality, max_age);
+    }
+    return send_error(hc, 404);
+}
+
+/*
+ * Parses the next request, continuing in data left over from the last
+ * one. Returns HTTP_PARSE_MORE if the connection ended or timed out
+ * before a complete request arrived.
+ */
+static http_parse_result_t read_request(http_conn_t *hc, http_request_t *req)
+{
+    http_request_init(req);
+    while (true) {
+        if (hc->inbuf == NULL) {
+            if (netconn_recv(hc->conn, &hc->inbuf) != ERR_OK) {
+                hc->inbuf = NULL;
+                return HTTP_PARSE_MORE;
+            }
+            hc->in_offset = 0;
+        }
+        char *data;
+        u16_t len;
+        netbuf_data(hc->inbuf, (void**) &data, &len);
+        size_t used;
+        http_parse_result_t res = http_request_parse(req, data + hc->in_offset, len - hc->in_offset, &used);
+        hc->in_offset += used;
+        if (hc->in_offset >= len) {
+            hc->in_offset = 0;
+            if (netbuf_next(hc->inbuf) < 0) {
+                netbuf_delete(hc->inbuf);
+                hc->inbuf = NULL;
+            }
+        }
+        if (res != HTTP_PARSE_MORE) {
+            return res;
+        }
+    }
+}
+
+static void http_server_netconn_serve(http_conn_t *hc)
+{
+    struct netconn *conn = hc->conn;
+    http_request_t req;
+    err_t err = ERR_OK;
+    tx_ring_begin(hc->tx, conn);
+    hc->inbuf = NULL;
+    hc->requests = 0;
+    do {
+        http_parse_result_t res = read_request(hc, &req);
+        if (res == HTTP_PARSE_MORE) {
+            // closed by the client or idle for too long
+            break;
+        }
+        hc->requests++;
+        hc->etag[0] = '\0';
+        if (res == HTTP_PARSE_ERROR) {
+            metric_add(&g_metrics.requests[METRICS_EP_OTHER], 1);
+            hc->tx->sent = &g_metrics.bytes_sent[METRICS_EP_OTHER];
+            ESP_LOGD(TAG, "Bad request: %d", req.status);
+            hc->keep_alive = false;
+            send_error(hc, req.status);
+            break;
+        }
+        hc->keep_alive = req.keep_alive;
+        TRACE_BEGIN(TRACE_REQUEST);
+        err = route_request(hc, &req);
+        if (err == ERR_OK) {
+            err = tx_ring_flush(hc->tx);
+        }
+        TRACE_END(TRACE_REQUEST);
+        // the next request of a kept-alive connection gets less time
+        netconn_set_recvtimeout(conn, HTTP_KEEPALIVE_TIMEOUT_MS);
+    } while (err == ERR_OK && hc->keep_alive);
+    ESP_LOGD(TAG, "%d requests on the connection", hc->requests);
+
+    // the chunks and frames in flight must be acknowledged before the pcb goes away
+    tx_ring_end(hc->tx, HTTP_TX_END_TIMEOUT_MS / portTICK_RATE_MS);
     netconn_close(conn); /* Close the connection (server closes in HTTP) */
-    netbuf_delete(inbuf);/* Delete the buffer (netconn_recv gives us ownership,so we have to make sure to deallocate the buffer) */
+    if (hc->inbuf != NULL) {
+        netbuf_delete(hc->inbuf);
+    }
+}
+
+static void http_worker(void *pvParameters)
+{
+    const int worker = (int) (intptr_t) pvParameters;
+    http_conn_t hc;
+    tx_ring_t tx;
+    rate_ctrl_t rate;
+    if (tx_ring_init(&tx, CONFIG_HTTP_TX_CHUNKS, HTTP_TX_CHUNK_SIZE) != ESP_OK) {
+        ESP_LOGE(TAG, "worker %d: no memory for transmit chunks", worker);
+        vTaskDelete(NULL);
+        return;
+    }
+    metrics_register_task(NULL);
+    while (true) {
+        xQueueReceive(s_http_queue, &hc, portMAX_DELAY);
+        metric_add(&g_metrics.connections_opened, 1);
+        hc.worker = worker;
+        hc.tx = &tx;
+        conn_rate_ctrl_init(&hc, &rate);
+        ESP_LOGD(TAG, "worker %d: connection waited %d ms", worker, now_ms() - hc.accepted_ms);
+        // a client which never sends its request must not hold the worker forever
+        netconn_set_recvtimeout(hc.conn, HTTP_RECV_TIMEOUT_MS);
+        http_server_netconn_serve(&hc);
+        /*
+        netconn_delete: if status is connecting, after call this function, do active close.
+         , delete newconn struct in the end.
+        */
+        netconn_delete(hc.conn);
+        metric_add(&g_metrics.connections_closed, 1);
+        ESP_LOGD(TAG, "worker %d: done after %d ms, stack left %d", worker,
+                 now_ms() - hc.accepted_ms, uxTaskGetStackHighWaterMark(NULL));
+    }
 }
 
 static void http_server(void *pvParameters)
@@ -508,7 +2090,23 @@ static void http_server(void *pvParameters)
        }
     */
     struct netconn *conn, *newconn;  
-    err_t err,ert;
+    err_t err;
+
+    // accepted connections wait here for a free worker
+    s_http_queue = xQueueCreate(HTTP_BACKLOG, sizeof(http_conn_t));
+    if (s_http_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create HTTP connection queue");
+        vTaskDelete(NULL);
+        return;
+    }
+    for (int i = 0; i < HTTP_WORKERS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "http_worker%d", i);
+        if (!xTaskCreatePinnedToCore(&http_worker, name, 5120, (void*) (intptr_t) i, 5, NULL, 1)) {
+            ESP_LOGE(TAG, "Failed to create %s", name);
+        }
+    }
+    metrics_register_task(NULL);
     /*
         alloc netconn space for netconn struct     
     */
@@ -532,15 +2130,19 @@ static void http_server(void *pvParameters)
         */
         err = netconn_accept(conn, &newconn);
         if (err == ERR_OK) {    /* new conn is coming */
-            ert = camera_run();
-            printf("%s\n",ert == ERR_OK ? "camer run success" : "camera run failed" );
-            vTaskDelay(3000 / portTICK_RATE_MS);
-            http_server_netconn_serve(newconn);
-            /*
-            netconn_delete: if status is connecting, after call this function, do active close.
-             , delete newconn struct in the end.
-            */
-            netconn_delete(newconn);
+            http_conn_t hc = {
+                .conn = newconn,
+                .worker = -1,
+                .accepted_ms = now_ms(),
+            };
+            if (xQueueSend(s_http_queue, &hc, 0) != pdTRUE) {
+                // backlog is full, turn the client away instead of queueing without bound
+                ESP_LOGW(TAG, "All workers busy, rejecting connection");
+                metric_add(&g_metrics.connections_rejected, 1);
+                netconn_write(newconn, http_busy_hdr, sizeof(http_busy_hdr) - 1, NETCONN_NOCOPY);
+                netconn_close(newconn);
+                netconn_delete(newconn);
+            }
         }
     } while (err == ERR_OK);
     /*
@@ -555,9 +2157,11 @@ void app_main()
 {
 
     ESP_LOGI(TAG,"get free size of 32BIT heap : %d\n",heap_caps_get_free_size(MALLOC_CAP_32BIT));
+#if !CONFIG_CAMERA_STRIP_ONLY
     currFbPtr = heap_caps_malloc(160*120*2, MALLOC_CAP_32BIT);
 
     ESP_LOGI(TAG,"%s\n",currFbPtr == NULL ? "currFbPtr is NULL" : "currFbPtr not NULL" );
+#endif
 
     ESP_LOGI(TAG,"Starting nvs_flash_init ...");
     nvs_flash_init();
@@ -588,6 +2192,9 @@ void app_main()
         ESP_LOGI(TAG, "Detected OV7670 camera");
         s_pixel_format = CAMERA_PIXEL_FORMAT;
         config.frame_size = CAMERA_FRAME_SIZE;
+    } else if (camera_model == CAMERA_OV2640 && CAMERA_STRIP_ONLY) {
+        ESP_LOGE(TAG, "OV2640 JPEG needs a framebuffer, not supported strip only");
+        return;
     } else if (camera_model == CAMERA_OV2640) {
         ESP_LOGI(TAG, "Detected OV2640 camera, using JPEG format");
         s_pixel_format = CAMERA_PF_JPEG;
@@ -600,6 +2207,7 @@ void app_main()
 
     espilicam_event_group = xEventGroupCreate();
     config.displayBuffer = currFbPtr;
+    config.strip_only = CAMERA_STRIP_ONLY;
     config.pixel_format = s_pixel_format;
 
     err = camera_init(&config);
@@ -608,6 +2216,80 @@ void app_main()
         return;
     }
 
+    err = jpeg_stream_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "JPEG encoder init failed with error 0x%x", err);
+        return;
+    }
+
+#if CONFIG_RATE_CTRL_ENABLE
+    // the software encoder gets a controller per connection, see conn_rate_ctrl_init
+    s_rate_lock = xSemaphoreCreateMutex();
+    if (s_rate_lock == NULL) {
+        ESP_LOGE(TAG, "No memory for JPEG rate control");
+        return;
+    }
+    if (s_pixel_format == CAMERA_PF_JPEG) {
+        rate_ctrl_config_t rate_config;
+        rate_ctrl_config_defaults(&rate_config);
+        rate_config.q_best = OV2640_QS_BEST;
+        rate_config.q_worst = OV2640_QS_WORST;
+        rate_config.q_initial = config.jpeg_quality;
+        rate_config.apply = &apply_sensor_quality;
+        if (rate_ctrl_init(&s_rate_ctrl, &rate_config) != 0) {
+            ESP_LOGE(TAG, "JPEG rate control init failed");
+        }
+    }
+#endif
+
+    // strip only there are no whole frames to stream or keep fresh
+    if (!CAMERA_STRIP_ONLY) {
+        // room for a full bitmap part; JPEG parts are smaller
+        err = broadcaster_init(camera_get_fb_width() * camera_get_fb_height() * 2 + 256,
+                               CONFIG_STREAM_MAX_FRAMES, CONFIG_STREAM_QUEUE_DEPTH, &render_stream_part);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Broadcaster init failed with error 0x%x", err);
+            return;
+        }
+
+#if CONFIG_CAPTURE_FPS > 0
+        if (xTaskCreatePinnedToCore(&capture_task, "capture", 3072, NULL, 4, NULL, 1)) {
+            set_moviemode(true);
+        } else {
+            ESP_LOGE(TAG, "Failed to create capture task, snapshots capture on demand");
+        }
+#endif
+    }
+
+    err = recorder_init(s_pixel_format);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Recorder init failed with error 0x%x", err);
+    }
+
+#if CONFIG_RTSP_ENABLE
+    err = rtsp_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "RTSP init failed with error 0x%x", err);
+    }
+#endif
+
+    err = frame_etag_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "ETag init failed with error 0x%x", err);
+        return;
+    }
+    err = snap_cache_init(CONFIG_SNAPSHOT_CACHE_KB * 1024);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Snapshot cache init failed with error 0x%x", err);
+        return;
+    }
+
+    // fill the header cache before the server can look headers up
+    image_header_prepare(IMAGE_HDR_BMP565, camera_get_fb_width(), camera_get_fb_height());
+    image_header_prepare(IMAGE_HDR_PGM, camera_get_fb_width(), camera_get_fb_height());
+    // the half size frames of adaptive streams
+    image_header_prepare(IMAGE_HDR_BMP565, camera_get_fb_width() / 2, camera_get_fb_height() / 2);
+
     vTaskDelay(2000 / portTICK_RATE_MS);
 
     ESP_LOGD(TAG, "Starting http_server task...");
@@ -616,7 +2298,22 @@ void app_main()
 
     ESP_LOGI(TAG, "open http://" IPSTR "/bmp for single image/bitmap image", IP2STR(&s_ip_addr));
     ESP_LOGI(TAG, "open http://" IPSTR "/stream for multipart/x-mixed-replace stream of bitmaps", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/stream?format=auto for a stream fitted to the link of each viewer", IP2STR(&s_ip_addr));
     ESP_LOGI(TAG, "open http://" IPSTR "/get for raw image as stored in framebuffer ", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/jpg for single JPEG image", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/mjpeg for multipart/x-mixed-replace stream of JPEG images", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/cr for a block-update video viewer", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/fbview for a viewer converting the raw framebuffer itself", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/qoi for single lossless QOI image", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/rec for recordings on flash", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open ws://" IPSTR "/ws for frames as WebSocket messages", IP2STR(&s_ip_addr));
+    ESP_LOGI(TAG, "open http://" IPSTR "/metrics for Prometheus metrics", IP2STR(&s_ip_addr));
+#if CONFIG_CAMERA_TRACE
+    ESP_LOGI(TAG, "open http://" IPSTR "/trace for a Chrome trace of the pipeline", IP2STR(&s_ip_addr));
+#endif
+#if CONFIG_RTSP_ENABLE
+    ESP_LOGI(TAG, "open rtsp://" IPSTR ":%d/ for RTP/JPEG over UDP", IP2STR(&s_ip_addr), CONFIG_RTSP_PORT);
+#endif
 
     ESP_LOGI(TAG,"get free size of 32BIT heap : %d\n",heap_caps_get_free_size(MALLOC_CAP_32BIT));
     ESP_LOGI(TAG, "task stack: %d", uxTaskGetStackHighWaterMark(NULL));
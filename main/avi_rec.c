@@ -0,0 +1,417 @@
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "avi_rec.h"
+
+// byte offsets of the header fields patched when a segment is closed
+#define OFS_RIFF_SIZE       4
+#define OFS_AVIH_US         32
+#define OFS_AVIH_MAX_BPS    36
+#define OFS_AVIH_FRAMES     48
+#define OFS_AVIH_BUFSIZE    60
+#define OFS_STRH_SCALE      128
+#define OFS_STRH_RATE       132
+#define OFS_STRH_LENGTH     140
+#define OFS_STRH_BUFSIZE    144
+#define OFS_MOVI_SIZE       216
+#define OFS_MOVI            220     // idx1 offsets count from the "movi" fourcc
+
+#define AVIF_HASINDEX       0x10
+#define AVIIF_KEYFRAME      0x10
+
+static void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void build_header(const avi_rec_config_t* c, uint8_t* h)
+{
+    uint32_t us_per_frame = 1000000 / c->fps;
+    memset(h, 0, AVI_REC_HEADER_SIZE);
+
+    memcpy(h + 0, "RIFF", 4);           // size is patched on close, 0 marks an open segment
+    memcpy(h + 8, "AVI ", 4);
+    memcpy(h + 12, "LIST", 4);
+    put32(h + 16, 192);
+    memcpy(h + 20, "hdrl", 4);
+
+    memcpy(h + 24, "avih", 4);
+    put32(h + 28, 56);
+    put32(h + OFS_AVIH_US, us_per_frame);
+    put32(h + 44, AVIF_HASINDEX);
+    put32(h + 56, 1);                   // streams
+    put32(h + OFS_AVIH_BUFSIZE, c->max_frame_size);
+    put32(h + 64, c->width);
+    put32(h + 68, c->height);
+
+    memcpy(h + 88, "LIST", 4);
+    put32(h + 92, 116);
+    memcpy(h + 96, "strl", 4);
+    memcpy(h + 100, "strh", 4);
+    put32(h + 104, 56);
+    memcpy(h + 108, "vids", 4);
+    memcpy(h + 112, "MJPG", 4);
+    put32(h + OFS_STRH_SCALE, us_per_frame);
+    put32(h + OFS_STRH_RATE, 1000000);
+    put32(h + OFS_STRH_BUFSIZE, c->max_frame_size);
+    put32(h + 148, 0xffffffff);         // quality, default
+    put16(h + 160, c->width);
+    put16(h + 162, c->height);
+
+    memcpy(h + 164, "strf", 4);
+    put32(h + 168, 40);
+    put32(h + 172, 40);
+    put32(h + 176, c->width);
+    put32(h + 180, c->height);
+    put16(h + 184, 1);                  // planes
+    put16(h + 186, 24);                 // bits per pixel once decoded
+    memcpy(h + 188, "MJPG", 4);
+    put32(h + 192, c->width * c->height * 3);
+
+    memcpy(h + 212, "LIST", 4);
+    put32(h + OFS_MOVI_SIZE, 4);
+    memcpy(h + OFS_MOVI, "movi", 4);
+}
+
+void avi_rec_segment_name(const avi_rec_t* rec, uint32_t seq, char* name, size_t size)
+{
+    snprintf(name, size, "%s/seg%05u.avi", rec->config.dir, (unsigned) seq);
+}
+
+int avi_rec_segment_ready(const avi_rec_t* rec, uint32_t seq)
+{
+    if (seq < rec->first_seq || seq >= rec->next_seq) {
+        return 0;
+    }
+    return !(rec->file != NULL && seq == rec->cur_seq);
+}
+
+static int rec_flush(avi_rec_t* rec)
+{
+    if (rec->wbuf_len == 0) {
+        return 0;
+    }
+    if (fwrite(rec->wbuf, 1, rec->wbuf_len, rec->file) != rec->wbuf_len) {
+        return -1;
+    }
+    rec->file_pos += rec->wbuf_len;
+    rec->wbuf_len = 0;
+    return 0;
+}
+
+static int rec_put(avi_rec_t* rec, const void* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) data;
+    while (len > 0) {
+        size_t n = rec->config.write_chunk - rec->wbuf_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(rec->wbuf + rec->wbuf_len, p, n);
+        rec->wbuf_len += n;
+        p += n;
+        len -= n;
+        if (rec->wbuf_len == rec->config.write_chunk && rec_flush(rec) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t rec_pos(const avi_rec_t* rec)
+{
+    return rec->file_pos + rec->wbuf_len;
+}
+
+// drop everything after pos, which has to be at or after the header
+static void rec_rewind(avi_rec_t* rec, uint32_t pos)
+{
+    if (pos >= rec->file_pos) {
+        rec->wbuf_len = pos - rec->file_pos;
+    } else {
+        rec->wbuf_len = 0;
+        rec->file_pos = pos;
+        fseek(rec->file, pos, SEEK_SET);
+    }
+}
+
+// only called with an empty write buffer
+static int rec_patch32(avi_rec_t* rec, uint32_t pos, uint32_t value)
+{
+    uint8_t b[4];
+    put32(b, value);
+    if (fseek(rec->file, pos, SEEK_SET) != 0 || fwrite(b, 1, 4, rec->file) != 4) {
+        return -1;
+    }
+    return 0;
+}
+
+static void delete_oldest(avi_rec_t* rec)
+{
+    uint32_t seq = rec->first_seq;
+    if (seq >= rec->next_seq || (int32_t) seq == rec->pinned_seq) {
+        return;
+    }
+    if (rec->file != NULL && seq == rec->cur_seq) {
+        return;
+    }
+    char name[AVI_REC_NAME_MAX];
+    avi_rec_segment_name(rec, seq, name, sizeof(name));
+    rec->first_seq = seq + 1;
+    remove(name);
+    rec->segments_deleted++;
+}
+
+static int open_segment(avi_rec_t* rec)
+{
+    // keep max_segments - 1 old ones, the new segment makes it max_segments
+    while (rec->next_seq - rec->first_seq >= (uint32_t) rec->config.max_segments) {
+        uint32_t first = rec->first_seq;
+        delete_oldest(rec);
+        if (rec->first_seq == first) {
+            break;                      // pinned by a download, the ring grows by one for now
+        }
+    }
+
+    char name[AVI_REC_NAME_MAX];
+    avi_rec_segment_name(rec, rec->next_seq, name, sizeof(name));
+    rec->file = fopen(name, "wb");
+    if (rec->file == NULL) {
+        return -1;
+    }
+    // writes are batched here already
+    setvbuf(rec->file, NULL, _IONBF, 0);
+    rec->cur_seq = rec->next_seq++;
+    rec->file_pos = 0;
+    rec->wbuf_len = 0;
+    rec->frames = 0;
+
+    uint8_t header[AVI_REC_HEADER_SIZE];
+    build_header(&rec->config, header);
+    return rec_put(rec, header, sizeof(header));
+}
+
+int avi_rec_close_segment(avi_rec_t* rec)
+{
+    if (rec->file == NULL) {
+        return 0;
+    }
+    uint32_t movi_end = rec_pos(rec);
+    uint32_t max_size = 0;
+    uint8_t entry[16];
+
+    int ret = 0;
+    memcpy(entry, "idx1", 4);
+    put32(entry + 4, rec->frames * 16);
+    ret |= rec_put(rec, entry, 8);
+    for (uint32_t i = 0; i < rec->frames && ret == 0; i++) {
+        uint32_t size = rec->index[2 * i + 1];
+        if (size > max_size) {
+            max_size = size;
+        }
+        memcpy(entry, "00dc", 4);
+        put32(entry + 4, AVIIF_KEYFRAME);
+        put32(entry + 8, rec->index[2 * i]);
+        put32(entry + 12, size);
+        ret |= rec_put(rec, entry, 16);
+    }
+    if (ret == 0) {
+        ret = rec_flush(rec);
+    }
+
+    uint32_t us_per_frame = 1000000 / rec->config.fps;
+    if (rec->frames > 1 && rec->last_ts_ms != rec->first_ts_ms) {
+        us_per_frame = (uint64_t) (rec->last_ts_ms - rec->first_ts_ms) * 1000 / (rec->frames - 1);
+    }
+    uint32_t bytes_per_sec = (uint64_t) (movi_end - AVI_REC_HEADER_SIZE) * 1000000 /
+                             ((uint64_t) us_per_frame * (rec->frames ? rec->frames : 1));
+    if (ret == 0) {
+        ret |= rec_patch32(rec, OFS_RIFF_SIZE, rec->file_pos - 8);
+        ret |= rec_patch32(rec, OFS_AVIH_US, us_per_frame);
+        ret |= rec_patch32(rec, OFS_AVIH_MAX_BPS, bytes_per_sec);
+        ret |= rec_patch32(rec, OFS_AVIH_FRAMES, rec->frames);
+        ret |= rec_patch32(rec, OFS_AVIH_BUFSIZE, max_size + 8);
+        ret |= rec_patch32(rec, OFS_STRH_SCALE, us_per_frame);
+        ret |= rec_patch32(rec, OFS_STRH_LENGTH, rec->frames);
+        ret |= rec_patch32(rec, OFS_STRH_BUFSIZE, max_size + 8);
+        ret |= rec_patch32(rec, OFS_MOVI_SIZE, movi_end - OFS_MOVI);
+    }
+    if (fclose(rec->file) != 0) {
+        ret = -1;
+    }
+    rec->file = NULL;
+    rec->wbuf_len = 0;
+    return ret ? -1 : 0;
+}
+
+int avi_rec_write_frame(avi_rec_t* rec, const uint8_t* data, size_t len, uint32_t timestamp_ms)
+{
+    if (len == 0 || len > rec->config.max_frame_size) {
+        rec->frames_dropped++;
+        return -1;
+    }
+    uint32_t chunk_size = 8 + len + (len & 1);
+    if (rec->file != NULL) {
+        uint32_t end = rec_pos(rec) + chunk_size + 8 + (rec->frames + 1) * 16;
+        if (rec->frames == rec->index_max || end > rec->config.segment_size) {
+            avi_rec_close_segment(rec);
+        }
+    }
+    if (rec->file == NULL && open_segment(rec) != 0) {
+        if (rec->file != NULL) {
+            fclose(rec->file);
+            rec->file = NULL;
+        }
+        rec->frames_dropped++;
+        return -1;
+    }
+
+    uint32_t chunk_pos = rec_pos(rec);
+    uint8_t hdr[8];
+    memcpy(hdr, "00dc", 4);
+    put32(hdr + 4, len);
+    int ret = rec_put(rec, hdr, 8);
+    if (ret == 0) {
+        ret = rec_put(rec, data, len);
+    }
+    if (ret == 0 && (len & 1)) {
+        ret = rec_put(rec, "", 1);
+    }
+    if (ret != 0) {
+        // most likely out of space: give the frame up, make room and end the segment
+        rec_rewind(rec, chunk_pos);
+        delete_oldest(rec);
+        avi_rec_close_segment(rec);
+        rec->frames_dropped++;
+        return -1;
+    }
+
+    if (rec->frames == 0) {
+        rec->first_ts_ms = timestamp_ms;
+    }
+    rec->last_ts_ms = timestamp_ms;
+    rec->index[2 * rec->frames] = chunk_pos - OFS_MOVI;
+    rec->index[2 * rec->frames + 1] = len;
+    rec->frames++;
+    rec->frames_written++;
+    return 0;
+}
+
+// walk the chunks of a segment left open by a reset and give it an index
+static void repair_segment(avi_rec_t* rec, uint32_t seq)
+{
+    char name[AVI_REC_NAME_MAX];
+    avi_rec_segment_name(rec, seq, name, sizeof(name));
+    FILE* f = fopen(name, "r+b");
+    if (f == NULL) {
+        return;
+    }
+    uint8_t b[8];
+    if (fread(b, 1, 8, f) != 8 || memcmp(b, "RIFF", 4) != 0 || get32(b + 4) != 0) {
+        fclose(f);                      // closed properly, or not ours
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    uint32_t file_size = (uint32_t) ftell(f);
+
+    uint32_t pos = AVI_REC_HEADER_SIZE;
+    rec->frames = 0;
+    while (rec->frames < rec->index_max && pos + 8 <= file_size) {
+        fseek(f, pos, SEEK_SET);
+        if (fread(b, 1, 8, f) != 8 || memcmp(b, "00dc", 4) != 0) {
+            break;
+        }
+        uint32_t len = get32(b + 4);
+        if (len == 0 || pos + 8 + len > file_size) {
+            break;                      // cut short by the reset
+        }
+        rec->index[2 * rec->frames] = pos - OFS_MOVI;
+        rec->index[2 * rec->frames + 1] = len;
+        rec->frames++;
+        pos += 8 + len + (len & 1);
+    }
+    fseek(f, pos, SEEK_SET);
+    setvbuf(f, NULL, _IONBF, 0);
+
+    // frame times are lost, the nominal rate is used
+    rec->file = f;
+    rec->cur_seq = seq;
+    rec->file_pos = pos;
+    rec->wbuf_len = 0;
+    rec->first_ts_ms = rec->last_ts_ms = 0;
+    avi_rec_close_segment(rec);
+}
+
+static int parse_segment_name(const char* name, uint32_t* seq)
+{
+    unsigned n;
+    char tail[8];
+    if (sscanf(name, "seg%5u%7s", &n, tail) != 2 || strcmp(tail, ".avi") != 0) {
+        return -1;
+    }
+    *seq = n;
+    return 0;
+}
+
+int avi_rec_init(avi_rec_t* rec, const avi_rec_config_t* config)
+{
+    memset(rec, 0, sizeof(*rec));
+    if (config->dir == NULL || config->max_segments < 2 || config->fps <= 0 ||
+        config->write_chunk == 0 ||
+        config->segment_size < AVI_REC_HEADER_SIZE + config->max_frame_size + 32) {
+        return -1;
+    }
+    rec->config = *config;
+    rec->pinned_seq = -1;
+    rec->index_max = config->segment_size / 512;
+    rec->index = (uint32_t*) malloc(rec->index_max * 2 * sizeof(uint32_t));
+    rec->wbuf = (uint8_t*) malloc(config->write_chunk);
+    if (rec->index == NULL || rec->wbuf == NULL) {
+        avi_rec_deinit(rec);
+        return -1;
+    }
+
+    DIR* dir = opendir(config->dir);
+    if (dir != NULL) {
+        uint32_t lo = UINT32_MAX, hi = 0;
+        struct dirent* de;
+        while ((de = readdir(dir)) != NULL) {
+            uint32_t seq;
+            if (parse_segment_name(de->d_name, &seq) == 0) {
+                lo = (seq < lo) ? seq : lo;
+                hi = (seq > hi) ? seq : hi;
+            }
+        }
+        closedir(dir);
+        if (lo != UINT32_MAX) {
+            rec->first_seq = lo;
+            rec->next_seq = hi + 1;
+            repair_segment(rec, hi);
+        }
+    }
+    return 0;
+}
+
+void avi_rec_deinit(avi_rec_t* rec)
+{
+    avi_rec_close_segment(rec);
+    free(rec->index);
+    free(rec->wbuf);
+    rec->index = NULL;
+    rec->wbuf = NULL;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * MJPEG AVI recorder writing a ring of segment files.
+ *
+ * Segments are named seg<NNNNN>.avi with a sequence number which only grows.
+ * Once the ring holds max_segments files the oldest one is deleted before a
+ * new one is opened. Every segment ends with an idx1 frame index; a segment
+ * left open by a reset is repaired by avi_rec_init.
+ *
+ * Only stdio is used, so the same code runs on a SPIFFS mount point and on
+ * a plain directory on the host. Data is collected into write_chunk sized
+ * blocks (the flash erase block size) before it is handed to fwrite.
+ */
+
+#define AVI_REC_HEADER_SIZE 224         // RIFF, hdrl and the movi list header
+#define AVI_REC_NAME_MAX    48
+
+typedef struct {
+    const char* dir;                    //!< directory holding the segments, e.g. "/spiffs"
+    int max_segments;                   //!< files kept in the ring, at least 2
+    uint32_t segment_size;              //!< soft size limit of a segment, in bytes
+    uint32_t max_frame_size;            //!< larger frames are rejected
+    size_t write_chunk;                 //!< bytes collected before a write, e.g. 4096
+    int width;
+    int height;
+    int fps;                            //!< nominal rate, used until a segment is closed
+} avi_rec_config_t;
+
+typedef struct {
+    avi_rec_config_t config;
+    uint32_t first_seq;                 // oldest segment on disk
+    uint32_t next_seq;                  // sequence of the next segment to open
+    volatile int32_t pinned_seq;        // segment being downloaded, not deleted; -1 if none
+
+    FILE* file;                         // open segment, NULL between segments
+    uint32_t cur_seq;
+    uint32_t file_pos;                  // bytes handed to fwrite
+    uint8_t* wbuf;                      // data not yet written, starts at file_pos
+    size_t wbuf_len;
+    uint32_t* index;                    // (offset, size) per frame, offsets relative to "movi"
+    uint32_t index_max;
+    uint32_t frames;
+    uint32_t first_ts_ms;
+    uint32_t last_ts_ms;
+
+    uint32_t frames_written;
+    uint32_t frames_dropped;
+    uint32_t segments_deleted;
+} avi_rec_t;
+
+/**
+ * @brief Scan the directory for existing segments and repair an unfinished one
+ *
+ * @return 0 on success, -1 on invalid config or out of memory
+ */
+int avi_rec_init(avi_rec_t* rec, const avi_rec_config_t* config);
+
+/**
+ * @brief Close the open segment and free the buffers
+ */
+void avi_rec_deinit(avi_rec_t* rec);
+
+/**
+ * @brief Append a JPEG frame, opening or rotating segments as needed
+ *
+ * @param data JPEG data
+ * @param len size of data
+ * @param timestamp_ms capture time, used for the frame rate of the segment
+ * @return 0 on success, -1 if the frame was dropped
+ */
+int avi_rec_write_frame(avi_rec_t* rec, const uint8_t* data, size_t len, uint32_t timestamp_ms);
+
+/**
+ * @brief Write the index of the open segment and close it
+ * @return 0 on success
+ */
+int avi_rec_close_segment(avi_rec_t* rec);
+
+/**
+ * @brief Build the file name of a segment
+ */
+void avi_rec_segment_name(const avi_rec_t* rec, uint32_t seq, char* name, size_t size);
+
+/**
+ * @brief Check if a segment is closed and can be downloaded
+ */
+int avi_rec_segment_ready(const avi_rec_t* rec, uint32_t seq);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "broadcaster.h"
+#include "metrics.h"
+
+#define BCAST_MAX_SUBSCRIBERS 8
+
+static const char* TAG = "broadcaster";
+
+static SemaphoreHandle_t s_lock = NULL;     // guards everything below
+static SemaphoreHandle_t s_demand = NULL;   // a subscriber may have room for a frame
+static bcast_sub_t* s_subs[BCAST_MAX_SUBSCRIBERS];
+static int s_frames_alive = 0;
+static uint32_t s_seq = 0;
+static size_t s_max_frame_size;
+static int s_max_frames;
+static int s_queue_depth;
+static bcast_render_t s_render;
+
+static void frame_unref_locked(bcast_frame_t* frame)
+{
+    if (--frame->refcount == 0) {
+        free(frame);
+        s_frames_alive--;
+        xSemaphoreGive(s_demand);
+    }
+}
+
+// removes the oldest waiting frame of a subscriber
+static void queue_drop_locked(bcast_sub_t* sub)
+{
+    frame_unref_locked(sub->queue[0]);
+    memmove(&sub->queue[0], &sub->queue[1], (sub->queue_len - 1) * sizeof(sub->queue[0]));
+    sub->queue_len--;
+}
+
+/*
+ * Frames only waiting in queues can go, they will be replaced by the one
+ * about to be rendered anyway. Frames being sent cannot. Drops the oldest
+ * waiting frame everywhere until there is room for one more.
+ */
+static bool make_room_locked()
+{
+    while (s_frames_alive >= s_max_frames) {
+        bcast_frame_t* oldest = NULL;
+        for (int i = 0; i < BCAST_MAX_SUBSCRIBERS; i++) {
+            bcast_sub_t* sub = s_subs[i];
+            if (sub != NULL && sub->queue_len > 0 && (oldest == NULL || sub->queue[0]->seq < oldest->seq)) {
+                oldest = sub->queue[0];
+            }
+        }
+        if (oldest == NULL) {
+            return false;
+        }
+        for (int i = 0; i < BCAST_MAX_SUBSCRIBERS; i++) {
+            bcast_sub_t* sub = s_subs[i];
+            if (sub != NULL && sub->queue_len > 0 && sub->queue[0] == oldest) {
+                queue_drop_locked(sub);
+            }
+        }
+    }
+    return true;
+}
+
+// some subscriber has room in its queue and there is memory for another frame
+static bool frame_wanted_locked()
+{
+    bool room = false;
+    for (int i = 0; i < BCAST_MAX_SUBSCRIBERS; i++) {
+        bcast_sub_t* sub = s_subs[i];
+        if (sub != NULL && sub->queue_len < s_queue_depth) {
+            room = true;
+        }
+    }
+    return room && make_room_locked();
+}
+
+static void broadcaster_task(void *pvParameters)
+{
+    metrics_register_task(NULL);
+    while (true) {
+        xSemaphoreTake(s_demand, portMAX_DELAY);
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        bool wanted = frame_wanted_locked();
+        if (wanted) {
+            s_frames_alive++;
+        }
+        xSemaphoreGive(s_lock);
+        if (!wanted) {
+            continue;
+        }
+
+        bcast_frame_t* frame = (bcast_frame_t*) malloc(sizeof(bcast_frame_t) + s_max_frame_size);
+        size_t len = 0;
+        if (frame == NULL) {
+            ESP_LOGW(TAG, "No memory for a frame of %d bytes", s_max_frame_size);
+        } else {
+            len = s_render(frame->data, s_max_frame_size);
+        }
+        if (len == 0) {
+            free(frame);
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            s_frames_alive--;
+            xSemaphoreGive(s_lock);
+            // try again a bit later
+            vTaskDelay(100 / portTICK_RATE_MS);
+            xSemaphoreGive(s_demand);
+            continue;
+        }
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        // the frame may be gone once the lock is released, log its seq from here
+        const uint32_t seq = ++s_seq;
+        frame->seq = seq;
+        frame->len = len;
+        // the broadcaster's own reference keeps it alive while it is queued
+        frame->refcount = 1;
+        int subscribers = 0;
+        for (int i = 0; i < BCAST_MAX_SUBSCRIBERS; i++) {
+            bcast_sub_t* sub = s_subs[i];
+            if (sub == NULL) {
+                continue;
+            }
+            if (sub->queue_len == s_queue_depth) {
+                // lagging, the newest frame wins
+                queue_drop_locked(sub);
+            }
+            frame->refcount++;
+            sub->queue[sub->queue_len++] = frame;
+            xSemaphoreGive(sub->wake);
+            subscribers++;
+        }
+        frame_unref_locked(frame);
+        xSemaphoreGive(s_lock);
+        ESP_LOGD(TAG, "Frame %d: %d bytes for %d subscribers", seq, len, subscribers);
+        // keep rendering while some queue has room
+        xSemaphoreGive(s_demand);
+    }
+}
+
+esp_err_t broadcaster_init(size_t max_frame_size, int max_frames, int queue_depth, bcast_render_t render)
+{
+    if (max_frames < 2 || queue_depth < 1 || queue_depth > BCAST_QUEUE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_max_frame_size = max_frame_size;
+    s_max_frames = max_frames;
+    s_queue_depth = queue_depth;
+    s_render = render;
+    s_lock = xSemaphoreCreateMutex();
+    s_demand = xSemaphoreCreateBinary();
+    if (s_lock == NULL || s_demand == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!xTaskCreatePinnedToCore(&broadcaster_task, "broadcaster", 3072, NULL, 6, NULL, 1)) {
+        ESP_LOGE(TAG, "Failed to create broadcaster task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t broadcaster_subscribe(bcast_sub_t* sub)
+{
+    memset(sub, 0, sizeof(*sub));
+    sub->wake = xSemaphoreCreateBinary();
+    if (sub->wake == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = ESP_ERR_NO_MEM;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < BCAST_MAX_SUBSCRIBERS; i++) {
+        if (s_subs[i] == NULL) {
+            s_subs[i] = sub;
+            // start with the next frame, frames queued for others may be old
+            sub->last_seq = s_seq;
+            err = ESP_OK;
+            break;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    if (err != ESP_OK) {
+        vSemaphoreDelete(sub->wake);
+        sub->wake = NULL;
+        return err;
+    }
+    xSemaphoreGive(s_demand);
+    return ESP_OK;
+}
+
+void broadcaster_unsubscribe(bcast_sub_t* sub)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < BCAST_MAX_SUBSCRIBERS; i++) {
+        if (s_subs[i] == sub) {
+            s_subs[i] = NULL;
+        }
+    }
+    if (sub->frame != NULL) {
+        frame_unref_locked(sub->frame);
+        sub->frame = NULL;
+    }
+    while (sub->queue_len > 0) {
+        queue_drop_locked(sub);
+    }
+    xSemaphoreGive(s_lock);
+    vSemaphoreDelete(sub->wake);
+    sub->wake = NULL;
+    ESP_LOGD(TAG, "Subscriber left: %d frames sent, %d skipped", sub->frames_sent, sub->frames_skipped);
+}
+
+bool broadcaster_next(bcast_sub_t* sub, TickType_t timeout)
+{
+    while (true) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (sub->queue_len > 0) {
+            bcast_frame_t* frame = sub->queue[0];
+            memmove(&sub->queue[0], &sub->queue[1], (sub->queue_len - 1) * sizeof(sub->queue[0]));
+            sub->queue_len--;
+            // the queue's reference now belongs to sub->frame
+            sub->frames_skipped += frame->seq - sub->last_seq - 1;
+            sub->frame = frame;
+            sub->offset = 0;
+            sub->last_seq = frame->seq;
+            xSemaphoreGive(s_lock);
+            // there is room in the queue now
+            xSemaphoreGive(s_demand);
+            return true;
+        }
+        xSemaphoreGive(s_lock);
+        xSemaphoreGive(s_demand);
+        if (xSemaphoreTake(sub->wake, timeout) != pdTRUE) {
+            return false;
+        }
+    }
+}
+
+void broadcaster_done(bcast_sub_t* sub)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (sub->frame != NULL) {
+        frame_unref_locked(sub->frame);
+        sub->frame = NULL;
+        sub->frames_sent++;
+    }
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_demand);
+}
+
+int broadcaster_subscriber_count()
+{
+    int count = 0;
+    if (s_lock == NULL) {
+        // never started, strip only builds have no /stream
+        return 0;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < BCAST_MAX_SUBSCRIBERS; i++) {
+        if (s_subs[i] != NULL) {
+            count++;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return count;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/*
+ * Fan-out of one capture to many viewers.
+ *
+ * The broadcaster task renders each frame once into a reference counted
+ * buffer and queues the same buffer for every subscriber. Subscribers send
+ * at their own pace, each with its own cursor. A subscriber's queue holds
+ * at most queue_depth frames; when a new frame arrives for a full queue
+ * the oldest waiting one is dropped, so a lagging client always gets the
+ * newest frame and never holds up capture or the other clients. Frames
+ * are rendered while some queue has room, so nothing is captured without
+ * viewers, and at most max_frames exist at once.
+ */
+
+#define BCAST_QUEUE_MAX 3
+
+typedef struct {
+    uint32_t seq;
+    size_t len;
+    int refcount;               // guarded by the broadcaster lock
+    uint8_t data[];
+} bcast_frame_t;
+
+/**
+ * @brief Render one frame
+ *
+ * Called from the broadcaster task, captures and converts a frame.
+ *
+ * @param dst buffer to render into
+ * @param size size of dst
+ * @return bytes written to dst, 0 if the frame failed
+ */
+typedef size_t (*bcast_render_t)(uint8_t* dst, size_t size);
+
+typedef struct {
+    bcast_frame_t* frame;       // frame being sent, a reference is held
+    size_t offset;              // send cursor into frame->data
+    bcast_frame_t* queue[BCAST_QUEUE_MAX];  // waiting to be sent, oldest first, referenced
+    int queue_len;
+    uint32_t last_seq;          // last frame taken
+    uint32_t frames_sent;
+    uint32_t frames_skipped;
+    SemaphoreHandle_t wake;     // given when a frame is published
+} bcast_sub_t;
+
+/**
+ * @brief Start the broadcaster task
+ *
+ * @param max_frame_size size of the frame buffers
+ * @param max_frames frame buffers which may exist at once, at least 2
+ * @param queue_depth frames queued per subscriber, 1 to BCAST_QUEUE_MAX
+ * @param render renders a frame into a buffer
+ * @return ESP_OK on success
+ */
+esp_err_t broadcaster_init(size_t max_frame_size, int max_frames, int queue_depth, bcast_render_t render);
+
+/**
+ * @brief Add a subscriber
+ * @return ESP_OK, ESP_ERR_NO_MEM if there are too many subscribers
+ */
+esp_err_t broadcaster_subscribe(bcast_sub_t* sub);
+
+/**
+ * @brief Remove a subscriber, dropping the frames it holds
+ */
+void broadcaster_unsubscribe(bcast_sub_t* sub);
+
+/**
+ * @brief Take the oldest frame from the queue
+ *
+ * Blocks until a frame is queued. On success sub->frame holds the frame
+ * and sub->offset is 0; frames dropped since the last one are counted in
+ * sub->frames_skipped.
+ *
+ * @return false on timeout
+ */
+bool broadcaster_next(bcast_sub_t* sub, TickType_t timeout);
+
+/**
+ * @brief Release sub->frame after it has been sent
+ */
+void broadcaster_done(bcast_sub_t* sub);
+
+/**
+ * @brief Number of subscribers, for statistics
+ */
+int broadcaster_subscriber_count();
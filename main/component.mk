@@ -7,3 +7,5 @@
 # please read the SDK documents if you need to do this.
 #
 
+
+COMPONENT_EMBED_TXTFILES := www/cr_viewer.html www/fb_viewer.html
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "frame_etag.h"
+#include "image_convert.h"
+
+// tagged frames whose signature is kept, the least recently used one goes
+#define ETAG_HISTORY 8
+// the hash takes 4 bytes out of every ETAG_HASH_STRIDE
+#define ETAG_HASH_STRIDE 64
+
+static const char* TAG = "frame_etag";
+
+typedef struct {
+    frame_etag_t tag;
+    uint32_t used;              // s_clock when last looked up
+    bool has_sig;
+    image_sig_t sig;
+} etag_entry_t;
+
+static SemaphoreHandle_t s_lock = NULL;     // guards the history
+static etag_entry_t s_history[ETAG_HISTORY];
+static int s_history_len = 0;
+static uint32_t s_clock = 0;
+
+esp_err_t frame_etag_init()
+{
+    s_lock = xSemaphoreCreateMutex();
+    return s_lock != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/*
+ * NULL if the frame is not in the history, call with the lock held.
+ * Finding an entry keeps it, so the frame a polling client compares
+ * against stays while newer frames come and go.
+ */
+static etag_entry_t* history_find_locked(uint32_t seq)
+{
+    for (int i = 0; i < s_history_len; i++) {
+        if (s_history[i].tag.seq == seq) {
+            s_history[i].used = ++s_clock;
+            return &s_history[i];
+        }
+    }
+    return NULL;
+}
+
+static void history_add_locked(const etag_entry_t* entry)
+{
+    int slot = s_history_len;
+    if (s_history_len < ETAG_HISTORY) {
+        s_history_len++;
+    } else {
+        slot = 0;
+        for (int i = 1; i < ETAG_HISTORY; i++) {
+            if ((int32_t) (s_history[i].used - s_history[slot].used) < 0) {
+                slot = i;
+            }
+        }
+    }
+    s_history[slot] = *entry;
+    s_history[slot].used = ++s_clock;
+}
+
+static uint32_t frame_hash(const camera_fb_t* fb)
+{
+    uint32_t hash = image_fnv1a(IMAGE_FNV_SEED, &fb->len, sizeof(fb->len));
+    size_t i = 0;
+    for (; i + 4 <= fb->len; i += ETAG_HASH_STRIDE) {
+        hash = image_fnv1a(hash, fb->buf + i, 4);
+    }
+    // a JPEG frame ends in its last bytes, take them whatever the stride
+    size_t tail = fb->len < 4 ? fb->len : 4;
+    return image_fnv1a(hash, fb->buf + fb->len - tail, tail);
+}
+
+// false if the format has no signature or there is no memory for a line
+static bool frame_sig(const camera_fb_t* fb, image_sig_t* sig)
+{
+    const int width = fb->width;
+    const int height = fb->height;
+    image_sig_builder_t b;
+    if (fb->format == CAMERA_PF_GRAYSCALE) {
+        image_sig_init(&b, sig, width, height);
+        for (int y = 0; y < height; y += IMAGE_SIG_STEP) {
+            image_sig_gray_line(&b, fb->buf + y * width, y);
+        }
+        image_sig_finish(&b);
+        return true;
+    }
+    if (fb->format != CAMERA_PF_RGB565 && fb->format != CAMERA_PF_YUV422) {
+        return false;
+    }
+    uint8_t* line = (uint8_t*) malloc(width * 2);
+    if (line == NULL) {
+        return false;
+    }
+    image_sig_init(&b, sig, width, height);
+    for (int y = 0; y < height; y += IMAGE_SIG_STEP) {
+        // two pixels per framebuffer word
+        const uint32_t* src = (const uint32_t*) fb->buf + y * width / 2;
+        if (fb->format == CAMERA_PF_YUV422) {
+            image_yuv422_line_to_rgb565(src, line, width);
+        } else {
+            image_fb_rgb565_line_to_rgb565(src, line, width);
+        }
+        image_sig_rgb565_line(&b, (const uint16_t*) line, y);
+    }
+    image_sig_finish(&b);
+    free(line);
+    return true;
+}
+
+void frame_etag_get(const camera_fb_t* fb, frame_etag_t* tag)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    etag_entry_t* found = history_find_locked(fb->seq);
+    if (found != NULL) {
+        *tag = found->tag;
+    }
+    xSemaphoreGive(s_lock);
+    if (found != NULL) {
+        return;
+    }
+
+    // computed outside the lock, two requests for a new frame may both do it
+    etag_entry_t entry = {
+        .tag = { .seq = fb->seq, .hash = frame_hash(fb) },
+    };
+    entry.has_sig = frame_sig(fb, &entry.sig);
+    *tag = entry.tag;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (history_find_locked(fb->seq) == NULL) {
+        history_add_locked(&entry);
+    }
+    xSemaphoreGive(s_lock);
+    ESP_LOGD(TAG, "frame %u: hash %08x", fb->seq, entry.tag.hash);
+}
+
+void frame_etag_format(const frame_etag_t* tag, char* out, size_t size)
+{
+    snprintf(out, size, "\"%x-%08x\"", tag->seq, tag->hash);
+}
+
+// within threshold of the current frame, by their signatures
+static bool sig_close(uint32_t seq, uint32_t hash, const frame_etag_t* current, int threshold)
+{
+    bool close = false;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const etag_entry_t* old = history_find_locked(seq);
+    const etag_entry_t* cur = history_find_locked(current->seq);
+    if (old != NULL && cur != NULL && old->tag.hash == hash && old->has_sig && cur->has_sig) {
+        close = image_sig_diff(&old->sig, &cur->sig) <= threshold;
+    }
+    xSemaphoreGive(s_lock);
+    return close;
+}
+
+bool frame_etag_match(const char* list, const frame_etag_t* current, int threshold, frame_etag_t* match)
+{
+    const char* p = list;
+    while (*p) {
+        while (*p == ' ' || *p == ',') {
+            p++;
+        }
+        if (*p == '*') {
+            *match = *current;
+            return true;
+        }
+        // weak tags compare the same way
+        if (strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        unsigned seq, hash;
+        int n = 0;
+        if (sscanf(p, "\"%x-%x\"%n", &seq, &hash, &n) == 2 && n > 0) {
+            if (hash == current->hash || (threshold > 0 && sig_close(seq, hash, current, threshold))) {
+                match->seq = seq;
+                match->hash = hash;
+                return true;
+            }
+        }
+        // on to the next tag
+        while (*p && *p != ',') {
+            p++;
+        }
+    }
+    return false;
+}
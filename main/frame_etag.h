@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "camera.h"
+
+/*
+ * Entity tags for snapshots, so polling clients can ask for a frame only
+ * if it changed.
+ *
+ * A tag is the frame sequence number and a hash of sampled framebuffer
+ * words, "1a2b-89abcdef". The hash alone decides whether two frames are
+ * the same. For uncompressed frames a coarse signature of the last few
+ * tagged frames is kept as well, so a tag the client holds can also be
+ * compared with a threshold: sensor noise changes the hash of every
+ * frame, but the scene is the same as long as no cell of the signature
+ * moves by more than the threshold.
+ */
+
+// quoted, "xxxxxxxx-xxxxxxxx" plus NUL
+#define FRAME_ETAG_LEN 20
+
+typedef struct {
+    uint32_t seq;
+    uint32_t hash;
+} frame_etag_t;
+
+/**
+ * @brief Prepare the history of tagged frames
+ */
+esp_err_t frame_etag_init();
+
+/**
+ * @brief Tag of a frame
+ *
+ * Computed once per frame, later calls for the same frame find it in
+ * the history.
+ */
+void frame_etag_get(const camera_fb_t* fb, frame_etag_t* tag);
+
+/**
+ * @brief Tag as sent in the ETag header, quotes included
+ */
+void frame_etag_format(const frame_etag_t* tag, char* out, size_t size);
+
+/**
+ * @brief Check an If-None-Match header against the tag of a frame
+ *
+ * @param list header value, a comma separated list of tags or "*"
+ * @param current tag of the frame the client would get
+ * @param threshold largest signature difference still taken as unchanged,
+ *        0 compares the hash only
+ * @param match set to the matching tag of the list, which stays the
+ *        client's reference; current for "*"
+ * @return true if the client already has the frame, or one like it
+ */
+bool frame_etag_match(const char* list, const frame_etag_t* current, int threshold, frame_etag_t* match);
@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "http_parser.h"
+
+enum {
+    ST_METHOD,
+    ST_PATH,
+    ST_QUERY,
+    ST_VERSION,
+    ST_LINE_LF,         // CR seen at the end of the request line
+    ST_HDR_START,       // start of a header line, or the blank line
+    ST_HDR_NAME,
+    ST_HDR_SPACE,       // whitespace after the colon
+    ST_HDR_VALUE,
+    ST_HDR_LF,
+    ST_END_LF,          // CR of the blank line seen
+    ST_BODY,
+    ST_DONE,
+};
+
+static const char* const s_header_names[HTTP_HDR_COUNT] = {
+    [HTTP_HDR_CONNECTION] = "connection",
+    [HTTP_HDR_CONTENT_LENGTH] = "content-length",
+    [HTTP_HDR_UPGRADE] = "upgrade",
+    [HTTP_HDR_SEC_WEBSOCKET_KEY] = "sec-websocket-key",
+    [HTTP_HDR_SEC_WEBSOCKET_VERSION] = "sec-websocket-version",
+    [HTTP_HDR_IF_NONE_MATCH] = "if-none-match",
+};
+
+void http_request_init(http_request_t *req)
+{
+    memset(req, 0, sizeof(*req));
+    req->state = ST_METHOD;
+    req->header = -1;
+}
+
+static http_parse_result_t fail(http_request_t *req, int status)
+{
+    req->status = status;
+    return HTTP_PARSE_ERROR;
+}
+
+// appends c to a field, cutting it if it is too long
+static bool field_add(char *field, size_t size, size_t *len, char c)
+{
+    if (*len + 1 >= size) {
+        return false;
+    }
+    field[(*len)++] = c;
+    field[*len] = '\0';
+    return true;
+}
+
+// case insensitive search for a token in a comma separated list
+static bool has_token(const char *list, const char *token)
+{
+    size_t n = strlen(token);
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ' || *p == ',') {
+            p++;
+        }
+        const char *end = p;
+        while (*end && *end != ',' && *end != ' ') {
+            end++;
+        }
+        if ((size_t) (end - p) == n && strncasecmp(p, token, n) == 0) {
+            return true;
+        }
+        p = end;
+    }
+    return false;
+}
+
+// the blank line after the headers was read
+static http_parse_result_t head_done(http_request_t *req)
+{
+    const char *conn = req->headers[HTTP_HDR_CONNECTION];
+    if (req->version_minor >= 1) {
+        req->keep_alive = !has_token(conn, "close");
+    } else {
+        req->keep_alive = has_token(conn, "keep-alive");
+    }
+    const char *cl = req->headers[HTTP_HDR_CONTENT_LENGTH];
+    if (*cl) {
+        char *end;
+        long n = strtol(cl, &end, 10);
+        if (n < 0 || *end != '\0') {
+            return fail(req, 400);
+        }
+        req->body_left = n;
+    }
+    req->state = req->body_left ? ST_BODY : ST_DONE;
+    return req->state == ST_DONE ? HTTP_PARSE_DONE : HTTP_PARSE_MORE;
+}
+
+static void header_name_done(http_request_t *req)
+{
+    req->header = -1;
+    for (int i = 0; i < HTTP_HDR_COUNT; i++) {
+        if (strcmp(req->name, s_header_names[i]) == 0) {
+            req->header = i;
+            req->headers[i][0] = '\0';
+            break;
+        }
+    }
+    req->len = 0;
+}
+
+static void header_value_done(http_request_t *req)
+{
+    if (req->header >= 0) {
+        // trailing whitespace is not part of the value
+        char *v = req->headers[req->header];
+        size_t n = strlen(v);
+        while (n > 0 && (v[n - 1] == ' ' || v[n - 1] == '\t')) {
+            v[--n] = '\0';
+        }
+    }
+}
+
+http_parse_result_t http_request_parse(http_request_t *req, const char *data, size_t len, size_t *consumed)
+{
+    size_t i = 0;
+    http_parse_result_t result = HTTP_PARSE_MORE;
+    while (i < len && result == HTTP_PARSE_MORE) {
+        if (req->state == ST_BODY) {
+            size_t n = len - i;
+            if (n > req->body_left) {
+                n = req->body_left;
+            }
+            i += n;
+            req->body_left -= n;
+            if (req->body_left == 0) {
+                req->state = ST_DONE;
+                result = HTTP_PARSE_DONE;
+            }
+            continue;
+        }
+        char c = data[i++];
+        if (++req->head_bytes > HTTP_HEAD_MAX) {
+            result = fail(req, 431);
+            break;
+        }
+        switch (req->state) {
+        case ST_METHOD:
+            if (c == ' ') {
+                if (req->len == 0) {
+                    result = fail(req, 400);
+                }
+                req->state = ST_PATH;
+                req->len = 0;
+            } else if (c == '\r' && req->len == 0) {
+                // blank lines before a request are allowed
+            } else if (c == '\n' && req->len == 0) {
+            } else if (!isupper((unsigned char) c) ||
+                       !field_add(req->method, sizeof(req->method), &req->len, c)) {
+                result = fail(req, c == '\r' || c == '\n' ? 400 : 501);
+            }
+            break;
+        case ST_PATH:
+        case ST_QUERY:
+            if (c == ' ') {
+                if (req->path[0] != '/') {
+                    result = fail(req, 400);
+                }
+                req->state = ST_VERSION;
+                req->len = 0;
+                req->name[0] = '\0';
+            } else if (c == '?' && req->state == ST_PATH) {
+                req->state = ST_QUERY;
+                req->len = 0;
+            } else if (c == '\r' || c == '\n') {
+                // HTTP/0.9 style requests are not served
+                result = fail(req, 400);
+            } else if (req->state == ST_PATH) {
+                if (!field_add(req->path, sizeof(req->path), &req->len, c)) {
+                    result = fail(req, 414);
+                }
+            } else if (!field_add(req->query, sizeof(req->query), &req->len, c)) {
+                result = fail(req, 414);
+            }
+            break;
+        case ST_VERSION:
+            if (c == '\r' || c == '\n') {
+                if (strncmp(req->name, "HTTP/1.", 7) != 0 || req->len != 8 || !isdigit((unsigned char) req->name[7])) {
+                    result = fail(req, 505);
+                    break;
+                }
+                req->version_minor = req->name[7] - '0';
+                req->state = (c == '\r') ? ST_LINE_LF : ST_HDR_START;
+            } else if (!field_add(req->name, sizeof(req->name), &req->len, c)) {
+                result = fail(req, 505);
+            }
+            break;
+        case ST_LINE_LF:
+        case ST_HDR_LF:
+            if (c != '\n') {
+                result = fail(req, 400);
+            }
+            req->state = ST_HDR_START;
+            break;
+        case ST_HDR_START:
+            if (c == '\r') {
+                req->state = ST_END_LF;
+            } else if (c == '\n') {
+                result = head_done(req);
+            } else if (c == ' ' || c == '\t') {
+                // folded continuation of the previous header, not kept
+                req->header = -1;
+                req->state = ST_HDR_VALUE;
+            } else {
+                req->len = 0;
+                req->name[0] = '\0';
+                req->state = ST_HDR_NAME;
+                field_add(req->name, sizeof(req->name), &req->len, tolower((unsigned char) c));
+            }
+            break;
+        case ST_HDR_NAME:
+            if (c == ':') {
+                header_name_done(req);
+                req->state = ST_HDR_SPACE;
+            } else if (c == '\r' || c == '\n') {
+                result = fail(req, 400);
+            } else if (!field_add(req->name, sizeof(req->name), &req->len, tolower((unsigned char) c))) {
+                // longer than any header we keep, cut it so it matches none
+                req->name[0] = '\0';
+            }
+            break;
+        case ST_HDR_SPACE:
+            if (c == ' ' || c == '\t') {
+                break;
+            }
+            req->state = ST_HDR_VALUE;
+            // fall through
+        case ST_HDR_VALUE:
+            if (c == '\r' || c == '\n') {
+                header_value_done(req);
+                req->state = (c == '\r') ? ST_HDR_LF : ST_HDR_START;
+            } else if (req->header >= 0) {
+                // too long values are cut
+                field_add(req->headers[req->header], HTTP_HEADER_VALUE_MAX, &req->len, c);
+            }
+            break;
+        case ST_END_LF:
+            if (c != '\n') {
+                result = fail(req, 400);
+                break;
+            }
+            result = head_done(req);
+            break;
+        default:
+            result = HTTP_PARSE_DONE;
+            i--;
+            break;
+        }
+    }
+    *consumed = i;
+    return result;
+}
+
+const char *http_request_header(const http_request_t *req, http_header_id_t id)
+{
+    return req->headers[id];
+}
+
+bool http_header_has_token(const http_request_t *req, http_header_id_t id, const char *token)
+{
+    return has_token(req->headers[id], token);
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = tolower((unsigned char) c);
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+bool http_query_get(const http_request_t *req, const char *key, char *out, size_t out_size)
+{
+    return http_params_get(req->query, key, out, out_size);
+}
+
+bool http_params_get(const char *params, const char *key, char *out, size_t out_size)
+{
+    size_t key_len = strlen(key);
+    const char *p = params;
+    while (*p) {
+        const char *end = strchr(p, '&');
+        if (end == NULL) {
+            end = p + strlen(p);
+        }
+        if (strncmp(p, key, key_len) == 0 && (p[key_len] == '=' || p + key_len == end)) {
+            const char *v = p + key_len + (p[key_len] == '=' ? 1 : 0);
+            size_t n = 0;
+            while (v < end && n + 1 < out_size) {
+                if (*v == '%' && end - v >= 3 && hex_value(v[1]) >= 0 && hex_value(v[2]) >= 0) {
+                    out[n++] = (char) (hex_value(v[1]) * 16 + hex_value(v[2]));
+                    v += 3;
+                } else {
+                    out[n++] = (*v == '+') ? ' ' : *v;
+                    v++;
+                }
+            }
+            if (out_size > 0) {
+                out[n] = '\0';
+            }
+            return true;
+        }
+        p = (*end == '&') ? end + 1 : end;
+    }
+    return false;
+}
+
+int http_query_int(const http_request_t *req, const char *key, int def)
+{
+    return http_params_int(req->query, key, def);
+}
+
+int http_params_int(const char *params, const char *key, int def)
+{
+    char value[16];
+    if (!http_params_get(params, key, value, sizeof(value)) || value[0] == '\0') {
+        return def;
+    }
+    char *end;
+    long n = strtol(value, &end, 10);
+    return (*end == '\0') ? (int) n : def;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Incremental HTTP/1.x request parser.
+ *
+ * Feed it whatever arrived, in pieces of any size; it keeps its state in
+ * http_request_t and allocates nothing. Only the headers the server acts
+ * on are kept, everything else is skipped. A request body announced by
+ * Content-Length is consumed and dropped, so the next request on a
+ * keep-alive connection starts where this one ended.
+ */
+
+#define HTTP_METHOD_MAX       8
+#define HTTP_PATH_MAX         64
+#define HTTP_QUERY_MAX        96
+#define HTTP_HEADER_VALUE_MAX 64
+// request line plus headers, protects the worker from endless headers
+#define HTTP_HEAD_MAX         4096
+
+typedef enum {
+    HTTP_PARSE_ERROR = -1,
+    HTTP_PARSE_MORE = 0,    //!< all input consumed, request not complete yet
+    HTTP_PARSE_DONE = 1,    //!< request complete, input after it was not consumed
+} http_parse_result_t;
+
+// headers kept by the parser, values longer than HTTP_HEADER_VALUE_MAX - 1 are cut
+typedef enum {
+    HTTP_HDR_CONNECTION,
+    HTTP_HDR_CONTENT_LENGTH,
+    HTTP_HDR_UPGRADE,
+    HTTP_HDR_SEC_WEBSOCKET_KEY,
+    HTTP_HDR_SEC_WEBSOCKET_VERSION,
+    HTTP_HDR_IF_NONE_MATCH,
+    HTTP_HDR_COUNT
+} http_header_id_t;
+
+typedef struct {
+    // parsed request
+    char method[HTTP_METHOD_MAX];
+    char path[HTTP_PATH_MAX];           // decoded is up to the handler, this is as sent
+    char query[HTTP_QUERY_MAX];         // without the '?'
+    int version_minor;                  // 0 for HTTP/1.0, 1 for HTTP/1.1
+    bool keep_alive;                    // valid once done
+    char headers[HTTP_HDR_COUNT][HTTP_HEADER_VALUE_MAX];
+    int status;                         // HTTP status to answer a parse error with
+
+    // parser state
+    int state;
+    size_t len;                         // bytes in the field being parsed
+    size_t head_bytes;
+    int header;                         // header being read, -1 to skip it
+    char name[24];                      // header name, lower case, cut
+    size_t body_left;
+} http_request_t;
+
+/**
+ * @brief Prepare for a new request
+ */
+void http_request_init(http_request_t *req);
+
+/**
+ * @brief Parse the next piece of input
+ *
+ * @param consumed set to the bytes used, less than len only when done
+ * @return HTTP_PARSE_DONE, HTTP_PARSE_MORE, or HTTP_PARSE_ERROR with
+ *         req->status set
+ */
+http_parse_result_t http_request_parse(http_request_t *req, const char *data, size_t len, size_t *consumed);
+
+/**
+ * @brief Get a kept header, "" if the request did not have it
+ */
+const char *http_request_header(const http_request_t *req, http_header_id_t id);
+
+/**
+ * @brief Check a comma separated header for a token, case insensitive
+ */
+bool http_header_has_token(const http_request_t *req, http_header_id_t id, const char *token);
+
+/**
+ * @brief Get a query parameter, %XX and '+' decoded
+ *
+ * @return true if the parameter is present, out holds its value cut to out_size - 1
+ */
+bool http_query_get(const http_request_t *req, const char *key, char *out, size_t out_size);
+
+/**
+ * @brief http_query_get on any string in query syntax, "a=1&b=2"
+ */
+bool http_params_get(const char *params, const char *key, char *out, size_t out_size);
+
+/**
+ * @brief Get a numeric query parameter
+ * @return the value, def if missing or not a number
+ */
+int http_query_int(const http_request_t *req, const char *key, int def);
+
+/**
+ * @brief http_query_int on any string in query syntax
+ */
+int http_params_int(const char *params, const char *key, int def);
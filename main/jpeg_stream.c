@@ -0,0 +1,219 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "jpeg_stream.h"
+#include "metrics.h"
+#include "camera_trace.h"
+
+// 16 lines make two MCU rows, so each strip hands the encoder a decent chunk of work
+#define STRIP_LINES 16
+#define OUT_BUF_SIZE (CONFIG_JPEG_STREAM_BUFFER_KB * 1024)
+// s_out_ready is shared, a caller which lost its wakeup to the next one looks again this often
+#define OUT_POLL_TICKS 1
+
+static const char* TAG = "jpeg_stream";
+
+typedef struct {
+    const uint8_t* data;        // NULL asks the encoder task to start the frame
+    size_t first_line;
+    size_t line_count;          // 0 marks the end of the frame
+} strip_msg_t;
+
+/*
+ * Encoder output on its way to the caller. The encoder task only ever
+ * appends and never waits: the DMA filter hands it strips and blocks on
+ * their return, so the capture would stall behind a slow client.
+ */
+typedef struct {
+    uint8_t* buf;
+    volatile size_t head;       // bytes written, by the encoder task
+    volatile size_t tail;       // bytes sent, by the caller
+    volatile bool overflow;     // the caller fell a whole buffer behind
+    volatile bool failed;       // write failed, the rest of the frame is not wanted
+    volatile bool done;         // frame finished, the encoder task is no longer using this
+    esp_err_t result;
+    jpeg_input_format_t input;
+    size_t stride;              // bytes from one line to the next
+    int quality;
+} out_buf_t;
+
+static QueueHandle_t s_strip_queue = NULL;
+static SemaphoreHandle_t s_encoder_free = NULL;
+// given when bytes were added or a frame is done
+static SemaphoreHandle_t s_out_ready = NULL;
+static jpeg_encoder_t s_encoder;
+static out_buf_t* s_out;
+
+// runs in the DMA filter task
+static void on_strip(const uint8_t* data, size_t first_line, size_t line_count, void* arg)
+{
+    strip_msg_t msg = {
+        .data = data,
+        .first_line = first_line,
+        .line_count = line_count,
+    };
+    xQueueSend(s_strip_queue, &msg, portMAX_DELAY);
+}
+
+// encoder output, runs in the encoder task
+static int out_write(void* arg, const uint8_t* data, size_t len)
+{
+    out_buf_t* out = (out_buf_t*) arg;
+    size_t head = out->head;
+    if (out->failed) {
+        return -1;
+    }
+    if (head + len - out->tail > OUT_BUF_SIZE) {
+        out->overflow = true;
+        return -1;
+    }
+    while (len > 0) {
+        size_t pos = head % OUT_BUF_SIZE;
+        size_t n = (len < OUT_BUF_SIZE - pos) ? len : OUT_BUF_SIZE - pos;
+        memcpy(out->buf + pos, data, n);
+        data += n;
+        len -= n;
+        head += n;
+    }
+    out->head = head;
+    xSemaphoreGive(s_out_ready);
+    return 0;
+}
+
+// hands the frame back to the caller, which may free out right away
+static void out_done(out_buf_t* out, esp_err_t result)
+{
+    out->result = result;
+    out->done = true;
+    xSemaphoreGive(s_encoder_free);
+    xSemaphoreGive(s_out_ready);
+}
+
+/*
+ * Owns the camera lock from the start of a frame to its end, so the lock
+ * is never held by a task waiting for the network.
+ */
+static void jpeg_encoder_task(void *pvParameters)
+{
+    strip_msg_t msg;
+    metrics_register_task(NULL);
+    while (true) {
+        xQueueReceive(s_strip_queue, &msg, portMAX_DELAY);
+        if (msg.data == NULL && msg.line_count != 0) {
+            out_buf_t* out = s_out;
+            if (jpeg_enc_start(&s_encoder, camera_get_fb_width(), camera_get_fb_height(),
+                               out->input, out->quality, &out_write, out) != 0) {
+                out_done(out, ESP_FAIL);
+                continue;
+            }
+            esp_err_t err = camera_strips_start(STRIP_LINES, &on_strip, NULL);
+            if (err != ESP_OK) {
+                out_done(out, err);
+            }
+            continue;
+        }
+        if (msg.line_count == 0) {
+            jpeg_enc_finish(&s_encoder);
+            camera_strips_wait();
+            out_done(s_out, s_encoder.error ? ESP_FAIL : ESP_OK);
+            continue;
+        }
+        ESP_LOGV(TAG, "encoding lines %d..%d", msg.first_line, msg.first_line + msg.line_count - 1);
+        TRACE_BEGIN(TRACE_JPEG_STRIP);
+        jpeg_enc_strip(&s_encoder, msg.data, msg.line_count, s_out->stride);
+        TRACE_END(TRACE_JPEG_STRIP);
+        camera_strip_release();
+    }
+}
+
+esp_err_t jpeg_stream_init()
+{
+    // only two strips exist, so that is all the queue ever holds besides the end marker
+    s_strip_queue = xQueueCreate(3, sizeof(strip_msg_t));
+    s_encoder_free = xSemaphoreCreateBinary();
+    s_out_ready = xSemaphoreCreateBinary();
+    if (s_strip_queue == NULL || s_encoder_free == NULL || s_out_ready == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(s_encoder_free);
+    // capture and the DMA filter live on core 1
+    if (!xTaskCreatePinnedToCore(&jpeg_encoder_task, "jpeg_enc", 4096, NULL, 9, NULL, 0)) {
+        ESP_LOGE(TAG, "Failed to create JPEG encoder task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// passes what the encoder produced so far to write, returns false once it failed
+static bool out_send(out_buf_t* out, jpeg_write_cb_t write, void* arg)
+{
+    size_t head = out->head;
+    while (out->tail != head) {
+        size_t pos = out->tail % OUT_BUF_SIZE;
+        size_t n = (head - out->tail < OUT_BUF_SIZE - pos) ? head - out->tail : OUT_BUF_SIZE - pos;
+        if (write(arg, out->buf + pos, n) != 0) {
+            out->failed = true;
+            return false;
+        }
+        out->tail += n;
+    }
+    return true;
+}
+
+esp_err_t jpeg_stream_frame(camera_pixelformat_t format, int quality, jpeg_write_cb_t write, void* arg)
+{
+    out_buf_t out = { .quality = quality, .stride = camera_get_fb_width() * 2 };
+    if (format == CAMERA_PF_RGB565) {
+        out.input = JPEG_INPUT_FB_RGB565;
+    } else if (format == CAMERA_PF_YUV422) {
+        out.input = JPEG_INPUT_FB_YUV422;
+    } else if (format == CAMERA_PF_GRAYSCALE) {
+        out.input = JPEG_INPUT_GRAYSCALE;
+        out.stride = camera_get_fb_width();
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (s_strip_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    out.buf = (uint8_t*) malloc(OUT_BUF_SIZE);
+    if (out.buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // the encoder and the strip ring are shared, one frame at a time
+    xSemaphoreTake(s_encoder_free, portMAX_DELAY);
+    s_out = &out;
+    strip_msg_t start = { .line_count = 1 };
+    xQueueSend(s_strip_queue, &start, portMAX_DELAY);
+
+    // send while the frame is captured, after a failed write only wait for the end
+    bool sending = true;
+    while (!out.done) {
+        xSemaphoreTake(s_out_ready, OUT_POLL_TICKS);
+        if (sending) {
+            sending = out_send(&out, write, arg);
+        }
+    }
+    // the rest goes out while the next frame may be captured already
+    if (sending && !out.overflow) {
+        sending = out_send(&out, write, arg);
+    }
+    free(out.buf);
+
+    if (out.overflow) {
+        ESP_LOGD(TAG, "Client more than %d KB behind, frame aborted", CONFIG_JPEG_STREAM_BUFFER_KB);
+        return ESP_ERR_TIMEOUT;
+    }
+    if (out.result != ESP_OK) {
+        return out.result;
+    }
+    return sending ? ESP_OK : ESP_FAIL;
+}
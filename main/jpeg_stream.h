@@ -0,0 +1,31 @@
+#pragma once
+
+#include "esp_err.h"
+#include "camera.h"
+#include "jpeg_encoder.h"
+
+/**
+ * @brief Start the JPEG encoder task on the core not used for capture
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t jpeg_stream_init();
+
+/**
+ * @brief Capture one frame and JPEG encode it while it is being captured
+ *
+ * Strips completed by the DMA filter are encoded on the other core, so
+ * the first bytes leave before the sensor has finished scanning the frame.
+ * Only two strips of raw pixels are held in RAM, the framebuffer is not
+ * written. The output goes through a buffer of JPEG_STREAM_BUFFER_KB to
+ * write, which runs in the calling task and may block: the capture never
+ * waits for it, a frame write falls that far behind on is aborted.
+ *
+ * @param format pixel format the camera was initialized with
+ * @param quality JPEG quality, 1..100
+ * @param write output callback, called from the calling task
+ * @param arg passed to write
+ * @return ESP_OK on success, ESP_FAIL if write failed,
+ *         ESP_ERR_TIMEOUT if write fell behind and the frame was aborted
+ */
+esp_err_t jpeg_stream_frame(camera_pixelformat_t format, int quality, jpeg_write_cb_t write, void* arg);
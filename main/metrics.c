@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+
+#include "camera.h"
+#include "broadcaster.h"
+#include "snapshot_cache.h"
+#include "metrics.h"
+
+#define METRICS_LINE_MAX 160
+
+metrics_t g_metrics;
+
+static portMUX_TYPE s_tasks_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t s_tasks[METRICS_MAX_TASKS];
+static int s_task_count;
+
+static const char *s_endpoint_names[METRICS_EP_COUNT] = {
+    [METRICS_EP_SNAPSHOT] = "snapshot",
+    [METRICS_EP_STREAM] = "stream",
+    [METRICS_EP_MJPEG] = "mjpeg",
+    [METRICS_EP_CR] = "cr",
+    [METRICS_EP_WS] = "ws",
+    [METRICS_EP_REC] = "rec",
+    [METRICS_EP_METRICS] = "metrics",
+    [METRICS_EP_OTHER] = "other",
+};
+
+static const struct {
+    const char *name;
+    uint32_t caps;
+} s_heaps[] = {
+    { "8bit", MALLOC_CAP_8BIT },
+    { "32bit", MALLOC_CAP_32BIT },
+    { "dma", MALLOC_CAP_DMA },
+};
+
+typedef struct {
+    metrics_write_cb_t write;
+    void *arg;
+    int error;
+} render_t;
+
+uint64_t metric_read(const metric_counter_t *counter)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        // 64 bit stores are two words, read again if one came in between
+        uint64_t v;
+        do {
+            v = counter->per_core[i];
+        } while (v != counter->per_core[i]);
+        sum += v;
+    }
+    return sum;
+}
+
+void metrics_register_task(TaskHandle_t task)
+{
+    if (task == NULL) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+    portENTER_CRITICAL(&s_tasks_mux);
+    if (s_task_count < METRICS_MAX_TASKS) {
+        s_tasks[s_task_count++] = task;
+    }
+    portEXIT_CRITICAL(&s_tasks_mux);
+}
+
+static void emit(render_t *r, const char *fmt, ...)
+{
+    char line[METRICS_LINE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (r->error == 0 && len > 0) {
+        if (len >= (int) sizeof(line)) {
+            len = sizeof(line) - 1;
+        }
+        r->error = r->write(r->arg, (const uint8_t*) line, len);
+    }
+}
+
+static void family(render_t *r, const char *name, const char *type, const char *help)
+{
+    emit(r, "# HELP esp32cam_%s %s\n# TYPE esp32cam_%s %s\n", name, help, name, type);
+}
+
+static void counter(render_t *r, const char *name, const char *help, uint64_t value)
+{
+    family(r, name, "counter", help);
+    emit(r, "esp32cam_%s %llu\n", name, value);
+}
+
+static void gauge(render_t *r, const char *name, const char *help, uint64_t value)
+{
+    family(r, name, "gauge", help);
+    emit(r, "esp32cam_%s %llu\n", name, value);
+}
+
+static void seconds(render_t *r, const char *name, const char *type, const char *help, uint64_t us)
+{
+    family(r, name, type, help);
+    emit(r, "esp32cam_%s %llu.%06u\n", name, us / 1000000, (unsigned) (us % 1000000));
+}
+
+static void render_camera(render_t *r)
+{
+    camera_stats_t stats;
+    camera_get_stats(&stats);
+    counter(r, "frames_captured_total", "Frames captured.", stats.frames_captured);
+    counter(r, "frames_dropped_total", "Captures skipped because every frame buffer was held.",
+            stats.frames_dropped);
+    counter(r, "frames_corrupt_total", "Frames which lost DMA buffers.", stats.frames_corrupt);
+    gauge(r, "dma_queue_high_water", "Most DMA buffers waiting for the filter task.",
+          stats.dma_queue_high_water);
+    counter(r, "dma_queue_overflows_total", "DMA buffers lost to a full queue.", stats.dma_queue_overflows);
+    seconds(r, "filter_seconds_last", "gauge", "DMA filter time of the last frame.",
+            stats.filter_us_last);
+    seconds(r, "filter_seconds_total", "counter", "DMA filter time of all frames.",
+            stats.filter_us_total);
+    seconds(r, "convert_seconds_total", "counter", "Time spent converting stream frames to RGB565.",
+            metric_read(&g_metrics.convert_us));
+    counter(r, "convert_frames_total", "Stream frames converted to RGB565.",
+            metric_read(&g_metrics.convert_frames));
+
+    family(r, "task_stack_free_bytes", "gauge", "Stack a task never used.");
+    emit(r, "esp32cam_task_stack_free_bytes{task=\"dma_filter\"} %u\n", stats.filter_stack_free);
+    portENTER_CRITICAL(&s_tasks_mux);
+    int count = s_task_count;
+    portEXIT_CRITICAL(&s_tasks_mux);
+    for (int i = 0; i < count; i++) {
+        emit(r, "esp32cam_task_stack_free_bytes{task=\"%s\"} %u\n", pcTaskGetTaskName(s_tasks[i]),
+             uxTaskGetStackHighWaterMark(s_tasks[i]));
+    }
+}
+
+static void render_http(render_t *r)
+{
+    family(r, "http_requests_total", "counter", "HTTP requests by endpoint.");
+    for (int i = 0; i < METRICS_EP_COUNT; i++) {
+        emit(r, "esp32cam_http_requests_total{endpoint=\"%s\"} %llu\n", s_endpoint_names[i],
+             metric_read(&g_metrics.requests[i]));
+    }
+    family(r, "http_sent_bytes_total", "counter", "Bytes sent by endpoint.");
+    for (int i = 0; i < METRICS_EP_COUNT; i++) {
+        emit(r, "esp32cam_http_sent_bytes_total{endpoint=\"%s\"} %llu\n", s_endpoint_names[i],
+             metric_read(&g_metrics.bytes_sent[i]));
+    }
+    uint64_t opened = metric_read(&g_metrics.connections_opened);
+    uint64_t closed = metric_read(&g_metrics.connections_closed);
+    counter(r, "http_connections_total", "Connections served.", opened);
+    counter(r, "http_connections_rejected_total", "Connections turned away, all workers busy.",
+            metric_read(&g_metrics.connections_rejected));
+    counter(r, "http_not_modified_total", "Snapshots answered with 304 Not Modified.",
+            metric_read(&g_metrics.snapshots_not_modified));
+    counter(r, "snapshot_cache_hits_total", "Snapshots sent from the conversion cache.",
+            metric_read(&g_metrics.snapshot_cache_hits));
+    counter(r, "snapshot_cache_misses_total", "Snapshots converted for lack of a cached copy.",
+            metric_read(&g_metrics.snapshot_cache_misses));
+    gauge(r, "snapshot_cache_bytes", "Bytes held by the conversion cache.", snap_cache_bytes());
+    // a connection served between the two reads can make closed the larger
+    gauge(r, "http_clients_active", "Connections being served.", opened > closed ? opened - closed : 0);
+    gauge(r, "stream_viewers", "Viewers of /stream.", broadcaster_subscriber_count());
+}
+
+static void render_system(render_t *r)
+{
+    const int heaps = sizeof(s_heaps) / sizeof(s_heaps[0]);
+    family(r, "heap_free_bytes", "gauge", "Free heap by capability.");
+    for (int i = 0; i < heaps; i++) {
+        emit(r, "esp32cam_heap_free_bytes{caps=\"%s\"} %u\n", s_heaps[i].name,
+             heap_caps_get_free_size(s_heaps[i].caps));
+    }
+    family(r, "heap_largest_free_block_bytes", "gauge", "Largest block which can be allocated by capability.");
+    for (int i = 0; i < heaps; i++) {
+        emit(r, "esp32cam_heap_largest_free_block_bytes{caps=\"%s\"} %u\n", s_heaps[i].name,
+             heap_caps_get_largest_free_block(s_heaps[i].caps));
+    }
+    family(r, "heap_minimum_free_bytes", "gauge", "Least free heap since boot by capability.");
+    for (int i = 0; i < heaps; i++) {
+        emit(r, "esp32cam_heap_minimum_free_bytes{caps=\"%s\"} %u\n", s_heaps[i].name,
+             heap_caps_get_minimum_free_size(s_heaps[i].caps));
+    }
+    seconds(r, "uptime_seconds", "counter", "Time since boot.",
+            (uint64_t) xTaskGetTickCount() * portTICK_PERIOD_MS * 1000);
+}
+
+int metrics_render(metrics_write_cb_t write, void* arg)
+{
+    render_t r = { .write = write, .arg = arg };
+    render_camera(&r);
+    render_http(&r);
+    render_system(&r);
+    return r.error;
+}
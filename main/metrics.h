@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Counters and gauges served on /metrics in the Prometheus text format.
+ *
+ * Counters are bumped on the capture and send paths, so adding takes no
+ * lock: every core adds to its own slot and only the reader sums them.
+ * A task preempted in the middle of an add by another task on the same
+ * core can lose that one count, which is acceptable for statistics.
+ * Gauges such as free heap or stack watermarks are read when rendering.
+ */
+
+// tasks whose stack watermark is reported
+#define METRICS_MAX_TASKS 16
+
+typedef struct {
+    volatile uint64_t per_core[portNUM_PROCESSORS];
+} metric_counter_t;
+
+// what a request was for, to count bytes and requests by
+typedef enum {
+    METRICS_EP_SNAPSHOT,        // /, /get, /snapshot, /bmp, /jpg, ...
+    METRICS_EP_STREAM,          // /stream
+    METRICS_EP_MJPEG,           // /mjpeg
+    METRICS_EP_CR,              // /cr, /crstream
+    METRICS_EP_WS,              // /ws
+    METRICS_EP_REC,             // /rec
+    METRICS_EP_METRICS,         // /metrics
+    METRICS_EP_OTHER,           // errors and unknown paths
+    METRICS_EP_COUNT
+} metrics_endpoint_t;
+
+typedef struct {
+    metric_counter_t requests[METRICS_EP_COUNT];
+    metric_counter_t bytes_sent[METRICS_EP_COUNT];
+    metric_counter_t connections_opened;
+    metric_counter_t connections_closed;
+    metric_counter_t connections_rejected;  // turned away, all workers busy
+    metric_counter_t snapshots_not_modified;    // answered with 304
+    metric_counter_t snapshot_cache_hits;
+    metric_counter_t snapshot_cache_misses;     // converted, cacheable formats only
+    metric_counter_t convert_us;            // framebuffer to RGB565 of stream frames
+    metric_counter_t convert_frames;
+} metrics_t;
+
+extern metrics_t g_metrics;
+
+typedef int (*metrics_write_cb_t)(void* arg, const uint8_t* data, size_t len);
+
+static inline void metric_add(metric_counter_t *counter, uint64_t n)
+{
+    counter->per_core[xPortGetCoreID()] += n;
+}
+
+/**
+ * @brief Sum of all cores
+ */
+uint64_t metric_read(const metric_counter_t *counter);
+
+/**
+ * @brief Report the stack watermark of a task
+ *
+ * Only for tasks which live forever, the handle is kept.
+ *
+ * @param task NULL for the calling task
+ */
+void metrics_register_task(TaskHandle_t task);
+
+/**
+ * @brief Write all metrics in the Prometheus text exposition format 0.0.4
+ *
+ * @return 0 on success, -1 if write failed
+ */
+int metrics_render(metrics_write_cb_t write, void* arg);
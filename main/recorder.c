@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_spiffs.h"
+
+#include "recorder.h"
+#include "avi_rec.h"
+#include "jpeg_stream.h"
+#include "metrics.h"
+
+#define RECORDER_BASE_PATH   "/spiffs"
+// SPIFFS erase block, writes are collected up to this size
+#define RECORDER_WRITE_CHUNK 4096
+
+static avi_rec_t s_rec;
+static SemaphoreHandle_t s_rec_lock = NULL;    // guards s_rec between the recorder and downloads
+
+#if CONFIG_RECORDER_ENABLE
+
+static const char* TAG = "recorder";
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t size;
+} frame_buf_t;
+
+static camera_pixelformat_t s_format;
+static frame_buf_t s_frame;
+
+// software encoder output, passed on by jpeg_stream_frame
+static int frame_buf_write(void* arg, const uint8_t* data, size_t len)
+{
+    frame_buf_t* f = (frame_buf_t*) arg;
+    if (f->len + len > f->size) {
+        return -1;
+    }
+    memcpy(f->data + f->len, data, len);
+    f->len += len;
+    return 0;
+}
+
+static uint32_t now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void recorder_task(void *pvParameters)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    metrics_register_task(NULL);
+    while (true) {
+        vTaskDelayUntil(&last_wake, (1000 / CONFIG_RECORDER_FPS) / portTICK_RATE_MS);
+
+        uint32_t timestamp = now_ms();
+        const uint8_t* data = NULL;
+        size_t len = 0;
+        if (s_format == CAMERA_PF_JPEG) {
+            // the framebuffer is read until the frame is written
+            camera_lock();
+            if (camera_run() == ESP_OK) {
+                data = (const uint8_t*) camera_get_fb();
+                len = camera_get_data_size();
+            }
+        } else {
+            // the encoder task locks the camera for the capture itself
+            s_frame.len = 0;
+            if (jpeg_stream_frame(s_format, CONFIG_RECORDER_QUALITY, &frame_buf_write, &s_frame) == ESP_OK) {
+                data = s_frame.data;
+                len = s_frame.len;
+            }
+            camera_lock();
+        }
+        // flash writes stall the caches, so they must not run while a frame is captured
+        if (data != NULL) {
+            xSemaphoreTake(s_rec_lock, portMAX_DELAY);
+            if (avi_rec_write_frame(&s_rec, data, len, timestamp) != 0) {
+                ESP_LOGW(TAG, "Frame of %d bytes dropped", len);
+            }
+            xSemaphoreGive(s_rec_lock);
+        }
+        camera_unlock();
+    }
+}
+
+#endif // CONFIG_RECORDER_ENABLE
+
+esp_err_t recorder_init(camera_pixelformat_t format)
+{
+#if CONFIG_RECORDER_ENABLE
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = RECORDER_BASE_PATH,
+        .partition_label = NULL,
+        .max_files = 4,
+        .format_if_mount_failed = true
+    };
+    esp_err_t err = esp_vfs_spiffs_register(&conf);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mount SPIFFS (0x%x)", err);
+        return err;
+    }
+    size_t total = 0, used = 0;
+    esp_spiffs_info(NULL, &total, &used);
+
+    // SPIFFS needs free blocks for garbage collection, only plan with 3/4 of it
+    avi_rec_config_t config = {
+        .dir = RECORDER_BASE_PATH,
+        .max_segments = (total * 3 / 4) / (CONFIG_RECORDER_SEGMENT_KB * 1024),
+        .segment_size = CONFIG_RECORDER_SEGMENT_KB * 1024,
+        .max_frame_size = CONFIG_RECORDER_MAX_FRAME_KB * 1024,
+        .write_chunk = RECORDER_WRITE_CHUNK,
+        .width = camera_get_fb_width(),
+        .height = camera_get_fb_height(),
+        .fps = CONFIG_RECORDER_FPS,
+    };
+    if (config.max_segments < 2) {
+        ESP_LOGE(TAG, "SPIFFS partition (%d bytes) too small for two segments", total);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    s_format = format;
+    if (format != CAMERA_PF_JPEG) {
+        s_frame.size = config.max_frame_size;
+        s_frame.data = (uint8_t*) malloc(s_frame.size);
+        if (s_frame.data == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    s_rec_lock = xSemaphoreCreateMutex();
+    if (s_rec_lock == NULL || avi_rec_init(&s_rec, &config) != 0) {
+        ESP_LOGE(TAG, "Failed to initialize recorder");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Recording %d fps into %d segments of %d KB, %d of %d bytes used",
+             CONFIG_RECORDER_FPS, config.max_segments, CONFIG_RECORDER_SEGMENT_KB, used, total);
+
+    if (!xTaskCreatePinnedToCore(&recorder_task, "recorder", 3072, NULL, 4, NULL, 0)) {
+        ESP_LOGE(TAG, "Failed to create recorder task");
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+    return ESP_OK;
+}
+
+bool recorder_get_segments(uint32_t* first, uint32_t* next)
+{
+    if (s_rec_lock == NULL) {
+        return false;
+    }
+    xSemaphoreTake(s_rec_lock, portMAX_DELAY);
+    *first = s_rec.first_seq;
+    *next = s_rec.next_seq;
+    xSemaphoreGive(s_rec_lock);
+    return true;
+}
+
+FILE* recorder_open_segment(uint32_t seq, size_t* size)
+{
+    if (s_rec_lock == NULL) {
+        return NULL;
+    }
+    FILE* file = NULL;
+    xSemaphoreTake(s_rec_lock, portMAX_DELAY);
+    if (s_rec.pinned_seq < 0 && avi_rec_segment_ready(&s_rec, seq)) {
+        char name[AVI_REC_NAME_MAX];
+        avi_rec_segment_name(&s_rec, seq, name, sizeof(name));
+        file = fopen(name, "rb");
+        if (file != NULL) {
+            s_rec.pinned_seq = seq;
+            fseek(file, 0, SEEK_END);
+            *size = ftell(file);
+            fseek(file, 0, SEEK_SET);
+        }
+    }
+    xSemaphoreGive(s_rec_lock);
+    return file;
+}
+
+void recorder_close_segment(FILE* file)
+{
+    fclose(file);
+    xSemaphoreTake(s_rec_lock, portMAX_DELAY);
+    s_rec.pinned_seq = -1;
+    xSemaphoreGive(s_rec_lock);
+}
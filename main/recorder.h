@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "camera.h"
+
+/**
+ * @brief Mount SPIFFS and start recording frames into a ring of AVI segments
+ *
+ * Does nothing unless CONFIG_RECORDER_ENABLE is set.
+ *
+ * @param format pixel format the camera was initialized with, frames which
+ *               are not JPEG already go through the software encoder
+ * @return ESP_OK on success
+ */
+esp_err_t recorder_init(camera_pixelformat_t format);
+
+/**
+ * @brief Get the range of segment sequence numbers on flash
+ *
+ * @param first oldest segment
+ * @param next one past the newest segment
+ * @return false if the recorder is not running
+ */
+bool recorder_get_segments(uint32_t* first, uint32_t* next);
+
+/**
+ * @brief Open a closed segment for download
+ *
+ * The segment is not deleted by the ring until recorder_close_segment
+ * is called. Only one segment can be open at a time.
+ *
+ * @param seq sequence number of the segment
+ * @param size set to the file size
+ * @return file opened for reading, NULL if the segment is not available
+ */
+FILE* recorder_open_segment(uint32_t seq, size_t* size);
+
+/**
+ * @brief Close a segment opened with recorder_open_segment
+ */
+void recorder_close_segment(FILE* file);
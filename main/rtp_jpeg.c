@@ -0,0 +1,224 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "rtp_jpeg.h"
+
+#define RTP_HEADER_LEN      12
+#define JPEG_HEADER_LEN     8
+#define RESTART_HEADER_LEN  4
+#define QTABLE_HEADER_LEN   4
+#define QTABLE_LEN          64
+
+// what rtp_jpeg_send_frame needs from the JPEG headers
+typedef struct {
+    int type;                   // RFC 2435 type, +64 with restart markers
+    int width;
+    int height;
+    uint16_t restart_interval;
+    const uint8_t *qtables[2];  // luma and chroma, zigzag order as in DQT
+    const uint8_t *scan;
+    size_t scan_len;
+} jpeg_info_t;
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+    return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+    p = put16(p, v >> 16);
+    return put16(p, v);
+}
+
+static bool parse_dqt(jpeg_info_t *info, const uint8_t *p, size_t len)
+{
+    while (len > 0) {
+        int precision = p[0] >> 4;
+        int id = p[0] & 0x0f;
+        if (precision != 0 || len < 1 + QTABLE_LEN) {
+            // 16 bit tables are not in the payload format
+            return false;
+        }
+        if (id < 2) {
+            info->qtables[id] = p + 1;
+        }
+        p += 1 + QTABLE_LEN;
+        len -= 1 + QTABLE_LEN;
+    }
+    return true;
+}
+
+static bool parse_sof(jpeg_info_t *info, const uint8_t *p, size_t len)
+{
+    if (len < 6 || p[0] != 8 || p[5] != 3 || len < 6 + 3 * 3) {
+        return false;
+    }
+    info->height = get16(p + 1);
+    info->width = get16(p + 3);
+    // Y sampling tells the type, chroma must not be subsampled further
+    const uint8_t *comp = p + 6;
+    if (comp[3 + 1] != 0x11 || comp[6 + 1] != 0x11 || comp[0 + 2] != 0 ||
+        comp[3 + 2] != 1 || comp[6 + 2] != 1) {
+        return false;
+    }
+    if (comp[1] == 0x21) {
+        info->type = 0;
+    } else if (comp[1] == 0x22) {
+        info->type = 1;
+    } else {
+        return false;
+    }
+    return info->width > 0 && info->width <= 2040 && info->height > 0 && info->height <= 2040;
+}
+
+static bool parse_jpeg(jpeg_info_t *info, const uint8_t *jpeg, size_t len)
+{
+    memset(info, 0, sizeof(*info));
+    info->type = -1;
+    if (len < 4 || jpeg[0] != 0xff || jpeg[1] != 0xd8) {
+        return false;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= len) {
+        if (jpeg[pos] != 0xff) {
+            return false;
+        }
+        uint8_t marker = jpeg[pos + 1];
+        if (marker == 0xff) {
+            // fill byte
+            pos++;
+            continue;
+        }
+        size_t seg_len = get16(jpeg + pos + 2);
+        const uint8_t *seg = jpeg + pos + 4;
+        if (seg_len < 2 || pos + 2 + seg_len > len) {
+            return false;
+        }
+        seg_len -= 2;
+        pos += 4 + seg_len;
+        switch (marker) {
+        case 0xdb:
+            if (!parse_dqt(info, seg, seg_len)) {
+                return false;
+            }
+            break;
+        case 0xc0:
+            if (!parse_sof(info, seg, seg_len)) {
+                return false;
+            }
+            break;
+        case 0xdd:
+            if (seg_len < 2) {
+                return false;
+            }
+            info->restart_interval = get16(seg);
+            break;
+        case 0xc1: case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7:
+        case 0xc9: case 0xca: case 0xcb: case 0xcd: case 0xce: case 0xcf:
+            // only baseline
+            return false;
+        case 0xda: {
+            if (info->type < 0 || info->qtables[0] == NULL || info->qtables[1] == NULL) {
+                return false;
+            }
+            // the scan ends at the last EOI, anything after it is padding
+            size_t end = len;
+            while (end >= pos + 2 && !(jpeg[end - 2] == 0xff && jpeg[end - 1] == 0xd9)) {
+                end--;
+            }
+            if (end < pos + 2) {
+                end = len + 2;
+            }
+            info->scan = jpeg + pos;
+            info->scan_len = end - 2 - pos;
+            if (info->restart_interval) {
+                info->type += 64;
+            }
+            return info->scan_len > 0;
+        }
+        default:
+            // APPn, COM, DHT: the receiver uses the standard Huffman tables
+            break;
+        }
+    }
+    return false;
+}
+
+void rtp_jpeg_init(rtp_jpeg_t *rtp, uint32_t ssrc, size_t packet_size)
+{
+    memset(rtp, 0, sizeof(*rtp));
+    rtp->ssrc = ssrc;
+    rtp->seq = ssrc >> 16;
+    if (packet_size > RTP_JPEG_PACKET_MAX) {
+        packet_size = RTP_JPEG_PACKET_MAX;
+    }
+    rtp->packet_size = packet_size;
+}
+
+int rtp_jpeg_send_frame(rtp_jpeg_t *rtp, const uint8_t *jpeg, size_t len, uint32_t timestamp,
+                        rtp_send_cb_t send, void *arg)
+{
+    jpeg_info_t info;
+    if (!parse_jpeg(&info, jpeg, len)) {
+        rtp->frames_dropped++;
+        return RTP_JPEG_ERR_FORMAT;
+    }
+    size_t offset = 0;
+    while (offset < info.scan_len) {
+        uint8_t *p = rtp->packet;
+        // RTP header, version 2, marker on the last packet of the frame
+        *p++ = 0x80;
+        uint8_t *mark = p;
+        *p++ = RTP_JPEG_PAYLOAD_TYPE;
+        p = put16(p, rtp->seq);
+        p = put32(p, timestamp);
+        p = put32(p, rtp->ssrc);
+
+        // main JPEG header: type specific, 24 bit fragment offset, type, Q, size in 8 pixel units
+        p = put32(p, offset & 0xffffff);
+        *p++ = info.type;
+        *p++ = 255;
+        *p++ = info.width / 8;
+        *p++ = info.height / 8;
+        if (info.type >= 64) {
+            // the frame is sent whole, first and last bit set, count 0x3fff
+            p = put16(p, info.restart_interval);
+            p = put16(p, 0xffff);
+        }
+        if (offset == 0) {
+            *p++ = 0;
+            *p++ = 0;
+            p = put16(p, 2 * QTABLE_LEN);
+            memcpy(p, info.qtables[0], QTABLE_LEN);
+            memcpy(p + QTABLE_LEN, info.qtables[1], QTABLE_LEN);
+            p += 2 * QTABLE_LEN;
+        }
+
+        size_t room = rtp->packet_size - (p - rtp->packet);
+        size_t n = info.scan_len - offset;
+        if (n > room) {
+            n = room;
+        } else {
+            *mark |= 0x80;
+        }
+        memcpy(p, info.scan + offset, n);
+        p += n;
+        offset += n;
+        rtp->seq++;
+        rtp->packets++;
+        if (send(arg, rtp->packet, p - rtp->packet) != 0) {
+            rtp->frames_dropped++;
+            return RTP_JPEG_ERR_SEND;
+        }
+    }
+    rtp->frames++;
+    return RTP_JPEG_OK;
+}
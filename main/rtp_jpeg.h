@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * RTP payload format for JPEG, RFC 2435.
+ *
+ * A baseline JPEG frame is split into packets of at most packet_size
+ * bytes, RTP header included. The JPEG headers are not sent: the receiver
+ * rebuilds them from the type, size and quantization tables in the
+ * payload header. The tables go in-band (Q = 255) with the first packet
+ * of every frame, so the encoder may change them between frames.
+ * Only 3 component 4:2:2 or 4:2:0 frames with the standard Huffman tables
+ * can be carried, which is what the OV2640 and the software encoder make.
+ */
+
+#define RTP_JPEG_PAYLOAD_TYPE  26
+#define RTP_JPEG_CLOCK_HZ      90000
+// largest UDP payload in an unfragmented 1500 byte Ethernet/WiFi frame
+#define RTP_JPEG_PACKET_MAX    1472
+
+typedef enum {
+    RTP_JPEG_OK = 0,
+    RTP_JPEG_ERR_FORMAT = -1,   //!< not a JPEG this payload format can carry
+    RTP_JPEG_ERR_SEND = -2,     //!< send failed, rest of the frame dropped
+} rtp_jpeg_err_t;
+
+/**
+ * @brief Packet output
+ * @return 0 on success, anything else drops the rest of the frame
+ */
+typedef int (*rtp_send_cb_t)(void *arg, const uint8_t *packet, size_t len);
+
+typedef struct {
+    uint32_t ssrc;
+    uint16_t seq;               // of the next packet
+    size_t packet_size;
+    uint32_t frames;
+    uint32_t frames_dropped;    // not sent completely
+    uint32_t packets;
+    uint8_t packet[RTP_JPEG_PACKET_MAX];
+} rtp_jpeg_t;
+
+/**
+ * @brief Start a stream
+ *
+ * @param ssrc stream identifier, best random
+ * @param packet_size largest packet, at most RTP_JPEG_PACKET_MAX
+ */
+void rtp_jpeg_init(rtp_jpeg_t *rtp, uint32_t ssrc, size_t packet_size);
+
+/**
+ * @brief Packetize and send one JPEG frame
+ *
+ * @param jpeg complete JPEG file, from SOI to EOI; padding after EOI is ignored
+ * @param timestamp RTP timestamp, RTP_JPEG_CLOCK_HZ units from the capture time
+ * @return RTP_JPEG_OK or an rtp_jpeg_err_t
+ */
+int rtp_jpeg_send_frame(rtp_jpeg_t *rtp, const uint8_t *jpeg, size_t len, uint32_t timestamp,
+                        rtp_send_cb_t send, void *arg);
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "lwip/api.h"
+
+#include "rtsp_server.h"
+#include "rtsp_session.h"
+#include "rtp_jpeg.h"
+#include "metrics.h"
+
+static const char* TAG = "rtsp";
+
+typedef struct {
+    struct netconn *udp;
+    ip_addr_t addr;
+    u16_t port;
+} rtp_dest_t;
+
+static uint16_t s_port;
+static int s_fps;
+static size_t s_packet_size;
+static rtsp_frame_get_t s_get;
+static rtsp_frame_put_t s_put;
+// one client at a time, kept off the task stack
+static rtp_jpeg_t s_rtp;
+static char s_request[RTSP_REQUEST_MAX + 1];
+static char s_response[RTSP_RESPONSE_MAX];
+
+static uint32_t ticks_ms()
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static int send_packet(void *arg, const uint8_t *packet, size_t len)
+{
+    rtp_dest_t *dest = (rtp_dest_t*) arg;
+    struct netbuf *buf = netbuf_new();
+    if (buf == NULL) {
+        return -1;
+    }
+    // netconn_sendto returns once the WiFi driver has copied the packet
+    netbuf_ref(buf, packet, len);
+    err_t err = netconn_sendto(dest->udp, buf, &dest->addr, dest->port);
+    netbuf_delete(buf);
+    return err == ERR_OK ? 0 : -1;
+}
+
+static void send_frame(rtp_dest_t *dest)
+{
+    rtsp_frame_t frame;
+    if (!s_get(&frame)) {
+        return;
+    }
+    int ret = rtp_jpeg_send_frame(&s_rtp, frame.data, frame.len, frame.timestamp_ms * (RTP_JPEG_CLOCK_HZ / 1000),
+                                  &send_packet, dest);
+    s_put(&frame);
+    if (ret == RTP_JPEG_ERR_FORMAT) {
+        ESP_LOGW(TAG, "Frame is not a JPEG RTP can carry");
+    }
+}
+
+// answers the complete requests in s_request, false if the client has to go
+static bool handle_requests(struct netconn *conn, rtsp_session_t *session, size_t *len)
+{
+    size_t req_len;
+    while ((req_len = rtsp_request_len(s_request, *len)) > 0) {
+        char next = s_request[req_len];
+        s_request[req_len] = '\0';
+        size_t resp_len = rtsp_session_handle(session, s_request, s_response, sizeof(s_response));
+        s_request[req_len] = next;
+        memmove(s_request, s_request + req_len, *len - req_len);
+        *len -= req_len;
+        if (resp_len == 0 || netconn_write(conn, s_response, resp_len, NETCONN_COPY) != ERR_OK) {
+            return false;
+        }
+    }
+    // a request which cannot fit will never complete
+    return *len < RTSP_REQUEST_MAX;
+}
+
+static void serve_client(struct netconn *conn, struct netconn *udp)
+{
+    rtp_dest_t dest = { .udp = udp };
+    u16_t ctrl_port;
+    netconn_getaddr(conn, &dest.addr, &ctrl_port, 0);
+    ESP_LOGI(TAG, "Client %s connected", ipaddr_ntoa(&dest.addr));
+
+    rtsp_session_t session;
+    rtsp_session_init(&session, esp_random(), RTSP_RTP_PORT);
+    rtp_jpeg_init(&s_rtp, esp_random(), s_packet_size);
+    size_t len = 0;
+    uint32_t next_ms = ticks_ms();
+    while (!session.teardown) {
+        // while playing, control requests are looked at between frames
+        int timeout = RTSP_SESSION_TIMEOUT_S * 1000;
+        if (session.state == RTSP_STATE_PLAYING) {
+            timeout = (int) (next_ms - ticks_ms());
+            timeout = timeout < 1 ? 1 : timeout;
+        }
+        netconn_set_recvtimeout(conn, timeout);
+        struct netbuf *buf;
+        err_t err = netconn_recv(conn, &buf);
+        if (err == ERR_OK) {
+            do {
+                char *data;
+                u16_t n;
+                netbuf_data(buf, (void**) &data, &n);
+                if (n > RTSP_REQUEST_MAX - len) {
+                    n = RTSP_REQUEST_MAX - len;
+                }
+                memcpy(s_request + len, data, n);
+                len += n;
+            } while (netbuf_next(buf) >= 0);
+            netbuf_delete(buf);
+            if (!handle_requests(conn, &session, &len)) {
+                break;
+            }
+        } else if (err != ERR_TIMEOUT || session.state != RTSP_STATE_PLAYING) {
+            // closed, or the session timed out
+            break;
+        }
+        if (session.state == RTSP_STATE_PLAYING && (int) (ticks_ms() - next_ms) >= 0) {
+            dest.port = session.client_rtp_port;
+            send_frame(&dest);
+            next_ms += 1000 / s_fps;
+            if ((int) (ticks_ms() - next_ms) > 0) {
+                // late, do not try to catch up
+                next_ms = ticks_ms();
+            }
+        }
+    }
+    ESP_LOGI(TAG, "Client %s left: %u frames in %u packets, %u dropped", ipaddr_ntoa(&dest.addr),
+             s_rtp.frames, s_rtp.packets, s_rtp.frames_dropped);
+}
+
+static void rtsp_task(void *pvParameters)
+{
+    struct netconn *listener = netconn_new(NETCONN_TCP);
+    struct netconn *udp = netconn_new(NETCONN_UDP);
+    if (listener == NULL || udp == NULL ||
+        netconn_bind(listener, NULL, s_port) != ERR_OK || netconn_listen(listener) != ERR_OK ||
+        netconn_bind(udp, NULL, RTSP_RTP_PORT) != ERR_OK) {
+        ESP_LOGE(TAG, "Cannot listen on port %d", s_port);
+        vTaskDelete(NULL);
+        return;
+    }
+    metrics_register_task(NULL);
+    while (true) {
+        struct netconn *conn;
+        if (netconn_accept(listener, &conn) != ERR_OK) {
+            continue;
+        }
+        serve_client(conn, udp);
+        netconn_close(conn);
+        netconn_delete(conn);
+    }
+}
+
+esp_err_t rtsp_server_init(uint16_t port, int fps, size_t packet_size,
+                           rtsp_frame_get_t get, rtsp_frame_put_t put)
+{
+    s_port = port;
+    s_fps = fps > 0 ? fps : 1;
+    s_packet_size = packet_size;
+    s_get = get;
+    s_put = put;
+    if (!xTaskCreatePinnedToCore(&rtsp_task, "rtsp", 3072, NULL, 5, NULL, 1)) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/*
+ * RTSP server sending JPEG frames as RTP over UDP.
+ *
+ * One client at a time is served; further ones wait for it to leave.
+ * Frames are taken from the source at the configured rate and every
+ * frame is sent once, right away: a packet which cannot be queued drops
+ * the rest of its frame instead of delaying the next one.
+ */
+
+// RTP leaves from this port, RTCP would use the next one
+#define RTSP_RTP_PORT 5004
+
+typedef struct {
+    const uint8_t *data;        // complete JPEG
+    size_t len;
+    uint32_t timestamp_ms;      // capture time
+    void *handle;               // for the source
+} rtsp_frame_t;
+
+/**
+ * @brief Get the next frame to send
+ * @return false if there is none
+ */
+typedef bool (*rtsp_frame_get_t)(rtsp_frame_t *frame);
+
+/**
+ * @brief Hand a frame from rtsp_frame_get_t back once it is sent
+ */
+typedef void (*rtsp_frame_put_t)(rtsp_frame_t *frame);
+
+/**
+ * @brief Start the server task
+ *
+ * @param port TCP port for RTSP, usually 554
+ * @param fps frames per second sent at most
+ * @param packet_size largest RTP packet, see RTP_JPEG_PACKET_MAX
+ * @return ESP_OK, ESP_ERR_NO_MEM
+ */
+esp_err_t rtsp_server_init(uint16_t port, int fps, size_t packet_size,
+                           rtsp_frame_get_t get, rtsp_frame_put_t put);
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "rtsp_session.h"
+#include "rtp_jpeg.h"
+
+#define RTSP_PUBLIC "OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER"
+
+// copies the value of a header, case insensitive name, false if missing
+static bool header_get(const char *request, const char *name, char *out, size_t size)
+{
+    size_t n = strlen(name);
+    const char *line = strstr(request, "\r\n");
+    while (line != NULL && line[2] != '\r' && line[2] != '\0') {
+        line += 2;
+        if (strncasecmp(line, name, n) == 0 && line[n] == ':') {
+            const char *v = line + n + 1;
+            while (*v == ' ' || *v == '\t') {
+                v++;
+            }
+            size_t len = strcspn(v, "\r\n");
+            if (len >= size) {
+                len = size - 1;
+            }
+            memcpy(out, v, len);
+            out[len] = '\0';
+            return true;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return false;
+}
+
+void rtsp_session_init(rtsp_session_t *s, uint32_t session_id, uint16_t server_rtp_port)
+{
+    memset(s, 0, sizeof(*s));
+    s->session_id = session_id;
+    s->server_rtp_port = server_rtp_port;
+}
+
+size_t rtsp_request_len(const char *data, size_t len)
+{
+    for (size_t i = 0; i + 4 <= len; i++) {
+        if (memcmp(data + i, "\r\n\r\n", 4) == 0) {
+            size_t head = i + 4;
+            // headers are looked up in a NUL terminated copy
+            char copy[RTSP_REQUEST_MAX];
+            size_t n = head < sizeof(copy) - 1 ? head : sizeof(copy) - 1;
+            memcpy(copy, data, n);
+            copy[n] = '\0';
+            char value[16];
+            size_t body = 0;
+            if (header_get(copy, "Content-Length", value, sizeof(value))) {
+                body = strtoul(value, NULL, 10);
+            }
+            return head + body <= len ? head + body : 0;
+        }
+    }
+    return 0;
+}
+
+static size_t respond(char *out, size_t size, int status, const char *reason, const char *cseq,
+                      const char *headers, const char *body)
+{
+    int n = snprintf(out, size, "RTSP/1.0 %d %s\r\nCSeq: %s\r\n%s", status, reason, cseq, headers);
+    if (n < 0 || (size_t) n >= size) {
+        return 0;
+    }
+    int m;
+    if (body != NULL) {
+        m = snprintf(out + n, size - n, "Content-Length: %u\r\n\r\n%s", (unsigned) strlen(body), body);
+    } else {
+        m = snprintf(out + n, size - n, "\r\n");
+    }
+    if (m < 0 || (size_t) (n + m) >= size) {
+        return 0;
+    }
+    return n + m;
+}
+
+static size_t describe(rtsp_session_t *s, const char *url, const char *cseq, char *out, size_t size)
+{
+    char sdp[256];
+    snprintf(sdp, sizeof(sdp),
+             "v=0\r\n"
+             "o=- %u 1 IN IP4 0.0.0.0\r\n"
+             "s=ESP32 camera\r\n"
+             "c=IN IP4 0.0.0.0\r\n"
+             "t=0 0\r\n"
+             "m=video 0 RTP/AVP %d\r\n"
+             "a=rtpmap:%d JPEG/%d\r\n"
+             "a=control:track1\r\n",
+             (unsigned) s->session_id, RTP_JPEG_PAYLOAD_TYPE, RTP_JPEG_PAYLOAD_TYPE, RTP_JPEG_CLOCK_HZ);
+    char headers[192];
+    size_t url_len = strlen(url);
+    snprintf(headers, sizeof(headers), "Content-Base: %s%s\r\nContent-Type: application/sdp\r\n",
+             url, (url_len > 0 && url[url_len - 1] == '/') ? "" : "/");
+    return respond(out, size, 200, "OK", cseq, headers, sdp);
+}
+
+static size_t setup(rtsp_session_t *s, const char *request, const char *cseq, char *out, size_t size)
+{
+    char transport[128];
+    if (!header_get(request, "Transport", transport, sizeof(transport))) {
+        return respond(out, size, 400, "Bad Request", cseq, "", NULL);
+    }
+    const char *ports = strstr(transport, "client_port=");
+    if (strstr(transport, "RTP/AVP/TCP") != NULL || strstr(transport, "interleaved") != NULL ||
+        strstr(transport, "multicast") != NULL || ports == NULL) {
+        return respond(out, size, 461, "Unsupported Transport", cseq, "", NULL);
+    }
+    int port = atoi(ports + strlen("client_port="));
+    if (port <= 0 || port > 65535) {
+        return respond(out, size, 400, "Bad Request", cseq, "", NULL);
+    }
+    s->client_rtp_port = port;
+    if (s->state == RTSP_STATE_INIT) {
+        s->state = RTSP_STATE_READY;
+    }
+    char headers[200];
+    snprintf(headers, sizeof(headers),
+             "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d\r\n"
+             "Session: %08X;timeout=%d\r\n",
+             port, port + 1, s->server_rtp_port, s->server_rtp_port + 1,
+             (unsigned) s->session_id, RTSP_SESSION_TIMEOUT_S);
+    return respond(out, size, 200, "OK", cseq, headers, NULL);
+}
+
+size_t rtsp_session_handle(rtsp_session_t *s, const char *request, char *out, size_t size)
+{
+    char method[16];
+    char url[128];
+    char cseq[16] = "0";
+    bool has_cseq = header_get(request, "CSeq", cseq, sizeof(cseq));
+    if (sscanf(request, "%15s %127s RTSP/1.0", method, url) != 2 || !has_cseq) {
+        return respond(out, size, 400, "Bad Request", cseq, "", NULL);
+    }
+
+    // requests after SETUP must name our session
+    char session[24];
+    char session_hdr[40];
+    snprintf(session_hdr, sizeof(session_hdr), "Session: %08X\r\n", (unsigned) s->session_id);
+    bool has_session = header_get(request, "Session", session, sizeof(session));
+    if (has_session && (s->state == RTSP_STATE_INIT || strtoul(session, NULL, 16) != s->session_id)) {
+        return respond(out, size, 454, "Session Not Found", cseq, "", NULL);
+    }
+
+    if (strcmp(method, "OPTIONS") == 0) {
+        return respond(out, size, 200, "OK", cseq, "Public: " RTSP_PUBLIC "\r\n", NULL);
+    } else if (strcmp(method, "DESCRIBE") == 0) {
+        return describe(s, url, cseq, out, size);
+    } else if (strcmp(method, "SETUP") == 0) {
+        return setup(s, request, cseq, out, size);
+    } else if (strcmp(method, "GET_PARAMETER") == 0) {
+        // keep-alive
+        return respond(out, size, 200, "OK", cseq, has_session ? session_hdr : "", NULL);
+    }
+
+    if (strcmp(method, "PLAY") == 0 || strcmp(method, "PAUSE") == 0 || strcmp(method, "TEARDOWN") == 0) {
+        if (s->state == RTSP_STATE_INIT) {
+            return respond(out, size, 455, "Method Not Valid in This State", cseq, "", NULL);
+        }
+        if (strcmp(method, "PLAY") == 0) {
+            s->state = RTSP_STATE_PLAYING;
+            char headers[80];
+            snprintf(headers, sizeof(headers), "%sRange: npt=0.000-\r\n", session_hdr);
+            return respond(out, size, 200, "OK", cseq, headers, NULL);
+        }
+        if (strcmp(method, "PAUSE") == 0) {
+            s->state = RTSP_STATE_READY;
+        } else {
+            s->state = RTSP_STATE_INIT;
+            s->teardown = true;
+        }
+        return respond(out, size, 200, "OK", cseq, session_hdr, NULL);
+    }
+    return respond(out, size, 501, "Not Implemented", cseq, "", NULL);
+}
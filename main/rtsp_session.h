@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * RTSP 1.0 control of one live JPEG stream, RFC 2326.
+ *
+ * Only the protocol: requests go in as text and responses come out as
+ * text, so the same code runs behind lwIP on the device and behind POSIX
+ * sockets on the host. The media is one video track, RTP/JPEG over
+ * unicast UDP; interleaved TCP transport is refused, a late packet is
+ * worth less than a lost one here.
+ */
+
+#define RTSP_REQUEST_MAX  1024
+#define RTSP_RESPONSE_MAX 768
+// sessions not kept alive by a request for this long may be dropped
+#define RTSP_SESSION_TIMEOUT_S 60
+
+typedef enum {
+    RTSP_STATE_INIT,
+    RTSP_STATE_READY,           // set up, not playing
+    RTSP_STATE_PLAYING,
+} rtsp_state_t;
+
+typedef struct {
+    rtsp_state_t state;
+    uint32_t session_id;
+    uint16_t server_rtp_port;
+    uint16_t client_rtp_port;   // where RTP goes, valid once set up
+    bool teardown;              // the client ended the session
+} rtsp_session_t;
+
+/**
+ * @brief Start a session for a new control connection
+ *
+ * @param session_id identifier handed to the client, best random
+ * @param server_rtp_port local UDP port RTP is sent from, RTCP is the next one
+ */
+void rtsp_session_init(rtsp_session_t *s, uint32_t session_id, uint16_t server_rtp_port);
+
+/**
+ * @brief Find the end of the first request in received data
+ *
+ * @return length of the request including its body, 0 if it is not complete yet
+ */
+size_t rtsp_request_len(const char *data, size_t len);
+
+/**
+ * @brief Answer one request
+ *
+ * @param request a complete request, NUL terminated
+ * @param response buffer for the response, RTSP_RESPONSE_MAX is enough
+ * @return length of the response, 0 if it did not fit
+ */
+size_t rtsp_session_handle(rtsp_session_t *s, const char *request, char *response, size_t size);
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "snapshot_cache.h"
+
+#define SNAP_CACHE_MAX_ENTRIES 8
+
+static const char* TAG = "snap_cache";
+
+static SemaphoreHandle_t s_lock = NULL;     // guards everything below and the refcounts
+static snap_entry_t* s_entries[SNAP_CACHE_MAX_ENTRIES];
+static size_t s_max_bytes = 0;
+static size_t s_bytes = 0;
+static uint32_t s_clock = 0;
+static uint32_t s_newest_seq = 0;
+static bool s_have_seq = false;
+
+esp_err_t snap_cache_init(size_t max_bytes)
+{
+    if (max_bytes == 0) {
+        return ESP_OK;
+    }
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_max_bytes = max_bytes;
+    return ESP_OK;
+}
+
+static bool key_equal(const snap_key_t* a, const snap_key_t* b)
+{
+    return a->seq == b->seq && a->width == b->width && a->height == b->height &&
+           a->format == b->format && a->quality == b->quality;
+}
+
+static void unref_locked(snap_entry_t* entry)
+{
+    if (--entry->refcount == 0) {
+        free(entry);
+    }
+}
+
+static void remove_locked(int i)
+{
+    snap_entry_t* entry = s_entries[i];
+    s_entries[i] = NULL;
+    entry->cached = false;
+    s_bytes -= entry->size;
+    unref_locked(entry);
+}
+
+// entries of frames before seq are never asked for again
+static void age_out_locked(uint32_t seq)
+{
+    if (s_have_seq && (int32_t) (seq - s_newest_seq) <= 0) {
+        return;
+    }
+    s_newest_seq = seq;
+    s_have_seq = true;
+    for (int i = 0; i < SNAP_CACHE_MAX_ENTRIES; i++) {
+        if (s_entries[i] != NULL && s_entries[i]->key.seq != seq) {
+            remove_locked(i);
+        }
+    }
+}
+
+snap_entry_t* snap_cache_get(const snap_key_t* key)
+{
+    if (s_max_bytes == 0) {
+        return NULL;
+    }
+    snap_entry_t* found = NULL;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    age_out_locked(key->seq);
+    for (int i = 0; i < SNAP_CACHE_MAX_ENTRIES; i++) {
+        if (s_entries[i] != NULL && key_equal(&s_entries[i]->key, key)) {
+            found = s_entries[i];
+            found->refcount++;
+            found->used = ++s_clock;
+            break;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return found;
+}
+
+snap_entry_t* snap_cache_new(const snap_key_t* key, size_t size)
+{
+    if (s_max_bytes == 0 || size > s_max_bytes) {
+        return NULL;
+    }
+    snap_entry_t* entry = (snap_entry_t*) malloc(sizeof(snap_entry_t) + size);
+    if (entry == NULL) {
+        ESP_LOGD(TAG, "No memory for %d bytes", size);
+        return NULL;
+    }
+    memset(entry, 0, sizeof(*entry));
+    entry->key = *key;
+    entry->size = size;
+    entry->refcount = 1;
+    return entry;
+}
+
+bool snap_cache_append(snap_entry_t** entry, const void* data, size_t len)
+{
+    snap_entry_t* e = *entry;
+    if (e->len + len > e->size) {
+        size_t size = e->size * 2 > e->len + len ? e->size * 2 : e->len + len;
+        size = size < s_max_bytes ? size : s_max_bytes;
+        snap_entry_t* grown = (e->len + len <= size) ?
+                              (snap_entry_t*) realloc(e, sizeof(snap_entry_t) + size) : NULL;
+        if (grown == NULL) {
+            free(e);
+            *entry = NULL;
+            return false;
+        }
+        e = grown;
+        e->size = size;
+        *entry = e;
+    }
+    memcpy(e->data + e->len, data, len);
+    e->len += len;
+    return true;
+}
+
+void snap_cache_put(snap_entry_t* entry)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    age_out_locked(entry->key.seq);
+    // a request which took a while may be done after a newer frame came in
+    if (entry->key.seq != s_newest_seq || entry->size > s_max_bytes) {
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    while (true) {
+        int free_slot = -1;
+        int lru = -1;
+        for (int i = 0; i < SNAP_CACHE_MAX_ENTRIES; i++) {
+            if (s_entries[i] == NULL) {
+                free_slot = i;
+            } else if (key_equal(&s_entries[i]->key, &entry->key)) {
+                // encoded twice at the same time, keep the first
+                xSemaphoreGive(s_lock);
+                return;
+            } else if (lru < 0 || (int32_t) (s_entries[i]->used - s_entries[lru]->used) < 0) {
+                lru = i;
+            }
+        }
+        if (free_slot >= 0 && s_bytes + entry->size <= s_max_bytes) {
+            entry->refcount++;
+            entry->cached = true;
+            entry->used = ++s_clock;
+            s_entries[free_slot] = entry;
+            s_bytes += entry->size;
+            break;
+        }
+        remove_locked(lru);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void snap_cache_release(void* entry)
+{
+    if (s_lock == NULL) {
+        free(entry);
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    unref_locked((snap_entry_t*) entry);
+    xSemaphoreGive(s_lock);
+}
+
+size_t snap_cache_bytes()
+{
+    return s_bytes;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/*
+ * Encoded snapshots, kept so that requests for the same frame in the same
+ * format are sent without converting or encoding it again.
+ *
+ * Entries are keyed by frame, format, size and quality and reference
+ * counted, so one can be sent straight from the cache with
+ * tx_ring_send_buf while another request evicts it. What the cache holds
+ * is capped; past the cap the least recently used entries go. Snapshots
+ * are always taken from the newest frame, so an entry of an older frame
+ * is dropped as soon as a newer frame's entry comes in.
+ */
+
+typedef struct {
+    uint32_t seq;               // frame sequence number
+    uint16_t width;
+    uint16_t height;
+    uint8_t format;             // the caller's id of the output format
+    uint8_t quality;            // 0 where it does not apply
+} snap_key_t;
+
+typedef struct {
+    snap_key_t key;
+    size_t len;                 // bytes of data filled in
+    size_t size;                // bytes of data allocated
+    // owned by the cache
+    int refcount;
+    uint32_t used;
+    bool cached;
+    uint8_t data[];
+} snap_entry_t;
+
+/**
+ * @brief Set up the cache
+ *
+ * @param max_bytes cap on the data held, 0 disables caching
+ */
+esp_err_t snap_cache_init(size_t max_bytes);
+
+/**
+ * @brief Look up an output
+ *
+ * @return a reference to release with snap_cache_release, NULL if not cached
+ */
+snap_entry_t *snap_cache_get(const snap_key_t *key);
+
+/**
+ * @brief Allocate an entry to encode into
+ *
+ * @param size bytes to allocate, grown by snap_cache_append if needed
+ * @return a reference to the new entry, NULL if it could never be cached
+ *         or there is no memory
+ */
+snap_entry_t *snap_cache_new(const snap_key_t *key, size_t size);
+
+/**
+ * @brief Append to an entry not yet in the cache, growing it as needed
+ *
+ * @return false if the entry outgrew the cap or memory; it is freed and
+ *         *entry set to NULL then
+ */
+bool snap_cache_append(snap_entry_t **entry, const void *data, size_t len);
+
+/**
+ * @brief Add a complete entry to the cache, the caller keeps its reference
+ */
+void snap_cache_put(snap_entry_t *entry);
+
+/**
+ * @brief Drop a reference, a tx_release_t for tx_ring_send_buf
+ */
+void snap_cache_release(void *entry);
+
+/**
+ * @brief Bytes held by the cache
+ */
+size_t snap_cache_bytes();
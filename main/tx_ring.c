@@ -0,0 +1,268 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+
+#include "tx_ring.h"
+#include "camera_trace.h"
+
+// longest wait for the peer to acknowledge a chunk while sending
+#define TX_ACK_TIMEOUT_MS 5000
+
+static const char* TAG = "tx_ring";
+
+/*
+ * lastack and snd_lbb belong to the tcpip thread. Reading them from here
+ * races only in the safe direction: a stale lastack makes us wait a
+ * little longer. Once the pcb is gone (reset, abort) lwIP has freed the
+ * segments and nothing refers to our buffers any more.
+ */
+static bool seq_acked(struct netconn *conn, uint32_t seq)
+{
+    struct tcp_pcb *pcb = conn->pcb.tcp;
+    return pcb == NULL || (int32_t) (pcb->lastack - seq) >= 0;
+}
+
+static uint32_t seq_sent(struct netconn *conn)
+{
+    struct tcp_pcb *pcb = conn->pcb.tcp;
+    return pcb == NULL ? 0 : pcb->snd_lbb;
+}
+
+static void pending_pop(tx_ring_t *tx)
+{
+    tx_pending_t *p = &tx->pending[tx->pending_head];
+    if (p->release != NULL) {
+        p->release(p->ref);
+        p->release = NULL;
+    } else {
+        tx->chunks_in_flight--;
+    }
+    tx->pending_head = (tx->pending_head + 1) % TX_RING_MAX_PENDING;
+    tx->pending_count--;
+}
+
+static void reap(tx_ring_t *tx)
+{
+    while (tx->pending_count > 0 && seq_acked(tx->conn, tx->pending[tx->pending_head].end_seq)) {
+        pending_pop(tx);
+    }
+}
+
+// wait for the oldest entry to be acknowledged
+static err_t wait_oldest(tx_ring_t *tx, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    int count = tx->pending_count;
+    while (true) {
+        reap(tx);
+        if (tx->pending_count < count || tx->pending_count == 0) {
+            return ERR_OK;
+        }
+        if (xTaskGetTickCount() - start >= timeout) {
+            return ERR_TIMEOUT;
+        }
+        vTaskDelay(1);
+    }
+}
+
+static void pending_push(tx_ring_t *tx, uint32_t end_seq, tx_release_t release, void *ref)
+{
+    tx_pending_t *p = &tx->pending[(tx->pending_head + tx->pending_count) % TX_RING_MAX_PENDING];
+    p->end_seq = end_seq;
+    p->release = release;
+    p->ref = ref;
+    tx->pending_count++;
+    if (release == NULL) {
+        tx->chunks_in_flight++;
+    }
+}
+
+// netconn_write and remember what has to stay alive until acknowledged
+static err_t send_nocopy(tx_ring_t *tx, const void *data, size_t len, tx_release_t release, void *ref)
+{
+    if (tx->pending_count == TX_RING_MAX_PENDING &&
+        wait_oldest(tx, TX_ACK_TIMEOUT_MS / portTICK_RATE_MS) != ERR_OK) {
+        if (release != NULL) {
+            release(ref);
+        }
+        return ERR_TIMEOUT;
+    }
+    TRACE_BEGIN(TRACE_SEND);
+    err_t err = netconn_write(tx->conn, data, len, NETCONN_NOCOPY);
+    TRACE_END(TRACE_SEND);
+    // even a failed write may have queued part of the data
+    pending_push(tx, seq_sent(tx->conn), release, ref);
+    tx->writes++;
+    if (err == ERR_OK) {
+        tx->bytes += len;
+        if (tx->sent != NULL) {
+            metric_add(tx->sent, len);
+        }
+    }
+    return err;
+}
+
+esp_err_t tx_ring_init(tx_ring_t *tx, size_t chunk_count, size_t chunk_size)
+{
+    memset(tx, 0, sizeof(*tx));
+    if (chunk_count == 0 || chunk_count > TX_RING_MAX_CHUNKS || chunk_size == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < chunk_count; i++) {
+        tx->chunks[i] = (uint8_t*) malloc(chunk_size);
+        if (tx->chunks[i] == NULL) {
+            ESP_LOGE(TAG, "No memory for %d chunks of %d bytes", chunk_count, chunk_size);
+            while (i-- > 0) {
+                free(tx->chunks[i]);
+                tx->chunks[i] = NULL;
+            }
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    tx->chunk_count = chunk_count;
+    tx->chunk_size = chunk_size;
+    return ESP_OK;
+}
+
+void tx_ring_begin(tx_ring_t *tx, struct netconn *conn)
+{
+    tx->conn = conn;
+    tx->fill = NULL;
+    tx->fill_len = 0;
+    tx->writes = 0;
+    tx->bytes = 0;
+}
+
+uint8_t *tx_ring_reserve(tx_ring_t *tx, size_t *avail)
+{
+    if (tx->fill == NULL) {
+        reap(tx);
+        // the next chunk in turn is the oldest one in flight
+        while (tx->chunks_in_flight == (int) tx->chunk_count) {
+            if (wait_oldest(tx, TX_ACK_TIMEOUT_MS / portTICK_RATE_MS) != ERR_OK) {
+                ESP_LOGW(TAG, "No acknowledgement in %d ms", TX_ACK_TIMEOUT_MS);
+                return NULL;
+            }
+        }
+        tx->fill = tx->chunks[tx->next_chunk];
+        tx->next_chunk = (tx->next_chunk + 1) % tx->chunk_count;
+        tx->fill_len = 0;
+    }
+    *avail = tx->chunk_size - tx->fill_len;
+    return tx->fill + tx->fill_len;
+}
+
+err_t tx_ring_commit(tx_ring_t *tx, size_t len)
+{
+    tx->fill_len += len;
+    if (tx->fill_len < tx->chunk_size) {
+        return ERR_OK;
+    }
+    return tx_ring_flush(tx);
+}
+
+err_t tx_ring_write(tx_ring_t *tx, const void *data, size_t len)
+{
+    const uint8_t *src = (const uint8_t*) data;
+    err_t err = ERR_OK;
+    while (len > 0 && err == ERR_OK) {
+        size_t avail;
+        uint8_t *dst = tx_ring_reserve(tx, &avail);
+        if (dst == NULL) {
+            return ERR_TIMEOUT;
+        }
+        size_t n = (len < avail) ? len : avail;
+        memcpy(dst, src, n);
+        src += n;
+        len -= n;
+        err = tx_ring_commit(tx, n);
+    }
+    return err;
+}
+
+int tx_ring_write_cb(void *arg, const uint8_t *data, size_t len)
+{
+    return tx_ring_write((tx_ring_t*) arg, data, len) == ERR_OK ? 0 : -1;
+}
+
+static void release_frame(void *ref)
+{
+    camera_fb_release((camera_fb_t*) ref);
+}
+
+err_t tx_ring_send_frame(tx_ring_t *tx, camera_fb_t *fb)
+{
+    return tx_ring_send_buf(tx, fb->buf, fb->len, &release_frame, fb);
+}
+
+err_t tx_ring_send_buf(tx_ring_t *tx, const void *data, size_t len, tx_release_t release, void *ref)
+{
+    err_t err = tx_ring_flush(tx);
+    if (err != ERR_OK) {
+        release(ref);
+        return err;
+    }
+    return send_nocopy(tx, data, len, release, ref);
+}
+
+err_t tx_ring_flush(tx_ring_t *tx)
+{
+    if (tx->fill == NULL) {
+        return ERR_OK;
+    }
+    uint8_t *chunk = tx->fill;
+    size_t len = tx->fill_len;
+    tx->fill = NULL;
+    tx->fill_len = 0;
+    if (len == 0) {
+        // not sent, hand the chunk back
+        tx->next_chunk = (tx->next_chunk + tx->chunk_count - 1) % tx->chunk_count;
+        return ERR_OK;
+    }
+    return send_nocopy(tx, chunk, len, NULL, NULL);
+}
+
+static void abort_in_tcpip_thread(void *arg)
+{
+    struct netconn *conn = (struct netconn*) arg;
+    if (conn->pcb.tcp != NULL) {
+        // lwIP frees the segments and tells the netconn, as for a reset
+        tcp_abort(conn->pcb.tcp);
+    }
+}
+
+err_t tx_ring_drain(tx_ring_t *tx, TickType_t timeout)
+{
+    err_t err = tx_ring_flush(tx);
+    TickType_t start = xTaskGetTickCount();
+    while (tx->pending_count > 0) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout || wait_oldest(tx, timeout - waited) != ERR_OK) {
+            return ERR_TIMEOUT;
+        }
+    }
+    return err;
+}
+
+err_t tx_ring_end(tx_ring_t *tx, TickType_t timeout)
+{
+    err_t err = tx_ring_drain(tx, timeout);
+    if (tx->pending_count > 0) {
+        ESP_LOGW(TAG, "%d sends not acknowledged, aborting the connection", tx->pending_count);
+        if (tcpip_callback(&abort_in_tcpip_thread, tx->conn) == ERR_OK) {
+            while (tx->conn->pcb.tcp != NULL) {
+                vTaskDelay(1);
+            }
+        }
+        reap(tx);
+        return ERR_ABRT;
+    }
+    ESP_LOGD(TAG, "%d bytes in %d writes", tx->bytes, tx->writes);
+    return err;
+}
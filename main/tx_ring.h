@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "lwip/api.h"
+#include "camera.h"
+#include "metrics.h"
+
+/*
+ * Coalescing, zero-copy transmit path for one connection.
+ *
+ * Small writes are gathered into chunks of a few MSS and each full chunk
+ * goes to lwIP with NETCONN_NOCOPY, so a frame takes a handful of
+ * netconn_write calls instead of one per line. Frames from the camera
+ * pool, and other reference counted buffers, are sent straight from
+ * their memory. A chunk or buffer handed to lwIP stays referenced by the
+ * unacknowledged segments; it is reused or released only once the peer
+ * has acknowledged its last byte.
+ */
+
+#define TX_RING_MAX_CHUNKS  4
+#define TX_RING_MAX_PENDING (TX_RING_MAX_CHUNKS + 2)
+
+// drops the reference to a buffer sent with tx_ring_send_buf
+typedef void (*tx_release_t)(void *ref);
+
+typedef struct {
+    uint32_t end_seq;           // TCP sequence number after the last byte
+    tx_release_t release;       // NULL for a chunk
+    void *ref;
+} tx_pending_t;
+
+typedef struct {
+    struct netconn *conn;
+    uint8_t *chunks[TX_RING_MAX_CHUNKS];
+    size_t chunk_count;
+    size_t chunk_size;
+    int next_chunk;             // chunks are used round robin
+    int chunks_in_flight;
+    uint8_t *fill;              // chunk being filled, NULL if none
+    size_t fill_len;
+    tx_pending_t pending[TX_RING_MAX_PENDING];   // in send order
+    int pending_head;
+    int pending_count;
+    uint32_t writes;            // netconn_write calls since tx_ring_begin
+    size_t bytes;
+    metric_counter_t *sent;     // also counts the bytes sent if not NULL
+} tx_ring_t;
+
+/**
+ * @brief Allocate the chunk buffers
+ *
+ * @param chunk_count number of chunks, at most TX_RING_MAX_CHUNKS
+ * @param chunk_size bytes per chunk, best a multiple of the MSS
+ * @return ESP_OK, ESP_ERR_NO_MEM
+ */
+esp_err_t tx_ring_init(tx_ring_t *tx, size_t chunk_count, size_t chunk_size);
+
+/**
+ * @brief Start sending on a connection
+ */
+void tx_ring_begin(tx_ring_t *tx, struct netconn *conn);
+
+/**
+ * @brief Get room in the current chunk to write into directly
+ *
+ * Waits for a chunk to be acknowledged if all of them are in flight.
+ *
+ * @param avail set to the bytes available, at least 1
+ * @return where to write, NULL if the connection failed
+ */
+uint8_t *tx_ring_reserve(tx_ring_t *tx, size_t *avail);
+
+/**
+ * @brief Account for bytes written after tx_ring_reserve, sends the chunk once full
+ */
+err_t tx_ring_commit(tx_ring_t *tx, size_t len);
+
+/**
+ * @brief Copy data into the chunks
+ */
+err_t tx_ring_write(tx_ring_t *tx, const void *data, size_t len);
+
+/**
+ * @brief tx_ring_write for the encoders, arg is the tx_ring_t
+ * @return 0 on success
+ */
+int tx_ring_write_cb(void *arg, const uint8_t *data, size_t len);
+
+/**
+ * @brief Send a held frame without copying it
+ *
+ * Takes over the reference: the frame is released once acknowledged,
+ * also when sending fails.
+ */
+err_t tx_ring_send_frame(tx_ring_t *tx, camera_fb_t *fb);
+
+/**
+ * @brief Send a referenced buffer without copying it
+ *
+ * Like tx_ring_send_frame, release(ref) is called once the data is
+ * acknowledged or sending failed.
+ */
+err_t tx_ring_send_buf(tx_ring_t *tx, const void *data, size_t len, tx_release_t release, void *ref);
+
+/**
+ * @brief Send what is in the current chunk
+ */
+err_t tx_ring_flush(tx_ring_t *tx);
+
+/**
+ * @brief Flush and wait until everything is acknowledged, the connection stays open
+ *
+ * @return ERR_TIMEOUT if something is still not acknowledged after timeout
+ */
+err_t tx_ring_drain(tx_ring_t *tx, TickType_t timeout);
+
+/**
+ * @brief Flush and wait until everything is acknowledged
+ *
+ * A connection which does not acknowledge in time is aborted, lwIP then
+ * drops its references to the chunks and frames.
+ *
+ * @return ERR_OK, or the error which ended the connection
+ */
+err_t tx_ring_end(tx_ring_t *tx, TickType_t timeout);
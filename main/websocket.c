@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+
+#include "websocket.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+enum {
+    ST_HEADER,
+    ST_PAYLOAD,
+};
+
+bool ws_accept_key(const char *key, char *out, size_t size)
+{
+    char buf[64 + sizeof(WS_GUID)];
+    size_t key_len = strlen(key);
+    if (key_len == 0 || key_len > 64 || size < WS_ACCEPT_KEY_LEN + 1) {
+        return false;
+    }
+    memcpy(buf, key, key_len);
+    memcpy(buf + key_len, WS_GUID, sizeof(WS_GUID) - 1);
+    unsigned char sha[20];
+    mbedtls_sha1((const unsigned char*) buf, key_len + sizeof(WS_GUID) - 1, sha);
+    size_t olen;
+    return mbedtls_base64_encode((unsigned char*) out, size, &olen, sha, sizeof(sha)) == 0;
+}
+
+size_t ws_frame_header(uint8_t *out, int opcode, bool fin, uint64_t payload_len)
+{
+    out[0] = (fin ? 0x80 : 0) | opcode;
+    if (payload_len < 126) {
+        out[1] = payload_len;
+        return 2;
+    }
+    if (payload_len <= 0xffff) {
+        out[1] = 126;
+        out[2] = payload_len >> 8;
+        out[3] = payload_len;
+        return 4;
+    }
+    out[1] = 127;
+    for (int i = 0; i < 8; i++) {
+        out[2 + i] = payload_len >> (56 - 8 * i);
+    }
+    return 10;
+}
+
+void ws_parser_init(ws_parser_t *ws)
+{
+    memset(ws, 0, sizeof(*ws));
+    ws->state = ST_HEADER;
+}
+
+static ws_parse_result_t fail(ws_parser_t *ws, int code)
+{
+    ws->close_code = code;
+    return WS_PARSE_ERROR;
+}
+
+// bytes of the header announced by its first two
+static size_t header_size(const uint8_t *h)
+{
+    size_t len7 = h[1] & 0x7f;
+    return 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0) + 4;
+}
+
+static ws_parse_result_t header_done(ws_parser_t *ws)
+{
+    const uint8_t *h = ws->header;
+    uint64_t len = h[1] & 0x7f;
+    if (len == 126) {
+        len = (h[2] << 8) | h[3];
+    } else if (len == 127) {
+        len = 0;
+        for (int i = 0; i < 8; i++) {
+            len = (len << 8) | h[2 + i];
+        }
+    }
+    ws->frame_fin = (h[0] & 0x80) != 0;
+    ws->frame_opcode = h[0] & 0x0f;
+    switch (ws->frame_opcode) {
+    case WS_OP_CLOSE:
+    case WS_OP_PING:
+    case WS_OP_PONG:
+        if (!ws->frame_fin || len > sizeof(ws->ctrl)) {
+            return fail(ws, WS_CLOSE_PROTOCOL);
+        }
+        ws->ctrl_len = 0;
+        break;
+    case WS_OP_TEXT:
+    case WS_OP_BINARY:
+        if (ws->msg_opcode != 0) {
+            return fail(ws, WS_CLOSE_PROTOCOL);
+        }
+        ws->msg_opcode = ws->frame_opcode;
+        ws->msg_len = 0;
+        // fall through
+    case WS_OP_CONTINUATION:
+        if (ws->msg_opcode == 0) {
+            return fail(ws, WS_CLOSE_PROTOCOL);
+        }
+        if (len > WS_MESSAGE_MAX - ws->msg_len) {
+            return fail(ws, WS_CLOSE_TOO_BIG);
+        }
+        break;
+    default:
+        return fail(ws, WS_CLOSE_PROTOCOL);
+    }
+    ws->frame_left = len;
+    ws->frame_pos = 0;
+    ws->state = ST_PAYLOAD;
+    return WS_PARSE_MORE;
+}
+
+static ws_parse_result_t frame_done(ws_parser_t *ws)
+{
+    ws->state = ST_HEADER;
+    ws->header_len = 0;
+    if (ws->frame_opcode >= WS_OP_CLOSE) {
+        ws->opcode = ws->frame_opcode;
+        ws->payload = ws->ctrl;
+        ws->payload_len = ws->ctrl_len;
+        return WS_PARSE_MESSAGE;
+    }
+    if (!ws->frame_fin) {
+        return WS_PARSE_MORE;
+    }
+    ws->opcode = ws->msg_opcode;
+    ws->payload = ws->msg;
+    ws->payload_len = ws->msg_len;
+    ws->msg_opcode = 0;
+    return WS_PARSE_MESSAGE;
+}
+
+ws_parse_result_t ws_parse(ws_parser_t *ws, const uint8_t *data, size_t len, size_t *consumed)
+{
+    size_t i = 0;
+    ws_parse_result_t result = WS_PARSE_MORE;
+    while (result == WS_PARSE_MORE && (i < len || (ws->state == ST_PAYLOAD && ws->frame_left == 0))) {
+        if (ws->state == ST_HEADER) {
+            ws->header[ws->header_len++] = data[i++];
+            if (ws->header_len == 2 && ((ws->header[0] & 0x70) != 0 || (ws->header[1] & 0x80) == 0)) {
+                // no extensions were negotiated, and clients must mask
+                result = fail(ws, WS_CLOSE_PROTOCOL);
+            } else if (ws->header_len >= 2 && ws->header_len == header_size(ws->header)) {
+                result = header_done(ws);
+            }
+            continue;
+        }
+        if (ws->frame_left == 0) {
+            result = frame_done(ws);
+            continue;
+        }
+        const uint8_t *mask = ws->header + ws->header_len - 4;
+        uint8_t *dst = (ws->frame_opcode >= WS_OP_CLOSE) ? ws->ctrl + ws->ctrl_len : ws->msg + ws->msg_len;
+        size_t n = len - i;
+        if (n > ws->frame_left) {
+            n = ws->frame_left;
+        }
+        for (size_t k = 0; k < n; k++) {
+            dst[k] = data[i + k] ^ mask[(ws->frame_pos + k) & 3];
+        }
+        if (ws->frame_opcode >= WS_OP_CLOSE) {
+            ws->ctrl_len += n;
+        } else {
+            ws->msg_len += n;
+        }
+        i += n;
+        ws->frame_pos += n;
+        ws->frame_left -= n;
+    }
+    *consumed = i;
+    return result;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * WebSocket framing, RFC 6455, server side.
+ *
+ * Outgoing frames are written as a header followed by the payload from
+ * wherever it lives, so a frame buffer can go out without being copied.
+ * Incoming frames are parsed incrementally like HTTP requests and are
+ * only expected to be small control messages.
+ */
+
+#define WS_OP_CONTINUATION  0x0
+#define WS_OP_TEXT          0x1
+#define WS_OP_BINARY        0x2
+#define WS_OP_CLOSE         0x8
+#define WS_OP_PING          0x9
+#define WS_OP_PONG          0xa
+
+#define WS_CLOSE_NORMAL     1000
+#define WS_CLOSE_PROTOCOL   1002
+#define WS_CLOSE_TOO_BIG    1009
+
+// longest frame header the server sends
+#define WS_HEADER_MAX       10
+// longest message accepted from a client
+#define WS_MESSAGE_MAX      128
+// Sec-WebSocket-Accept is 28 characters
+#define WS_ACCEPT_KEY_LEN   28
+
+typedef enum {
+    WS_PARSE_ERROR = -1,        //!< close with ws->close_code
+    WS_PARSE_MORE = 0,
+    WS_PARSE_MESSAGE = 1,       //!< a message or control frame is in payload
+} ws_parse_result_t;
+
+typedef struct {
+    // complete message, valid after WS_PARSE_MESSAGE
+    int opcode;
+    const uint8_t *payload;
+    size_t payload_len;
+    int close_code;             // why parsing failed
+
+    // parser state
+    int state;
+    uint8_t header[14];
+    size_t header_len;
+    size_t frame_left;          // payload bytes of the current frame still to come
+    size_t frame_pos;           // payload bytes of the current frame seen, for the mask
+    bool frame_fin;
+    int frame_opcode;
+    int msg_opcode;             // of the data message being assembled, 0 if none
+    uint8_t msg[WS_MESSAGE_MAX];
+    size_t msg_len;
+    uint8_t ctrl[125];          // control frames may come between fragments
+    size_t ctrl_len;
+} ws_parser_t;
+
+/**
+ * @brief Compute Sec-WebSocket-Accept for the Sec-WebSocket-Key of a request
+ *
+ * @param out at least WS_ACCEPT_KEY_LEN + 1 bytes
+ * @return true on success
+ */
+bool ws_accept_key(const char *key, char *out, size_t size);
+
+/**
+ * @brief Write a frame header
+ *
+ * @param fin last frame of the message
+ * @return bytes written, at most WS_HEADER_MAX
+ */
+size_t ws_frame_header(uint8_t *out, int opcode, bool fin, uint64_t payload_len);
+
+/**
+ * @brief Prepare for the first frame of a connection
+ */
+void ws_parser_init(ws_parser_t *ws);
+
+/**
+ * @brief Parse received bytes
+ *
+ * @param consumed set to the bytes used, less than len once a message is complete
+ * @return WS_PARSE_MESSAGE, WS_PARSE_MORE, or WS_PARSE_ERROR
+ */
+ws_parse_result_t ws_parse(ws_parser_t *ws, const uint8_t *data, size_t len, size_t *consumed);